@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include "arena.h"
+#include "util.h"
 
 struct arena {
 	void **used_blocks;
@@ -19,7 +20,8 @@ struct arena {
 
 #define DEFAULT_STORAGE_SIZE 8
 
-static arena *current_arena;
+//each thread runs its own system, so each has its own current arena
+static THREAD_LOCAL arena *current_arena;
 
 arena *get_current_arena()
 {
@@ -87,3 +89,49 @@ void *try_alloc_arena()
 	track_block(ret);
 	return ret;
 }
+
+static void add_free_block(arena *dst, void *block)
+{
+	if (dst->free_count == dst->free_storage) {
+		if (dst->free_storage) {
+			dst->free_storage *= 2;
+		} else {
+			dst->free_storage = DEFAULT_STORAGE_SIZE;
+		}
+		dst->free_blocks = realloc(dst->free_blocks, dst->free_storage * sizeof(void *));
+	}
+	dst->free_blocks[dst->free_count++] = block;
+}
+
+void take_free_blocks(arena *a)
+{
+	if (!a || a == current_arena) {
+		return;
+	}
+	arena *cur = get_current_arena();
+	for (; a->free_count > 0; a->free_count--)
+	{
+		add_free_block(cur, a->free_blocks[a->free_count-1]);
+	}
+}
+
+void merge_arena(arena *a)
+{
+	if (!a || a == current_arena) {
+		return;
+	}
+	take_free_blocks(a);
+	arena *cur = get_current_arena();
+	for (; a->used_count > 0; a->used_count--)
+	{
+		add_free_block(cur, a->used_blocks[a->used_count-1]);
+	}
+	free(a->used_blocks);
+	free(a->free_blocks);
+	free(a);
+}
+
+size_t arena_used_blocks(arena *a)
+{
+	return a ? a->used_count : 0;
+}
@@ -6,6 +6,8 @@
 #ifndef ARENA_H_
 #define ARENA_H_
 
+#include <stddef.h>
+
 typedef struct arena arena;
 
 arena *get_current_arena();
@@ -14,5 +16,11 @@ arena *start_new_arena();
 void track_block(void *block);
 void mark_all_free();
 void *try_alloc_arena();
+//moves the unused blocks of a suspended arena to the free list of the current one
+void take_free_blocks(arena *a);
+//hands every block of a to the current arena for reuse and frees a
+//nothing may still be running out of a's blocks
+void merge_arena(arena *a);
+size_t arena_used_blocks(arena *a);
 
 #endif //ARENA_H_
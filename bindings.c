@@ -8,6 +8,10 @@
 #include "genesis.h"
 #include "menu.h"
 #include "bindings.h"
+#include "frame_dump.h"
+#ifndef DISABLE_ZLIB
+#include "capture.h"
+#endif
 #ifndef DISABLE_NUKLEAR
 #include "nuklear_ui/blastem_nuklear.h"
 #endif
@@ -34,6 +38,9 @@ typedef enum {
 	UI_RELOAD,
 	UI_SMS_PAUSE,
 	UI_SCREENSHOT,
+	UI_FRAME_DUMP,
+	UI_RECORD,
+	UI_VGM_LOG,
 	UI_EXIT
 } ui_action;
 
@@ -249,6 +256,27 @@ static uint8_t mouse_captured;
 #define localtime_r(a,b) localtime(a)
 #endif
 
+//expands a strftime template into a path inside the configured screenshot directory
+static char *screenshot_path_from_template(char *template)
+{
+	char *screenshot_base = tern_find_path(config, "ui\0screenshot_path\0", TVAL_PTR).ptrval;
+	if (!screenshot_base) {
+		screenshot_base = "$HOME";
+	}
+	tern_node *vars = tern_insert_ptr(NULL, "HOME", get_home_dir());
+	vars = tern_insert_ptr(vars, "EXEDIR", get_exe_dir());
+	screenshot_base = replace_vars(screenshot_base, vars, 1);
+	tern_free(vars);
+	time_t now = time(NULL);
+	struct tm local_store;
+	char fname_part[256];
+	strftime(fname_part, sizeof(fname_part), template, localtime_r(&now, &local_store));
+	char const *parts[] = {screenshot_base, PATH_SEP, fname_part};
+	char *path = alloc_concat_m(3, parts);
+	free(screenshot_base);
+	return path;
+}
+
 void handle_binding_up(keybinding * binding)
 {
 	switch(binding->bind_type)
@@ -330,28 +358,52 @@ void handle_binding_up(keybinding * binding)
 			}
 			break;
 		case UI_SCREENSHOT: {
-			char *screenshot_base = tern_find_path(config, "ui\0screenshot_path\0", TVAL_PTR).ptrval;
-			if (!screenshot_base) {
-				screenshot_base = "$HOME";
-			}
-			tern_node *vars = tern_insert_ptr(NULL, "HOME", get_home_dir());
-			vars = tern_insert_ptr(vars, "EXEDIR", get_exe_dir());
-			screenshot_base = replace_vars(screenshot_base, vars, 1);
-			tern_free(vars);
-			time_t now = time(NULL);
-			struct tm local_store;
-			char fname_part[256];
 			char *template = tern_find_path(config, "ui\0screenshot_template\0", TVAL_PTR).ptrval;
 			if (!template) {
 				template = "blastem_%c.ppm";
 			}
-			strftime(fname_part, sizeof(fname_part), template, localtime_r(&now, &local_store));
-			char const *parts[] = {screenshot_base, PATH_SEP, fname_part};
-			char *path = alloc_concat_m(3, parts);
-			free(screenshot_base);
-			render_save_screenshot(path);
+			render_save_screenshot(screenshot_path_from_template(template));
 			break;
 		}
+		case UI_FRAME_DUMP:
+			if (frame_dump_active()) {
+				frame_dump_stop();
+			} else {
+				char *template = tern_find_path(config, "ui\0frame_dump_template\0", TVAL_PTR).ptrval;
+				if (!template) {
+					template = "blastem_%Y%m%d_%H%M%S_";
+				}
+				frame_dump_start(screenshot_path_from_template(template));
+			}
+			break;
+		case UI_RECORD:
+#ifndef DISABLE_ZLIB
+			if (capture_active()) {
+				capture_stop();
+			} else {
+				char *template = tern_find_path(config, "ui\0capture_template\0", TVAL_PTR).ptrval;
+				if (!template) {
+					template = "blastem_%Y%m%d_%H%M%S.bcap";
+				}
+				capture_start(screenshot_path_from_template(template));
+			}
+#else
+			warning("Recording requires zlib support\n");
+#endif
+			break;
+		case UI_VGM_LOG:
+			if (!current_system || !current_system->start_vgm_log) {
+				warning("VGM logging is not supported for this system\n");
+			} else if (current_system->vgm_logging) {
+				current_system->stop_vgm_log(current_system);
+			} else {
+				char *template = tern_find_path(config, "ui\0vgm_template\0", TVAL_PTR).ptrval;
+				if (!template) {
+					template = "blastem_%Y%m%d_%H%M%S.vgm";
+				}
+				current_system->start_vgm_log(current_system, screenshot_path_from_template(template));
+			}
+			break;
 		case UI_EXIT:
 #ifndef DISABLE_NUKLEAR
 			if (is_nuklear_active()) {
@@ -572,6 +624,12 @@ int parse_binding_target(char * target, tern_node * padbuttons, tern_node *mouse
 			*subtype_a = UI_SMS_PAUSE;
 		} else if (!strcmp(target + 3, "screenshot")) {
 			*subtype_a = UI_SCREENSHOT;
+		} else if (!strcmp(target + 3, "frame_dump")) {
+			*subtype_a = UI_FRAME_DUMP;
+		} else if (!strcmp(target + 3, "record")) {
+			*subtype_a = UI_RECORD;
+		} else if (!strcmp(target + 3, "vgm_log")) {
+			*subtype_a = UI_VGM_LOG;
 		} else if(!strcmp(target + 3, "exit")) {
 			*subtype_a = UI_EXIT;
 		} else {
@@ -856,6 +914,11 @@ static tern_node *get_mouse_buttons()
 	return mousebuttons;
 }
 
+uint8_t parse_gamepad_target(char *target, uint8_t *padnum, uint8_t *button)
+{
+	return parse_binding_target(target, get_pad_buttons(), get_mouse_buttons(), padnum, button) == BIND_GAMEPAD;
+}
+
 void handle_joy_added(int joystick)
 {
 	if (joystick > MAX_JOYSTICKS) {
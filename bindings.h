@@ -22,6 +22,7 @@ void handle_mouse_moved(int mouse, uint16_t x, uint16_t y, int16_t deltax, int16
 void handle_mousedown(int mouse, int button);
 void handle_mouseup(int mouse, int button);
 
+uint8_t parse_gamepad_target(char *target, uint8_t *padnum, uint8_t *button);
 void bindings_release_capture(void);
 void bindings_reacquire_capture(void);
 
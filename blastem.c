@@ -22,10 +22,15 @@
 #include "romdb.h"
 #include "terminal.h"
 #include "arena.h"
+#include "syscache.h"
+#include "startup.h"
+#include "pacing.h"
 #include "config.h"
 #include "bindings.h"
 #include "menu.h"
-#include "zip.h"
+#include "romload.h"
+#include "romcache.h"
+#include "hashlog.h"
 #ifndef DISABLE_NUKLEAR
 #include "nuklear_ui/blastem_nuklear.h"
 #endif
@@ -39,167 +44,12 @@
 #endif
 
 int headless = 0;
-int exit_after = 0;
-int z80_enabled = 1;
+static uint32_t exit_after;
 int frame_limit = 0;
 uint8_t use_native_states = 1;
 
 tern_node * config;
 
-#define SMD_HEADER_SIZE 512
-#define SMD_MAGIC1 0x03
-#define SMD_MAGIC2 0xAA
-#define SMD_MAGIC3 0xBB
-#define SMD_BLOCK_SIZE 0x4000
-
-#ifdef DISABLE_ZLIB
-#define ROMFILE FILE*
-#define romopen fopen
-#define romread fread
-#define romseek fseek
-#define romgetc fgetc
-#define romclose fclose
-#else
-#include "zlib/zlib.h"
-#define ROMFILE gzFile
-#define romopen gzopen
-#define romread gzfread
-#define romseek gzseek
-#define romgetc gzgetc
-#define romclose gzclose
-#endif
-
-int load_smd_rom(ROMFILE f, void **buffer)
-{
-	uint8_t block[SMD_BLOCK_SIZE];
-	romseek(f, SMD_HEADER_SIZE, SEEK_SET);
-
-	size_t filesize = 512 * 1024;
-	size_t readsize = 0;
-	uint16_t *dst = malloc(filesize);
-	
-
-	size_t read;
-	do {
-		if ((readsize + SMD_BLOCK_SIZE > filesize)) {
-			filesize *= 2;
-			dst = realloc(dst, filesize);
-		}
-		read = romread(block, 1, SMD_BLOCK_SIZE, f);
-		if (read > 0) {
-			for (uint8_t *low = block, *high = (block+read/2), *end = block+read; high < end; high++, low++) {
-				*(dst++) = *low << 8 | *high;
-			}
-			readsize += read;
-		}
-	} while(read > 0);
-	romclose(f);
-	
-	*buffer = dst;
-	
-	return readsize;
-}
-
-uint32_t load_rom_zip(const char *filename, void **dst)
-{
-	static const char *valid_exts[] = {"bin", "md", "gen", "sms", "rom"};
-	const uint32_t num_exts = sizeof(valid_exts)/sizeof(*valid_exts);
-	zip_file *z = zip_open(filename);
-	if (!z) {
-		return 0;
-	}
-	
-	for (uint32_t i = 0; i < z->num_entries; i++)
-	{
-		char *ext = path_extension(z->entries[i].name);
-		if (!ext) {
-			continue;
-		}
-		for (uint32_t j = 0; j < num_exts; j++)
-		{
-			if (!strcasecmp(ext, valid_exts[j])) {
-				size_t out_size = nearest_pow2(z->entries[i].size);
-				*dst = zip_read(z, i, &out_size);
-				if (*dst) {
-					free(ext);
-					zip_close(z);
-					return out_size;
-				}
-			}
-		}
-		free(ext);
-	}
-	zip_close(z);
-	return 0;
-}
-
-uint32_t load_rom(const char * filename, void **dst, system_type *stype)
-{
-	uint8_t header[10];
-	char *ext = path_extension(filename);
-	if (!strcasecmp(ext, "zip")) {
-		free(ext);
-		return load_rom_zip(filename, dst);
-	}
-	free(ext);
-	ROMFILE f = romopen(filename, "rb");
-	if (!f) {
-		return 0;
-	}
-	if (sizeof(header) != romread(header, 1, sizeof(header), f)) {
-		fatal_error("Error reading from %s\n", filename);
-	}
-	
-	if (header[1] == SMD_MAGIC1 && header[8] == SMD_MAGIC2 && header[9] == SMD_MAGIC3) {
-		int i;
-		for (i = 3; i < 8; i++) {
-			if (header[i] != 0) {
-				break;
-			}
-		}
-		if (i == 8) {
-			if (header[2]) {
-				fatal_error("%s is a split SMD ROM which is not currently supported", filename);
-			}
-			if (stype) {
-				*stype = SYSTEM_GENESIS;
-			}
-			return load_smd_rom(f, dst);
-		}
-	}
-	
-	size_t filesize = 512 * 1024;
-	size_t readsize = sizeof(header);
-		
-	char *buf = malloc(filesize);
-	memcpy(buf, header, readsize);
-	
-	size_t read;
-	do {
-		read = romread(buf + readsize, 1, filesize - readsize, f);
-		if (read > 0) {
-			readsize += read;
-			if (readsize == filesize) {
-				int one_more = romgetc(f);
-				if (one_more >= 0) {
-					filesize *= 2;
-					buf = realloc(buf, filesize);
-					buf[readsize++] = one_more;
-				} else {
-					read = 0;
-				}
-			}
-		}
-	} while (read > 0);
-	
-	*dst = buf;
-	
-	romclose(f);
-	return readsize;
-}
-
-
-
 int break_on_sync = 0;
 char *save_state_path;
 
@@ -219,6 +69,14 @@ void persist_save()
 	game_system->persist_save(game_system);
 }
 
+//VGM logs need their header finalized, so they get closed on any kind of exit
+static void stop_vgm_log(void)
+{
+	if (game_system && game_system->vgm_logging) {
+		game_system->stop_vgm_log(game_system);
+	}
+}
+
 char *title;
 void update_title(char *rom_name)
 {
@@ -248,9 +106,8 @@ static char *get_save_dir(system_media *media)
 	return save_dir;
 }
 
-void setup_saves(system_media *media, system_header *context)
+static void setup_save_paths(system_media *media, system_header *context)
 {
-	static uint8_t persist_save_registered;
 	rom_info *info = &context->info;
 	char *save_dir = get_save_dir(info->is_save_lock_on ? media->chain : media);
 	char const *parts[] = {save_dir, PATH_SEP, info->save_type == SAVE_I2C ? "save.eeprom" : info->save_type == SAVE_NOR ? "save.nor" : "save.sram"};
@@ -269,8 +126,15 @@ void setup_saves(system_media *media, system_header *context)
 	}
 	free(save_state_path);
 	save_state_path = alloc_concat_m(3, parts);
+	free(context->save_dir);
 	context->save_dir = save_dir;
-	if (info->save_type != SAVE_NONE) {
+}
+
+void setup_saves(system_media *media, system_header *context)
+{
+	static uint8_t persist_save_registered;
+	setup_save_paths(media, context);
+	if (context->info.save_type != SAVE_NONE) {
 		context->load_save(context);
 		if (!persist_save_registered) {
 			atexit(persist_save);
@@ -313,6 +177,24 @@ static void on_drag_drop(const char *filename)
 }
 
 static system_media cart, lock_on;
+//path the running game was loaded from, reloading it always starts fresh
+static char *game_path;
+//set when init_system_with_media brings back a suspended game instead of loading a new one
+static uint8_t game_resumed;
+//files seen by the ROM browser don't need to be hashed or probed again
+static void use_cached_metadata(const char *path, system_type *stype)
+{
+	rom_metadata meta;
+	cart.has_sha1 = romcache_lookup(path, &meta);
+	if (cart.has_sha1) {
+		memcpy(cart.sha1, meta.sha1, sizeof(cart.sha1));
+		free(meta.title);
+		if (*stype == SYSTEM_UNKNOWN) {
+			*stype = meta.system;
+		}
+	}
+}
+
 void reload_media(void)
 {
 	if (!current_system) {
@@ -321,15 +203,19 @@ void reload_media(void)
 	if (current_system->next_rom) {
 		free(current_system->next_rom);
 	}
-	char const *parts[] = {
-		cart.dir, PATH_SEP, cart.name, ".", cart.extension
-	};
-	char const **start = parts[0] ? parts : parts + 2;
-	int num_parts = parts[0] ? 5 : 3;
-	if (!parts[4]) {
-		num_parts--;
+	if (game_path) {
+		current_system->next_rom = strdup(game_path);
+	} else {
+		char const *parts[] = {
+			cart.dir, PATH_SEP, cart.name, ".", cart.extension
+		};
+		char const **start = parts[0] ? parts : parts + 2;
+		int num_parts = parts[0] ? 5 : 3;
+		if (!parts[4]) {
+			num_parts--;
+		}
+		current_system->next_rom = alloc_concat_m(num_parts, start);
 	}
-	current_system->next_rom = alloc_concat_m(num_parts, start);
 	current_system->request_exit(current_system);
 }
 
@@ -344,6 +230,9 @@ void lockon_media(char *lock_on_path)
 	lock_on.name = basename_no_extension(lock_on_path);
 	lock_on.extension = path_extension(lock_on_path);
 	lock_on.size = load_rom(lock_on_path, &lock_on.buffer, NULL);
+	if (!lock_on.size) {
+		cart.chain = NULL;
+	}
 }
 
 static uint32_t opts = 0;
@@ -352,16 +241,39 @@ void init_system_with_media(const char *path, system_type force_stype)
 {
 	if (game_system) {
 		game_system->persist_save(game_system);
-		//swap to game context arena and mark all allocated pages in it free
+		//swap to game context arena
 		if (current_system == menu_system) {
 			current_system->arena = set_current_arena(game_system->arena);
 		}
-		mark_all_free();
-		game_system->free_context(game_system);
+		//keep the game suspended so switching back to it is instant, unless it's the one being reloaded
+		if (cart.chain || !game_path || !strcmp(game_path, path) || !syscache_suspend(game_system, &cart, game_path)) {
+			//mark all allocated pages in the arena free
+			mark_all_free();
+			game_system->free_context(game_system);
+		}
 	} else if(current_system) {
 		//start a new arena and save old one in suspended system context
 		current_system->arena = start_new_arena();
 	}
+	free(game_path);
+	game_path = strdup(path);
+	system_media media;
+	if (!cart.chain && (game_system = syscache_resume(path, &media))) {
+		free(cart.dir);
+		free(cart.name);
+		free(cart.extension);
+		cart = media;
+		game_resumed = 1;
+		if (menu_system) {
+			menu_system->next_context = game_system;
+		}
+		game_system->next_context = menu_system;
+		game_system->exit_after = exit_after;
+		setup_save_paths(&cart, game_system);
+		update_title(game_system->info.name);
+		return;
+	}
+	game_resumed = 0;
 	system_type stype = SYSTEM_UNKNOWN;
 	if (!(cart.size = load_rom(path, &cart.buffer, &stype))) {
 		fatal_error("Failed to open %s for reading\n", path);
@@ -372,6 +284,7 @@ void init_system_with_media(const char *path, system_type force_stype)
 	cart.dir = path_dirname(path);
 	cart.name = basename_no_extension(path);
 	cart.extension = path_extension(path);
+	use_cached_metadata(path, &stype);
 	if (force_stype != SYSTEM_UNKNOWN) {
 		stype = force_stype;
 	}
@@ -390,14 +303,29 @@ void init_system_with_media(const char *path, system_type force_stype)
 		menu_system->next_context = game_system;
 	}
 	game_system->next_context = menu_system;
+	game_system->exit_after = exit_after;
 	setup_saves(&cart, game_system);
 	update_title(game_system->info.name);
 }
 
+static int ym_tables_main(void *data)
+{
+	uint64_t start = pacing_now_ns();
+	ym_init_tables();
+	startup_background_phase("YM tables", pacing_now_ns() - start);
+	return 0;
+}
+
 int main(int argc, char ** argv)
 {
+	startup_trace_begin();
 	set_exe_str(argv[0]);
 	config = load_config();
+	startup_phase("config");
+	//nothing below needs the ROM DB until a ROM is configured, so load it while the window comes up
+	preload_rom_db();
+	//same for the YM2612 tables, ym_init waits for them if the thread hasn't finished
+	SDL_DetachThread(SDL_CreateThread(ym_tables_main, "YM tables", NULL));
 	int width = -1;
 	int height = -1;
 	int debug = 0;
@@ -409,6 +337,8 @@ int main(int argc, char ** argv)
 	uint8_t start_in_debugger = 0;
 	uint8_t fullscreen = FULLSCREEN_DEFAULT, use_gl = 1;
 	uint8_t debug_target = 0;
+	uint8_t log_mix = 0;
+	char *hash_log = NULL, *golden_log = NULL, *input_script = NULL, *vgm_log = NULL;
 	for (int i = 1; i < argc; i++) {
 		if (argv[i][0] == '-') {
 			switch(argv[i][1]) {
@@ -446,7 +376,7 @@ int main(int argc, char ** argv)
 				return 0;
 				break;
 			case 'n':
-				z80_enabled = 0;
+				opts |= OPT_NO_Z80;
 				break;
 			case 'r':
 				i++;
@@ -483,8 +413,47 @@ int main(int argc, char ** argv)
 			case 't':
 				force_no_terminal();
 				break;
-			case 'y':
-				opts |= YM_OPT_WAVE_LOG;
+			case 'T':
+				startup_trace_enable();
+				break;
+			case 'y': {
+				char *targets = tern_find_path_default(config, "audio\0wave_log\0", (tern_val){.ptrval = "ym"}, TVAL_PTR).ptrval;
+				if (strstr(targets, "ym")) {
+					opts |= YM_OPT_WAVE_LOG;
+				}
+				if (strstr(targets, "psg")) {
+					opts |= OPT_PSG_WAVE_LOG;
+				}
+				log_mix = strstr(targets, "mix") != NULL;
+				break;
+			}
+			case 'H':
+				i++;
+				if (i >= argc) {
+					fatal_error("-H must be followed by a hash log filename\n");
+				}
+				hash_log = argv[i];
+				break;
+			case 'G':
+				i++;
+				if (i >= argc) {
+					fatal_error("-G must be followed by a golden hash log filename\n");
+				}
+				golden_log = argv[i];
+				break;
+			case 'i':
+				i++;
+				if (i >= argc) {
+					fatal_error("-i must be followed by an input script filename\n");
+				}
+				input_script = argv[i];
+				break;
+			case 'V':
+				i++;
+				if (i >= argc) {
+					fatal_error("-V must be followed by a VGM log filename\n");
+				}
+				vgm_log = argv[i];
 				break;
 			case 'o': {
 				i++;
@@ -518,7 +487,15 @@ int main(int argc, char ** argv)
 					"	-n          Disable Z80\n"
 					"	-v          Display version number and exit\n"
 					"	-l          Log 68K code addresses (useful for assemblers)\n"
-					"	-y          Log individual YM-2612 channels to WAVE files\n"
+					"	-y          Log individual sound channels to WAVE files\n"
+					"	-V FILE     Log YM-2612 and PSG writes to a VGM file\n"
+					"	-b FRAMES   Run headless for FRAMES frames and then exit\n"
+					"	-H FILE     Run headless and write per-frame video/audio hashes to FILE\n"
+					"	-G FILE     Run headless and compare per-frame hashes against FILE,\n"
+					"	            exiting at the first divergence\n"
+					"	-i FILE     Apply scripted gamepad input from FILE when hashing\n"
+					"	            Each line is FRAME gamepads.N.BUTTON (down|up)\n"
+					"	-T          Print the time taken by each phase of startup\n"
 				);
 				return 0;
 			default:
@@ -531,6 +508,7 @@ int main(int argc, char ** argv)
 			cart.dir = path_dirname(argv[i]);
 			cart.name = basename_no_extension(argv[i]);
 			cart.extension = path_extension(argv[i]);
+			use_cached_metadata(argv[i], &stype);
 			romfname = argv[i];
 			loaded = 1;
 		} else if (width < 0) {
@@ -539,6 +517,11 @@ int main(int argc, char ** argv)
 			height = atoi(argv[i]);
 		}
 	}
+	if (hash_log || golden_log || input_script) {
+		headless = 1;
+		hashlog_init(hash_log, golden_log, input_script);
+	}
+	startup_phase("arguments and ROM load");
 	
 	int def_width = 0, def_height = 0;
 	char *config_width = tern_find_path(config, "video\0width\0", TVAL_PTR).ptrval;
@@ -565,6 +548,9 @@ int main(int argc, char ** argv)
 	if (!headless) {
 		render_init(width, height, "BlastEm", fullscreen);
 		render_set_drag_drop_handler(on_drag_drop);
+		if (log_mix) {
+			render_start_mix_log("audio_mix.wav");
+		}
 	}
 	set_bindings();
 	
@@ -619,13 +605,16 @@ int main(int argc, char ** argv)
 		if (!current_system) {
 			fatal_error("Failed to configure emulated machine for %s\n", romfname);
 		}
+		current_system->exit_after = exit_after;
 	
 		setup_saves(&cart, current_system);
 		update_title(current_system->info.name);
+		startup_phase("system init");
 		if (menu) {
 			menu_system = current_system;
 		} else {
 			game_system = current_system;
+			game_path = strdup(romfname);
 		}
 	}
 	
@@ -637,6 +626,14 @@ int main(int argc, char ** argv)
 	}
 #endif
 	
+	atexit(stop_vgm_log);
+	if (vgm_log && game_system) {
+		if (game_system->start_vgm_log) {
+			game_system->start_vgm_log(game_system, strdup(vgm_log));
+		} else {
+			warning("VGM logging is not supported for this system\n");
+		}
+	}
 	current_system->debugger_type = dtype;
 	current_system->enter_debugger = start_in_debugger && menu == debug_target;
 	current_system->start_context(current_system,  menu ? NULL : statefile);
@@ -645,6 +642,8 @@ int main(int argc, char ** argv)
 		if (current_system->should_exit) {
 			break;
 		}
+		//the -b frame limit counts frames across every system that runs
+		exit_after = current_system->exit_after;
 		if (current_system->next_rom) {
 			char *next_rom = current_system->next_rom;
 			current_system->next_rom = NULL;
@@ -652,13 +651,18 @@ int main(int argc, char ** argv)
 			free(next_rom);
 			menu = 0;
 			current_system = game_system;
-			current_system->debugger_type = dtype;
-			current_system->enter_debugger = start_in_debugger && menu == debug_target;
-			current_system->start_context(current_system, statefile);
+			if (game_resumed) {
+				current_system->resume_context(current_system);
+			} else {
+				current_system->debugger_type = dtype;
+				current_system->enter_debugger = start_in_debugger && menu == debug_target;
+				current_system->start_context(current_system, statefile);
+			}
 		} else if (menu && game_system) {
 			current_system->arena = set_current_arena(game_system->arena);
 			current_system = game_system;
 			menu = 0;
+			current_system->exit_after = exit_after;
 			current_system->resume_context(current_system);
 		} else if (!menu && (menu_system || use_nuklear)) {
 			if (use_nuklear) {
@@ -670,6 +674,7 @@ int main(int argc, char ** argv)
 				current_system = menu_system;
 				menu = 1;
 			}
+			current_system->exit_after = exit_after;
 			if (!current_system->next_rom) {
 				current_system->resume_context(current_system);
 			}
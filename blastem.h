@@ -5,8 +5,6 @@
 #include "system.h"
 
 extern int headless;
-extern int exit_after;
-extern int z80_enabled;
 extern int frame_limit;
 
 extern tern_node * config;
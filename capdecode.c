@@ -0,0 +1,140 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "capture.h"
+#include "png.h"
+#include "wave.h"
+#include "zlib/zlib.h"
+
+static uint32_t read_le(uint8_t *src, uint8_t bytes)
+{
+	uint32_t value = 0;
+	for (uint8_t i = 0; i < bytes; i++)
+	{
+		value |= src[i] << (8 * i);
+	}
+	return value;
+}
+
+static uint32_t frame_num;
+static void write_png(char *prefix, uint32_t *pixels, uint32_t width, uint32_t height)
+{
+	size_t path_size = strlen(prefix) + strlen("0000000.png") + 1;
+	char *path = malloc(path_size);
+	snprintf(path, path_size, "%s%07d.png", prefix, frame_num++);
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s for writing\n", path);
+		exit(1);
+	}
+	save_png(f, pixels, width, height, width * sizeof(uint32_t));
+	fclose(f);
+	free(path);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		fputs("Usage: capdecode CAPTURE_FILE OUTPUT_PREFIX\n"
+			"Writes each frame to OUTPUT_PREFIXnnnnnnn.png and the audio to OUTPUT_PREFIX.wav\n", stderr);
+		return 1;
+	}
+	FILE *f = fopen(argv[1], "rb");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s for reading\n", argv[1]);
+		return 1;
+	}
+	uint8_t header[CAPTURE_HEADER_SIZE];
+	if (fread(header, 1, sizeof(header), f) != sizeof(header) || memcmp(header, CAPTURE_MAGIC, 8)) {
+		fprintf(stderr, "%s is not a BlastEm capture file\n", argv[1]);
+		return 1;
+	}
+	if (read_le(header + 8, 2) != CAPTURE_VERSION) {
+		fprintf(stderr, "Unsupported capture version %d\n", read_le(header + 8, 2));
+		return 1;
+	}
+	uint16_t channels = read_le(header + 10, 2);
+	uint32_t sample_rate = read_le(header + 12, 4);
+	char *prefix = argv[2];
+	char *wave_path = malloc(strlen(prefix) + strlen(".wav") + 1);
+	sprintf(wave_path, "%s.wav", prefix);
+	FILE *wave = fopen(wave_path, "wb");
+	if (!wave) {
+		fprintf(stderr, "Failed to open %s for writing\n", wave_path);
+		return 1;
+	}
+	wave_init(wave, sample_rate, 16, channels);
+
+	uint32_t *frame = NULL, *delta = NULL;
+	uint32_t width = 0, height = 0, storage = 0;
+	uint8_t *chunk = NULL;
+	uint32_t chunk_storage = 0;
+	uint8_t chunk_header[CAPTURE_CHUNK_HEADER_SIZE];
+	uint32_t audio_samples = 0;
+	while (fread(chunk_header, 1, sizeof(chunk_header), f) == sizeof(chunk_header))
+	{
+		uint32_t size = read_le(chunk_header + 4, 4);
+		if (size > chunk_storage) {
+			chunk_storage = size;
+			chunk = realloc(chunk, chunk_storage);
+		}
+		if (fread(chunk, 1, size, f) != size) {
+			fputs("Capture file is truncated, stopping early\n", stderr);
+			break;
+		}
+		if (!memcmp(chunk_header, CAPTURE_AUDIO, 4)) {
+			fwrite(chunk, 1, size, wave);
+			audio_samples += size / (channels * sizeof(int16_t));
+		} else if (!memcmp(chunk_header, CAPTURE_VIDEO, 4)) {
+			if (size < CAPTURE_VIDEO_HEADER_SIZE) {
+				fputs("Malformed video chunk\n", stderr);
+				break;
+			}
+			uint32_t new_width = read_le(chunk, 2), new_height = read_le(chunk + 2, 2);
+			uint8_t flags = chunk[4];
+			uint16_t repeat = read_le(chunk + 6, 2);
+			if (frame) {
+				for (uint16_t i = 0; i < repeat; i++)
+				{
+					write_png(prefix, frame, width, height);
+				}
+			}
+			if (!new_width && !new_height) {
+				//only marks frames dropped at the end of the recording
+				continue;
+			}
+			if (!(flags & CAPTURE_KEYFRAME) && (!frame || new_width != width || new_height != height)) {
+				fputs("Delta frame without a matching reference frame\n", stderr);
+				break;
+			}
+			width = new_width;
+			height = new_height;
+			if (width * height > storage) {
+				storage = width * height;
+				frame = realloc(frame, storage * sizeof(uint32_t));
+				delta = realloc(delta, storage * sizeof(uint32_t));
+			}
+			uLongf out_size = width * height * sizeof(uint32_t);
+			if (uncompress((Bytef *)delta, &out_size, chunk + CAPTURE_VIDEO_HEADER_SIZE, size - CAPTURE_VIDEO_HEADER_SIZE) != Z_OK || out_size != width * height * sizeof(uint32_t)) {
+				fputs("Failed to decompress video frame\n", stderr);
+				break;
+			}
+			if (flags & CAPTURE_KEYFRAME) {
+				memcpy(frame, delta, out_size);
+			} else {
+				for (uint32_t i = 0; i < width * height; i++)
+				{
+					frame[i] ^= delta[i];
+				}
+			}
+			write_png(prefix, frame, width, height);
+		} else {
+			//unknown chunks are skipped so the format can be extended
+		}
+	}
+	wave_finalize(wave);
+	fclose(f);
+	printf("Decoded %d frames and %d audio samples at %dHz\n", frame_num, audio_samples, sample_rate);
+	return 0;
+}
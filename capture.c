@@ -0,0 +1,326 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "capture.h"
+#include "frame_dump.h"
+#include "blastem.h"
+#include "util.h"
+#include "zlib/zlib.h"
+
+//large enough for an interlaced PAL frame
+#define MAX_FRAME_WIDTH LINEBUF_SIZE
+#define MAX_FRAME_HEIGHT 588
+#define MAX_FRAME_PIXELS (MAX_FRAME_WIDTH * MAX_FRAME_HEIGHT)
+#define NUM_FRAME_BUFFERS 4
+//periodic keyframes keep a damaged file decodable past the damage
+#define KEYFRAME_INTERVAL 600
+#define AUDIO_CHANNELS 2
+
+typedef struct capture_buffer capture_buffer;
+struct capture_buffer {
+	capture_buffer *next;
+	uint32_t       *pixels;
+	uint32_t       width;
+	uint32_t       height;
+	uint16_t       repeat;
+};
+
+//shared between the emulation, audio and capture threads, protected by capture_lock
+static SDL_mutex      *capture_lock;
+static SDL_cond       *frame_ready;
+static capture_buffer *free_buffers;
+static capture_buffer *pending_head;
+static capture_buffer *pending_tail;
+static int16_t        *audio_pending;
+static uint32_t       audio_pending_samples, audio_pending_storage;
+static uint8_t        capturing, capture_quit;
+static uint16_t       trailing_repeat;
+
+//only touched by the emulation thread
+static capture_buffer buffers[NUM_FRAME_BUFFERS];
+static SDL_Thread     *capture_thread;
+static uint32_t       dropped, total_dropped, total_frames;
+
+//only touched by the capture thread while it is running
+static FILE           *capture_file;
+static uint32_t       *prev_frame;
+static uint32_t       *delta;
+static uint8_t        *compressed;
+static uLong          compressed_storage;
+static int16_t        *audio_writing;
+static uint32_t       audio_writing_storage;
+static uint32_t       prev_width, prev_height, frames_since_key;
+
+static void write_le(uint8_t *dst, uint32_t value, uint8_t bytes)
+{
+	for (uint8_t i = 0; i < bytes; i++)
+	{
+		dst[i] = value >> (8 * i);
+	}
+}
+
+static void write_chunk_header(char *type, uint32_t size)
+{
+	uint8_t header[CAPTURE_CHUNK_HEADER_SIZE];
+	memcpy(header, type, 4);
+	write_le(header + 4, size, 4);
+	fwrite(header, 1, sizeof(header), capture_file);
+}
+
+static void write_audio(int16_t *samples, uint32_t num_samples)
+{
+	if (!num_samples) {
+		return;
+	}
+	write_chunk_header(CAPTURE_AUDIO, num_samples * AUDIO_CHANNELS * sizeof(int16_t));
+	fwrite(samples, sizeof(int16_t), num_samples * AUDIO_CHANNELS, capture_file);
+}
+
+static void write_frame(capture_buffer *frame)
+{
+	uint32_t num_pixels = frame->width * frame->height;
+	uint8_t flags = 0;
+	if (frame->width != prev_width || frame->height != prev_height || !frames_since_key) {
+		flags |= CAPTURE_KEYFRAME;
+		frames_since_key = KEYFRAME_INTERVAL;
+		memcpy(delta, frame->pixels, num_pixels * sizeof(uint32_t));
+	} else {
+		//unchanged pixels become zero which deflate handles very cheaply
+		for (uint32_t i = 0; i < num_pixels; i++)
+		{
+			delta[i] = frame->pixels[i] ^ prev_frame[i];
+		}
+	}
+	frames_since_key--;
+	prev_width = frame->width;
+	prev_height = frame->height;
+	//swap instead of copy, the old reference frame goes back into the pool
+	uint32_t *tmp = prev_frame;
+	prev_frame = frame->pixels;
+	frame->pixels = tmp;
+
+	uLong compressed_size = compressed_storage;
+	if (compress2(compressed, &compressed_size, (Bytef *)delta, num_pixels * sizeof(uint32_t), Z_BEST_SPEED) != Z_OK) {
+		warning("Failed to compress captured frame\n");
+		return;
+	}
+	uint8_t header[CAPTURE_VIDEO_HEADER_SIZE];
+	write_le(header, frame->width, 2);
+	write_le(header + 2, frame->height, 2);
+	header[4] = flags;
+	header[5] = 0;
+	write_le(header + 6, frame->repeat, 2);
+	write_chunk_header(CAPTURE_VIDEO, sizeof(header) + compressed_size);
+	fwrite(header, 1, sizeof(header), capture_file);
+	fwrite(compressed, 1, compressed_size, capture_file);
+}
+
+static int capture_main(void *data)
+{
+	SDL_LockMutex(capture_lock);
+	for (;;)
+	{
+		while (!pending_head && !capture_quit)
+		{
+			SDL_CondWait(frame_ready, capture_lock);
+		}
+		capture_buffer *frame = pending_head;
+		if (frame) {
+			pending_head = frame->next;
+			if (!pending_head) {
+				pending_tail = NULL;
+			}
+		}
+		//audio that arrived before this frame was submitted is written ahead of it
+		int16_t *tmp = audio_writing;
+		uint32_t tmp_storage = audio_writing_storage;
+		uint32_t num_samples = audio_pending_samples;
+		audio_writing = audio_pending;
+		audio_writing_storage = audio_pending_storage;
+		audio_pending = tmp;
+		audio_pending_storage = tmp_storage;
+		audio_pending_samples = 0;
+		SDL_UnlockMutex(capture_lock);
+
+		write_audio(audio_writing, num_samples);
+		if (!frame) {
+			if (trailing_repeat) {
+				uint8_t header[CAPTURE_VIDEO_HEADER_SIZE] = {0};
+				write_le(header + 6, trailing_repeat, 2);
+				write_chunk_header(CAPTURE_VIDEO, sizeof(header));
+				fwrite(header, 1, sizeof(header), capture_file);
+			}
+			break;
+		}
+		write_frame(frame);
+
+		SDL_LockMutex(capture_lock);
+		frame->next = free_buffers;
+		free_buffers = frame;
+	}
+	return 0;
+}
+
+static void free_capture_buffers(void)
+{
+	for (int i = 0; i < NUM_FRAME_BUFFERS; i++)
+	{
+		free(buffers[i].pixels);
+	}
+	free(prev_frame);
+	free(delta);
+	free(compressed);
+}
+
+void capture_start(char *path)
+{
+	if (capture_thread) {
+		capture_stop();
+	}
+	capture_file = fopen(path, "wb");
+	if (!capture_file) {
+		warning("Failed to open %s for writing\n", path);
+		free(path);
+		return;
+	}
+	uint8_t header[CAPTURE_HEADER_SIZE];
+	memcpy(header, CAPTURE_MAGIC, 8);
+	write_le(header + 8, CAPTURE_VERSION, 2);
+	write_le(header + 10, AUDIO_CHANNELS, 2);
+	write_le(header + 12, render_sample_rate(), 4);
+	fwrite(header, 1, sizeof(header), capture_file);
+
+	if (!capture_lock) {
+		//the audio callback may still be holding this when capture stops so it is never destroyed
+		capture_lock = SDL_CreateMutex();
+		frame_ready = SDL_CreateCond();
+	}
+	free_buffers = pending_head = pending_tail = NULL;
+	for (int i = 0; i < NUM_FRAME_BUFFERS; i++)
+	{
+		buffers[i].pixels = malloc(MAX_FRAME_PIXELS * sizeof(uint32_t));
+		buffers[i].next = free_buffers;
+		free_buffers = buffers + i;
+	}
+	prev_frame = malloc(MAX_FRAME_PIXELS * sizeof(uint32_t));
+	delta = malloc(MAX_FRAME_PIXELS * sizeof(uint32_t));
+	compressed_storage = compressBound(MAX_FRAME_PIXELS * sizeof(uint32_t));
+	compressed = malloc(compressed_storage);
+	prev_width = prev_height = frames_since_key = 0;
+	dropped = total_dropped = total_frames = 0;
+	capture_quit = 0;
+
+	SDL_LockMutex(capture_lock);
+		audio_pending_samples = 0;
+		capturing = 1;
+	SDL_UnlockMutex(capture_lock);
+	capture_thread = SDL_CreateThread(capture_main, "capture", NULL);
+	if (!capture_thread) {
+		warning("Failed to start capture thread: %s\n", SDL_GetError());
+		SDL_LockMutex(capture_lock);
+			capturing = 0;
+		SDL_UnlockMutex(capture_lock);
+		fclose(capture_file);
+		capture_file = NULL;
+		free_capture_buffers();
+		free(path);
+		return;
+	}
+	info_message("Recording to %s\n", path);
+	free(path);
+}
+
+void capture_stop(void)
+{
+	if (!capture_thread) {
+		return;
+	}
+	SDL_LockMutex(capture_lock);
+		capturing = 0;
+		capture_quit = 1;
+		trailing_repeat = dropped > 0xFFFF ? 0xFFFF : dropped;
+		SDL_CondSignal(frame_ready);
+	SDL_UnlockMutex(capture_lock);
+	//the capture thread drains any queued frames before it exits
+	SDL_WaitThread(capture_thread, NULL);
+	capture_thread = NULL;
+	fclose(capture_file);
+	capture_file = NULL;
+	free_capture_buffers();
+	info_message("Stopped recording, %d frames captured, %d dropped\n", total_frames, total_dropped);
+}
+
+uint8_t capture_active(void)
+{
+	return capture_thread != NULL;
+}
+
+void capture_frame(void *pixels, uint32_t width, uint32_t height, uint32_t pitch, pixel_format format)
+{
+	if (!capture_thread) {
+		return;
+	}
+	SDL_LockMutex(capture_lock);
+		capture_buffer *frame = free_buffers;
+		if (frame) {
+			free_buffers = frame->next;
+		}
+	SDL_UnlockMutex(capture_lock);
+	total_frames++;
+	if (!frame) {
+		//never stall emulation, the decoder repeats the previous frame to keep timing intact
+		dropped++;
+		total_dropped++;
+		return;
+	}
+	if (width > MAX_FRAME_WIDTH) {
+		width = MAX_FRAME_WIDTH;
+	}
+	if (height > MAX_FRAME_HEIGHT) {
+		height = MAX_FRAME_HEIGHT;
+	}
+	frame_copy_argb8888(frame->pixels, pixels, width, height, pitch, format);
+	frame->width = width;
+	frame->height = height;
+	frame->repeat = dropped > 0xFFFF ? 0xFFFF : dropped;
+	dropped = 0;
+	frame->next = NULL;
+	SDL_LockMutex(capture_lock);
+		if (pending_tail) {
+			pending_tail->next = frame;
+		} else {
+			pending_head = frame;
+		}
+		pending_tail = frame;
+		SDL_CondSignal(frame_ready);
+	SDL_UnlockMutex(capture_lock);
+}
+
+void capture_audio(void *samples, uint32_t num_samples, uint8_t is_float)
+{
+	//cheap unlocked check so the audio callback doesn't take the lock when nothing is recording
+	if (!capturing) {
+		return;
+	}
+	SDL_LockMutex(capture_lock);
+		if (capturing) {
+			if (audio_pending_samples + num_samples > audio_pending_storage) {
+				audio_pending_storage = (audio_pending_samples + num_samples) * 2;
+				audio_pending = realloc(audio_pending, audio_pending_storage * AUDIO_CHANNELS * sizeof(int16_t));
+			}
+			int16_t *dst = audio_pending + audio_pending_samples * AUDIO_CHANNELS;
+			if (is_float) {
+				float *src = samples;
+				for (uint32_t i = 0; i < num_samples * AUDIO_CHANNELS; i++)
+				{
+					float sample = src[i];
+					sample = sample > 1.0f ? 1.0f : sample < -1.0f ? -1.0f : sample;
+					dst[i] = sample * 0x7FFF;
+				}
+			} else {
+				memcpy(dst, samples, num_samples * AUDIO_CHANNELS * sizeof(int16_t));
+			}
+			audio_pending_samples += num_samples;
+		}
+	SDL_UnlockMutex(capture_lock);
+}
@@ -0,0 +1,37 @@
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <stdint.h>
+#include "render.h"
+
+//Lossless audio/video capture format
+//
+//File header: "BLASTCAP", u16 version, u16 audio channels, u32 sample rate
+//Followed by chunks of: 4 byte type, u32 payload size, payload
+//All integers are little endian
+//
+//CAPTURE_VIDEO payload: u16 width, u16 height, u8 flags, u8 reserved, u16 repeat count
+//followed by a zlib stream of width*height ARGB8888 pixels. Unless CAPTURE_KEYFRAME
+//is set, the pixels are XORed with the previous frame. The previous frame should be
+//output repeat count additional times before this one to fill in frames that were dropped
+//A chunk with zero width and height only carries a repeat count for frames dropped at the end
+//
+//CAPTURE_AUDIO payload: interleaved signed 16-bit samples
+
+#define CAPTURE_MAGIC "BLASTCAP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 16
+#define CAPTURE_CHUNK_HEADER_SIZE 8
+#define CAPTURE_VIDEO "VIDF"
+#define CAPTURE_AUDIO "AUDS"
+#define CAPTURE_VIDEO_HEADER_SIZE 8
+#define CAPTURE_KEYFRAME 1
+
+void capture_start(char *path);
+void capture_stop(void);
+uint8_t capture_active(void);
+void capture_frame(void *pixels, uint32_t width, uint32_t height, uint32_t pitch, pixel_format format);
+//Receives mixed stereo output from the audio callback, is_float indicates 32-bit float samples instead of 16-bit
+void capture_audio(void *samples, uint32_t num_samples, uint8_t is_float);
+
+#endif //CAPTURE_H_
@@ -7,6 +7,8 @@
 #define CONFIG_H_
 #include "tern.h"
 
+//parses config text in place, the buffer is clobbered but can be freed afterwards
+tern_node *parse_config(char *config_data);
 tern_node *parse_config_file(char *config_path);
 tern_node *parse_bundled_config(char *config_name);
 tern_node *load_config();
@@ -0,0 +1,293 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "frame_dump.h"
+#include "blastem.h"
+#include "util.h"
+#include "ppm.h"
+#ifndef DISABLE_ZLIB
+#include "png.h"
+#endif
+
+//large enough for an interlaced PAL frame
+#define MAX_FRAME_WIDTH LINEBUF_SIZE
+#define MAX_FRAME_HEIGHT 588
+#define DEFAULT_BUFFERS 8
+
+typedef struct dump_job dump_job;
+struct dump_job {
+	dump_job *next;
+	uint32_t *pixels;
+	char     *path;
+	uint32_t width;
+	uint32_t height;
+	uint8_t  png;
+};
+
+static SDL_Thread *encoder_thread;
+static SDL_mutex  *dump_lock;
+static SDL_cond   *job_ready;
+static SDL_cond   *job_done;
+static dump_job   *free_jobs;
+static dump_job   *pending_head;
+static dump_job   *pending_tail;
+static uint32_t   num_jobs, max_jobs;
+static uint8_t    encoder_quit;
+
+static char       *sequence_prefix;
+static uint32_t   sequence_frame, sequence_queued, sequence_dropped;
+static uint8_t    sequence_png, sequence_wait;
+
+static void encode_job(dump_job *job)
+{
+	FILE *f = fopen(job->path, "wb");
+	if (!f) {
+		warning("Failed to open %s for writing\n", job->path);
+		return;
+	}
+#ifndef DISABLE_ZLIB
+	if (job->png) {
+		save_png(f, job->pixels, job->width, job->height, job->width * sizeof(uint32_t));
+	} else {
+#endif
+		save_ppm(f, job->pixels, job->width, job->height, job->width * sizeof(uint32_t));
+#ifndef DISABLE_ZLIB
+	}
+#endif
+	fclose(f);
+}
+
+static int encoder_main(void *data)
+{
+	SDL_LockMutex(dump_lock);
+	for (;;)
+	{
+		while (!pending_head && !encoder_quit)
+		{
+			SDL_CondWait(job_ready, dump_lock);
+		}
+		dump_job *job = pending_head;
+		if (!job) {
+			break;
+		}
+		pending_head = job->next;
+		if (!pending_head) {
+			pending_tail = NULL;
+		}
+		SDL_UnlockMutex(dump_lock);
+
+		encode_job(job);
+		free(job->path);
+		job->path = NULL;
+
+		SDL_LockMutex(dump_lock);
+		job->next = free_jobs;
+		free_jobs = job;
+		SDL_CondSignal(job_done);
+	}
+	SDL_UnlockMutex(dump_lock);
+	return 0;
+}
+
+static uint8_t init_encoder(void)
+{
+	if (encoder_thread) {
+		return 1;
+	}
+	char *buffers = tern_find_path(config, "ui\0frame_dump_buffers\0", TVAL_PTR).ptrval;
+	max_jobs = buffers ? atoi(buffers) : DEFAULT_BUFFERS;
+	if (max_jobs < 2) {
+		max_jobs = 2;
+	}
+	dump_lock = SDL_CreateMutex();
+	job_ready = SDL_CreateCond();
+	job_done = SDL_CreateCond();
+	encoder_quit = 0;
+	encoder_thread = SDL_CreateThread(encoder_main, "frame encoder", NULL);
+	if (!encoder_thread) {
+		warning("Failed to start frame encoder thread: %s\n", SDL_GetError());
+		//the next attempt creates these again
+		SDL_DestroyCond(job_ready);
+		SDL_DestroyCond(job_done);
+		SDL_DestroyMutex(dump_lock);
+		return 0;
+	}
+	return 1;
+}
+
+//grabs a buffer from the pool, growing it up to max_jobs before waiting or giving up
+static dump_job *acquire_job(uint8_t wait)
+{
+	if (!init_encoder()) {
+		return NULL;
+	}
+	dump_job *job = NULL;
+	SDL_LockMutex(dump_lock);
+		for (;;)
+		{
+			if (free_jobs) {
+				job = free_jobs;
+				free_jobs = job->next;
+				break;
+			}
+			if (num_jobs < max_jobs) {
+				job = malloc(sizeof(dump_job));
+				job->pixels = malloc(MAX_FRAME_WIDTH * MAX_FRAME_HEIGHT * sizeof(uint32_t));
+				num_jobs++;
+				break;
+			}
+			if (!wait) {
+				break;
+			}
+			SDL_CondWait(job_done, dump_lock);
+		}
+	SDL_UnlockMutex(dump_lock);
+	return job;
+}
+
+static void submit_job(dump_job *job)
+{
+	job->next = NULL;
+	SDL_LockMutex(dump_lock);
+		if (pending_tail) {
+			pending_tail->next = job;
+		} else {
+			pending_head = job;
+		}
+		pending_tail = job;
+		SDL_CondSignal(job_ready);
+	SDL_UnlockMutex(dump_lock);
+}
+
+void frame_copy_argb8888(uint32_t *dst, void *pixels, uint32_t width, uint32_t height, uint32_t pitch, pixel_format format)
+{
+	uint8_t *src = pixels;
+	for (uint32_t y = 0; y < height; y++, src += pitch, dst += width)
+	{
+		if (format == PIXEL_RGB565) {
+			uint16_t *line = (uint16_t *)src;
+			for (uint32_t x = 0; x < width; x++)
+			{
+				uint16_t pixel = line[x];
+				uint8_t r = pixel >> 11, g = pixel >> 5 & 0x3F, b = pixel & 0x1F;
+				dst[x] = 0xFF000000 | (r << 3 | r >> 2) << 16 | (g << 2 | g >> 4) << 8 | (b << 3 | b >> 2);
+			}
+		} else {
+			memcpy(dst, src, width * sizeof(uint32_t));
+		}
+	}
+}
+
+//copies the visible portion of a frame into a job buffer, converting to the ARGB8888 format the encoders expect
+static void copy_frame(dump_job *job, void *pixels, uint32_t width, uint32_t height, uint32_t pitch, pixel_format format)
+{
+	if (width > MAX_FRAME_WIDTH) {
+		width = MAX_FRAME_WIDTH;
+	}
+	if (height > MAX_FRAME_HEIGHT) {
+		height = MAX_FRAME_HEIGHT;
+	}
+	job->width = width;
+	job->height = height;
+	frame_copy_argb8888(job->pixels, pixels, width, height, pitch, format);
+}
+
+void frame_dump_screenshot(char *path, void *pixels, uint32_t width, uint32_t height, uint32_t pitch, pixel_format format)
+{
+	dump_job *job = acquire_job(1);
+	if (!job) {
+		free(path);
+		return;
+	}
+	copy_frame(job, pixels, width, height, pitch, format);
+	job->path = path;
+#ifndef DISABLE_ZLIB
+	char *ext = path_extension(path);
+	job->png = ext && !strcasecmp(ext, "png");
+	free(ext);
+#else
+	job->png = 0;
+#endif
+	submit_job(job);
+}
+
+void frame_dump_start(char *prefix)
+{
+	if (sequence_prefix) {
+		frame_dump_stop();
+	}
+	tern_val def = {.ptrval = "png"};
+	char *format = tern_find_path_default(config, "ui\0frame_dump_format\0", def, TVAL_PTR).ptrval;
+#ifndef DISABLE_ZLIB
+	sequence_png = strcasecmp(format, "ppm") != 0;
+#else
+	sequence_png = 0;
+#endif
+	def.ptrval = "drop";
+	sequence_wait = !strcmp(tern_find_path_default(config, "ui\0frame_dump_overflow\0", def, TVAL_PTR).ptrval, "wait");
+	sequence_prefix = prefix;
+	sequence_frame = sequence_queued = sequence_dropped = 0;
+	info_message("Dumping frames to %s*.%s\n", prefix, sequence_png ? "png" : "ppm");
+}
+
+void frame_dump_stop(void)
+{
+	if (!sequence_prefix) {
+		return;
+	}
+	info_message("Stopped frame dump, %d frames queued, %d dropped\n", sequence_queued, sequence_dropped);
+	free(sequence_prefix);
+	sequence_prefix = NULL;
+}
+
+uint8_t frame_dump_active(void)
+{
+	return sequence_prefix != NULL;
+}
+
+void frame_dump_frame(void *pixels, uint32_t width, uint32_t height, uint32_t pitch, pixel_format format)
+{
+	if (!sequence_prefix) {
+		return;
+	}
+	//frames are numbered by emulated frame so any drops show up as gaps in the sequence
+	uint32_t frame = sequence_frame++;
+	dump_job *job = acquire_job(sequence_wait);
+	if (!job) {
+		sequence_dropped++;
+		return;
+	}
+	copy_frame(job, pixels, width, height, pitch, format);
+	size_t path_size = strlen(sequence_prefix) + strlen("0000000.png") + 1;
+	job->path = malloc(path_size);
+	snprintf(job->path, path_size, "%s%07d.%s", sequence_prefix, frame, sequence_png ? "png" : "ppm");
+	job->png = sequence_png;
+	sequence_queued++;
+	submit_job(job);
+}
+
+void frame_dump_shutdown(void)
+{
+	frame_dump_stop();
+	if (!encoder_thread) {
+		return;
+	}
+	SDL_LockMutex(dump_lock);
+		encoder_quit = 1;
+		SDL_CondSignal(job_ready);
+	SDL_UnlockMutex(dump_lock);
+	//encoder drains the pending queue before exiting so no screenshots are lost
+	SDL_WaitThread(encoder_thread, NULL);
+	encoder_thread = NULL;
+	while (free_jobs)
+	{
+		dump_job *job = free_jobs;
+		free_jobs = job->next;
+		free(job->pixels);
+		free(job);
+	}
+	num_jobs = 0;
+	SDL_DestroyCond(job_ready);
+	SDL_DestroyCond(job_done);
+	SDL_DestroyMutex(dump_lock);
+}
@@ -0,0 +1,20 @@
+#ifndef FRAME_DUMP_H_
+#define FRAME_DUMP_H_
+
+#include <stdint.h>
+#include "render.h"
+
+//Queues a copy of a frame to be written to path by the encoder thread, takes ownership of path
+//Screenshots are never dropped, this will wait for a free buffer if necessary
+void frame_dump_screenshot(char *path, void *pixels, uint32_t width, uint32_t height, uint32_t pitch, pixel_format format);
+//Starts dumping every frame as a numbered image sequence, takes ownership of prefix
+void frame_dump_start(char *prefix);
+void frame_dump_stop(void);
+uint8_t frame_dump_active(void);
+void frame_dump_frame(void *pixels, uint32_t width, uint32_t height, uint32_t pitch, pixel_format format);
+//Copies a frame into a tightly packed ARGB8888 buffer
+void frame_copy_argb8888(uint32_t *dst, void *pixels, uint32_t width, uint32_t height, uint32_t pitch, pixel_format format);
+//Waits for all queued images to be written and stops the encoder thread
+void frame_dump_shutdown(void);
+
+#endif //FRAME_DUMP_H_
@@ -17,10 +17,12 @@
 #include "gdb_remote.h"
 #include "saves.h"
 #include "bindings.h"
+#include "hashlog.h"
+#include "romload.h"
+#include "startup.h"
 #define MCLKS_NTSC 53693175
 #define MCLKS_PAL  53203395
 
-uint32_t MCLKS_PER_68K;
 #define MCLKS_PER_YM  7
 #define MCLKS_PER_Z80 15
 #define MCLKS_PER_PSG (MCLKS_PER_Z80*16)
@@ -60,6 +62,7 @@ void genesis_serialize(genesis_context *gen, serialize_buffer *buf, uint32_t m68
 	save_int8(buf, gen->z80->reset);
 	save_int8(buf, gen->z80->busreq);
 	save_int16(buf, gen->z80->bank_reg);
+	save_int32(buf, gen->refresh_counter);
 	end_section(buf);
 	
 	start_section(buf, SECTION_SEGA_IO_1);
@@ -124,9 +127,11 @@ static void bus_arbiter_deserialize(deserialize_buffer *buf, void *vgen)
 	gen->z80->reset = load_int8(buf);
 	gen->z80->busreq = load_int8(buf);
 	gen->z80->bank_reg = load_int16(buf) & 0x1FF;
+	//older states don't have the refresh counter
+	gen->refresh_counter = buf->cur_pos < buf->size ? load_int32(buf) : 0;
 }
 
-void genesis_deserialize(deserialize_buffer *buf, genesis_context *gen)
+static void register_genesis_handlers(deserialize_buffer *buf, genesis_context *gen)
 {
 	register_section_handler(buf, (section_handler){.fun = m68k_deserialize, .data = gen->m68k}, SECTION_68000);
 	register_section_handler(buf, (section_handler){.fun = z80_deserialize, .data = gen->z80}, SECTION_Z80);
@@ -140,16 +145,28 @@ void genesis_deserialize(deserialize_buffer *buf, genesis_context *gen)
 	register_section_handler(buf, (section_handler){.fun = ram_deserialize, .data = gen}, SECTION_MAIN_RAM);
 	register_section_handler(buf, (section_handler){.fun = zram_deserialize, .data = gen}, SECTION_SOUND_RAM);
 	register_section_handler(buf, (section_handler){.fun = cart_deserialize, .data = gen}, SECTION_MAPPER);
+}
+
+static void load_genesis_sections(deserialize_buffer *buf, genesis_context *gen)
+{
 	while (buf->cur_pos < buf->size)
 	{
 		load_section(buf);
 	}
 	update_z80_bank_pointer(gen);
+	//the 68K clock may have moved backwards, so refresh timing restarts from the restored cycle
+	gen->last_sync_cycle = gen->m68k->current_cycle;
+}
+
+void genesis_deserialize(deserialize_buffer *buf, genesis_context *gen)
+{
+	register_genesis_handlers(buf, gen);
+	load_genesis_sections(buf, gen);
 }
 
-uint16_t read_dma_value(uint32_t address)
+uint16_t read_dma_value(system_header *system, uint32_t address)
 {
-	genesis_context *genesis = (genesis_context *)current_system;
+	genesis_context *genesis = (genesis_context *)system;
 	//TODO: Figure out what happens when you try to DMA from weird adresses like IO or banked Z80 area
 	if ((address >= 0xA00000 && address < 0xB00000) || (address >= 0xC00000 && address <= 0xE00000)) {
 		return 0;
@@ -162,7 +179,7 @@ uint16_t read_dma_value(uint32_t address)
 static uint16_t get_open_bus_value(system_header *system)
 {
 	genesis_context *genesis = (genesis_context *)system;
-	return read_dma_value(genesis->m68k->last_prefetch_address/2);
+	return read_dma_value(system, genesis->m68k->last_prefetch_address/2);
 }
 
 static void adjust_int_cycle(m68k_context * context, vdp_context * v_context)
@@ -250,7 +267,8 @@ static void z80_next_int_pulse(z80_context * z_context)
 static void sync_z80(z80_context * z_context, uint32_t mclks)
 {
 #ifndef NO_Z80
-	if (z80_enabled) {
+	genesis_context *gen = z_context->system;
+	if (gen->z80_enabled) {
 		z80_run(z_context, mclks);
 	} else
 #endif
@@ -275,22 +293,93 @@ static void sync_sound(genesis_context * gen, uint32_t target)
 	//printf("Target: %d, YM bufferpos: %d, PSG bufferpos: %d\n", target, gen->ym->buffer_pos, gen->psg->buffer_pos * 2);
 }
 
-//TODO: move this inside the system context
-static uint32_t last_frame_num;
+static void write_ym(genesis_context *gen, uint32_t location, uint8_t value)
+{
+	if (location & 1) {
+		if (gen->vgm) {
+			//logged at the chip's own cycle, which is where the write takes effect
+			vgm_ym2612_write(gen->vgm, gen->ym->current_cycle, gen->ym->selected_part, gen->ym->selected_reg, value);
+		}
+		ym_data_write(gen->ym, value);
+	} else if (location & 2) {
+		ym_address_write_part2(gen->ym, value);
+	} else {
+		ym_address_write_part1(gen->ym, value);
+	}
+}
+
+static void write_psg(genesis_context *gen, uint8_t value)
+{
+	if (gen->vgm) {
+		vgm_psg_write(gen->vgm, gen->psg->cycles, value);
+	}
+	psg_write(gen->psg, value);
+}
+
+//writes the complete sound chip state to the VGM log, needed at the start and whenever the state changes outside of register writes
+static void log_sound_state(genesis_context *gen)
+{
+	if (gen->vgm) {
+		vgm_ym2612_state(gen->vgm, gen->ym->current_cycle, gen->ym);
+		vgm_psg_state(gen->vgm, gen->psg->cycles, gen->psg);
+	}
+}
 
 //My refresh emulation isn't currently good enough and causes more problems than it solves
 #define REFRESH_EMULATION
 #ifdef REFRESH_EMULATION
 #define REFRESH_INTERVAL 128
 #define REFRESH_DELAY 2
-uint32_t last_sync_cycle;
-uint32_t refresh_counter;
 #endif
 
 #include <limits.h>
 #define ADJUST_BUFFER (8*MCLKS_LINE*313)
 #define MAX_NO_ADJUST (UINT_MAX-ADJUST_BUFFER)
 
+//mapped saves are queued for a background msync at most this often
+#define SAVE_FLUSH_FRAMES 60
+
+static void flush_save_changes(genesis_context *gen)
+{
+	gen->save_flush_frame = gen->last_frame_num;
+	if (gen->save_shadow) {
+		uint32_t start = 0, end = gen->save_size;
+		while (start < end && gen->save_storage[start] == gen->save_shadow[start])
+		{
+			start++;
+		}
+		while (end > start && gen->save_storage[end - 1] == gen->save_shadow[end - 1])
+		{
+			end--;
+		}
+		if (start < end) {
+			memcpy(gen->save_shadow + start, gen->save_storage + start, end - start);
+			mark_save_dirty(&gen->save_dirty, start, end - start);
+		}
+	}
+	if (gen->save_dirty.start < gen->save_dirty.end) {
+		flush_save_async(gen->save_storage, gen->save_dirty.start, gen->save_dirty.end);
+		gen->save_dirty.start = gen->save_dirty.end = 0;
+	}
+}
+
+//the Z80 can be saved once it's at an instruction boundary or isn't running
+static uint8_t z80_can_save(z80_context *z_context)
+{
+	return z_context->pc || !z_context->native_pc || z_context->reset || !z_context->busreq;
+}
+
+static void z80_sync_to_instruction(z80_context *z_context)
+{
+	if (z_context->native_pc && !z_context->reset) {
+		//advance Z80 core to the start of an instruction
+		while (!z_context->pc)
+		{
+			sync_z80(z_context, z_context->current_cycle + MCLKS_PER_Z80);
+		}
+	}
+}
+
 m68k_context * sync_components(m68k_context * context, uint32_t address)
 {
 	genesis_context * gen = context->system;
@@ -298,11 +387,11 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 	z80_context * z_context = gen->z80;
 #ifdef REFRESH_EMULATION
 	//lame estimation of refresh cycle delay
-	refresh_counter += context->current_cycle - last_sync_cycle;
+	gen->refresh_counter += context->current_cycle - gen->last_sync_cycle;
 	if (!gen->bus_busy) {
-		context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
+		context->current_cycle += REFRESH_DELAY * gen->mclks_per_68k * (gen->refresh_counter / (gen->mclks_per_68k * REFRESH_INTERVAL));
 	}
-	refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+	gen->refresh_counter = gen->refresh_counter % (gen->mclks_per_68k * REFRESH_INTERVAL);
 #endif
 
 	uint32_t mclks = context->current_cycle;
@@ -314,14 +403,22 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 		context->should_return = 1;
 		gen->reset_cycle = CYCLE_NEVER;
 	}
-	if (v_context->frame != last_frame_num) {
-		//printf("reached frame end %d | MCLK Cycles: %d, Target: %d, VDP cycles: %d, vcounter: %d, hslot: %d\n", last_frame_num, mclks, gen->frame_end, v_context->cycles, v_context->vcounter, v_context->hslot);
-		last_frame_num = v_context->frame;
+	if (v_context->frame != gen->last_frame_num) {
+		//printf("reached frame end %d | MCLK Cycles: %d, Target: %d, VDP cycles: %d, vcounter: %d, hslot: %d\n", gen->last_frame_num, mclks, gen->frame_end, v_context->cycles, v_context->vcounter, v_context->hslot);
+		gen->last_frame_num = v_context->frame;
+		//headless runs never hand a frame to the renderer, so startup ends here for them
+		startup_trace_done();
 
-		if(exit_after){
-			--exit_after;
-			if (!exit_after) {
-				exit(0);
+		if (hashlog_enabled()) {
+			hashlog_frame_end(&gen->header, mclks);
+		}
+		if (gen->save_mapped && gen->last_frame_num - gen->save_flush_frame >= SAVE_FLUSH_FRAMES) {
+			flush_save_changes(gen);
+		}
+		if (gen->header.exit_after) {
+			if (!--gen->header.exit_after) {
+				gen->header.should_exit = 1;
+				context->should_return = 1;
 			}
 		}
 		if (context->current_cycle > MAX_NO_ADJUST) {
@@ -332,10 +429,10 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 			io_adjust_cycles(gen->io.ports+2, context->current_cycle, deduction);
 			context->current_cycle -= deduction;
 			z80_adjust_cycles(z_context, deduction);
-			gen->ym->current_cycle -= deduction;
+			ym_adjust_cycles(gen->ym, deduction);
 			gen->psg->cycles -= deduction;
-			if (gen->ym->write_cycle != CYCLE_NEVER) {
-				gen->ym->write_cycle = gen->ym->write_cycle >= deduction ? gen->ym->write_cycle - deduction : 0;
+			if (gen->vgm) {
+				vgm_adjust_cycles(gen->vgm, deduction);
 			}
 			if (gen->reset_cycle != CYCLE_NEVER) {
 				gen->reset_cycle -= deduction;
@@ -350,7 +447,7 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 		vdp_int_ack(v_context);
 		context->int_ack = 0;
 	}
-	if (!address && (gen->header.enter_debugger || gen->header.save_state)) {
+	if (!address && (gen->header.enter_debugger || gen->header.save_state || gen->header.save_snapshot)) {
 		context->sync_cycle = context->current_cycle + 1;
 	}
 	adjust_int_cycle(context, v_context);
@@ -362,23 +459,16 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 			gen->header.enter_debugger = 0;
 			debugger(context, address);
 		}
-		if (gen->header.save_state && (z_context->pc || !z_context->native_pc || z_context->reset || !z_context->busreq)) {
+		if (gen->header.save_state && z80_can_save(z_context)) {
 			uint8_t slot = gen->header.save_state - 1;
 			gen->header.save_state = 0;
-			if (z_context->native_pc && !z_context->reset) {
-				//advance Z80 core to the start of an instruction
-				while (!z_context->pc)
-				{
-					sync_z80(z_context, z_context->current_cycle + MCLKS_PER_Z80);
-				}
-			}
+			z80_sync_to_instruction(z_context);
 			char *save_path = get_slot_name(&gen->header, slot, use_native_states ? "state" : "gst");
 			if (use_native_states) {
 				serialize_buffer state;
-				init_serialize(&state);
+				get_state_buffer(&state);
 				genesis_serialize(gen, &state, address);
-				save_to_file(&state, save_path);
-				free(state.data);
+				save_state_async(&state, save_path);
 			} else {
 				save_gst(gen, save_path, address);
 			}
@@ -387,9 +477,20 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 		} else if(gen->header.save_state) {
 			context->sync_cycle = context->current_cycle + 1;
 		}
+		if (gen->header.save_snapshot && z80_can_save(z_context)) {
+			z80_sync_to_instruction(z_context);
+			genesis_save_snapshot(gen, gen->header.save_snapshot, address);
+			gen->header.save_snapshot = NULL;
+		} else if (gen->header.save_snapshot) {
+			context->sync_cycle = context->current_cycle + 1;
+		}
+	}
+	if (gen->header.load_snapshot && !gen->header.save_snapshot) {
+		//a save requested alongside the load has to see the state from before it
+		context->should_return = 1;
 	}
 #ifdef REFRESH_EMULATION
-	last_sync_cycle = context->current_cycle;
+	gen->last_sync_cycle = context->current_cycle;
 #endif
 	return context;
 }
@@ -400,16 +501,16 @@ static m68k_context * vdp_port_write(uint32_t vdp_port, m68k_context * context,
 		fatal_error("machine freeze due to write to address %X\n", 0xC00000 | vdp_port);
 	}
 	vdp_port &= 0x1F;
+	genesis_context * gen = context->system;
 	//printf("vdp_port write: %X, value: %X, cycle: %d\n", vdp_port, value, context->current_cycle);
 #ifdef REFRESH_EMULATION
 	//do refresh check here so we can avoid adding a penalty for a refresh that happens during a VDP access
-	refresh_counter += context->current_cycle - 4*MCLKS_PER_68K - last_sync_cycle;
-	context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
-	refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
-	last_sync_cycle = context->current_cycle;
+	gen->refresh_counter += context->current_cycle - 4*gen->mclks_per_68k - gen->last_sync_cycle;
+	context->current_cycle += REFRESH_DELAY * gen->mclks_per_68k * (gen->refresh_counter / (gen->mclks_per_68k * REFRESH_INTERVAL));
+	gen->refresh_counter = gen->refresh_counter % (gen->mclks_per_68k * REFRESH_INTERVAL);
+	gen->last_sync_cycle = context->current_cycle;
 #endif
 	sync_components(context, 0);
-	genesis_context * gen = context->system;
 	vdp_context *v_context = gen->vdp;
 	uint32_t before_cycle = v_context->cycles;
 	if (vdp_port < 0x10) {
@@ -420,9 +521,9 @@ static m68k_context * vdp_port_write(uint32_t vdp_port, m68k_context * context,
 					vdp_run_dma_done(v_context, gen->frame_end);
 					if (v_context->cycles >= gen->frame_end) {
 						uint32_t cycle_diff = v_context->cycles - context->current_cycle;
-						uint32_t m68k_cycle_diff = (cycle_diff / MCLKS_PER_68K) * MCLKS_PER_68K;
+						uint32_t m68k_cycle_diff = (cycle_diff / gen->mclks_per_68k) * gen->mclks_per_68k;
 						if (m68k_cycle_diff < cycle_diff) {
-							m68k_cycle_diff += MCLKS_PER_68K;
+							m68k_cycle_diff += gen->mclks_per_68k;
 						}
 						context->current_cycle += m68k_cycle_diff;
 						gen->bus_busy = 1;
@@ -442,9 +543,9 @@ static m68k_context * vdp_port_write(uint32_t vdp_port, m68k_context * context,
 						vdp_run_dma_done(v_context, gen->frame_end);
 						if (v_context->cycles >= gen->frame_end) {
 							uint32_t cycle_diff = v_context->cycles - context->current_cycle;
-							uint32_t m68k_cycle_diff = (cycle_diff / MCLKS_PER_68K) * MCLKS_PER_68K;
+							uint32_t m68k_cycle_diff = (cycle_diff / gen->mclks_per_68k) * gen->mclks_per_68k;
 							if (m68k_cycle_diff < cycle_diff) {
-								m68k_cycle_diff += MCLKS_PER_68K;
+								m68k_cycle_diff += gen->mclks_per_68k;
 							}
 							context->current_cycle += m68k_cycle_diff;
 							gen->bus_busy = 1;
@@ -470,9 +571,9 @@ static m68k_context * vdp_port_write(uint32_t vdp_port, m68k_context * context,
 		if (v_context->cycles != before_cycle) {
 			//printf("68K paused for %d (%d) cycles at cycle %d (%d) for write\n", v_context->cycles - context->current_cycle, v_context->cycles - before_cycle, context->current_cycle, before_cycle);
 			uint32_t cycle_diff = v_context->cycles - context->current_cycle;
-			uint32_t m68k_cycle_diff = (cycle_diff / MCLKS_PER_68K) * MCLKS_PER_68K;
+			uint32_t m68k_cycle_diff = (cycle_diff / gen->mclks_per_68k) * gen->mclks_per_68k;
 			if (m68k_cycle_diff < cycle_diff) {
-				m68k_cycle_diff += MCLKS_PER_68K;
+				m68k_cycle_diff += gen->mclks_per_68k;
 			}
 			context->current_cycle += m68k_cycle_diff;
 			//Lock the Z80 out of the bus until the VDP access is complete
@@ -481,21 +582,21 @@ static m68k_context * vdp_port_write(uint32_t vdp_port, m68k_context * context,
 			gen->bus_busy = 0;
 		}
 	} else if (vdp_port < 0x18) {
-		psg_write(gen->psg, value);
+		write_psg(gen, value);
 	} else {
 		vdp_test_port_write(gen->vdp, value);
 	}
 #ifdef REFRESH_EMULATION
-	last_sync_cycle -= 4;
+	gen->last_sync_cycle -= 4;
 	//refresh may have happened while we were waiting on the VDP,
-	//so advance refresh_counter but don't add any delays
+	//so advance gen->refresh_counter but don't add any delays
 	if (vdp_port >= 4 && vdp_port < 8 && v_context->cycles != before_cycle) {
-		refresh_counter = 0;
+		gen->refresh_counter = 0;
 	} else {
-		refresh_counter += (context->current_cycle - last_sync_cycle);
-		refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
+		gen->refresh_counter += (context->current_cycle - gen->last_sync_cycle);
+		gen->refresh_counter = gen->refresh_counter % (gen->mclks_per_68k * REFRESH_INTERVAL);
 	}
-	last_sync_cycle = context->current_cycle;
+	gen->last_sync_cycle = context->current_cycle;
 #endif
 	return context;
 }
@@ -526,7 +627,7 @@ static void * z80_vdp_port_write(uint32_t vdp_port, void * vcontext, uint8_t val
 		}
 	} else if (vdp_port < 0x18) {
 		sync_sound(gen, context->current_cycle);
-		psg_write(gen->psg, value);
+		write_psg(gen, value);
 	} else {
 		vdp_test_port_write(gen->vdp, value);
 	}
@@ -539,16 +640,16 @@ static uint16_t vdp_port_read(uint32_t vdp_port, m68k_context * context)
 		fatal_error("machine freeze due to read from address %X\n", 0xC00000 | vdp_port);
 	}
 	vdp_port &= 0x1F;
+	genesis_context *gen = context->system;
 	uint16_t value;
 #ifdef REFRESH_EMULATION
 	//do refresh check here so we can avoid adding a penalty for a refresh that happens during a VDP access
-	refresh_counter += context->current_cycle - 4*MCLKS_PER_68K - last_sync_cycle;
-	context->current_cycle += REFRESH_DELAY * MCLKS_PER_68K * (refresh_counter / (MCLKS_PER_68K * REFRESH_INTERVAL));
-	refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
-	last_sync_cycle = context->current_cycle;
+	gen->refresh_counter += context->current_cycle - 4*gen->mclks_per_68k - gen->last_sync_cycle;
+	context->current_cycle += REFRESH_DELAY * gen->mclks_per_68k * (gen->refresh_counter / (gen->mclks_per_68k * REFRESH_INTERVAL));
+	gen->refresh_counter = gen->refresh_counter % (gen->mclks_per_68k * REFRESH_INTERVAL);
+	gen->last_sync_cycle = context->current_cycle;
 #endif
 	sync_components(context, 0);
-	genesis_context *gen = context->system;
 	vdp_context * v_context = gen->vdp;
 	uint32_t before_cycle = v_context->cycles;
 	if (vdp_port < 0x10) {
@@ -575,12 +676,12 @@ static uint16_t vdp_port_read(uint32_t vdp_port, m68k_context * context)
 		gen->bus_busy = 0;
 	}
 #ifdef REFRESH_EMULATION
-	last_sync_cycle -= 4;
+	gen->last_sync_cycle -= 4;
 	//refresh may have happened while we were waiting on the VDP,
-	//so advance refresh_counter but don't add any delays
-	refresh_counter += (context->current_cycle - last_sync_cycle);
-	refresh_counter = refresh_counter % (MCLKS_PER_68K * REFRESH_INTERVAL);
-	last_sync_cycle = context->current_cycle;
+	//so advance gen->refresh_counter but don't add any delays
+	gen->refresh_counter += (context->current_cycle - gen->last_sync_cycle);
+	gen->refresh_counter = gen->refresh_counter % (gen->mclks_per_68k * REFRESH_INTERVAL);
+	gen->last_sync_cycle = context->current_cycle;
 #endif
 	return value;
 }
@@ -608,7 +709,7 @@ static uint8_t z80_vdp_port_read(uint32_t vdp_port, void * vcontext)
 	//TODO: add cycle for an access right after a previous one
 	//TODO: Below cycle time is an estimate based on the time between 68K !BG goes low and Z80 !MREQ goes high
 	//      Needs a new logic analyzer capture to get the actual delay on the 68K side
-	gen->m68k->current_cycle += 8 * MCLKS_PER_68K;
+	gen->m68k->current_cycle += 8 * gen->mclks_per_68k;
 
 
 	vdp_port &= 0x1F;
@@ -630,16 +731,13 @@ static uint8_t z80_vdp_port_read(uint32_t vdp_port, void * vcontext)
 	return vdp_port & 1 ? ret : ret >> 8;
 }
 
-//TODO: Move this inside the system context
-static uint32_t zram_counter = 0;
-
 static m68k_context * io_write(uint32_t location, m68k_context * context, uint8_t value)
 {
 	genesis_context * gen = context->system;
 	if (location < 0x10000) {
 		//Access to Z80 memory incurs a one 68K cycle wait state
-		context->current_cycle += MCLKS_PER_68K;
-		if (!z80_enabled || z80_get_busack(gen->z80, context->current_cycle)) {
+		context->current_cycle += gen->mclks_per_68k;
+		if (!gen->z80_enabled || z80_get_busack(gen->z80, context->current_cycle)) {
 			location &= 0x7FFF;
 			if (location < 0x4000) {
 				gen->zram[location & 0x1FFF] = value;
@@ -648,13 +746,7 @@ static m68k_context * io_write(uint32_t location, m68k_context * context, uint8_
 #endif
 			} else if (location < 0x6000) {
 				sync_sound(gen, context->current_cycle);
-				if (location & 1) {
-					ym_data_write(gen->ym, value);
-				} else if(location & 2) {
-					ym_address_write_part2(gen->ym, value);
-				} else {
-					ym_address_write_part1(gen->ym, value);
-				}
+				write_ym(gen, location, value);
 			} else if (location == 0x6000) {
 				gen->z80->bank_reg = (gen->z80->bank_reg >> 1 | value << 8) & 0x1FF;
 				if (gen->z80->bank_reg < 0x80) {
@@ -717,7 +809,7 @@ static m68k_context * io_write(uint32_t location, m68k_context * context, uint8_
 			if (location == 0x1100) {
 				if (value & 1) {
 					dputs("bus requesting Z80");
-					if (z80_enabled) {
+					if (gen->z80_enabled) {
 						z80_assert_busreq(gen->z80, context->current_cycle);
 					} else {
 						gen->z80->busack = 1;
@@ -727,13 +819,13 @@ static m68k_context * io_write(uint32_t location, m68k_context * context, uint8_
 						dputs("releasing z80 bus");
 						#ifdef DO_DEBUG_PRINT
 						char fname[20];
-						sprintf(fname, "zram-%d", zram_counter++);
+						sprintf(fname, "zram-%d", gen->zram_counter++);
 						FILE * f = fopen(fname, "wb");
 						fwrite(z80_ram, 1, sizeof(z80_ram), f);
 						fclose(f);
 						#endif
 					}
-					if (z80_enabled) {
+					if (gen->z80_enabled) {
 						z80_clear_busreq(gen->z80, context->current_cycle);
 					} else {
 						gen->z80->busack = 0;
@@ -742,18 +834,19 @@ static m68k_context * io_write(uint32_t location, m68k_context * context, uint8_
 			} else if (location == 0x1200) {
 				sync_z80(gen->z80, context->current_cycle);
 				if (value & 1) {
-					if (z80_enabled) {
+					if (gen->z80_enabled) {
 						z80_clear_reset(gen->z80, context->current_cycle);
 					} else {
 						gen->z80->reset = 0;
 					}
 				} else {
-					if (z80_enabled) {
+					if (gen->z80_enabled) {
 						z80_assert_reset(gen->z80, context->current_cycle);
 					} else {
 						gen->z80->reset = 1;
 					}
 					ym_reset(gen->ym);
+					log_sound_state(gen);
 				}
 			}
 		}
@@ -783,8 +876,8 @@ static uint8_t io_read(uint32_t location, m68k_context * context)
 	genesis_context *gen = context->system;
 	if (location < 0x10000) {
 		//Access to Z80 memory incurs a one 68K cycle wait state
-		context->current_cycle += MCLKS_PER_68K;
-		if (!z80_enabled || z80_get_busack(gen->z80, context->current_cycle)) {
+		context->current_cycle += gen->mclks_per_68k;
+		if (!gen->z80_enabled || z80_get_busack(gen->z80, context->current_cycle)) {
 			location &= 0x7FFF;
 			if (location < 0x4000) {
 				value = gen->zram[location & 0x1FFF];
@@ -856,7 +949,7 @@ static uint8_t io_read(uint32_t location, m68k_context * context)
 			}
 		} else {
 			if (location == 0x1100) {
-				value = z80_enabled ? !z80_get_busack(gen->z80, context->current_cycle) : !gen->z80->busack;
+				value = gen->z80_enabled ? !z80_get_busack(gen->z80, context->current_cycle) : !gen->z80->busack;
 				value |= (get_open_bus_value(&gen->header) >> 8) & 0xFE;
 				dprintf("Byte read of BUSREQ returned %d @ %d (reset: %d)\n", value, context->current_cycle, gen->z80->reset);
 			} else if (location == 0x1200) {
@@ -888,13 +981,7 @@ static void * z80_write_ym(uint32_t location, void * vcontext, uint8_t value)
 	z80_context * context = vcontext;
 	genesis_context * gen = context->system;
 	sync_sound(gen, context->current_cycle);
-	if (location & 1) {
-		ym_data_write(gen->ym, value);
-	} else if (location & 2) {
-		ym_address_write_part2(gen->ym, value);
-	} else {
-		ym_address_write_part1(gen->ym, value);
-	}
+	write_ym(gen, location, value);
 	return context;
 }
 
@@ -918,7 +1005,7 @@ static uint8_t z80_read_bank(uint32_t location, void * vcontext)
 	//TODO: add cycle for an access right after a previous one
 	//TODO: Below cycle time is an estimate based on the time between 68K !BG goes low and Z80 !MREQ goes high
 	//      Needs a new logic analyzer capture to get the actual delay on the 68K side
-	gen->m68k->current_cycle += 8 * MCLKS_PER_68K;
+	gen->m68k->current_cycle += 8 * gen->mclks_per_68k;
 
 	location &= 0x7FFF;
 	if (context->mem_pointers[1]) {
@@ -945,7 +1032,7 @@ static void *z80_write_bank(uint32_t location, void * vcontext, uint8_t value)
 	//TODO: add cycle for an access right after a previous one
 	//TODO: Below cycle time is an estimate based on the time between 68K !BG goes low and Z80 !MREQ goes high
 	//      Needs a new logic analyzer capture to get the actual delay on the 68K side
-	gen->m68k->current_cycle += 8 * MCLKS_PER_68K;
+	gen->m68k->current_cycle += 8 * gen->mclks_per_68k;
 
 	location &= 0x7FFF;
 	uint32_t address = context->bank_reg << 15 | location;
@@ -978,8 +1065,11 @@ static void set_speed_percent(system_header * system, uint32_t percent)
 	while (context->ym->current_cycle != context->psg->cycles) {
 		sync_sound(context, context->psg->cycles + MCLKS_PER_PSG);
 	}
-	ym_adjust_master_clock(context->ym, context->master_clock);
-	psg_adjust_master_clock(context->psg, context->master_clock);
+	//the YM worker must not be producing samples while the audio buffers are rebuilt
+	ym_flush(context->ym);
+	uint32_t audio_clock = render_set_speed(percent) ? context->normal_clock : context->master_clock;
+	ym_adjust_master_clock(context->ym, audio_clock);
+	psg_adjust_master_clock(context->psg, audio_clock);
 }
 
 void set_region(genesis_context *gen, rom_info *info, uint8_t region)
@@ -1019,6 +1109,7 @@ static uint8_t load_state(system_header *system, uint8_t slot)
 	if (!gen->m68k->resume_pc) {
 		system->delayed_load_slot = slot + 1;
 		gen->m68k->should_return = 1;
+		wait_state_writes();
 		ret = get_modification_time(statepath) != 0;
 		if (!ret) {
 			strcpy(statepath + strlen(statepath)-strlen("state"), "gst");
@@ -1026,7 +1117,7 @@ static uint8_t load_state(system_header *system, uint8_t slot)
 		}
 		goto done;
 	}
-	if (load_from_file(&state, statepath)) {
+	if (load_state_file(&state, statepath)) {
 		genesis_deserialize(&state, gen);
 		free(state.data);
 		//HACK
@@ -1039,15 +1130,33 @@ static uint8_t load_state(system_header *system, uint8_t slot)
 	}
 	if (ret) {
 		gen->m68k->resume_pc = get_native_address_trans(gen->m68k, pc);
+		log_sound_state(gen);
 	}
 done:
 	free(statepath);
 	return ret;
 }
 
+void genesis_save_snapshot(genesis_context *gen, snapshot *snap, uint32_t m68k_pc)
+{
+	genesis_serialize(gen, begin_snapshot(snap), m68k_pc);
+}
+
+void genesis_load_snapshot(genesis_context *gen, snapshot *snap)
+{
+	deserialize_buffer *buf = begin_restore(snap);
+	if (!buf->handlers) {
+		register_genesis_handlers(buf, gen);
+	}
+	load_genesis_sections(buf, gen);
+	adjust_int_cycle(gen->m68k, gen->vdp);
+	//HACK, same as load_state
+	gen->m68k->resume_pc = get_native_address_trans(gen->m68k, gen->m68k->last_prefetch_address);
+}
+
 static void handle_reset_requests(genesis_context *gen)
 {
-	while (gen->reset_requested || gen->header.delayed_load_slot)
+	while (gen->reset_requested || gen->header.delayed_load_slot || gen->header.load_snapshot)
 	{
 		if (gen->reset_requested) {
 			gen->reset_requested = 0;
@@ -1055,6 +1164,7 @@ static void handle_reset_requests(genesis_context *gen)
 			z80_assert_reset(gen->z80, gen->m68k->current_cycle);
 			z80_clear_busreq(gen->z80, gen->m68k->current_cycle);
 			ym_reset(gen->ym);
+			log_sound_state(gen);
 			//Is there any sort of VDP reset?
 			m68k_reset(gen->m68k);
 		}
@@ -1063,9 +1173,16 @@ static void handle_reset_requests(genesis_context *gen)
 			gen->header.delayed_load_slot = 0;
 			resume_68k(gen->m68k);
 		}
+		if (gen->header.load_snapshot) {
+			genesis_load_snapshot(gen, gen->header.load_snapshot);
+			gen->header.load_snapshot = NULL;
+			resume_68k(gen->m68k);
+		}
 	}
 	bindings_release_capture();
 	vdp_release_framebuffer(gen->vdp);
+	//the synthesis thread may still be filling the source's buffer
+	ym_flush(gen->ym);
 	render_pause_source(gen->ym->audio);
 	render_pause_source(gen->psg->audio);
 }
@@ -1077,7 +1194,7 @@ static void start_genesis(system_header *system, char *statefile)
 		//first try loading as a native format savestate
 		deserialize_buffer state;
 		uint32_t pc;
-		if (load_from_file(&state, statefile)) {
+		if (load_state_file(&state, statefile)) {
 			genesis_deserialize(&state, gen);
 			free(state.data);
 			//HACK
@@ -1149,6 +1266,12 @@ static void persist_save(system_header *system)
 	if (gen->save_type == SAVE_NONE) {
 		return;
 	}
+	if (gen->save_mapped) {
+		//every write is already in the file, just make sure it has reached the disk
+		flush_save(gen->save_storage, gen->save_size);
+		gen->save_dirty.start = gen->save_dirty.end = 0;
+		return;
+	}
 	FILE * f = fopen(save_filename, "wb");
 	if (!f) {
 		fprintf(stderr, "Failed to open %s file %s for writing\n", save_type_name(gen->save_type), save_filename);
@@ -1159,17 +1282,46 @@ static void persist_save(system_header *system)
 	printf("Saved %s to %s\n", save_type_name(gen->save_type), save_filename);
 }
 
+//Some cartridge maps let the 68K write save RAM directly instead of through a handler
+static uint8_t has_direct_save_writes(genesis_context *gen)
+{
+	rom_info *info = &gen->header.info;
+	for (uint32_t i = 0; i < info->map_chunks; i++)
+	{
+		uint8_t *buffer = info->map[i].buffer;
+		if (
+			(info->map[i].flags & MMAP_WRITE) && !(info->map[i].flags & MMAP_PTR_IDX)
+			&& buffer >= gen->save_storage && buffer < gen->save_storage + gen->save_size
+		) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
 static void load_save(system_header *system)
 {
 	genesis_context *gen = (genesis_context *)system;
-	FILE * f = fopen(save_filename, "rb");
-	if (f) {
-		uint32_t read = fread(gen->save_storage, 1, gen->save_size, f);
-		fclose(f);
-		if (read > 0) {
-			printf("Loaded %s from %s\n", save_type_name(gen->save_type), save_filename);
+	uint32_t read = 0;
+	char *save_mmap = tern_find_path_default(config, "system\0save_mmap\0", (tern_val){.ptrval = "on"}, TVAL_PTR).ptrval;
+	if (strcmp(save_mmap, "off") && map_save_file(gen->save_storage, gen->save_size, save_filename, &read)) {
+		gen->save_mapped = 1;
+		gen->save_flush_frame = gen->last_frame_num;
+		gen->save_dirty.start = gen->save_dirty.end = 0;
+		if (has_direct_save_writes(gen)) {
+			gen->save_shadow = malloc(gen->save_size);
+			memcpy(gen->save_shadow, gen->save_storage, gen->save_size);
+		}
+	} else {
+		FILE * f = fopen(save_filename, "rb");
+		if (f) {
+			read = fread(gen->save_storage, 1, gen->save_size, f);
+			fclose(f);
 		}
 	}
+	if (read > 0) {
+		printf("Loaded %s from %s\n", save_type_name(gen->save_type), save_filename);
+	}
 }
 
 static void soft_reset(system_header *system)
@@ -1184,23 +1336,55 @@ static void soft_reset(system_header *system)
 	}
 }
 
+static void start_vgm_log(system_header *system, char *filename)
+{
+	genesis_context *gen = (genesis_context *)system;
+	if (gen->vgm) {
+		system->stop_vgm_log(system);
+	}
+	gen->vgm = vgm_write_open(filename, gen->master_clock, (gen->version_reg & HZ50) != 0);
+	if (gen->vgm) {
+		info_message("Logging sound chip writes to %s\n", filename);
+		system->vgm_logging = 1;
+		log_sound_state(gen);
+	}
+	free(filename);
+}
+
+static void stop_vgm_log(system_header *system)
+{
+	genesis_context *gen = (genesis_context *)system;
+	if (!gen->vgm) {
+		return;
+	}
+	vgm_write_close(gen->vgm, gen->ym->current_cycle);
+	gen->vgm = NULL;
+	system->vgm_logging = 0;
+}
+
 static void free_genesis(system_header *system)
 {
 	genesis_context *gen = (genesis_context *)system;
+	stop_vgm_log(system);
 	vdp_free(gen->vdp);
 	memmap_chunk *map = (memmap_chunk *)gen->m68k->options->gen.memmap;
 	m68k_options_free(gen->m68k->options);
-	free(gen->cart);
+	rom_free(gen->cart);
 	free(gen->m68k);
 	free(gen->work_ram);
+#ifndef NO_Z80
+	memmap_chunk *z80_map = (memmap_chunk *)gen->z80->options->gen.memmap;
 	z80_options_free(gen->z80->options);
+	free(z80_map);
+#endif
 	free(gen->z80);
 	free(gen->zram);
 	ym_free(gen->ym);
 	psg_free(gen->psg);
 	free(gen->header.save_dir);
+	free(gen->save_shadow);
 	free_rom_info(&gen->header.info);
-	free(gen->lock_on);
+	rom_free(gen->lock_on);
 	free(gen);
 }
 
@@ -1260,7 +1444,7 @@ static void config_updated(system_header *system)
 
 genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on, uint32_t system_opts, uint8_t force_region)
 {
-	static memmap_chunk z80_map[] = {
+	static const memmap_chunk z80_base_map[] = {
 		{ 0x0000, 0x4000,  0x1FFF, 0, 0, MMAP_READ | MMAP_WRITE | MMAP_CODE, NULL, NULL, NULL, NULL,              NULL },
 		{ 0x8000, 0x10000, 0x7FFF, 0, 0, 0,                                  NULL, NULL, NULL, z80_read_bank,     z80_write_bank},
 		{ 0x4000, 0x6000,  0x0003, 0, 0, 0,                                  NULL, NULL, NULL, z80_read_ym,       z80_write_ym},
@@ -1268,6 +1452,12 @@ genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on
 		{ 0x7F00, 0x8000,  0x00FF, 0, 0, 0,                                  NULL, NULL, NULL, z80_vdp_port_read, z80_vdp_port_write}
 	};
 	genesis_context *gen = calloc(1, sizeof(genesis_context));
+	char *m68k_divider = tern_find_path(config, "clocks\0m68k_divider\0", TVAL_PTR).ptrval;
+	gen->mclks_per_68k = m68k_divider ? atoi(m68k_divider) : 0;
+	if (!gen->mclks_per_68k) {
+		gen->mclks_per_68k = 7;
+	}
+	gen->z80_enabled = !(system_opts & OPT_NO_Z80);
 	gen->header.set_speed_percent = set_speed_percent;
 	gen->header.start_context = start_genesis;
 	gen->header.resume_context = resume_genesis;
@@ -1289,6 +1479,8 @@ genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on
 	gen->header.keyboard_down = keyboard_down;
 	gen->header.keyboard_up = keyboard_up;
 	gen->header.config_updated = config_updated;
+	gen->header.start_vgm_log = start_vgm_log;
+	gen->header.stop_vgm_log = stop_vgm_log;
 	gen->header.type = SYSTEM_GENESIS;
 	gen->header.info = *rom;
 	set_region(gen, rom, force_region);
@@ -1299,19 +1491,32 @@ genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on
 	gen->frame_end = vdp_cycles_to_frame_end(gen->vdp);
 	char * config_cycles = tern_find_path(config, "clocks\0max_cycles\0", TVAL_PTR).ptrval;
 	gen->max_cycles = config_cycles ? atoi(config_cycles) : DEFAULT_SYNC_INTERVAL;
-	gen->int_latency_prev1 = MCLKS_PER_68K * 32;
-	gen->int_latency_prev2 = MCLKS_PER_68K * 16;
+	gen->int_latency_prev1 = gen->mclks_per_68k * 32;
+	gen->int_latency_prev2 = gen->mclks_per_68k * 16;
 	
 	render_set_video_standard((gen->version_reg & HZ50) ? VID_PAL : VID_NTSC);
 	
 	gen->ym = malloc(sizeof(ym2612_context));
-	ym_init(gen->ym, gen->master_clock, MCLKS_PER_YM, system_opts);
+	uint32_t ym_opts = system_opts;
+	char *ym_thread = tern_find_path_default(config, "audio\0ym_thread\0", (tern_val){.ptrval = "on"}, TVAL_PTR).ptrval;
+	//headless runs, hash logging in particular, expect every sample on the emulation thread
+	if (!headless && !strcmp(ym_thread, "on")) {
+		ym_opts |= YM_OPT_THREAD;
+	}
+	ym_init(gen->ym, gen->master_clock, MCLKS_PER_YM, ym_opts);
 
 	gen->psg = malloc(sizeof(psg_context));
 	psg_init(gen->psg, gen->master_clock, MCLKS_PER_PSG);
+	if (system_opts & OPT_PSG_WAVE_LOG) {
+		psg_start_wave_log(gen->psg, gen->master_clock);
+	}
 
-	z80_map[0].buffer = gen->zram = calloc(1, Z80_RAM_BYTES);
+	gen->zram = calloc(1, Z80_RAM_BYTES);
 #ifndef NO_Z80
+	//every instance needs its own copy since the first chunk points at its sound RAM
+	memmap_chunk *z80_map = malloc(sizeof(z80_base_map));
+	memcpy(z80_map, z80_base_map, sizeof(z80_base_map));
+	z80_map[0].buffer = gen->zram;
 	z80_options *z_opts = malloc(sizeof(z80_options));
 	init_z80_opts(z_opts, z80_map, 5, NULL, 0, MCLKS_PER_Z80, 0xFFFF);
 	gen->z80 = init_z80_context(z_opts);
@@ -1369,8 +1574,10 @@ genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on
 		gen->num_eeprom = rom->num_eeprom;
 		if (gen->save_type == SAVE_I2C) {
 			eeprom_init(&gen->eeprom, gen->save_storage, gen->save_size);
+			gen->eeprom.dirty = &gen->save_dirty;
 		} else if (gen->save_type == SAVE_NOR) {
 			memcpy(&gen->nor, rom->nor, sizeof(gen->nor));
+			gen->nor.dirty = &gen->save_dirty;
 			//nor_flash_init(&gen->nor, gen->save_storage, gen->save_size, rom->save_page_size, rom->save_product_id, rom->save_bus);
 		}
 	} else {
@@ -1387,7 +1594,7 @@ genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on
 	}
 
 	m68k_options *opts = malloc(sizeof(m68k_options));
-	init_m68k_opts(opts, rom->map, rom->map_chunks, MCLKS_PER_68K);
+	init_m68k_opts(opts, rom->map, rom->map_chunks, gen->mclks_per_68k);
 	//TODO: make this configurable
 	opts->gen.flags |= M68K_OPT_BROKEN_READ_MODIFY;
 	gen->m68k = init_68k_context(opts, NULL);
@@ -1413,7 +1620,7 @@ genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on
 	return gen;
 }
 
-genesis_context *alloc_config_genesis(void *rom, uint32_t rom_size, void *lock_on, uint32_t lock_on_size, uint32_t ym_opts, uint8_t force_region)
+genesis_context *alloc_config_genesis(void *rom, uint32_t rom_size, uint8_t const *sha1_hash, void *lock_on, uint32_t lock_on_size, uint32_t ym_opts, uint8_t force_region)
 {
 	static memmap_chunk base_map[] = {
 		{0xE00000, 0x1000000, 0xFFFF,   0, 0, MMAP_READ | MMAP_WRITE | MMAP_CODE, NULL,
@@ -1425,11 +1632,7 @@ genesis_context *alloc_config_genesis(void *rom, uint32_t rom_size, void *lock_o
 		           (read_16_fun)io_read_w,      (write_16_fun)io_write_w,
 		           (read_8_fun)io_read,         (write_8_fun)io_write}
 	};
-	static tern_node *rom_db;
-	if (!rom_db) {
-		rom_db = load_rom_db();
-	}
-	rom_info info = configure_rom(rom_db, rom, rom_size, lock_on, lock_on_size, base_map, sizeof(base_map)/sizeof(base_map[0]));
+	rom_info info = configure_rom(get_preloaded_rom_db(), rom, rom_size, sha1_hash, lock_on, lock_on_size, base_map, sizeof(base_map)/sizeof(base_map[0]));
 	rom = info.rom;
 	rom_size = info.rom_size;
 #ifndef BLASTEM_BIG_ENDIAN
@@ -1438,13 +1641,5 @@ genesis_context *alloc_config_genesis(void *rom, uint32_t rom_size, void *lock_o
 		byteswap_rom(lock_on_size, lock_on);
 	}
 #endif
-	char *m68k_divider = tern_find_path(config, "clocks\0m68k_divider\0", TVAL_PTR).ptrval;
-	if (!m68k_divider) {
-		m68k_divider = "7";
-	}
-	MCLKS_PER_68K = atoi(m68k_divider);
-	if (!MCLKS_PER_68K) {
-		MCLKS_PER_68K = 7;
-	}
 	return alloc_init_genesis(&info, rom, lock_on, ym_opts, force_region);
 }
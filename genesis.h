@@ -13,6 +13,7 @@
 #include "ym2612.h"
 #include "vdp.h"
 #include "psg.h"
+#include "vgm.h"
 #include "io.h"
 #include "romdb.h"
 #include "arena.h"
@@ -27,12 +28,14 @@ struct genesis_context {
 	vdp_context     *vdp;
 	ym2612_context  *ym;
 	psg_context     *psg;
+	vgm_writer      *vgm;
 	uint16_t        *cart;
 	uint16_t        *lock_on;
 	uint16_t        *work_ram;
 	uint8_t         *zram;
 	void            *extra;
 	uint8_t         *save_storage;
+	uint8_t         *save_shadow; //copy of a mapped save as of the last flush, only used when writes bypass the handlers
 	void            *mapper_temp;
 	eeprom_map      *eeprom_map;
 	uint32_t        num_eeprom;
@@ -45,6 +48,12 @@ struct genesis_context {
 	uint32_t        int_latency_prev1;
 	uint32_t        int_latency_prev2;
 	uint32_t        reset_cycle;
+	uint32_t        mclks_per_68k;
+	uint32_t        last_frame_num;
+	uint32_t        save_flush_frame;
+	uint32_t        last_sync_cycle;
+	uint32_t        refresh_counter;
+	uint32_t        zram_counter;
 	uint8_t         bank_regs[8];
 	uint16_t        mapper_start_index;
 	uint8_t         mapper_type;
@@ -53,6 +62,9 @@ struct genesis_context {
 	uint8_t         version_reg;
 	uint8_t         bus_busy;
 	uint8_t         reset_requested;
+	uint8_t         z80_enabled;
+	uint8_t         save_mapped;
+	save_dirty      save_dirty;
 	eeprom_state    eeprom;
 	nor_state       nor;
 };
@@ -60,11 +72,16 @@ struct genesis_context {
 #define RAM_WORDS 32 * 1024
 #define Z80_RAM_BYTES 8 * 1024
 
-uint16_t read_dma_value(uint32_t address);
+uint16_t read_dma_value(system_header *system, uint32_t address);
 m68k_context * sync_components(m68k_context *context, uint32_t address);
-genesis_context *alloc_config_genesis(void *rom, uint32_t rom_size, void *lock_on, uint32_t lock_on_size, uint32_t system_opts, uint8_t force_region);
+genesis_context *alloc_config_genesis(void *rom, uint32_t rom_size, uint8_t const *sha1_hash, void *lock_on, uint32_t lock_on_size, uint32_t system_opts, uint8_t force_region);
 void genesis_serialize(genesis_context *gen, serialize_buffer *buf, uint32_t m68k_pc);
 void genesis_deserialize(deserialize_buffer *buf, genesis_context *gen);
+//same constraints as genesis_serialize, a snapshot is bound to the context that first restores it
+void genesis_save_snapshot(genesis_context *gen, snapshot *snap, uint32_t m68k_pc);
+//only valid while the 68K is stopped with a resume_pc, which is pointed at the restored PC,
+//so resume_68k continues from the snapshot. Use system_header.load_snapshot from inside a frame.
+void genesis_load_snapshot(genesis_context *gen, snapshot *snap);
 
 #endif //GENESIS_H_
 
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include "hashlog.h"
+#include "render.h"
+#include "bindings.h"
+#include "util.h"
+
+//FNV-1a, this only needs to catch changes, not resist collisions
+#define FNV_OFFSET 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+typedef struct {
+	uint32_t frame;
+	uint8_t  pad;
+	uint8_t  button;
+	uint8_t  down;
+} input_event;
+
+static FILE *log_file;
+static FILE *golden_file;
+static input_event *events;
+static uint32_t num_events, next_event;
+static uint32_t frame_count;
+static uint64_t video_hash = FNV_OFFSET, audio_hash = FNV_OFFSET;
+static uint8_t enabled;
+
+static uint64_t fnv1a(uint64_t hash, uint8_t *data, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+static void hash_frame(uint8_t which, void *buffer, uint32_t pitch, uint32_t width, uint32_t height)
+{
+	uint32_t line_bytes = width * (pitch / LINEBUF_SIZE);
+	uint8_t *line = buffer;
+	for (uint32_t y = 0; y < height; y++, line += pitch)
+	{
+		video_hash = fnv1a(video_hash, line, line_bytes);
+	}
+	if (render_get_pixel_format() == PIXEL_PAL8) {
+		video_hash = fnv1a(video_hash, (uint8_t *)render_get_line_cram(which), height * CRAM_SIZE * sizeof(uint16_t));
+	}
+}
+
+static void hash_sample(audio_source *src, int16_t left, int16_t right)
+{
+	int16_t samples[2] = {left, right};
+	audio_hash = fnv1a(audio_hash, (uint8_t *)samples, sizeof(samples));
+}
+
+static void load_input_script(char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		fatal_error("Failed to open input script %s for reading\n", path);
+	}
+	uint32_t storage = 16;
+	events = malloc(storage * sizeof(input_event));
+	char buf[256], target[128], state[16];
+	uint32_t line = 0;
+	while (fgets(buf, sizeof(buf), f))
+	{
+		line++;
+		char *start = buf;
+		while (isspace(*start)) {
+			start++;
+		}
+		if (!*start || *start == '#') {
+			continue;
+		}
+		input_event event;
+		if (sscanf(start, "%" SCNu32 " %127s %15s", &event.frame, target, state) != 3) {
+			fatal_error("Malformed line %d in input script %s\n", line, path);
+		}
+		if (!parse_gamepad_target(target, &event.pad, &event.button)) {
+			fatal_error("Invalid gamepad button %s on line %d of input script %s\n", target, line, path);
+		}
+		if (!strcmp(state, "down")) {
+			event.down = 1;
+		} else if (!strcmp(state, "up")) {
+			event.down = 0;
+		} else {
+			fatal_error("Button state must be up or down, got %s on line %d of input script %s\n", state, line, path);
+		}
+		if (num_events == storage) {
+			storage *= 2;
+			events = realloc(events, storage * sizeof(input_event));
+		}
+		events[num_events++] = event;
+	}
+	fclose(f);
+	//insertion sort so events on the same frame keep the order they appear in the script
+	for (uint32_t i = 1; i < num_events; i++)
+	{
+		input_event event = events[i];
+		uint32_t j;
+		for (j = i; j > 0 && events[j-1].frame > event.frame; j--)
+		{
+			events[j] = events[j-1];
+		}
+		events[j] = event;
+	}
+}
+
+void hashlog_init(char *log_path, char *golden_path, char *input_path)
+{
+	if (log_path) {
+		log_file = fopen(log_path, "w");
+		if (!log_file) {
+			fatal_error("Failed to open hash log %s for writing\n", log_path);
+		}
+	}
+	if (golden_path) {
+		golden_file = fopen(golden_path, "r");
+		if (!golden_file) {
+			fatal_error("Failed to open golden hash log %s for reading\n", golden_path);
+		}
+	}
+	if (input_path) {
+		load_input_script(input_path);
+	}
+	enabled = 1;
+	render_set_frame_handler(hash_frame);
+	render_set_sample_handler(hash_sample);
+}
+
+uint8_t hashlog_enabled(void)
+{
+	return enabled;
+}
+
+static void compare_golden(uint32_t cycle)
+{
+	char buf[128];
+	uint32_t gframe, gcycle;
+	uint64_t gvideo, gaudio;
+	if (!fgets(buf, sizeof(buf), golden_file)) {
+		warning("Golden hash log ended at frame %d, no longer comparing\n", frame_count);
+		fclose(golden_file);
+		golden_file = NULL;
+		return;
+	}
+	if (sscanf(buf, "%" SCNu32 " %" SCNu32 " %" SCNx64 " %" SCNx64, &gframe, &gcycle, &gvideo, &gaudio) != 4) {
+		fatal_error("Malformed golden hash log entry for frame %d\n", frame_count);
+	}
+	char *what = NULL;
+	if (gframe != frame_count) {
+		what = "frame number";
+	} else if (gvideo != video_hash) {
+		what = "video hash";
+	} else if (gaudio != audio_hash) {
+		what = "audio hash";
+	} else if (gcycle != cycle) {
+		what = "cycle count";
+	}
+	if (what) {
+		if (log_file) {
+			fclose(log_file);
+		}
+		fatal_error(
+			"Divergence from golden log in %s at frame %d, cycle %d\n"
+			"expected: %d %d %016" PRIx64 " %016" PRIx64 "\n"
+			"got:      %d %d %016" PRIx64 " %016" PRIx64 "\n",
+			what, frame_count, cycle,
+			gframe, gcycle, gvideo, gaudio,
+			frame_count, cycle, video_hash, audio_hash
+		);
+	}
+}
+
+void hashlog_frame_end(system_header *system, uint32_t cycle)
+{
+	frame_count++;
+	if (log_file) {
+		fprintf(log_file, "%d %d %016" PRIx64 " %016" PRIx64 "\n", frame_count, cycle, video_hash, audio_hash);
+	}
+	if (golden_file) {
+		compare_golden(cycle);
+	}
+	video_hash = audio_hash = FNV_OFFSET;
+	for (; next_event < num_events && events[next_event].frame <= frame_count; next_event++)
+	{
+		input_event *event = events + next_event;
+		if (event->down) {
+			if (system->gamepad_down) {
+				system->gamepad_down(system, event->pad, event->button);
+			}
+		} else if (system->gamepad_up) {
+			system->gamepad_up(system, event->pad, event->button);
+		}
+	}
+}
@@ -0,0 +1,14 @@
+#ifndef HASHLOG_H_
+#define HASHLOG_H_
+
+#include <stdint.h>
+#include "system.h"
+
+//Per-frame video/audio hash log for deterministic headless regression runs
+//Any of the paths can be NULL. Must be called before the system context is created
+void hashlog_init(char *log_path, char *golden_path, char *input_path);
+uint8_t hashlog_enabled(void);
+//Called once per emulated frame, writes/compares the log and applies scripted input for the next frame
+void hashlog_frame_end(system_header *system, uint32_t cycle);
+
+#endif //HASHLOG_H_
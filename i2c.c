@@ -34,6 +34,7 @@ void eeprom_init(eeprom_state *state, uint8_t *buffer, uint32_t size)
 	state->slave_sda = 1;
 	state->host_sda = state->scl = 0;
 	state->buffer = buffer;
+	state->dirty = NULL;
 	state->size = size;
 	state->state = I2C_IDLE;
 }
@@ -83,6 +84,7 @@ void set_scl(eeprom_state *state, uint8_t val)
 					break;
 				case I2C_WRITE:
 					state->buffer[state->address] = state->latch;
+					mark_save_dirty(state->dirty, state->address, 1);
 					state->state = I2C_WRITE_ACK;
 					break;
 				}
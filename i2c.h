@@ -3,6 +3,7 @@
 
 typedef struct {
 	char        *buffer;
+	struct save_dirty *dirty;
 	uint32_t    size;
 	uint16_t    address;
 	uint8_t     host_sda;
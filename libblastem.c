@@ -0,0 +1,217 @@
+/*
+ Copyright 2013-2016 Michael Pavone
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "libblastem.h"
+#include "blastem.h"
+#include "config.h"
+#include "romload.h"
+#include "util.h"
+
+//process wide state the core expects from the frontend
+int headless = 1;
+tern_node *config;
+//only touched by the UI which the library never starts
+system_header *current_system;
+char *save_filename;
+uint8_t use_native_states = 1;
+
+void reload_media(void)
+{
+}
+
+void lockon_media(char *lock_on_path)
+{
+}
+
+void init_system_with_media(const char *path, system_type force_stype)
+{
+}
+
+void apply_updated_config(void)
+{
+}
+
+struct blastem_instance {
+	system_media       media;
+	SDL_Thread         *thread;
+	system_header      *system;
+	blastem_frame_fun  frame;
+	blastem_sample_fun sample;
+	void               *data;
+	SDL_atomic_t       stop_requested;
+	SDL_SpinLock       system_lock;
+	uint32_t           frames;
+	uint32_t           opts;
+	uint8_t            region;
+	uint8_t            ran;
+};
+
+//context allocation fills lazily initialized lookup tables shared by every instance,
+//so only one instance may be created at a time
+static SDL_SpinLock create_spin;
+static SDL_mutex *create_lock;
+static THREAD_LOCAL blastem_instance *running;
+
+static void frame_dispatch(uint8_t which, void *buffer, uint32_t pitch, uint32_t width, uint32_t height)
+{
+	if (!running || !running->frame) {
+		return;
+	}
+	//the partial frame flushed when the system stops isn't one of the frames that was asked for
+	if (SDL_AtomicGet(&running->stop_requested) || (running->system && running->system->should_exit)) {
+		return;
+	}
+	running->frame(running, buffer, pitch, width, height);
+}
+
+static void sample_dispatch(audio_source *src, int16_t left, int16_t right)
+{
+	if (running && running->sample) {
+		running->sample(running, src, left, right);
+	}
+}
+
+static int instance_main(void *data)
+{
+	blastem_instance *inst = data;
+	running = inst;
+	system_header *system = NULL;
+	SDL_LockMutex(create_lock);
+		system_type stype = detect_system_type(&inst->media);
+		if (stype != SYSTEM_UNKNOWN) {
+			//the system takes ownership of the ROM buffer from here on
+			system = alloc_config_system(stype, &inst->media, inst->opts, inst->region);
+		}
+	SDL_UnlockMutex(create_lock);
+	if (!system) {
+		warning("Failed to configure emulated machine for %s\n", inst->media.name);
+		if (stype == SYSTEM_UNKNOWN) {
+			rom_free(inst->media.buffer);
+		}
+		return 0;
+	}
+	system->exit_after = inst->frames;
+	//blastem_stop either sees the published system or its request is seen here
+	SDL_AtomicLock(&inst->system_lock);
+		inst->system = system;
+		uint8_t stop = SDL_AtomicGet(&inst->stop_requested);
+	SDL_AtomicUnlock(&inst->system_lock);
+	if (!stop) {
+		system->start_context(system, NULL);
+		while (!system->should_exit && !SDL_AtomicGet(&inst->stop_requested))
+		{
+			system->resume_context(system);
+		}
+	}
+	inst->ran = 1;
+	SDL_AtomicLock(&inst->system_lock);
+		inst->system = NULL;
+	SDL_AtomicUnlock(&inst->system_lock);
+	system->free_context(system);
+	render_free_headless_buffers();
+	return 0;
+}
+
+blastem_instance *blastem_start_buffer(void *rom, uint32_t rom_size, const char *name, blastem_params *params)
+{
+	SDL_AtomicLock(&create_spin);
+		if (!create_lock) {
+			create_lock = SDL_CreateMutex();
+		}
+	SDL_AtomicUnlock(&create_spin);
+	SDL_LockMutex(create_lock);
+		if (!config) {
+			config = load_config();
+		}
+		if (params->frame) {
+			render_set_frame_handler(frame_dispatch);
+		}
+		if (params->sample) {
+			render_set_sample_handler(sample_dispatch);
+		}
+		//settles the pixel format before any instance thread reads it
+		render_get_pixel_format();
+	SDL_UnlockMutex(create_lock);
+
+	blastem_instance *inst = calloc(1, sizeof(blastem_instance));
+	inst->media.buffer = rom;
+	inst->media.size = rom_size;
+	inst->media.name = strdup(name);
+	inst->frame = params->frame;
+	inst->sample = params->sample;
+	inst->data = params->data;
+	inst->frames = params->frames;
+	inst->opts = params->opts;
+	inst->region = params->region;
+	inst->thread = SDL_CreateThread(instance_main, "blastem", inst);
+	if (!inst->thread) {
+		warning("Failed to start emulation thread: %s\n", SDL_GetError());
+		free(inst->media.name);
+		free(inst);
+		return NULL;
+	}
+	return inst;
+}
+
+blastem_instance *blastem_start(const char *rom_path, blastem_params *params)
+{
+	void *rom;
+	uint32_t rom_size = load_rom(rom_path, &rom, NULL);
+	if (!rom_size) {
+		warning("Failed to open %s for reading\n", rom_path);
+		return NULL;
+	}
+	char *name = basename_no_extension(rom_path);
+	blastem_instance *inst = blastem_start_buffer(rom, rom_size, name, params);
+	free(name);
+	if (!inst) {
+		rom_free(rom);
+	}
+	return inst;
+}
+
+void *blastem_data(blastem_instance *inst)
+{
+	return inst->data;
+}
+
+void blastem_stop(blastem_instance *inst)
+{
+	SDL_AtomicSet(&inst->stop_requested, 1);
+	SDL_AtomicLock(&inst->system_lock);
+		if (inst->system) {
+			inst->system->request_exit(inst->system);
+		}
+	SDL_AtomicUnlock(&inst->system_lock);
+}
+
+uint8_t blastem_save_snapshot(blastem_instance *inst, snapshot *snap)
+{
+	if (inst->system->type != SYSTEM_GENESIS) {
+		return 0;
+	}
+	inst->system->save_snapshot = snap;
+	return 1;
+}
+
+uint8_t blastem_load_snapshot(blastem_instance *inst, snapshot *snap)
+{
+	if (inst->system->type != SYSTEM_GENESIS) {
+		return 0;
+	}
+	inst->system->load_snapshot = snap;
+	return 1;
+}
+
+uint8_t blastem_wait(blastem_instance *inst)
+{
+	SDL_WaitThread(inst->thread, NULL);
+	uint8_t ran = inst->ran;
+	free(inst->media.name);
+	free(inst);
+	return ran;
+}
@@ -0,0 +1,42 @@
+#ifndef LIBBLASTEM_H_
+#define LIBBLASTEM_H_
+
+#include <stdint.h>
+#include "system.h"
+#include "render.h"
+
+//Headless embedding API. Each instance runs on its own thread and shares nothing but
+//read-only tables and configuration with the others, so many ROMs can run in one process.
+typedef struct blastem_instance blastem_instance;
+
+//both callbacks are invoked on the instance's own thread
+//buffer is in the format returned by render_get_pixel_format
+typedef void (*blastem_frame_fun)(blastem_instance *inst, void *buffer, uint32_t pitch, uint32_t width, uint32_t height);
+//receives each chip's output at its native rate, src tells the chips apart
+typedef void (*blastem_sample_fun)(blastem_instance *inst, audio_source *src, int16_t left, int16_t right);
+
+typedef struct {
+	blastem_frame_fun  frame;  //frames are only rendered once any instance has asked for them
+	blastem_sample_fun sample;
+	void               *data;
+	uint32_t           frames; //Genesis frames to run before stopping, 0 runs until blastem_stop
+	uint32_t           opts;   //OPT_* flags from system.h
+	uint8_t            region; //0 for auto-detect, otherwise a REGION_* value from romdb.h
+} blastem_params;
+
+//loads the ROM on the calling thread and starts emulating it on a new one, returns NULL on failure
+blastem_instance *blastem_start(const char *rom_path, blastem_params *params);
+//same as blastem_start but takes ownership of a ROM image already in memory, which must be allocated with malloc
+blastem_instance *blastem_start_buffer(void *rom, uint32_t rom_size, const char *name, blastem_params *params);
+void *blastem_data(blastem_instance *inst);
+//asks a running instance to stop at its next sync point, safe to call from any thread
+void blastem_stop(blastem_instance *inst);
+//only callable from the instance's frame callback, the save or restore happens at the next point
+//the machine can be captured, a save requested along with a restore sees the state from before it
+//returns 0 if the emulated system has no snapshot support
+uint8_t blastem_save_snapshot(blastem_instance *inst, snapshot *snap);
+uint8_t blastem_load_snapshot(blastem_instance *inst, snapshot *snap);
+//waits for the instance's thread to finish and frees it, returns 0 if the ROM could not be run
+uint8_t blastem_wait(blastem_instance *inst);
+
+#endif //LIBBLASTEM_H_
@@ -10,6 +10,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
+#include <SDL.h>
 
 #include "mem.h"
 #include "arena.h"
@@ -26,6 +27,8 @@ void * alloc_code(size_t *size)
 	//start at the 1GB mark to allow plenty of room for sbrk based malloc implementations
 	//while still keeping well within 32-bit displacement range for calling code compiled into the executable
 	static uint8_t *next = (uint8_t *)0x40000000;
+	//every instance's translator allocates from here
+	static SDL_SpinLock next_lock;
 	uint8_t *ret = try_alloc_arena();
 	if (ret) {
 		return ret;
@@ -33,13 +36,17 @@ void * alloc_code(size_t *size)
 	if (*size & (PAGE_SIZE -1)) {
 		*size += PAGE_SIZE - (*size & (PAGE_SIZE - 1));
 	}
-	ret = mmap(next, *size, PROT_EXEC | PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	SDL_AtomicLock(&next_lock);
+		ret = mmap(next, *size, PROT_EXEC | PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+		if (ret != MAP_FAILED) {
+			next = ret + *size;
+		}
+	SDL_AtomicUnlock(&next_lock);
 	if (ret == MAP_FAILED) {
 		perror("alloc_code");
 		return NULL;
 	}
 	track_block(ret);
-	next = ret + *size;
 	return ret;
 }
 
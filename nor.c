@@ -22,6 +22,7 @@ enum {
 void nor_flash_init(nor_state *state, uint8_t *buffer, uint32_t size, uint32_t page_size, uint16_t product_id, uint8_t bus_flags)
 {
 	state->buffer = buffer;
+	state->dirty = NULL;
 	state->page_buffer = malloc(page_size);
 	memset(state->page_buffer, 0xFF, page_size);
 	state->size = size;
@@ -46,6 +47,7 @@ void nor_run(nor_state *state, m68k_context *m68k, uint32_t cycle)
 		for (uint32_t i = 0; i < state->page_size; i++) {
 			state->buffer[state->current_page + i] = state->page_buffer[i];
 		}
+		mark_save_dirty(state->dirty, state->current_page, state->page_size);
 		memset(state->page_buffer, 0xFF, state->page_size);
 		if (state->bus_flags == RAM_FLAG_BOTH) {
 			//TODO: add base address of NOR device to start and end addresses
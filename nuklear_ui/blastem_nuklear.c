@@ -15,6 +15,9 @@
 #include "../io.h"
 #include "../png.h"
 #include "../controller_info.h"
+#include "../zip.h"
+#include "../romcache.h"
+#include "../startup.h"
 
 static struct nk_context *context;
 
@@ -53,6 +56,62 @@ void view_play(struct nk_context *context)
 	
 }
 
+static uint8_t is_zip(char *path)
+{
+	char *ext = path_extension(path);
+	uint8_t ret = ext && !strcasecmp(ext, "zip");
+	free(ext);
+	return ret;
+}
+
+//lists the members of an archive from its central directory, nothing is decompressed
+static dir_entry *get_zip_list(char *path, size_t *num_entries)
+{
+	zip_file *z = zip_open(path);
+	if (!z) {
+		return NULL;
+	}
+	dir_entry *entries = calloc(z->num_entries + 1, sizeof(dir_entry));
+	entries[0].name = strdup("..");
+	entries[0].is_dir = 1;
+	size_t num = 1;
+	for (uint32_t i = 0; i < z->num_entries; i++)
+	{
+		char *name = z->entries[i].name;
+		if (!*name || name[strlen(name) - 1] == '/') {
+			//directory entries carry no data
+			continue;
+		}
+		entries[num].name = strdup(name);
+		entries[num++].is_dir = 0;
+	}
+	zip_close(z);
+	*num_entries = num;
+	return entries;
+}
+
+//archives holding more than one ROM are browsed like a directory
+static uint8_t browse_into_zip(char *path, char **ext_list, uint32_t num_exts)
+{
+	if (!is_zip(path)) {
+		return 0;
+	}
+	size_t num_entries;
+	dir_entry *entries = get_zip_list(path, &num_entries);
+	if (!entries) {
+		return 0;
+	}
+	uint32_t roms = 0;
+	for (size_t i = 1; i < num_entries; i++)
+	{
+		if (!num_exts || path_matches_extensions(entries[i].name, ext_list, num_exts)) {
+			roms++;
+		}
+	}
+	free_dir_list(entries, num_entries);
+	return roms > 1;
+}
+
 void view_file_browser(struct nk_context *context, uint8_t normal_open)
 {
 	static char *current_path;
@@ -62,19 +121,24 @@ void view_file_browser(struct nk_context *context, uint8_t normal_open)
 	static char **ext_list;
 	static uint32_t num_exts;
 	static uint8_t got_ext_list;
+	static rom_scan *scan;
 	if (!current_path) {
 		get_initial_browse_path(&current_path);
 	}
+	if (!got_ext_list) {
+		ext_list = get_extension_list(config, &num_exts);
+		got_ext_list = 1;
+	}
 	if (!entries) {
-		entries = get_dir_list(current_path, &num_entries);
+		uint8_t zip = is_zip(current_path);
+		entries = zip ? get_zip_list(current_path, &num_entries) : get_dir_list(current_path, &num_entries);
 		if (entries) {
 			sort_dir_list(entries, num_entries);
+			if (!zip) {
+				scan = romcache_scan(current_path, entries, num_entries, ext_list, num_exts);
+			}
 		}
 	}
-	if (!got_ext_list) {
-		ext_list = get_extension_list(config, &num_exts);
-		got_ext_list = 1;
-	}
 	uint32_t width = render_width();
 	uint32_t height = render_height();
 	if (nk_begin(context, "Load ROM", nk_rect(0, 0, width, height), 0)) {
@@ -91,7 +155,8 @@ void view_file_browser(struct nk_context *context, uint8_t normal_open)
 					continue;
 				}
 				int selected = i == selected_entry;
-				nk_selectable_label(context, entries[i].name, NK_TEXT_ALIGN_LEFT, &selected);
+				rom_metadata *meta = scan ? romcache_get(scan, i) : NULL;
+				nk_selectable_label(context, meta ? meta->title : entries[i].name, NK_TEXT_ALIGN_LEFT, &selected);
 				if (selected) {
 					selected_entry = i;
 				} else if (i == selected_entry) {
@@ -101,7 +166,8 @@ void view_file_browser(struct nk_context *context, uint8_t normal_open)
 			nk_group_end(context);
 		}
 		nk_layout_row_static(context, context->style.font->height * 1.75, width > 600 ? 300 : width / 2, 2);
-		if (nk_button_label(context, "Back")) {
+		uint8_t leaving = nk_button_label(context, "Back");
+		if (leaving) {
 			pop_view();
 		}
 		if (nk_button_label(context, "Open") || (old_selected >= 0 && selected_entry < 0)) {
@@ -109,11 +175,18 @@ void view_file_browser(struct nk_context *context, uint8_t normal_open)
 				selected_entry = old_selected;
 			}
 			char *full_path = path_append(current_path, entries[selected_entry].name);
-			if (entries[selected_entry].is_dir) {
+			uint8_t is_dir = entries[selected_entry].is_dir;
+			//stop scanning before a ROM is loaded so the scanner doesn't compete with it,
+			//the listing is rebuilt from the cache the next time the browser is shown
+			if (scan) {
+				romcache_end_scan(scan);
+				scan = NULL;
+			}
+			free_dir_list(entries, num_entries);
+			entries = NULL;
+			if (is_dir || browse_into_zip(full_path, ext_list, num_exts)) {
 				free(current_path);
 				current_path = full_path;
-				free_dir_list(entries, num_entries);
-				entries = NULL;
 			} else {
 				if(normal_open) {
 					if (current_system) {
@@ -132,6 +205,14 @@ void view_file_browser(struct nk_context *context, uint8_t normal_open)
 			}
 			selected_entry = -1;
 		}
+		if (leaving && entries) {
+			if (scan) {
+				romcache_end_scan(scan);
+				scan = NULL;
+			}
+			free_dir_list(entries, num_entries);
+			entries = NULL;
+		}
 		nk_end(context);
 	}
 }
@@ -1052,8 +1133,14 @@ void view_menu(struct nk_context *context)
 	}
 }
 
+static uint8_t textures_ready;
+static void texture_init(void);
 void blastem_nuklear_render(void)
 {
+	//baking the font atlas is a noticeable chunk of startup, so wait until there's UI to draw
+	if (!textures_ready && current_view != view_play) {
+		texture_init();
+	}
 	nk_input_end(context);
 	current_view(context);
 	nk_sdl_render(NK_ANTI_ALIASING_ON, 512 * 1024, 128 * 1024);
@@ -1096,6 +1183,15 @@ static uint32_t *controller_360_buf;
 
 static void texture_init(void)
 {
+	if (!controller_360_buf) {
+		uint32_t buf_size;
+		uint8_t *buf = (uint8_t *)read_bundled_file("images/360.png", &buf_size);
+		if (buf) {
+			controller_360_buf = load_png(buf, buf_size, &controller_360_width, &controller_360_height);
+			free(buf);
+		}
+	}
+	textures_ready = 1;
 	struct nk_font_atlas *atlas;
 	nk_sdl_font_stash_begin(&atlas);
 	uint32_t font_size;
@@ -1123,7 +1219,9 @@ static void texture_init(void)
 static void context_created(void)
 {
 	context = nk_sdl_init(render_get_window());
-	texture_init();
+	if (textures_ready) {
+		texture_init();
+	}
 }
 
 void show_pause_menu(void)
@@ -1169,14 +1267,6 @@ void blastem_nuklear_init(uint8_t file_loaded)
 {
 	context = nk_sdl_init(render_get_window());
 	
-	uint32_t buf_size;
-	uint8_t *buf = (uint8_t *)read_bundled_file("images/360.png", &buf_size);
-	if (buf) {
-		controller_360_buf = load_png(buf, buf_size, &controller_360_width, &controller_360_height);
-		free(buf);
-	}	
-	texture_init();
-	
 	current_view = file_loaded ? view_play : view_menu;
 	render_set_ui_render_fun(blastem_nuklear_render);
 	render_set_event_handler(handle_event);
@@ -1185,5 +1275,6 @@ void blastem_nuklear_init(uint8_t file_loaded)
 	atexit(persist_config_exit);
 	
 	active = 1;
+	startup_phase("UI init");
 	ui_idle_loop();
 }
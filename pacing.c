@@ -0,0 +1,156 @@
+#include <math.h>
+#ifdef _WIN32
+#include "SDL.h"
+#else
+#include <errno.h>
+#include <time.h>
+#endif
+#include "pacing.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+#define STATS_INTERVAL NSEC_PER_SEC
+//if we fall this many periods behind, stop trying to catch up and start over from now
+#define MAX_FRAMES_BEHIND 4
+
+static uint64_t period, next_deadline;
+static uint64_t last_frame, window_start;
+static uint32_t window_frames, window_presents, window_late, window_audio;
+static double   window_sum, window_sum_sq;
+static uint64_t window_min, window_max;
+static frame_stats stats;
+
+uint64_t pacing_now_ns(void)
+{
+#ifdef _WIN32
+	static uint64_t freq;
+	if (!freq) {
+		freq = SDL_GetPerformanceFrequency();
+	}
+	uint64_t count = SDL_GetPerformanceCounter();
+	return (count / freq) * NSEC_PER_SEC + (count % freq) * NSEC_PER_SEC / freq;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+#endif
+}
+
+void pacing_sleep_until(uint64_t deadline)
+{
+#if defined(_WIN32)
+	uint64_t now = pacing_now_ns();
+	if (deadline > now) {
+		//SDL_Delay only has millisecond resolution, round down so we wake up early rather than late
+		SDL_Delay((deadline - now) / 1000000);
+	}
+#elif defined(__APPLE__)
+	//no clock_nanosleep here, so recompute the relative delay from the deadline after each interruption
+	for (;;)
+	{
+		uint64_t now = pacing_now_ns();
+		if (now >= deadline) {
+			break;
+		}
+		struct timespec delay = {
+			.tv_sec = (deadline - now) / NSEC_PER_SEC,
+			.tv_nsec = (deadline - now) % NSEC_PER_SEC
+		};
+		if (!nanosleep(&delay, NULL)) {
+			break;
+		}
+	}
+#else
+	struct timespec ts = {
+		.tv_sec = deadline / NSEC_PER_SEC,
+		.tv_nsec = deadline % NSEC_PER_SEC
+	};
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+	{
+	}
+#endif
+}
+
+void pacing_set_rate(uint32_t frames_per_second)
+{
+	period = NSEC_PER_SEC / frames_per_second;
+	next_deadline = 0;
+}
+
+void pacing_wait_frame(void)
+{
+	uint64_t now = pacing_now_ns();
+	if (!next_deadline || now > next_deadline + MAX_FRAMES_BEHIND * period) {
+		next_deadline = now;
+	} else {
+		pacing_sleep_until(next_deadline);
+	}
+	next_deadline += period;
+}
+
+static void publish_stats(uint64_t now)
+{
+	float elapsed = (float)(now - window_start) / (float)NSEC_PER_SEC;
+	stats.fps = window_frames / elapsed;
+	stats.display_hz = window_presents / elapsed;
+	stats.audio_hz = window_audio / elapsed;
+	stats.late_frames = window_late;
+	if (window_frames) {
+		double mean = window_sum / window_frames;
+		double variance = window_sum_sq / window_frames - mean * mean;
+		stats.avg_ms = mean / 1000000.0;
+		stats.jitter_ms = variance > 0 ? sqrt(variance) / 1000000.0 : 0.0f;
+		stats.min_ms = window_min / 1000000.0;
+		stats.max_ms = window_max / 1000000.0;
+	} else {
+		stats.avg_ms = stats.jitter_ms = stats.min_ms = stats.max_ms = 0.0f;
+	}
+	window_start = now;
+	window_frames = window_presents = window_late = window_audio = 0;
+	window_sum = window_sum_sq = 0.0;
+	window_min = UINT64_MAX;
+	window_max = 0;
+}
+
+uint8_t pacing_frame_done(void)
+{
+	uint64_t now = pacing_now_ns();
+	if (!last_frame) {
+		last_frame = window_start = now;
+		window_min = UINT64_MAX;
+		return 0;
+	}
+	uint64_t frame_time = now - last_frame;
+	last_frame = now;
+	window_frames++;
+	window_sum += frame_time;
+	window_sum_sq += (double)frame_time * frame_time;
+	if (frame_time < window_min) {
+		window_min = frame_time;
+	}
+	if (frame_time > window_max) {
+		window_max = frame_time;
+	}
+	if (period && frame_time > period + period / 2) {
+		window_late++;
+	}
+	if (now - window_start >= STATS_INTERVAL) {
+		publish_stats(now);
+		return 1;
+	}
+	return 0;
+}
+
+void pacing_display_presented(void)
+{
+	window_presents++;
+}
+
+void pacing_audio_consumed(uint32_t sample_frames)
+{
+	window_audio += sample_frames;
+}
+
+void pacing_get_stats(frame_stats *out)
+{
+	*out = stats;
+}
@@ -0,0 +1,31 @@
+#ifndef PACING_H_
+#define PACING_H_
+
+#include <stdint.h>
+
+typedef struct {
+	float    fps;
+	float    avg_ms;
+	float    min_ms;
+	float    max_ms;
+	float    jitter_ms;   //standard deviation of frame times
+	float    display_hz;  //measured rate frames are presented to the display
+	float    audio_hz;    //measured rate the audio device consumes samples
+	uint32_t late_frames; //frames that missed their deadline by more than half a period
+} frame_stats;
+
+//Monotonic time in nanoseconds
+uint64_t pacing_now_ns(void);
+//Sleeps until the monotonic clock reaches deadline without spinning
+void pacing_sleep_until(uint64_t deadline);
+void pacing_set_rate(uint32_t frames_per_second);
+//Waits for the absolute deadline of the next frame, deadlines advance by exactly one period
+//so oversleeping on one frame is made up on the next instead of accumulating
+void pacing_wait_frame(void);
+//Records the end of an emulated frame, returns 1 when a new set of statistics is available
+uint8_t pacing_frame_done(void);
+void pacing_display_presented(void);
+void pacing_audio_consumed(uint32_t sample_frames);
+void pacing_get_stats(frame_stats *stats);
+
+#endif //PACING_H_
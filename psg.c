@@ -20,12 +20,52 @@ void psg_init(psg_context * context, uint32_t master_clock, uint32_t clock_div)
 	}
 }
 
+static psg_context *log_context;
+
+static void psg_finalize_log(void)
+{
+	if (!log_context) {
+		return;
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		if (log_context->channel_logs[i]) {
+			wave_log_close(log_context->channel_logs[i]);
+			log_context->channel_logs[i] = NULL;
+		}
+	}
+	log_context->wave_logging = 0;
+	log_context = NULL;
+}
+
 void psg_free(psg_context *context)
 {
 	render_free_source(context->audio);
+	if (context == log_context) {
+		psg_finalize_log();
+	}
 	free(context);
 }
 
+//logs each tone channel and the noise channel to psg_channel_N.wav at the native PSG rate
+void psg_start_wave_log(psg_context *context, uint32_t master_clock)
+{
+	static uint8_t registered_finalize;
+	psg_finalize_log();
+	for (int i = 0; i < 4; i++)
+	{
+		char fname[64];
+		sprintf(fname, "psg_channel_%d.wav", i);
+		context->channel_logs[i] = wave_log_open(fname, master_clock / context->clock_inc, 1);
+		context->wave_logging |= context->channel_logs[i] != NULL;
+	}
+	log_context = context;
+	if (!registered_finalize) {
+		atexit(psg_finalize_log);
+		registered_finalize = 1;
+	}
+}
+
 void psg_adjust_master_clock(psg_context * context, uint32_t master_clock)
 {
 	render_audio_adjust_clock(context->audio, master_clock, context->clock_inc);
@@ -83,9 +123,56 @@ static int16_t volume_table[16] = {
 	2067/PSG_VOL_DIV, 1642/PSG_VOL_DIV, 1304/PSG_VOL_DIV, 0
 };
 
+static int16_t psg_output(psg_context *context)
+{
+	int16_t accum = 0;
+	
+	for (int i = 0; i < 3; i++) {
+		if (context->output_state[i]) {
+			accum += volume_table[context->volume[i]];
+		}
+	}
+	if (context->noise_out) {
+		accum += volume_table[context->volume[3]];
+	}
+	return accum;
+}
+
+static void psg_log_channels(psg_context *context, uint32_t count)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		if (context->channel_logs[i]) {
+			uint8_t on = i < 3 ? context->output_state[i] : context->noise_out;
+			wave_log_run(context->channel_logs[i], on ? volume_table[context->volume[i]] : 0, count);
+		}
+	}
+}
+
 void psg_run(psg_context * context, uint32_t cycles)
 {
 	while (context->cycles < cycles) {
+		//output can only change when a counter expires, so skip straight to the next expiry
+		//and emit the constant stretch before it as a single run
+		uint32_t ticks = (cycles - context->cycles + context->clock_inc - 1) / context->clock_inc;
+		for (int i = 0; i < 4; i++) {
+			uint32_t expire = context->counters[i] ? context->counters[i] : 1;
+			if (expire < ticks) {
+				ticks = expire;
+			}
+		}
+		if (ticks > 1) {
+			uint32_t skip = ticks - 1;
+			for (int i = 0; i < 4; i++) {
+				context->counters[i] -= skip;
+			}
+			render_put_mono_samples(context->audio, psg_output(context), skip);
+			if (context->wave_logging) {
+				psg_log_channels(context, skip);
+			}
+			context->cycles += skip * context->clock_inc;
+		}
+		
 		for (int i = 0; i < 4; i++) {
 			if (context->counters[i]) {
 				context->counters[i] -= 1;
@@ -105,19 +192,11 @@ void psg_run(psg_context * context, uint32_t cycles)
 				}
 			}
 		}
-
-		int16_t accum = 0;
 		
-		for (int i = 0; i < 3; i++) {
-			if (context->output_state[i]) {
-				accum += volume_table[context->volume[i]];
-			}
+		render_put_mono_sample(context->audio, psg_output(context));
+		if (context->wave_logging) {
+			psg_log_channels(context, 1);
 		}
-		if (context->noise_out) {
-			accum += volume_table[context->volume[3]];
-		}
-		
-		render_put_mono_sample(context->audio, accum);
 
 		context->cycles += context->clock_inc;
 	}
@@ -9,9 +9,11 @@
 #include <stdint.h>
 #include "serialize.h"
 #include "render.h"
+#include "wavelog.h"
 
 typedef struct {
 	audio_source *audio;
+	wave_log *channel_logs[4];
 	uint32_t clock_inc;
 	uint32_t cycles;
 	uint16_t lsfr;
@@ -23,11 +25,13 @@ typedef struct {
 	uint8_t  noise_use_tone;
 	uint8_t  noise_type;
 	uint8_t  latch;
+	uint8_t  wave_logging;
 } psg_context;
 
 
 void psg_init(psg_context * context, uint32_t master_clock, uint32_t clock_div);
 void psg_free(psg_context *context);
+void psg_start_wave_log(psg_context *context, uint32_t master_clock);
 void psg_adjust_master_clock(psg_context * context, uint32_t master_clock);
 void psg_write(psg_context * context, uint8_t value);
 void psg_run(psg_context * context, uint32_t cycles);
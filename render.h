@@ -70,6 +70,7 @@
 #define FRAMEBUFFER_EVEN 1
 
 #include "vdp.h"
+#include "pacing.h"
 
 typedef enum {
 	VID_NTSC,
@@ -77,6 +78,13 @@ typedef enum {
 	NUM_VID_STD
 } vid_std;
 
+typedef enum {
+	PIXEL_ARGB8888,
+	PIXEL_RGB565,
+	PIXEL_PAL8,
+	NUM_PIXEL_FORMATS
+} pixel_format;
+
 #define RENDER_DPAD_BIT 0x40000000
 #define RENDER_AXIS_BIT 0x20000000
 #define RENDER_INVALID_NAME -1
@@ -85,11 +93,45 @@ typedef enum {
 
 typedef struct audio_source audio_source;
 typedef void (*drop_handler)(const char *filename);
+//receives completed frames when running without a window, buffer is in the format returned by render_get_pixel_format
+typedef void (*frame_handler)(uint8_t which, void *buffer, uint32_t pitch, uint32_t width, uint32_t height);
+//receives every sample passed to an audio source at its native rate, before filtering and resampling
+typedef void (*sample_handler)(audio_source *src, int16_t left, int16_t right);
+
+//all frame counts are stereo sample frames at the output rate
+typedef struct {
+	uint32_t buffered;        //frames waiting to be mixed when the stats were collected
+	uint32_t avg_buffered;    //average frames left after each audio callback
+	uint32_t min_buffered;    //fewest frames left after an audio callback
+	uint32_t capacity;
+	uint32_t underruns;       //callbacks that ran out of samples from this source
+	uint32_t underrun_frames; //frames that had to be filled with silence
+	float    rate_adjust;     //current dynamic rate control correction as a fraction of the nominal rate
+} audio_source_stats;
+
+//Audio telemetry, collected over roughly one second windows
+typedef struct {
+	audio_source_stats sources[8];
+	uint8_t  num_sources;
+	uint32_t output_underruns; //callbacks where the device received any silence padding
+	uint32_t callbacks;
+	float    callback_avg_us;
+	float    callback_max_us;
+	float    buffer_trend;     //smoothed change in buffered frames per video frame used by rate control
+	float    latency_ms;       //estimated time from a sample being produced to it being played
+} audio_stats;
 
 uint32_t render_map_color(uint8_t r, uint8_t g, uint8_t b);
 void render_save_screenshot(char *path);
 uint32_t *render_get_framebuffer(uint8_t which, int *pitch);
 void render_framebuffer_updated(uint8_t which, int width);
+void render_set_pixel_format(pixel_format format);
+pixel_format render_get_pixel_format(void);
+uint16_t *render_get_line_cram(uint8_t which);
+void render_set_frame_handler(frame_handler handler);
+void render_set_sample_handler(sample_handler handler);
+//frees the calling thread's headless framebuffers before the thread exits
+void render_free_headless_buffers(void);
 void render_init(int width, int height, char * title, uint8_t fullscreen);
 void render_set_video_standard(vid_std std);
 void render_toggle_fullscreen();
@@ -97,6 +139,9 @@ void render_update_caption(char *title);
 void render_wait_quit(vdp_context * context);
 uint32_t render_audio_buffer();
 uint32_t render_sample_rate();
+void render_start_mix_log(char *path);
+//Returns 1 if audio will be time-stretched to the new speed, in which case sound chips should stay at their normal clocks
+uint8_t render_set_speed(uint32_t percent);
 void process_events();
 int render_width();
 int render_height();
@@ -116,10 +161,14 @@ uint32_t render_overscan_top();
 uint32_t render_overscan_left();
 uint32_t render_elapsed_ms(void);
 void render_sleep_ms(uint32_t delay);
+void render_get_frame_stats(frame_stats *stats);
+void render_get_audio_stats(audio_stats *stats);
 uint8_t render_has_gl(void);
 audio_source *render_audio_source(uint64_t master_clock, uint64_t sample_divider, uint8_t channels);
 void render_audio_adjust_clock(audio_source *src, uint64_t master_clock, uint64_t sample_divider);
 void render_put_mono_sample(audio_source *src, int16_t value);
+//equivalent to calling render_put_mono_sample count times, but much cheaper once the lowpass filter settles
+void render_put_mono_samples(audio_source *src, int16_t value, uint32_t count);
 void render_put_stereo_sample(audio_source *src, int16_t left, int16_t right);
 void render_pause_source(audio_source *src);
 void render_resume_source(audio_source *src);
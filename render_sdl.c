@@ -13,9 +13,15 @@
 #include "genesis.h"
 #include "bindings.h"
 #include "util.h"
-#include "ppm.h"
-#include "png.h"
 #include "config.h"
+#include "frame_dump.h"
+#include "pacing.h"
+#include "startup.h"
+#include "wavelog.h"
+#include "stretch.h"
+#ifndef DISABLE_ZLIB
+#include "capture.h"
+#endif
 
 #ifndef DISABLE_OPENGL
 #include <GL/glew.h>
@@ -51,6 +57,8 @@ struct audio_source {
 	double   dt;
 	uint64_t buffer_fraction;
 	uint64_t buffer_inc;
+	//buffer_inc before any dynamic rate control adjustment
+	uint64_t nominal_inc;
 	uint32_t buffer_pos;
 	uint32_t read_start;
 	uint32_t read_end;
@@ -60,6 +68,28 @@ struct audio_source {
 	int16_t  last_right;
 	uint8_t  num_channels;
 	uint8_t  front_populated;
+	//only used when resampling happens on the audio thread
+	uint8_t  deferred;
+	int16_t  *raw_front;
+	int16_t  *raw_back;
+	float    *kernel;
+	float    *history;
+	uint64_t out_fraction;
+	uint32_t raw_pos;
+	uint32_t raw_end;
+	uint32_t raw_read;
+	uint32_t raw_mask;
+	//input samples per output sample the raw buffers were sized for
+	uint32_t raw_ratio;
+	uint32_t pending_outputs;
+	uint32_t taps;
+	uint32_t history_size;
+	uint32_t history_pos;
+	//telemetry for the current stats window, updated by the audio callback
+	uint64_t fill_sum;
+	uint32_t min_fill;
+	uint32_t underruns;
+	uint32_t underrun_frames;
 };
 
 static audio_source *audio_sources[8];
@@ -67,10 +97,70 @@ static audio_source *inactive_audio_sources[8];
 static uint8_t num_audio_sources;
 static uint8_t num_inactive_audio_sources;
 static uint8_t sync_to_audio;
+//sync source from the config, sync_to_audio is forced off while time-stretching
+static uint8_t sync_to_audio_config;
+//when set, speed changes leave the sound chips at their normal clocks and the mixed output is time-stretched
+static uint8_t time_stretch_enabled;
+static uint8_t stretching;
+//low latency replaces the front/back swap of sync to audio with a small ring the emulator is throttled against
+static uint8_t low_latency_config;
+static uint8_t low_latency;
+static uint32_t speed_percent = 100;
+static time_stretch *stretcher;
+static float *stretch_out;
+static uint64_t last_present;
+//when set, sources only store native rate samples and the audio thread filters and resamples them
+static uint8_t deferred_resample;
+//when set, frames are paced by sleeping until absolute deadlines instead of by vsync
+static uint8_t timer_pacing;
+static uint8_t show_frame_stats;
 static uint32_t min_buffered;
 
+//audio telemetry accumulated by the audio callback and reset each time stats are published
+static uint64_t stats_callback_ns, stats_callback_max_ns;
+static uint64_t stats_backlog_sum;
+static uint32_t stats_callbacks, stats_output_underruns;
+static audio_stats published_audio_stats;
+static uint8_t show_audio_stats;
+static FILE *audio_stats_log;
+static uint64_t audio_stats_start;
+
+static void note_fill(audio_source *src, int32_t buffered)
+{
+	uint32_t fill = buffered > 0 ? buffered : 0;
+	src->fill_sum += fill;
+	if (fill < src->min_fill) {
+		src->min_fill = fill;
+	}
+}
+
+static void note_callback(uint64_t start)
+{
+	uint64_t elapsed = pacing_now_ns() - start;
+	stats_callback_ns += elapsed;
+	if (elapsed > stats_callback_max_ns) {
+		stats_callback_max_ns = elapsed;
+	}
+	stats_callbacks++;
+}
+
 typedef int32_t (*mix_func)(audio_source *audio, void *vstream, int len);
 
+//Ring indices are shared between the producers and the audio callback without a lock. Each index
+//has a single writer, the barriers make sure samples are visible before the index that covers them
+static uint32_t ring_load(uint32_t *index)
+{
+	uint32_t value = *(volatile uint32_t *)index;
+	SDL_MemoryBarrierAcquire();
+	return value;
+}
+
+static void ring_store(uint32_t *index, uint32_t value)
+{
+	SDL_MemoryBarrierRelease();
+	*(volatile uint32_t *)index = value;
+}
+
 static int32_t mix_s16(audio_source *audio, void *vstream, int len)
 {
 	int samples = len/(sizeof(int16_t)*2);
@@ -78,7 +168,7 @@ static int32_t mix_s16(audio_source *audio, void *vstream, int len)
 	int16_t *end = stream + 2*samples;
 	int16_t *src = audio->front;
 	uint32_t i = audio->read_start;
-	uint32_t i_end = audio->read_end;
+	uint32_t i_end = ring_load(&audio->read_end);
 	int16_t *cur = stream;
 	if (audio->num_channels == 1) {
 		while (cur < end && i != i_end)
@@ -96,14 +186,12 @@ static int32_t mix_s16(audio_source *audio, void *vstream, int len)
 		}
 	}
 	
-	if (cur != end) {
-		printf("Underflow of %d samples, read_start: %d, read_end: %d, mask: %X\n", (int)(end-cur)/2, audio->read_start, audio->read_end, audio->mask);
-	}
 	if (!sync_to_audio) {
-		audio->read_start = i;
+		ring_store(&audio->read_start, i);
 	}
 	if (cur != end) {
-		//printf("Underflow of %d samples, read_start: %d, read_end: %d, mask: %X\n", (int)(end-cur)/2, audio->read_start, audio->read_end, audio->mask);
+		audio->underruns++;
+		audio->underrun_frames += (end-cur)/2;
 		return (cur-end)/2;
 	} else {
 		return ((i_end - i) & audio->mask) / audio->num_channels;
@@ -117,7 +205,7 @@ static int32_t mix_f32(audio_source *audio, void *vstream, int len)
 	float *end = stream + 2*samples;
 	int16_t *src = audio->front;
 	uint32_t i = audio->read_start;
-	uint32_t i_end = audio->read_end;
+	uint32_t i_end = ring_load(&audio->read_end);
 	float *cur = stream;
 	if (audio->num_channels == 1) {
 		while (cur < end && i != i_end)
@@ -135,10 +223,11 @@ static int32_t mix_f32(audio_source *audio, void *vstream, int len)
 		}
 	}
 	if (!sync_to_audio) {
-		audio->read_start = i;
+		ring_store(&audio->read_start, i);
 	}
 	if (cur != end) {
-		printf("Underflow of %d samples, read_start: %d, read_end: %d, mask: %X\n", (int)(end-cur)/2, audio->read_start, audio->read_end, audio->mask);
+		audio->underruns++;
+		audio->underrun_frames += (end-cur)/2;
 		return (cur-end)/2;
 	} else {
 		return ((i_end - i) & audio->mask) / audio->num_channels;
@@ -152,6 +241,229 @@ static int32_t mix_null(audio_source *audio, void *vstream, int len)
 
 static mix_func mix;
 
+#define BUFFER_INC_RES 0x40000000UL
+#define RESAMPLE_PHASES 256
+#define RESAMPLE_ZERO_CROSSINGS 8
+
+static int16_t lowpass_sample(audio_source *src, int16_t last, int16_t current)
+{
+	int32_t tmp = current * src->lowpass_alpha + last * (0x10000 - src->lowpass_alpha);
+	current = tmp >> 16;
+	return current;
+}
+
+//Builds a Blackman windowed sinc with one row of taps per fractional phase. Rows are stored
+//oldest tap first so they line up with a straight run of the history buffer
+static void build_resampler(audio_source *src)
+{
+	double ratio = (double)BUFFER_INC_RES / (double)src->buffer_inc;
+	//cutoff in cycles per input sample, a little under the output Nyquist frequency
+	double cutoff = 0.46 / (ratio > 1.0 ? ratio : 1.0);
+	uint32_t half = ceil(RESAMPLE_ZERO_CROSSINGS / (2.0 * cutoff));
+	uint32_t taps = 2 * half + 1;
+	free(src->kernel);
+	src->kernel = malloc(RESAMPLE_PHASES * taps * sizeof(float));
+	for (uint32_t phase = 0; phase < RESAMPLE_PHASES; phase++)
+	{
+		float *row = src->kernel + phase * taps;
+		double sum = 0.0;
+		for (uint32_t i = 0; i < taps; i++)
+		{
+			double x = (double)i - half - (double)phase / RESAMPLE_PHASES;
+			double window = fabs(x) >= half ? 0.0 : 0.42 + 0.5 * cos(M_PI * x / half) + 0.08 * cos(2.0 * M_PI * x / half);
+			double sinc = x == 0.0 ? 1.0 : sin(2.0 * M_PI * cutoff * x) / (2.0 * M_PI * cutoff * x);
+			row[taps - 1 - i] = sinc * window;
+			sum += sinc * window;
+		}
+		for (uint32_t i = 0; i < taps; i++)
+		{
+			row[i] /= sum;
+		}
+	}
+	src->taps = taps;
+	//each value is stored twice so any window of taps values is contiguous
+	src->history_size = nearest_pow2(taps + 2 + (uint32_t)(1.0 / ratio));
+	free(src->history);
+	src->history = calloc(src->history_size * 2 * src->num_channels, sizeof(float));
+	src->history_pos = 0;
+}
+
+static void resample_input(audio_source *src, int16_t *frame)
+{
+	src->history_pos = (src->history_pos + 1) & (src->history_size - 1);
+	float *history = src->history + src->history_pos;
+	src->last_left = lowpass_sample(src, src->last_left, frame[0]);
+	history[0] = history[src->history_size] = src->last_left;
+	if (src->num_channels == 2) {
+		history += 2 * src->history_size;
+		src->last_right = lowpass_sample(src, src->last_right, frame[1]);
+		history[0] = history[src->history_size] = src->last_right;
+	}
+}
+
+static void resample_output(audio_source *src)
+{
+	//how far the output sample lies behind the newest input, in input samples
+	double delay = (double)src->out_fraction / (double)src->buffer_inc;
+	uint32_t whole = delay;
+	uint32_t phase = (delay - whole) * RESAMPLE_PHASES + 0.5;
+	if (phase == RESAMPLE_PHASES) {
+		whole++;
+		phase = 0;
+	}
+	float *row = src->kernel + phase * src->taps;
+	uint32_t start = (src->history_pos - whole - (src->taps - 1)) & (src->history_size - 1);
+	for (uint8_t channel = 0; channel < src->num_channels; channel++)
+	{
+		float *history = src->history + channel * 2 * src->history_size + start;
+		float accum = 0.0f;
+		for (uint32_t i = 0; i < src->taps; i++)
+		{
+			accum += history[i] * row[i];
+		}
+		int32_t sample = lrintf(accum);
+		src->front[src->buffer_pos++] = sample > 0x7FFF ? 0x7FFF : sample < -0x8000 ? -0x8000 : sample;
+	}
+	src->buffer_pos &= src->mask;
+}
+
+//Steps through the raw samples exactly like the producer did when it counted output samples,
+//so a sync to audio buffer holding the input for N output samples yields exactly N
+static uint32_t resample_block(audio_source *src, uint32_t end, uint32_t max_outputs)
+{
+	uint32_t produced = 0;
+	for (;;)
+	{
+		while (src->out_fraction > BUFFER_INC_RES)
+		{
+			if (produced == max_outputs) {
+				return produced;
+			}
+			src->out_fraction -= BUFFER_INC_RES;
+			resample_output(src);
+			produced++;
+		}
+		if (src->raw_read == end) {
+			return produced;
+		}
+		resample_input(src, src->raw_front + src->raw_read);
+		src->raw_read = (src->raw_read + src->num_channels) & src->raw_mask;
+		src->out_fraction += src->buffer_inc;
+	}
+}
+
+static void resample_sync(audio_source *src)
+{
+	src->raw_read = 0;
+	src->buffer_pos = 0;
+	uint32_t produced = resample_block(src, src->raw_end, buffer_samples);
+	//can only come up short right after a clock change, hold the last value instead of playing stale data
+	for (uint32_t i = produced * src->num_channels; i < buffer_samples * src->num_channels; i++)
+	{
+		src->front[i] = i >= src->num_channels ? src->front[i - src->num_channels] : 0;
+	}
+}
+
+static void resample_pending(audio_source *src)
+{
+	uint32_t used = ((src->buffer_pos - src->read_start) & src->mask) / src->num_channels;
+	uint32_t space = (src->mask + 1) / src->num_channels - used - 1;
+	resample_block(src, ring_load(&src->raw_end), space);
+	ring_store(&src->read_end, src->buffer_pos);
+}
+
+//Frames of buffering for sources when dynamic rate control is used. Time-stretching consumes
+//speed_percent/100 frames of input for each frame of output so it needs proportionally more
+static uint32_t ring_frames(void)
+{
+	if (!stretching) {
+		return min_buffered * 4;
+	}
+	uint32_t scale = speed_percent > 100 ? speed_percent : 100;
+	return (min_buffered * 4 + buffer_samples * 2) * scale / 100;
+}
+
+static void setup_resampler(audio_source *src)
+{
+	if (src->raw_front != src->raw_back) {
+		free(src->raw_front);
+	}
+	free(src->raw_back);
+	free(src->kernel);
+	free(src->history);
+	src->raw_front = src->raw_back = NULL;
+	src->kernel = src->history = NULL;
+	src->deferred = deferred_resample;
+	if (!src->deferred) {
+		return;
+	}
+	//upper bound on input samples per output sample
+	uint32_t ratio = BUFFER_INC_RES / src->buffer_inc + 1;
+	src->raw_ratio = ratio;
+	if (sync_to_audio) {
+		uint32_t size = (buffer_samples * ratio + 2) * src->num_channels;
+		src->raw_back = malloc(size * sizeof(int16_t));
+		src->raw_front = malloc(size * sizeof(int16_t));
+		src->raw_mask = 0xFFFFFFFF;
+	} else {
+		uint32_t size = nearest_pow2(ring_frames() * ratio * src->num_channels);
+		src->raw_back = src->raw_front = malloc(size * sizeof(int16_t));
+		src->raw_mask = size - 1;
+	}
+	src->raw_pos = src->raw_end = src->raw_read = 0;
+	src->pending_outputs = 0;
+	src->buffer_fraction = src->out_fraction = 0;
+	src->last_left = src->last_right = 0;
+	build_resampler(src);
+}
+
+//number of stereo sample frames consumed by the audio device since the main thread last checked
+static uint32_t audio_frames_consumed;
+
+static wave_log *mix_log;
+
+void render_start_mix_log(char *path)
+{
+	if (!mix_log) {
+		mix_log = wave_log_open(path, sample_rate, 2);
+	}
+}
+
+static void log_mixed(uint8_t *byte_stream, uint32_t num_samples, uint8_t is_float)
+{
+	if (!is_float) {
+		wave_log_samples(mix_log, (int16_t *)byte_stream, num_samples * 2);
+		return;
+	}
+	float *src = (float *)byte_stream;
+	int16_t converted[1024];
+	for (uint32_t remaining = num_samples * 2; remaining;)
+	{
+		uint32_t chunk = remaining < 1024 ? remaining : 1024;
+		for (uint32_t i = 0; i < chunk; i++)
+		{
+			float sample = src[i];
+			sample = sample > 1.0f ? 1.0f : sample < -1.0f ? -1.0f : sample;
+			converted[i] = sample * 0x7FFF;
+		}
+		wave_log_samples(mix_log, converted, chunk);
+		src += chunk;
+		remaining -= chunk;
+	}
+}
+
+static void capture_mixed(uint8_t *byte_stream, int len)
+{
+	uint8_t is_float = mix == mix_f32;
+	uint32_t num_samples = len / (2 * (is_float ? sizeof(float) : sizeof(int16_t)));
+#ifndef DISABLE_ZLIB
+	capture_audio(byte_stream, num_samples, is_float);
+#endif
+	if (mix_log) {
+		log_mixed(byte_stream, num_samples, is_float);
+	}
+}
+
 static void audio_callback(void * userdata, uint8_t *byte_stream, int len)
 {
 	uint8_t num_populated;
@@ -171,14 +483,25 @@ static void audio_callback(void * userdata, uint8_t *byte_stream, int len)
 			}
 		} while(!quitting && num_populated < num_audio_sources);
 		if (!quitting) {
+			//time spent waiting for the emulator above is not part of the callback cost
+			uint64_t start = pacing_now_ns();
+			uint8_t underrun = 0;
 			for (uint8_t i = 0; i < num_audio_sources; i++)
 			{
-				mix(audio_sources[i], byte_stream, len);
+				if (audio_sources[i]->deferred) {
+					resample_sync(audio_sources[i]);
+				}
+				note_fill(audio_sources[i], buffer_samples);
+				underrun |= mix(audio_sources[i], byte_stream, len) < 0;
 				audio_sources[i]->front_populated = 0;
 				SDL_CondSignal(audio_sources[i]->cond);
 			}
+			stats_output_underruns += underrun;
+			note_callback(start);
 		}
+		audio_frames_consumed += len / (2 * (mix == mix_f32 ? sizeof(float) : sizeof(int16_t)));
 	SDL_UnlockMutex(audio_mutex);
+	capture_mixed(byte_stream, len);
 }
 
 #define NO_LAST_BUFFERED -2000000000
@@ -189,23 +512,115 @@ static float average_change;
 static float max_adjust;
 static int32_t cur_min_buffered;
 static uint32_t min_remaining_buffer;
+static void audio_callback_stretch(uint8_t *byte_stream, int len)
+{
+	uint64_t start = pacing_now_ns();
+	uint8_t is_float = mix == mix_f32;
+	uint32_t frames = len / (2 * (is_float ? sizeof(float) : sizeof(int16_t)));
+	audio_frames_consumed += frames;
+	//only frames every source has produced can be mixed
+	uint32_t available = num_audio_sources ? 0xFFFFFFFF : 0;
+	for (uint8_t i = 0; i < num_audio_sources; i++)
+	{
+		audio_source *src = audio_sources[i];
+		if (src->deferred) {
+			resample_pending(src);
+		}
+		uint32_t buffered = ((ring_load(&src->read_end) - src->read_start) & src->mask) / src->num_channels;
+		note_fill(src, buffered);
+		available = buffered < available ? buffered : available;
+	}
+	float *input = stretch_input(stretcher, available);
+	for (uint8_t i = 0; i < num_audio_sources; i++)
+	{
+		audio_source *src = audio_sources[i];
+		uint32_t pos = src->read_start;
+		for (uint32_t frame = 0; frame < available; frame++)
+		{
+			float left = (float)src->front[pos] / 0x7FFF;
+			float right = src->num_channels == 2 ? (float)src->front[pos + 1] / 0x7FFF : left;
+			input[frame * 2] += left;
+			input[frame * 2 + 1] += right;
+			pos = (pos + src->num_channels) & src->mask;
+		}
+		ring_store(&src->read_start, pos);
+	}
+	stretch_commit(stretcher, available);
+
+	//Aim for about one callback worth of queued input by nudging the tempo, and drop input
+	//outright if emulation got far ahead so latency stays bounded
+	float speed = speed_percent / 100.0f;
+	float segment = stretch_segment(stretcher);
+	float target = frames * speed + segment * 3;
+	float backlog = stretch_backlog(stretcher);
+	if (backlog > target * 4) {
+		stretch_skip(stretcher, backlog - target);
+		backlog = target;
+	}
+	stats_backlog_sum += backlog;
+	float adjusted = speed + (backlog - target) / (frames * 4);
+	if (adjusted < speed * 0.5f) {
+		adjusted = speed * 0.5f;
+	} else if (adjusted > speed * 1.5f) {
+		adjusted = speed * 1.5f;
+	}
+	uint8_t underrun = 0;
+	for (uint32_t done = 0; done < frames;)
+	{
+		uint32_t chunk = frames - done < buffer_samples ? frames - done : buffer_samples;
+		uint32_t written = stretch_output(stretcher, stretch_out, chunk, adjusted);
+		//underflow, pad with silence
+		underrun |= written < chunk;
+		memset(stretch_out + written * 2, 0, (chunk - written) * 2 * sizeof(float));
+		if (is_float) {
+			memcpy(byte_stream + done * 2 * sizeof(float), stretch_out, chunk * 2 * sizeof(float));
+		} else {
+			int16_t *dst = (int16_t *)byte_stream + done * 2;
+			for (uint32_t i = 0; i < chunk * 2; i++)
+			{
+				float sample = stretch_out[i];
+				sample = sample > 1.0f ? 1.0f : sample < -1.0f ? -1.0f : sample;
+				dst[i] = sample * 0x7FFF;
+			}
+		}
+		done += chunk;
+	}
+	stats_output_underruns += underrun;
+	note_callback(start);
+	capture_mixed(byte_stream, len);
+}
+
 static void audio_callback_drc(void *userData, uint8_t *byte_stream, int len)
 {
+	if (stretching) {
+		audio_callback_stretch(byte_stream, len);
+		return;
+	}
+	uint64_t start = pacing_now_ns();
 	memset(byte_stream, 0, len);
-	if (cur_min_buffered < 0) {
+	audio_frames_consumed += len / (2 * (mix == mix_f32 ? sizeof(float) : sizeof(int16_t)));
+	if (cur_min_buffered < 0 && !low_latency) {
 		//underflow last frame, but main thread hasn't gotten a chance to call SDL_PauseAudio yet
+		stats_output_underruns++;
+		note_callback(start);
 		return;
 	}
 	cur_min_buffered = 0x7FFFFFFF;
 	min_remaining_buffer = 0xFFFFFFFF;
 	for (uint8_t i = 0; i < num_audio_sources; i++)
 	{
-		
+		if (audio_sources[i]->deferred) {
+			resample_pending(audio_sources[i]);
+		}
 		int32_t buffered = mix(audio_sources[i], byte_stream, len);
+		note_fill(audio_sources[i], buffered);
 		cur_min_buffered = buffered < cur_min_buffered ? buffered : cur_min_buffered;
 		uint32_t remaining = (audio_sources[i]->mask + 1)/audio_sources[i]->num_channels - buffered;
 		min_remaining_buffer = remaining < min_remaining_buffer ? remaining : min_remaining_buffer;
 	}
+	stats_output_underruns += cur_min_buffered < 0;
+	note_callback(start);
+	capture_mixed(byte_stream, len);
 }
 
 static void lock_audio()
@@ -235,17 +650,29 @@ static void render_close_audio()
 	SDL_CloseAudio();
 }
 
-#define BUFFER_INC_RES 0x40000000UL
-
 void render_audio_adjust_clock(audio_source *src, uint64_t master_clock, uint64_t sample_divider)
 {
-	src->buffer_inc = ((BUFFER_INC_RES * (uint64_t)sample_rate) / master_clock) * sample_divider;
+	uint64_t buffer_inc = ((BUFFER_INC_RES * (uint64_t)sample_rate) / master_clock) * sample_divider;
+	if (src->deferred) {
+		//the filter kernel depends on the ratio and belongs to the audio thread
+		lock_audio();
+			src->buffer_inc = src->nominal_inc = buffer_inc;
+			if (BUFFER_INC_RES / buffer_inc + 1 > src->raw_ratio) {
+				//a faster clock produces more input per buffer than the raw buffers hold
+				setup_resampler(src);
+			} else {
+				build_resampler(src);
+			}
+		unlock_audio();
+	} else {
+		src->buffer_inc = src->nominal_inc = buffer_inc;
+	}
 }
 
 audio_source *render_audio_source(uint64_t master_clock, uint64_t sample_divider, uint8_t channels)
 {
 	audio_source *ret = NULL;
-	uint32_t alloc_size = sync_to_audio ? channels * buffer_samples : nearest_pow2(min_buffered * 4 * channels);
+	uint32_t alloc_size = sync_to_audio ? channels * buffer_samples : nearest_pow2(ring_frames() * channels);
 	lock_audio();
 		if (num_audio_sources < 8) {
 			ret = malloc(sizeof(audio_source));
@@ -254,7 +681,16 @@ audio_source *render_audio_source(uint64_t master_clock, uint64_t sample_divider
 			ret->front_populated = 0;
 			ret->cond = SDL_CreateCond();
 			ret->num_channels = channels;
-			audio_sources[num_audio_sources++] = ret;
+			ret->deferred = 0;
+			ret->raw_front = ret->raw_back = NULL;
+			ret->kernel = ret->history = NULL;
+			ret->fill_sum = 0;
+			ret->min_fill = 0xFFFFFFFF;
+			ret->underruns = ret->underrun_frames = 0;
+			//without a window nothing drains the shared table and each headless instance owns its sources
+			if (main_window) {
+				audio_sources[num_audio_sources++] = ret;
+			}
 		}
 	unlock_audio();
 	if (!ret) {
@@ -272,6 +708,9 @@ audio_source *render_audio_source(uint64_t master_clock, uint64_t sample_divider
 		ret->read_start = 0;
 		ret->read_end = sync_to_audio ? buffer_samples * channels : 0;
 		ret->mask = sync_to_audio ? 0xFFFFFFFF : alloc_size-1;
+		lock_audio();
+			setup_resampler(ret);
+		unlock_audio();
 	}
 	if (sync_to_audio && SDL_GetAudioStatus() == SDL_AUDIO_PAUSED) {
 		SDL_PauseAudio(0);
@@ -281,6 +720,9 @@ audio_source *render_audio_source(uint64_t master_clock, uint64_t sample_divider
 
 void render_pause_source(audio_source *src)
 {
+	if (!main_window) {
+		return;
+	}
 	uint8_t need_pause = 0;
 	lock_audio();
 		for (uint8_t i = 0; i < num_audio_sources; i++)
@@ -305,6 +747,9 @@ void render_pause_source(audio_source *src)
 
 void render_resume_source(audio_source *src)
 {
+	if (!main_window) {
+		return;
+	}
 	lock_audio();
 		if (num_audio_sources < 8) {
 			audio_sources[num_audio_sources++] = src;
@@ -330,9 +775,65 @@ void render_free_source(audio_source *src)
 		free(src->back);
 		SDL_DestroyCond(src->cond);
 	}
+	if (src->raw_front != src->raw_back) {
+		free(src->raw_front);
+	}
+	free(src->raw_back);
+	free(src->kernel);
+	free(src->history);
 	free(src);
 }
 static uint32_t sync_samples;
+
+//Starts the device once enough is buffered. In low latency mode the producer is held back so it
+//only stays min_buffered frames ahead of the device
+static void ring_ready(uint32_t num_buffered)
+{
+	if (num_buffered >= min_buffered && SDL_GetAudioStatus() == SDL_AUDIO_PAUSED) {
+		SDL_PauseAudio(0);
+	} else if (low_latency && num_buffered > min_buffered) {
+		pacing_sleep_until(pacing_now_ns() + (uint64_t)(num_buffered - min_buffered) * 1000000000ULL / sample_rate);
+	}
+}
+
+static void do_deferred_ready(audio_source *src)
+{
+	if (sync_to_audio) {
+		SDL_LockMutex(audio_mutex);
+			while (src->front_populated) {
+				SDL_CondWait(src->cond, audio_mutex);
+			}
+			int16_t *tmp = src->raw_front;
+			src->raw_front = src->raw_back;
+			src->raw_back = tmp;
+			src->raw_end = src->raw_pos;
+			src->raw_pos = 0;
+			src->front_populated = 1;
+			SDL_CondSignal(audio_ready);
+		SDL_UnlockMutex(audio_mutex);
+	} else {
+		ring_store(&src->raw_end, src->raw_pos);
+		//raw samples the audio thread hasn't converted yet are counted as the output they will become
+		uint32_t num_buffered = ((ring_load(&src->read_end) - ring_load(&src->read_start)) & src->mask) / src->num_channels
+			+ ((src->raw_end - ring_load(&src->raw_read)) & src->raw_mask) / src->num_channels * src->buffer_inc / BUFFER_INC_RES;
+		ring_ready(num_buffered);
+	}
+}
+
+//producer side of deferred resampling, only counts the output samples a stored input will produce
+static void defer_advance(audio_source *src)
+{
+	src->buffer_fraction += src->buffer_inc;
+	while (src->buffer_fraction > BUFFER_INC_RES)
+	{
+		src->buffer_fraction -= BUFFER_INC_RES;
+		if (++src->pending_outputs >= sync_samples) {
+			src->pending_outputs = 0;
+			do_deferred_ready(src);
+		}
+	}
+}
+
 static void do_audio_ready(audio_source *src)
 {
 	if (sync_to_audio) {
@@ -348,22 +849,16 @@ static void do_audio_ready(audio_source *src)
 			SDL_CondSignal(audio_ready);
 		SDL_UnlockMutex(audio_mutex);
 	} else {
-		uint32_t num_buffered;
-		SDL_LockAudio();
-			src->read_end = src->buffer_pos;
-			num_buffered = ((src->read_end - src->read_start) & src->mask) / src->num_channels;
-		SDL_UnlockAudio();
-		if (num_buffered >= min_buffered && SDL_GetAudioStatus() == SDL_AUDIO_PAUSED) {
-			SDL_PauseAudio(0);
-		}
+		ring_store(&src->read_end, src->buffer_pos);
+		uint32_t num_buffered = ((src->read_end - ring_load(&src->read_start)) & src->mask) / src->num_channels;
+		ring_ready(num_buffered);
 	}
 }
 
-static int16_t lowpass_sample(audio_source *src, int16_t last, int16_t current)
+static sample_handler custom_sample_handler;
+void render_set_sample_handler(sample_handler handler)
 {
-	int32_t tmp = current * src->lowpass_alpha + last * (0x10000 - src->lowpass_alpha);
-	current = tmp >> 16;
-	return current;
+	custom_sample_handler = handler;
 }
 
 static void interp_sample(audio_source *src, int16_t last, int16_t current)
@@ -375,6 +870,15 @@ static void interp_sample(audio_source *src, int16_t last, int16_t current)
 
 void render_put_mono_sample(audio_source *src, int16_t value)
 {
+	if (custom_sample_handler) {
+		custom_sample_handler(src, value, value);
+	}
+	if (src->deferred) {
+		src->raw_back[src->raw_pos] = value;
+		src->raw_pos = (src->raw_pos + 1) & src->raw_mask;
+		defer_advance(src);
+		return;
+	}
 	value = lowpass_sample(src, src->last_left, value);
 	src->buffer_fraction += src->buffer_inc;
 	uint32_t base = sync_to_audio ? 0 : src->read_end;
@@ -391,8 +895,75 @@ void render_put_mono_sample(audio_source *src, int16_t value)
 	src->last_left = value;
 }
 
+void render_put_mono_samples(audio_source *src, int16_t value, uint32_t count)
+{
+	if (custom_sample_handler) {
+		for (uint32_t i = 0; i < count; i++)
+		{
+			custom_sample_handler(src, value, value);
+		}
+	}
+	if (src->deferred) {
+		for (; count; count--)
+		{
+			src->raw_back[src->raw_pos] = value;
+			src->raw_pos = (src->raw_pos + 1) & src->raw_mask;
+			defer_advance(src);
+		}
+		return;
+	}
+	//run the filter normally until it settles, after that every input sample is identical
+	uint32_t base = sync_to_audio ? 0 : src->read_end;
+	for (; count; count--)
+	{
+		int16_t filtered = lowpass_sample(src, src->last_left, value);
+		if (filtered == src->last_left) {
+			break;
+		}
+		src->buffer_fraction += src->buffer_inc;
+		while (src->buffer_fraction > BUFFER_INC_RES)
+		{
+			src->buffer_fraction -= BUFFER_INC_RES;
+			interp_sample(src, src->last_left, filtered);
+			
+			if (((src->buffer_pos - base) & src->mask) >= sync_samples) {
+				do_audio_ready(src);
+				base = sync_to_audio ? 0 : src->read_end;
+			}
+			src->buffer_pos &= src->mask;
+		}
+		src->last_left = filtered;
+	}
+	if (!count) {
+		return;
+	}
+	//interpolating between two equal samples is exact, so only the number of output samples matters
+	uint64_t total = src->buffer_fraction + count * src->buffer_inc;
+	uint64_t outputs = total > BUFFER_INC_RES ? (total - 1) / BUFFER_INC_RES : 0;
+	src->buffer_fraction = total - outputs * BUFFER_INC_RES;
+	for (; outputs; outputs--)
+	{
+		src->back[src->buffer_pos++] = src->last_left;
+		if (((src->buffer_pos - base) & src->mask) >= sync_samples) {
+			do_audio_ready(src);
+			base = sync_to_audio ? 0 : src->read_end;
+		}
+		src->buffer_pos &= src->mask;
+	}
+}
+
 void render_put_stereo_sample(audio_source *src, int16_t left, int16_t right)
 {
+	if (custom_sample_handler) {
+		custom_sample_handler(src, left, right);
+	}
+	if (src->deferred) {
+		src->raw_back[src->raw_pos] = left;
+		src->raw_back[src->raw_pos + 1] = right;
+		src->raw_pos = (src->raw_pos + 2) & src->raw_mask;
+		defer_advance(src);
+		return;
+	}
 	left = lowpass_sample(src, src->last_left, left);
 	right = lowpass_sample(src, src->last_right, right);
 	src->buffer_fraction += src->buffer_inc;
@@ -494,6 +1065,31 @@ static GLuint load_shader(char * fname, GLenum shader_type)
 #endif
 
 static uint32_t texture_buf[512 * 513];
+static uint8_t fb_format, pending_format, fb_format_configured;
+static uint8_t pixel_sizes[NUM_PIXEL_FORMATS] = {4, 2, 1};
+static char *pixel_format_names[NUM_PIXEL_FORMATS] = {"argb8888", "rgb565", "pal8"};
+
+static void configure_pixel_format(void)
+{
+	if (fb_format_configured) {
+		return;
+	}
+	fb_format_configured = 1;
+	tern_val def = {.ptrval = "argb8888"};
+	char *name = tern_find_path_default(config, "video\0pixel_format\0", def, TVAL_PTR).ptrval;
+	for (fb_format = 0; fb_format < NUM_PIXEL_FORMATS; fb_format++)
+	{
+		if (!strcmp(name, pixel_format_names[fb_format])) {
+			break;
+		}
+	}
+	if (fb_format == NUM_PIXEL_FORMATS) {
+		warning("Unrecognized pixel format %s, using argb8888\n", name);
+		fb_format = PIXEL_ARGB8888;
+	}
+	pending_format = fb_format;
+}
+
 #ifndef DISABLE_OPENGL
 static void gl_setup()
 {
@@ -510,7 +1106,11 @@ static void gl_setup()
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 		if (i < 2) {
 			//TODO: Fixme for PAL + invalid display mode
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 512, 512, 0, GL_BGRA, GL_UNSIGNED_BYTE, texture_buf);
+			if (fb_format == PIXEL_RGB565) {
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 512, 512, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, texture_buf);
+			} else {
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 512, 512, 0, GL_BGRA, GL_UNSIGNED_BYTE, texture_buf);
+			}
 		} else {
 			uint32_t blank = 255 << 24;
 			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_BGRA, GL_UNSIGNED_BYTE, &blank);
@@ -558,6 +1158,11 @@ static void render_alloc_surfaces()
 	if (texture_init) {
 		return;
 	}
+	configure_pixel_format();
+	if (fb_format == PIXEL_PAL8) {
+		warning("pal8 pixel format is only supported in headless mode, using argb8888\n");
+		fb_format = pending_format = PIXEL_ARGB8888;
+	}
 	sdl_textures= malloc(sizeof(SDL_Texture *) * 2);
 	num_textures = 2;
 	texture_init = 1;
@@ -571,7 +1176,7 @@ static void render_alloc_surfaces()
 		char *scaling = tern_find_path_default(config, "video\0scaling\0", def, TVAL_PTR).ptrval;
 		SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, scaling);
 		//TODO: Fixme for invalid display mode
-		sdl_textures[0] = sdl_textures[1] = SDL_CreateTexture(main_renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, LINEBUF_SIZE, 588);
+		sdl_textures[0] = sdl_textures[1] = SDL_CreateTexture(main_renderer, fb_format == PIXEL_RGB565 ? SDL_PIXELFORMAT_RGB565 : SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, LINEBUF_SIZE, 588);
 #ifndef DISABLE_OPENGL
 	}
 #endif
@@ -590,12 +1195,93 @@ static void free_surfaces(void)
 	texture_init = 0;
 }
 
+//headless instances may run on several threads at once
+static THREAD_LOCAL void *headless_fb[FRAMEBUFFER_EVEN + 1];
+static THREAD_LOCAL vid_std headless_standard;
+static void apply_pixel_format(void)
+{
+	if (pending_format == fb_format) {
+		return;
+	}
+	fb_format = pending_format;
+	if (texture_init) {
+		free_surfaces();
+#ifndef DISABLE_OPENGL
+		if (render_gl) {
+			gl_teardown();
+		}
+#endif
+		render_alloc_surfaces();
+	}
+}
+
+void render_set_pixel_format(pixel_format format)
+{
+	fb_format_configured = 1;
+	if (format == PIXEL_PAL8 && main_window) {
+		warning("pal8 pixel format is only supported in headless mode, using argb8888\n");
+		format = PIXEL_ARGB8888;
+	}
+	pending_format = format;
+	if (!texture_init && !headless_fb[FRAMEBUFFER_ODD] && !headless_fb[FRAMEBUFFER_EVEN]) {
+		//nothing has been allocated in the old format yet so the change can take effect immediately
+		fb_format = format;
+	}
+	//otherwise the switch happens at the end of the current frame, the VDP picks up the new format
+	//when it requests its next framebuffer
+}
+
+void render_free_headless_buffers(void)
+{
+	for (int i = 0; i <= FRAMEBUFFER_EVEN; i++)
+	{
+		free(headless_fb[i]);
+		headless_fb[i] = NULL;
+	}
+}
+
+pixel_format render_get_pixel_format(void)
+{
+	configure_pixel_format();
+	return fb_format;
+}
+
+static uint16_t *line_cram[FRAMEBUFFER_EVEN + 1];
+uint16_t *render_get_line_cram(uint8_t which)
+{
+	if (which > FRAMEBUFFER_EVEN) {
+		return NULL;
+	}
+	if (!line_cram[which]) {
+		line_cram[which] = calloc(CRAM_SIZE * 513, sizeof(uint16_t));
+	}
+	return line_cram[which];
+}
+
+static frame_handler custom_frame_handler;
+void render_set_frame_handler(frame_handler handler)
+{
+	custom_frame_handler = handler;
+}
+
 static char * caption = NULL;
 static char * fps_caption = NULL;
 
 static void render_quit()
 {
+	frame_dump_shutdown();
+#ifndef DISABLE_ZLIB
+	capture_stop();
+#endif
 	render_close_audio();
+	if (mix_log) {
+		wave_log_close(mix_log);
+		mix_log = NULL;
+	}
+	if (audio_stats_log) {
+		fclose(audio_stats_log);
+		audio_stats_log = NULL;
+	}
 	free_surfaces();
 #ifndef DISABLE_OPENGL
 	if (render_gl) {
@@ -813,11 +1499,29 @@ SDL_Joystick *render_get_joystick(int index)
 	return joysticks[index];
 }
 
+//parsing the mapping DB takes a while and is only needed once a joystick shows up
+static void load_controller_db(void)
+{
+	static uint8_t loaded;
+	if (loaded) {
+		return;
+	}
+	loaded = 1;
+	uint32_t db_size;
+	char *db_data = read_bundled_file("gamecontrollerdb.txt", &db_size);
+	if (db_data) {
+		int added = SDL_GameControllerAddMappingsFromRW(SDL_RWFromMem(db_data, db_size), 1);
+		free(db_data);
+		printf("Added %d game controller mappings from gamecontrollerdb.txt\n", added);
+	}
+}
+
 SDL_GameController *render_get_controller(int index)
 {
 	if (index >= MAX_JOYSTICKS) {
 		return NULL;
 	}
+	load_controller_db();
 	return SDL_GameControllerOpen(joystick_sdl_index[index]);
 }
 
@@ -855,6 +1559,7 @@ static int32_t handle_event(SDL_Event *event)
 		if (event->jdevice.which < MAX_JOYSTICKS) {
 			int index = lowest_unused_joystick_index();
 			if (index >= 0) {
+				load_controller_db();
 				SDL_Joystick * joy = joysticks[index] = SDL_JoystickOpen(event->jdevice.which);
 				joystick_sdl_index[index] = event->jdevice.which;
 				if (joy) {
@@ -938,6 +1643,11 @@ static int source_frame;
 static int source_frame_count;
 static int frame_repeat[60];
 
+//requested device buffer in low latency mode, drivers that can't go this small will round it up
+#define LOW_LATENCY_SAMPLES 128
+//device buffers worth of samples the emulator stays ahead by in low latency mode
+#define LOW_LATENCY_BUFFERS 2
+
 static void init_audio()
 {
 	SDL_AudioSpec desired, actual;
@@ -955,8 +1665,25 @@ static void init_audio()
    		samples = 512;
    	}
     printf("config says: %d\n", samples);
-    desired.samples = samples*2;
+    desired.samples = low_latency ? LOW_LATENCY_SAMPLES : samples*2;
 	desired.callback = sync_to_audio ? audio_callback : audio_callback_drc;
+	char *resampler = tern_find_path_default(config, "audio\0resampler\0", (tern_val){.ptrval = "linear"}, TVAL_PTR).ptrval;
+	deferred_resample = !strcmp(resampler, "sinc");
+	char *stretch = tern_find_path_default(config, "audio\0time_stretch\0", (tern_val){.ptrval = "on"}, TVAL_PTR).ptrval;
+	time_stretch_enabled = !strcmp(stretch, "on");
+	char *stats = tern_find_path_default(config, "audio\0stats\0", (tern_val){.ptrval = "off"}, TVAL_PTR).ptrval;
+	show_audio_stats = !strcmp(stats, "on");
+	char *stats_log = tern_find_path(config, "audio\0stats_log\0", TVAL_PTR).ptrval;
+	if (stats_log && *stats_log && !audio_stats_log) {
+		audio_stats_log = fopen(stats_log, "w");
+		if (audio_stats_log) {
+			fputs("time_ms,source,buffered,avg_buffered,min_buffered,capacity,underruns,underrun_frames,rate_adjust,"
+				"output_underruns,callbacks,callback_avg_us,callback_max_us,buffer_trend,latency_ms\n", audio_stats_log);
+			audio_stats_start = pacing_now_ns();
+		} else {
+			warning("Failed to open audio stats log %s for writing\n", stats_log);
+		}
+	}
 	desired.userdata = NULL;
 
 	if (SDL_OpenAudio(&desired, &actual) < 0) {
@@ -978,6 +1705,24 @@ static void init_audio()
 	}
 }
 
+#ifndef DISABLE_OPENGL
+static int swap_interval;
+static void update_swap_interval(void)
+{
+	if (render_gl) {
+		//emulation is paced by a timer while time-stretching, waiting for vblank on each present would cap it at the refresh rate
+		SDL_GL_SetSwapInterval(stretching ? 0 : swap_interval);
+	}
+}
+#endif
+
+//time-stretching takes over pacing from both of the audio sync modes
+static void update_sync_mode(void)
+{
+	low_latency = low_latency_config && !stretching;
+	sync_to_audio = sync_to_audio_config && !stretching && !low_latency;
+}
+
 void window_setup(void)
 {
 	uint32_t flags = SDL_WINDOW_RESIZABLE;
@@ -987,14 +1732,22 @@ void window_setup(void)
 	
 	tern_val def = {.ptrval = "video"};
 	char *sync_src = tern_find_path_default(config, "system\0sync_source\0", def, TVAL_PTR).ptrval;
-	sync_to_audio = !strcmp(sync_src, "audio");
+	sync_to_audio_config = !strcmp(sync_src, "audio");
+	char *latency = tern_find_path_default(config, "audio\0latency\0", (tern_val){.ptrval = "normal"}, TVAL_PTR).ptrval;
+	low_latency_config = sync_to_audio_config && !strcmp(latency, "low");
+	update_sync_mode();
+	
+	char *pacing = tern_find_path_default(config, "video\0pacing\0", (tern_val){.ptrval = "vsync"}, TVAL_PTR).ptrval;
+	timer_pacing = !sync_to_audio_config && !strcmp(pacing, "timer");
+	char *stats = tern_find_path_default(config, "video\0frame_stats\0", (tern_val){.ptrval = "off"}, TVAL_PTR).ptrval;
+	show_frame_stats = !strcmp(stats, "on");
 	
 	const char *vsync;
-	if (sync_to_audio) {
+	if (sync_to_audio_config) {
 		def.ptrval = "off";
 		vsync = tern_find_path_default(config, "video\0vsync\0", def, TVAL_PTR).ptrval;
 	} else {
-		vsync = "on";
+		vsync = timer_pacing ? "off" : "on";
 	}
 	
 	tern_node *video = tern_find_node(config, "video");
@@ -1065,6 +1818,8 @@ void window_setup(void)
 					warning("Failed to set vsync to %s: %s\n", vsync, SDL_GetError());
 				}
 			}
+			swap_interval = SDL_GL_GetSwapInterval();
+			update_swap_interval();
 		} else {
 			warning("OpenGL 2.0 is unavailable, falling back to SDL2 renderer\n");
 		}
@@ -1101,6 +1856,7 @@ void render_init(int width, int height, char * title, uint8_t fullscreen)
 		fatal_error("Unable to init SDL: %s\n", SDL_GetError());
 	}
 	atexit(SDL_Quit);
+	startup_phase("SDL init");
 	if (height <= 0) {
 		float aspect = config_aspect() > 0.0f ? config_aspect() : 4.0f/3.0f;
 		height = ((float)width / aspect) + 0.5f;
@@ -1127,19 +1883,13 @@ void render_init(int width, int height, char * title, uint8_t fullscreen)
 	caption = title;
 	
 	window_setup();
+	startup_phase("window and GL setup");
 
 	audio_mutex = SDL_CreateMutex();
 	audio_ready = SDL_CreateCond();
 	
 	init_audio();
-	
-	uint32_t db_size;
-	char *db_data = read_bundled_file("gamecontrollerdb.txt", &db_size);
-	if (db_data) {
-		int added = SDL_GameControllerAddMappingsFromRW(SDL_RWFromMem(db_data, db_size), 1);
-		free(db_data);
-		printf("Added %d game controller mappings from gamecontrollerdb.txt\n", added);
-	}
+	startup_phase("audio init");
 	
 	SDL_JoystickEventState(SDL_ENABLE);
 	
@@ -1149,30 +1899,72 @@ void render_init(int width, int height, char * title, uint8_t fullscreen)
 }
 #include<unistd.h>
 static int in_toggle;
-static void update_source(audio_source *src, double rc, uint8_t sync_changed)
+static void update_source(audio_source *src, double rc, uint8_t buffers_changed)
 {
 	double alpha = src->dt / (src->dt + rc);
 	int32_t lowpass_alpha = (int32_t)(((double)0x10000) * alpha);
 	src->lowpass_alpha = lowpass_alpha;
-	if (sync_changed) {
-		uint32_t alloc_size = sync_to_audio ? src->num_channels * buffer_samples : nearest_pow2(min_buffered * 4 * src->num_channels);
-		src->back = realloc(src->back, alloc_size * sizeof(int16_t));
-		if (sync_to_audio) {
-			src->front = malloc(alloc_size * sizeof(int16_t));
-		} else {
+	if (buffers_changed) {
+		uint32_t alloc_size = sync_to_audio ? src->num_channels * buffer_samples : nearest_pow2(ring_frames() * src->num_channels);
+		if (src->front != src->back) {
 			free(src->front);
-			src->front = src->back;
 		}
+		src->back = realloc(src->back, alloc_size * sizeof(int16_t));
+		src->front = sync_to_audio ? malloc(alloc_size * sizeof(int16_t)) : src->back;
 		src->mask = sync_to_audio ? 0xFFFFFFFF : alloc_size-1;
 		src->read_start = 0;
 		src->read_end = sync_to_audio ? buffer_samples * src->num_channels : 0;
 		src->buffer_pos = 0;
 	}
+	if (buffers_changed || src->deferred != deferred_resample) {
+		setup_resampler(src);
+	}
+}
+
+static void reset_stretcher(void)
+{
+	if (stretcher) {
+		stretch_free(stretcher);
+		stretcher = NULL;
+	}
+	free(stretch_out);
+	stretch_out = NULL;
+	if (stretching) {
+		stretcher = stretch_new(sample_rate);
+		stretch_out = malloc(buffer_samples * 2 * sizeof(float));
+	}
+}
+
+static void reopen_audio(uint8_t buffers_changed)
+{
+	uint8_t was_paused = SDL_GetAudioStatus() == SDL_AUDIO_PAUSED;
+	render_close_audio();
+	quitting = 0;
+	init_audio();
+	reset_stretcher();
+	render_set_video_standard(video_standard);
+	
+	double lowpass_cutoff = get_lowpass_cutoff(config);
+	double rc = (1.0 / lowpass_cutoff) / (2.0 * M_PI);
+	lock_audio();
+		for (uint8_t i = 0; i < num_audio_sources; i++)
+		{
+			update_source(audio_sources[i], rc, buffers_changed);
+		}
+	unlock_audio();
+	for (uint8_t i = 0; i < num_inactive_audio_sources; i++)
+	{
+		update_source(inactive_audio_sources[i], rc, buffers_changed);
+	}
+	if (!was_paused) {
+		SDL_PauseAudio(0);
+	}
 }
 
 void render_config_updated(void)
 {
 	uint8_t old_sync_to_audio = sync_to_audio;
+	uint8_t old_low_latency = low_latency;
 	
 	free_surfaces();
 #ifndef DISABLE_OPENGL
@@ -1225,29 +2017,32 @@ void render_config_updated(void)
 	}
 #endif
 
-	uint8_t was_paused = SDL_GetAudioStatus() == SDL_AUDIO_PAUSED;
-	render_close_audio();
-	quitting = 0;
-	init_audio();
-	render_set_video_standard(video_standard);
-	
-	double lowpass_cutoff = get_lowpass_cutoff(config);
-	double rc = (1.0 / lowpass_cutoff) / (2.0 * M_PI);
-	lock_audio();
-		for (uint8_t i = 0; i < num_audio_sources; i++)
-		{
-			update_source(audio_sources[i], rc, old_sync_to_audio != sync_to_audio);
-		}
-	unlock_audio();
-	for (uint8_t i = 0; i < num_inactive_audio_sources; i++)
-	{
-		update_source(inactive_audio_sources[i], rc, old_sync_to_audio != sync_to_audio);
-	}
+	//the ring size depends on the latency mode
+	reopen_audio(old_sync_to_audio != sync_to_audio || old_low_latency != low_latency);
 	drain_events();
 	in_toggle = 0;
-	if (!was_paused) {
-		SDL_PauseAudio(0);
+}
+
+uint8_t render_set_speed(uint32_t percent)
+{
+	if (!time_stretch_enabled || !main_window) {
+		return 0;
+	}
+	if (percent == speed_percent) {
+		return stretching;
 	}
+	speed_percent = percent;
+	stretching = percent != 100;
+	update_sync_mode();
+	last_buffered = NO_LAST_BUFFERED;
+	cur_min_buffered = 0;
+	average_change = 0;
+#ifndef DISABLE_OPENGL
+	update_swap_interval();
+#endif
+	//ring sizes depend on the speed, so the source buffers are rebuilt even if the sync mode is unchanged
+	reopen_audio(1);
+	return stretching;
 }
 
 SDL_Window *render_get_window(void)
@@ -1257,11 +2052,16 @@ SDL_Window *render_get_window(void)
 
 void render_set_video_standard(vid_std std)
 {
+	if (!main_window) {
+		headless_standard = std;
+		return;
+	}
 	video_standard = std;
 	source_hz = std == VID_PAL ? 50 : 60;
 	uint32_t max_repeat = 0;
-	if (abs(source_hz - display_hz) < 2) {
-		memset(frame_repeat, 0, sizeof(int)*display_hz);
+	pacing_set_rate(stretching ? source_hz * speed_percent / 100 : source_hz);
+	if (timer_pacing || stretching || low_latency || abs(source_hz - display_hz) < 2) {
+		memset(frame_repeat, 0, sizeof(frame_repeat));
 	} else {
 		int inc = display_hz * 100000 / source_hz;
 		int accum = 0;
@@ -1289,6 +2089,10 @@ void render_set_video_standard(vid_std std)
 	max_repeat++;
 	min_buffered = (((float)max_repeat * (float)sample_rate/(float)source_hz)/* / (float)buffer_samples*/);// + 0.9999;
 	//min_buffered *= buffer_samples;
+	if (low_latency) {
+		//the producers are throttled against the ring in small steps, so they never need to cover a whole frame
+		min_buffered = LOW_LATENCY_BUFFERS * buffer_samples + sync_samples;
+	}
 	printf("Min samples buffered before audio start: %d\n", min_buffered);
 	max_adjust = BASE_MAX_ADJUST / source_hz;
 }
@@ -1313,9 +2117,21 @@ uint32_t *locked_pixels;
 uint32_t locked_pitch;
 uint32_t *render_get_framebuffer(uint8_t which, int *pitch)
 {
+	if (!main_window) {
+		//without a window, frames are only rendered if someone is around to consume them
+		if (!custom_frame_handler || which > FRAMEBUFFER_EVEN) {
+			return NULL;
+		}
+		configure_pixel_format();
+		if (!headless_fb[which]) {
+			headless_fb[which] = calloc(LINEBUF_SIZE * 513, sizeof(uint32_t));
+		}
+		*pitch = LINEBUF_SIZE * pixel_sizes[fb_format];
+		return headless_fb[which];
+	}
 #ifndef DISABLE_OPENGL
 	if (render_gl && which <= FRAMEBUFFER_EVEN) {
-		*pitch = LINEBUF_SIZE * sizeof(uint32_t);
+		*pitch = LINEBUF_SIZE * pixel_sizes[fb_format];
 		return texture_buf;
 	} else {
 #endif
@@ -1353,12 +2169,87 @@ uint8_t events_processed;
 #define FPS_INTERVAL 1000
 #endif
 
+//Collects the telemetry gathered by the audio callback since the last call
+static void publish_audio_stats(void)
+{
+	audio_stats *stats = &published_audio_stats;
+	uint64_t backlog_sum;
+	lock_audio();
+		stats->num_sources = num_audio_sources;
+		stats->callbacks = stats_callbacks;
+		for (uint8_t i = 0; i < num_audio_sources; i++)
+		{
+			audio_source *src = audio_sources[i];
+			audio_source_stats *cur = stats->sources + i;
+			if (sync_to_audio) {
+				cur->capacity = buffer_samples;
+				cur->buffered = src->front_populated ? buffer_samples : 0;
+			} else {
+				cur->capacity = (src->mask + 1) / src->num_channels;
+				cur->buffered = ((src->read_end - src->read_start) & src->mask) / src->num_channels;
+			}
+			cur->avg_buffered = stats_callbacks ? src->fill_sum / stats_callbacks : cur->buffered;
+			cur->min_buffered = src->min_fill == 0xFFFFFFFF ? cur->buffered : src->min_fill;
+			cur->underruns = src->underruns;
+			cur->underrun_frames = src->underrun_frames;
+			cur->rate_adjust = (double)src->buffer_inc / (double)src->nominal_inc - 1.0;
+			src->fill_sum = 0;
+			src->min_fill = 0xFFFFFFFF;
+			src->underruns = src->underrun_frames = 0;
+		}
+		stats->output_underruns = stats_output_underruns;
+		stats->callback_avg_us = stats_callbacks ? stats_callback_ns / (stats_callbacks * 1000.0f) : 0.0f;
+		stats->callback_max_us = stats_callback_max_ns / 1000.0f;
+		backlog_sum = stats_backlog_sum;
+		stats_callback_ns = stats_callback_max_ns = stats_backlog_sum = 0;
+		stats_callbacks = stats_output_underruns = 0;
+	unlock_audio();
+	stats->buffer_trend = average_change;
+
+	//a new sample waits behind everything already queued plus one device buffer
+	float queued;
+	if (stretching) {
+		queued = stats->callbacks ? (float)backlog_sum / stats->callbacks * 100.0f / speed_percent : 0.0f;
+	} else if (sync_to_audio) {
+		queued = buffer_samples;
+	} else {
+		queued = stats->num_sources ? 0xFFFFFFFF : 0;
+		for (uint8_t i = 0; i < stats->num_sources; i++)
+		{
+			if (stats->sources[i].avg_buffered < queued) {
+				queued = stats->sources[i].avg_buffered;
+			}
+		}
+	}
+	stats->latency_ms = sample_rate ? (queued + buffer_samples) * 1000.0f / sample_rate : 0.0f;
+
+	if (audio_stats_log) {
+		uint32_t time_ms = (pacing_now_ns() - audio_stats_start) / 1000000;
+		for (uint8_t i = 0; i < stats->num_sources; i++)
+		{
+			audio_source_stats *cur = stats->sources + i;
+			fprintf(audio_stats_log, "%u,%u,%u,%u,%u,%u,%u,%u,%.6f,%u,%u,%.1f,%.1f,%.2f,%.2f\n",
+				time_ms, i, cur->buffered, cur->avg_buffered, cur->min_buffered, cur->capacity, cur->underruns,
+				cur->underrun_frames, cur->rate_adjust, stats->output_underruns, stats->callbacks,
+				stats->callback_avg_us, stats->callback_max_us, stats->buffer_trend, stats->latency_ms);
+		}
+	}
+}
+
 static uint32_t last_width, last_height;
 static uint8_t interlaced;
 void render_framebuffer_updated(uint8_t which, int width)
 {
 	static uint8_t last;
-	if (!sync_to_audio && which <= FRAMEBUFFER_EVEN && source_frame_count < 0) {
+	startup_trace_done();
+	if (!main_window) {
+		if (custom_frame_handler && which <= FRAMEBUFFER_EVEN && headless_fb[which]) {
+			custom_frame_handler(which, headless_fb[which], LINEBUF_SIZE * pixel_sizes[fb_format], width, headless_standard == VID_NTSC ? 243 : 294);
+		}
+		fb_format = pending_format;
+		return;
+	}
+	if (!sync_to_audio && !stretching && !low_latency && which <= FRAMEBUFFER_EVEN && source_frame_count < 0) {
 		source_frame++;
 		if (source_frame >= source_hz) {
 			source_frame = 0;
@@ -1372,21 +2263,19 @@ void render_framebuffer_updated(uint8_t which, int width)
 	uint32_t height = which <= FRAMEBUFFER_EVEN 
 		? (video_standard == VID_NTSC ? 243 : 294) - (overscan_top[video_standard] + overscan_bot[video_standard])
 		: 240;
-	FILE *screenshot_file = NULL;
-	uint32_t shot_height, shot_width;
-	char *ext;
-	if (screenshot_path && which == FRAMEBUFFER_ODD) {
-		screenshot_file = fopen(screenshot_path, "wb");
-		if (screenshot_file) {
+	char *screenshot = NULL;
+	uint8_t grab_frame = which <= FRAMEBUFFER_EVEN && frame_dump_active();
 #ifndef DISABLE_ZLIB
-			ext = path_extension(screenshot_path);
+	grab_frame = grab_frame || (which <= FRAMEBUFFER_EVEN && capture_active());
 #endif
-			info_message("Saving screenshot to %s\n", screenshot_path);
-		} else {
-			warning("Failed to open screenshot file %s for writing\n", screenshot_path);
-		}
-		free(screenshot_path);
+	uint32_t shot_height, shot_width;
+	if (screenshot_path && which == FRAMEBUFFER_ODD) {
+		//encoding happens on a separate thread, so ownership of the path is handed off
+		screenshot = screenshot_path;
 		screenshot_path = NULL;
+		info_message("Saving screenshot to %s\n", screenshot);
+	}
+	if (screenshot || grab_frame) {
 		shot_height = video_standard == VID_NTSC ? 243 : 294;
 		shot_width = width;
 	}
@@ -1394,21 +2283,25 @@ void render_framebuffer_updated(uint8_t which, int width)
 	width -= overscan_left[video_standard] + overscan_right[video_standard];
 #ifndef DISABLE_OPENGL
 	if (render_gl && which <= FRAMEBUFFER_EVEN) {
+		uint8_t *upload = ((uint8_t *)texture_buf) + (overscan_left[video_standard] + LINEBUF_SIZE * overscan_top[video_standard]) * pixel_sizes[fb_format];
 		glBindTexture(GL_TEXTURE_2D, textures[which]);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, LINEBUF_SIZE, height, GL_BGRA, GL_UNSIGNED_BYTE, texture_buf + overscan_left[video_standard] + LINEBUF_SIZE * overscan_top[video_standard]);
+		if (fb_format == PIXEL_RGB565) {
+			//LINEBUF_SIZE is odd so 16-bit rows are not 4-byte aligned
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, LINEBUF_SIZE, height, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, upload);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		} else {
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, LINEBUF_SIZE, height, GL_BGRA, GL_UNSIGNED_BYTE, upload);
+		}
 		
-		if (screenshot_file) {
+		if (screenshot) {
 			//properly supporting interlaced modes here is non-trivial, so only save the odd field for now
+			frame_dump_screenshot(screenshot, texture_buf, shot_width, shot_height, LINEBUF_SIZE*pixel_sizes[fb_format], fb_format);
+		}
+		if (grab_frame) {
+			frame_dump_frame(texture_buf, shot_width, shot_height, LINEBUF_SIZE*pixel_sizes[fb_format], fb_format);
 #ifndef DISABLE_ZLIB
-			if (!strcasecmp(ext, "png")) {
-				free(ext);
-				save_png(screenshot_file, texture_buf, shot_width, shot_height, LINEBUF_SIZE*sizeof(uint32_t));
-			} else {
-				free(ext);
-#endif
-				save_ppm(screenshot_file, texture_buf, shot_width, shot_height, LINEBUF_SIZE*sizeof(uint32_t));
-#ifndef DISABLE_ZLIB
-			}
+			capture_frame(texture_buf, shot_width, shot_height, LINEBUF_SIZE*pixel_sizes[fb_format], fb_format);
 #endif
 		}
 	} else {
@@ -1429,48 +2322,94 @@ void render_framebuffer_updated(uint8_t which, int width)
 			}
 			height = 480;
 		}
-		if (screenshot_file) {
+		if (screenshot || grab_frame) {
 			uint32_t shot_pitch = locked_pitch;
 			if (which == FRAMEBUFFER_EVEN) {
 				shot_height *= 2;
 			} else {
 				shot_pitch *= 2;
 			}
+			if (screenshot) {
+				frame_dump_screenshot(screenshot, locked_pixels, shot_width, shot_height, shot_pitch, fb_format);
+			}
+			if (grab_frame) {
+				frame_dump_frame(locked_pixels, shot_width, shot_height, shot_pitch, fb_format);
 #ifndef DISABLE_ZLIB
-			if (!strcasecmp(ext, "png")) {
-				free(ext);
-				save_png(screenshot_file, locked_pixels, shot_width, shot_height, shot_pitch);
-			} else {
-				free(ext);
+				capture_frame(locked_pixels, shot_width, shot_height, shot_pitch, fb_format);
 #endif
-				save_ppm(screenshot_file, locked_pixels, shot_width, shot_height, shot_pitch);
-#ifndef DISABLE_ZLIB
 			}
-#endif
 		}
 		SDL_UnlockTexture(sdl_textures[which]);
 #ifndef DISABLE_OPENGL
 	}
 #endif
 	last_height = height;
-	render_update_display();
-	if (screenshot_file) {
-		fclose(screenshot_file);
+	if ((timer_pacing || stretching) && which <= FRAMEBUFFER_EVEN) {
+		pacing_wait_frame();
+	}
+	uint8_t present = 1;
+	if (stretching && which <= FRAMEBUFFER_EVEN && display_hz) {
+		//frames beyond what the display can show are emulated but not presented
+		uint64_t now = pacing_now_ns();
+		if (now - last_present < 1000000000ULL / display_hz) {
+			present = 0;
+		} else {
+			last_present = now;
+		}
+	}
+	if (present) {
+		render_update_display();
+	}
+	if (which <= FRAMEBUFFER_EVEN) {
+		apply_pixel_format();
 	}
 	if (which <= FRAMEBUFFER_EVEN) {
 		last = which;
+		lock_audio();
+			uint32_t consumed = audio_frames_consumed;
+			audio_frames_consumed = 0;
+		unlock_audio();
+		pacing_audio_consumed(consumed);
+		if (pacing_frame_done() && !sync_to_audio && !timer_pacing && !stretching && !low_latency && display_hz) {
+			frame_stats stats;
+			pacing_get_stats(&stats);
+			if (stats.fps > source_hz * 1.25f) {
+				//some drivers and compositors ignore the swap interval, don't let emulation run unthrottled
+				warning("vsync is not limiting the frame rate (%.1f fps), falling back to timer pacing\n", stats.fps);
+				timer_pacing = 1;
+				render_set_video_standard(video_standard);
+			}
+		}
 		static uint32_t frame_counter, start;
 		frame_counter++;
 		last_frame= SDL_GetTicks();
 		if ((last_frame - start) > FPS_INTERVAL) {
 			if (start && (last_frame-start)) {
+				char stats_text[256] = "";
+				int stats_len = 0;
+				if (show_frame_stats) {
+					frame_stats stats;
+					pacing_get_stats(&stats);
+					stats_len = snprintf(stats_text, sizeof(stats_text), ", %.2fms avg, %.2fms max, %.2fms jitter, %d late",
+						stats.avg_ms, stats.max_ms, stats.jitter_ms, stats.late_frames);
+				}
+				publish_audio_stats();
+				if (show_audio_stats) {
+					audio_stats *stats = &published_audio_stats;
+					stats_len += snprintf(stats_text + stats_len, sizeof(stats_text) - stats_len, ", audio %.1fms latency, %d underruns",
+						stats->latency_ms, stats->output_underruns);
+					if (!sync_to_audio && !stretching && !low_latency && stats->num_sources) {
+						snprintf(stats_text + stats_len, sizeof(stats_text) - stats_len, ", rate %+.3f%%",
+							stats->sources[0].rate_adjust * 100.0f);
+					}
+				}
 	#ifdef __ANDROID__
-				info_message("%s - %.1f fps", caption, ((float)frame_counter) / (((float)(last_frame-start)) / 1000.0));
+				info_message("%s - %.1f fps%s", caption, ((float)frame_counter) / (((float)(last_frame-start)) / 1000.0), stats_text);
 	#else
 				if (!fps_caption) {
-					fps_caption = malloc(strlen(caption) + strlen(" - 100000000.1 fps") + 1);
+					fps_caption = malloc(strlen(caption) + strlen(" - 100000000.1 fps") + sizeof(stats_text));
 				}
-				sprintf(fps_caption, "%s - %.1f fps", caption, ((float)frame_counter) / (((float)(last_frame-start)) / 1000.0));
+				sprintf(fps_caption, "%s - %.1f fps%s", caption, ((float)frame_counter) / (((float)(last_frame-start)) / 1000.0), stats_text);
 				SDL_SetWindowTitle(main_window, fps_caption);
 	#endif
 			}
@@ -1478,7 +2417,7 @@ void render_framebuffer_updated(uint8_t which, int width)
 			frame_counter = 0;
 		}
 	}
-	if (!sync_to_audio) {
+	if (!sync_to_audio && !stretching && !low_latency) {
 		int32_t local_cur_min, local_min_remaining;
 		SDL_LockAudio();
 			if (last_buffered > NO_LAST_BUFFERED) {
@@ -1594,6 +2533,7 @@ void render_update_display()
 #ifndef DISABLE_OPENGL
 	}
 #endif
+	pacing_display_presented();
 	if (!events_processed) {
 		process_events();
 	}
@@ -1720,6 +2660,9 @@ int32_t render_axis_part(int32_t input)
 
 void process_events()
 {
+	if (!main_window) {
+		return;
+	}
 	if (events_processed > MAX_EVENT_POLL_PER_FRAME) {
 		return;
 	}
@@ -1796,12 +2739,22 @@ void render_infobox(char *title, char *message)
 
 uint32_t render_elapsed_ms(void)
 {
-	return SDL_GetTicks();
+	return pacing_now_ns() / 1000000;
 }
 
 void render_sleep_ms(uint32_t delay)
 {
-	return SDL_Delay(delay);
+	pacing_sleep_until(pacing_now_ns() + delay * 1000000ULL);
+}
+
+void render_get_frame_stats(frame_stats *stats)
+{
+	pacing_get_stats(stats);
+}
+
+void render_get_audio_stats(audio_stats *stats)
+{
+	*stats = published_audio_stats;
 }
 
 uint8_t render_has_gl(void)
@@ -0,0 +1,443 @@
+/*
+ Copyright 2013-2016 Michael Pavone
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <SDL.h>
+#include "romcache.h"
+#include "romload.h"
+#include "romdb.h"
+#include "system.h"
+#include "paths.h"
+#include "hash.h"
+#include "tern.h"
+
+static const char cache_magic[4] = {'B', 'R', 'C', '1'};
+#define CACHE_HEADER_SIZE 8
+//size, mtime, sha1, system, regions, save type, name length, title length
+#define CACHE_RECORD_SIZE 43
+#define MAX_SCAN_THREADS 4
+
+enum {
+	SCAN_SKIP,     //directory or unrecognized extension
+	SCAN_PENDING,  //nothing known yet
+	SCAN_CACHED,   //metadata from the cache file, not yet checked against the file
+	SCAN_VERIFIED, //cached metadata matches the file
+	SCAN_DONE      //freshly scanned metadata is in scanned
+};
+
+typedef struct {
+	rom_metadata *meta;
+	char         **names;
+	tern_node    *lookup; //file name -> index + 1
+	uint32_t     count;
+} cache_file;
+
+struct rom_scan {
+	char         *dir;
+	char         *cache_path;
+	char         **names;
+	rom_metadata *cached;
+	rom_metadata *scanned;
+	SDL_atomic_t *state;
+	SDL_Thread   *threads[MAX_SCAN_THREADS];
+	cache_file   cache;
+	SDL_atomic_t next;
+	SDL_atomic_t stop;
+	uint32_t     count;
+	uint32_t     num_threads;
+};
+
+//the scanner threads only need the ROM DB for names, regions and save types
+static rom_database *scan_db;
+static SDL_mutex *scan_db_lock;
+
+static void write_le(uint8_t *dst, uint64_t value, uint8_t bytes)
+{
+	for (uint8_t i = 0; i < bytes; i++)
+	{
+		dst[i] = value >> (8 * i);
+	}
+}
+
+static uint64_t read_le(uint8_t *src, uint8_t bytes)
+{
+	uint64_t value = 0;
+	for (uint8_t i = 0; i < bytes; i++)
+	{
+		value |= (uint64_t)src[i] << (8 * i);
+	}
+	return value;
+}
+
+//one cache file per directory in the user data directory, keyed by the directory's path
+static char *cache_path(const char *dir)
+{
+	char const *userdata = get_userdata_dir();
+	if (!userdata || !is_absolute_path((char *)dir)) {
+		return NULL;
+	}
+	uint8_t hash[20];
+	sha1((uint8_t *)dir, strlen(dir), hash);
+	char name[sizeof(hash) * 2 + 1];
+	bin_to_hex((uint8_t *)name, hash, sizeof(hash));
+	char const *parts[] = {userdata, PATH_SEP, "blastem", PATH_SEP, "romcache", PATH_SEP, name};
+	return alloc_concat_m(sizeof(parts)/sizeof(*parts), parts);
+}
+
+static void load_cache(char *path, cache_file *cache)
+{
+	memset(cache, 0, sizeof(cache_file));
+	FILE *f = path ? fopen(path, "rb") : NULL;
+	if (!f) {
+		return;
+	}
+	long size = file_size(f);
+	uint8_t *buf = size > CACHE_HEADER_SIZE ? malloc(size) : NULL;
+	if (!buf || fread(buf, 1, size, f) != size || memcmp(buf, cache_magic, sizeof(cache_magic))) {
+		free(buf);
+		fclose(f);
+		return;
+	}
+	fclose(f);
+	uint32_t count = read_le(buf + 4, 4);
+	if (count > (size - CACHE_HEADER_SIZE) / CACHE_RECORD_SIZE) {
+		free(buf);
+		return;
+	}
+	cache->meta = calloc(count, sizeof(rom_metadata));
+	cache->names = calloc(count, sizeof(char *));
+	uint8_t *cur = buf + CACHE_HEADER_SIZE, *end = buf + size;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (end - cur < CACHE_RECORD_SIZE) {
+			break;
+		}
+		rom_metadata *meta = cache->meta + cache->count;
+		meta->size = read_le(cur, 8);
+		meta->mtime = read_le(cur + 8, 8);
+		memcpy(meta->sha1, cur + 16, sizeof(meta->sha1));
+		meta->system = cur[36];
+		meta->regions = cur[37];
+		meta->save_type = cur[38];
+		uint32_t name_len = read_le(cur + 39, 2);
+		uint32_t title_len = read_le(cur + 41, 2);
+		cur += CACHE_RECORD_SIZE;
+		if (!name_len || end - cur < name_len + title_len) {
+			break;
+		}
+		char *name = malloc(name_len + 1);
+		memcpy(name, cur, name_len);
+		name[name_len] = 0;
+		cur += name_len;
+		meta->title = malloc(title_len + 1);
+		memcpy(meta->title, cur, title_len);
+		meta->title[title_len] = 0;
+		cur += title_len;
+		cache->names[cache->count++] = name;
+		cache->lookup = tern_insert_int(cache->lookup, name, cache->count);
+	}
+	free(buf);
+}
+
+static void free_cache(cache_file *cache)
+{
+	for (uint32_t i = 0; i < cache->count; i++)
+	{
+		free(cache->names[i]);
+		free(cache->meta[i].title);
+	}
+	free(cache->names);
+	free(cache->meta);
+	if (cache->lookup) {
+		tern_free(cache->lookup);
+	}
+}
+
+static rom_metadata *cache_find(cache_file *cache, const char *name)
+{
+	intptr_t index = tern_find_int(cache->lookup, name, 0);
+	return index ? cache->meta + index - 1 : NULL;
+}
+
+static uint8_t stat_rom(const char *path, uint64_t *size, uint64_t *mtime)
+{
+	struct stat st;
+	if (stat(path, &st)) {
+		return 0;
+	}
+	*size = st.st_size;
+	*mtime = stat_mtime_ns(&st);
+	return 1;
+}
+
+static void scan_file(rom_scan *scan, uint32_t index)
+{
+	char *path = path_append(scan->dir, scan->names[index]);
+	rom_metadata *meta = scan->scanned + index;
+	uint64_t size, mtime;
+	if (!stat_rom(path, &size, &mtime)) {
+		free(path);
+		SDL_AtomicSet(scan->state + index, SCAN_SKIP);
+		return;
+	}
+	if (SDL_AtomicGet(scan->state + index) == SCAN_CACHED) {
+		rom_metadata *cached = scan->cached + index;
+		if (cached->size == size && cached->mtime == mtime) {
+			free(path);
+			SDL_AtomicSet(scan->state + index, SCAN_VERIFIED);
+			return;
+		}
+	}
+	meta->size = size;
+	meta->mtime = mtime;
+	system_media media;
+	memset(&media, 0, sizeof(media));
+	system_type stype = SYSTEM_UNKNOWN;
+	media.size = load_rom(path, &media.buffer, &stype);
+	if (media.size) {
+		media.extension = path_extension(scan->names[index]);
+		if (stype == SYSTEM_UNKNOWN) {
+			stype = detect_system_type(&media);
+		}
+		free(media.extension);
+		sha1(media.buffer, media.size, meta->sha1);
+	}
+	meta->system = stype;
+	meta->regions = 0;
+	meta->save_type = SAVE_NONE;
+	if (stype == SYSTEM_GENESIS) {
+		SDL_LockMutex(scan_db_lock);
+			describe_rom(scan_db, media.buffer, media.size, meta->sha1, &meta->title, &meta->regions, &meta->save_type);
+		SDL_UnlockMutex(scan_db_lock);
+	} else {
+		meta->title = basename_no_extension(scan->names[index]);
+	}
+	if (media.size) {
+		rom_free(media.buffer);
+	}
+	free(path);
+	SDL_AtomicSet(scan->state + index, SCAN_DONE);
+}
+
+static int scan_thread(void *data)
+{
+	rom_scan *scan = data;
+	while (!SDL_AtomicGet(&scan->stop))
+	{
+		uint32_t index = SDL_AtomicAdd(&scan->next, 1);
+		if (index >= scan->count) {
+			break;
+		}
+		int state = SDL_AtomicGet(scan->state + index);
+		if (state == SCAN_PENDING || state == SCAN_CACHED) {
+			scan_file(scan, index);
+		}
+	}
+	return 0;
+}
+
+rom_scan *romcache_scan(const char *dir, dir_entry *entries, size_t num_entries, char **ext_list, uint32_t num_exts)
+{
+	rom_scan *scan = calloc(1, sizeof(rom_scan));
+	scan->dir = strdup(dir);
+	scan->cache_path = cache_path(dir);
+	scan->count = num_entries;
+	scan->names = calloc(num_entries, sizeof(char *));
+	scan->cached = calloc(num_entries, sizeof(rom_metadata));
+	scan->scanned = calloc(num_entries, sizeof(rom_metadata));
+	scan->state = calloc(num_entries, sizeof(SDL_atomic_t));
+	load_cache(scan->cache_path, &scan->cache);
+	uint8_t needs_scan = 0;
+	for (size_t i = 0; i < num_entries; i++)
+	{
+		if (entries[i].is_dir || (num_exts && !path_matches_extensions(entries[i].name, ext_list, num_exts))) {
+			continue;
+		}
+		scan->names[i] = strdup(entries[i].name);
+		rom_metadata *cached = cache_find(&scan->cache, entries[i].name);
+		if (cached) {
+			scan->cached[i] = *cached;
+			SDL_AtomicSet(scan->state + i, SCAN_CACHED);
+		} else {
+			SDL_AtomicSet(scan->state + i, SCAN_PENDING);
+		}
+		needs_scan = 1;
+	}
+	if (!needs_scan) {
+		return scan;
+	}
+	if (!scan_db) {
+		scan_db = load_rom_db();
+		scan_db_lock = SDL_CreateMutex();
+	}
+	uint32_t num_threads = SDL_GetCPUCount();
+	if (!num_threads) {
+		num_threads = 1;
+	} else if (num_threads > MAX_SCAN_THREADS) {
+		num_threads = MAX_SCAN_THREADS;
+	}
+	for (uint32_t i = 0; i < num_threads; i++)
+	{
+		scan->threads[scan->num_threads] = SDL_CreateThread(scan_thread, "ROM scanner", scan);
+		if (scan->threads[scan->num_threads]) {
+			scan->num_threads++;
+		}
+	}
+	if (!scan->num_threads) {
+		warning("Failed to start ROM scanner: %s\n", SDL_GetError());
+	}
+	return scan;
+}
+
+rom_metadata *romcache_get(rom_scan *scan, size_t index)
+{
+	rom_metadata *meta;
+	switch (SDL_AtomicGet(scan->state + index))
+	{
+	case SCAN_CACHED:
+	case SCAN_VERIFIED:
+		meta = scan->cached + index;
+		break;
+	case SCAN_DONE:
+		meta = scan->scanned + index;
+		break;
+	default:
+		return NULL;
+	}
+	return meta->system == SYSTEM_UNKNOWN ? NULL : meta;
+}
+
+static void save_cache(rom_scan *scan)
+{
+	char *dir = path_dirname(scan->cache_path);
+	uint8_t dir_ok = ensure_dir_exists(dir);
+	free(dir);
+	if (!dir_ok) {
+		return;
+	}
+	//written to a temporary file and renamed over the old cache so a crash never leaves a truncated one
+	char *tmp_path = alloc_concat(scan->cache_path, ".tmp");
+	FILE *f = fopen(tmp_path, "wb");
+	if (!f) {
+		free(tmp_path);
+		return;
+	}
+	//a file rewritten in the same timestamp tick it was hashed in would still match its cached mtime,
+	//so recently modified files are stored without one and get hashed again next time
+	uint64_t racy_after = (uint64_t)(time(NULL) - 2) * 1000000000ULL;
+	uint8_t header[CACHE_HEADER_SIZE];
+	memcpy(header, cache_magic, sizeof(cache_magic));
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < scan->count; i++)
+	{
+		int state = SDL_AtomicGet(scan->state + i);
+		count += state == SCAN_CACHED || state == SCAN_VERIFIED || state == SCAN_DONE;
+	}
+	write_le(header + 4, count, 4);
+	fwrite(header, 1, sizeof(header), f);
+	for (uint32_t i = 0; i < scan->count; i++)
+	{
+		int state = SDL_AtomicGet(scan->state + i);
+		rom_metadata *meta;
+		if (state == SCAN_DONE) {
+			meta = scan->scanned + i;
+		} else if (state == SCAN_CACHED || state == SCAN_VERIFIED) {
+			meta = scan->cached + i;
+		} else {
+			continue;
+		}
+		size_t name_len = strlen(scan->names[i]);
+		size_t title_len = strlen(meta->title);
+		uint8_t record[CACHE_RECORD_SIZE];
+		write_le(record, meta->size, 8);
+		write_le(record + 8, meta->mtime >= racy_after ? 0 : meta->mtime, 8);
+		memcpy(record + 16, meta->sha1, sizeof(meta->sha1));
+		record[36] = meta->system;
+		record[37] = meta->regions;
+		record[38] = meta->save_type;
+		write_le(record + 39, name_len, 2);
+		write_le(record + 41, title_len, 2);
+		fwrite(record, 1, sizeof(record), f);
+		fwrite(scan->names[i], 1, name_len, f);
+		fwrite(meta->title, 1, title_len, f);
+	}
+	uint8_t ok = !ferror(f);
+	ok = !fclose(f) && ok;
+	if (ok) {
+#ifdef _WIN32
+		//rename won't replace an existing file on Windows
+		remove(scan->cache_path);
+#endif
+		ok = !rename(tmp_path, scan->cache_path);
+	}
+	if (!ok) {
+		remove(tmp_path);
+	}
+	free(tmp_path);
+}
+
+void romcache_end_scan(rom_scan *scan)
+{
+	SDL_AtomicSet(&scan->stop, 1);
+	for (uint32_t i = 0; i < scan->num_threads; i++)
+	{
+		SDL_WaitThread(scan->threads[i], NULL);
+	}
+	//only rewrite the cache when something changed, entries for files that
+	//are gone from the directory get dropped along the way
+	uint8_t changed = 0;
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < scan->count; i++)
+	{
+		int state = SDL_AtomicGet(scan->state + i);
+		changed |= state == SCAN_DONE;
+		kept += state == SCAN_CACHED || state == SCAN_VERIFIED;
+	}
+	if (scan->cache_path && (changed || kept != scan->cache.count)) {
+		save_cache(scan);
+	}
+	for (uint32_t i = 0; i < scan->count; i++)
+	{
+		free(scan->names[i]);
+		free(scan->scanned[i].title);
+	}
+	free_cache(&scan->cache);
+	free(scan->names);
+	free(scan->cached);
+	free(scan->scanned);
+	free(scan->state);
+	free(scan->dir);
+	free(scan->cache_path);
+	free(scan);
+}
+
+uint8_t romcache_lookup(const char *path, rom_metadata *out)
+{
+	char *dir = path_dirname(path);
+	char *cpath = dir ? cache_path(dir) : NULL;
+	free(dir);
+	if (!cpath) {
+		return 0;
+	}
+	cache_file cache;
+	load_cache(cpath, &cache);
+	free(cpath);
+	char const *name = strrchr(path, PATH_SEP[0]);
+	name = name ? name + 1 : path;
+	rom_metadata *meta = cache_find(&cache, name);
+	uint64_t size, mtime;
+	uint8_t ret = meta && meta->system != SYSTEM_UNKNOWN && stat_rom(path, &size, &mtime)
+		&& meta->size == size && meta->mtime == mtime;
+	if (ret) {
+		*out = *meta;
+		out->title = strdup(meta->title);
+	}
+	free_cache(&cache);
+	return ret;
+}
@@ -0,0 +1,32 @@
+#ifndef ROMCACHE_H_
+#define ROMCACHE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "util.h"
+
+typedef struct {
+	char     *title;     //ROM DB or header name
+	uint64_t size;
+	uint64_t mtime;
+	uint8_t  sha1[20];   //hash of the image as returned by load_rom
+	uint8_t  system;     //system_type, SYSTEM_UNKNOWN for files that aren't ROMs
+	uint8_t  regions;    //REGION_* bits, Genesis only
+	uint8_t  save_type;  //SAVE_* or RAM_FLAG_* value from romdb.h
+} rom_metadata;
+
+typedef struct rom_scan rom_scan;
+
+//Starts scanning the ROMs in a directory listing on background threads.
+//Metadata cached from an earlier scan is available immediately and is checked against
+//each file's size and modification time as the scanner reaches it.
+rom_scan *romcache_scan(const char *dir, dir_entry *entries, size_t num_entries, char **ext_list, uint32_t num_exts);
+//returns NULL until metadata is known for the entry or if it is not a ROM
+rom_metadata *romcache_get(rom_scan *scan, size_t index);
+//stops the scanner threads and writes any new metadata back to the cache
+void romcache_end_scan(rom_scan *scan);
+//checks a single file against its directory's cache, returns 0 if it is missing or stale
+//on success out->title must be freed by the caller
+uint8_t romcache_lookup(const char *path, rom_metadata *out);
+
+#endif //ROMCACHE_H_
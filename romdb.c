@@ -13,6 +13,17 @@
 #include "multi_game.h"
 #include "megawifi.h"
 #include "blastem.h"
+#include "romload.h"
+#include "saves.h"
+#include "pacing.h"
+#include "startup.h"
+#include <SDL.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #define DOM_TITLE_START 0x120
 #define DOM_TITLE_END 0x150
@@ -35,20 +46,173 @@ char const *save_type_name(uint8_t save_type)
 	return "SRAM";
 }
 
-tern_node *load_rom_db()
+struct rom_database {
+	tern_node *text;   //only used when rom.bdb is missing or stale
+	tern_node *parsed; //entries from rom.bdb that have been looked up so far
+	uint8_t   *data;
+	uint32_t  size;
+	uint32_t  count;
+};
+
+static uint32_t read_le32(uint8_t *src)
+{
+	return src[0] | src[1] << 8 | src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+static uint8_t map_binary_rom_db(rom_database *db)
+{
+#if defined(_WIN32) || defined(__ANDROID__)
+	uint32_t size;
+	db->data = (uint8_t *)read_bundled_file("rom.bdb", &size);
+	if (!db->data) {
+		return 0;
+	}
+	db->size = size;
+#else
+	char *exe_dir = get_exe_dir();
+	if (!exe_dir) {
+		return 0;
+	}
+	char const *bin_pieces[] = {exe_dir, PATH_SEP, "rom.bdb"};
+	char const *text_pieces[] = {exe_dir, PATH_SEP, "rom.db"};
+	char *bin_path = alloc_concat_m(3, bin_pieces);
+	char *text_path = alloc_concat_m(3, text_pieces);
+	//someone edited rom.db without rebuilding rom.bdb, the text wins
+	uint8_t stale = get_modification_time(text_path) > get_modification_time(bin_path);
+	int fd = stale ? -1 : open(bin_path, O_RDONLY);
+	free(bin_path);
+	free(text_path);
+	if (fd < 0) {
+		return 0;
+	}
+	struct stat st;
+	if (fstat(fd, &st) || !st.st_size || st.st_size > UINT32_MAX) {
+		close(fd);
+		return 0;
+	}
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return 0;
+	}
+	db->data = data;
+	db->size = st.st_size;
+#endif
+	if (
+		db->size < ROMDB_HEADER_SIZE || memcmp(db->data, ROMDB_MAGIC, 4)
+		|| (uint64_t)read_le32(db->data + 4) * ROMDB_RECORD_SIZE > db->size - ROMDB_HEADER_SIZE
+	) {
+		warning("rom.bdb is corrupt, falling back to rom.db\n");
+#if defined(_WIN32) || defined(__ANDROID__)
+		free(db->data);
+#else
+		munmap(db->data, db->size);
+#endif
+		db->data = NULL;
+		return 0;
+	}
+	db->count = read_le32(db->data + 4);
+	return 1;
+}
+
+rom_database *load_rom_db()
 {
-	tern_node *db = parse_bundled_config("rom.db");
-	if (!db) {
-		fatal_error("Failed to load ROM DB\n");
+	rom_database *db = calloc(1, sizeof(rom_database));
+	if (!map_binary_rom_db(db)) {
+		db->text = parse_bundled_config("rom.db");
+		if (!db->text) {
+			fatal_error("Failed to load ROM DB\n");
+		}
 	}
 	return db;
 }
 
+static rom_database *preloaded_db;
+static SDL_Thread   *preload_thread;
+
+static int preload_main(void *data)
+{
+	uint64_t start = pacing_now_ns();
+	preloaded_db = load_rom_db();
+	startup_background_phase("ROM DB", pacing_now_ns() - start);
+	return 0;
+}
+
+void preload_rom_db(void)
+{
+	//get_exe_dir caches its result without a lock, fill it in before anything else can race for it
+	get_exe_dir();
+	preload_thread = SDL_CreateThread(preload_main, "ROM DB loader", NULL);
+}
+
+rom_database *get_preloaded_rom_db(void)
+{
+	static SDL_SpinLock lock;
+	SDL_AtomicLock(&lock);
+		if (preload_thread) {
+			SDL_WaitThread(preload_thread, NULL);
+			preload_thread = NULL;
+		}
+		if (!preloaded_db) {
+			preloaded_db = load_rom_db();
+		}
+	SDL_AtomicUnlock(&lock);
+	return preloaded_db;
+}
+
+tern_node *rom_db_find(rom_database *db, char *key)
+{
+	if (!db->data) {
+		return tern_find_node(db->text, key);
+	}
+	size_t len = strlen(key);
+	if (!len || len > ROMDB_KEY_LEN) {
+		return NULL;
+	}
+	tern_node *entry = tern_find_node(db->parsed, key);
+	if (entry) {
+		return entry;
+	}
+	char padded[ROMDB_KEY_LEN];
+	memset(padded, 0, sizeof(padded));
+	memcpy(padded, key, len);
+	uint32_t lo = 0, hi = db->count;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		uint8_t *record = db->data + ROMDB_HEADER_SIZE + mid * ROMDB_RECORD_SIZE;
+		int diff = memcmp(record, padded, ROMDB_KEY_LEN);
+		if (diff < 0) {
+			lo = mid + 1;
+		} else if (diff > 0) {
+			hi = mid;
+		} else {
+			uint32_t offset = read_le32(record + ROMDB_KEY_LEN);
+			uint32_t size = read_le32(record + ROMDB_KEY_LEN + 4);
+			if (offset > db->size || size > db->size - offset) {
+				warning("rom.bdb entry for %s is out of bounds\n", key);
+				return NULL;
+			}
+			//entries are only parsed on first use and kept since rom_info points into them
+			char *text = malloc(size + 1);
+			memcpy(text, db->data + offset, size);
+			text[size] = 0;
+			entry = parse_config(text);
+			free(text);
+			if (entry) {
+				db->parsed = tern_insert_node(db->parsed, key, entry);
+			}
+			return entry;
+		}
+	}
+	return NULL;
+}
+
 void free_rom_info(rom_info *info)
 {
 	free(info->name);
 	if (info->save_type != SAVE_NONE) {
-		free(info->save_buffer);
+		free_save_buffer(info->save_buffer, info->save_size);
 		if (info->save_type == SAVE_I2C) {
 			free(info->eeprom_map);
 		} else if (info->save_type == SAVE_NOR) {
@@ -241,7 +405,7 @@ uint32_t read_ram_header(rom_info *info, uint8_t *rom)
 		save_size /= 2;
 	}
 	info->save_size = save_size;
-	info->save_buffer = malloc(save_size);
+	info->save_buffer = alloc_save_buffer(save_size);
 	return ram_start;
 }
 
@@ -384,7 +548,7 @@ typedef struct {
 	uint8_t      *rom;
 	uint8_t      *lock_on;
 	tern_node    *root;
-	tern_node    *rom_db;
+	rom_database *rom_db;
 	uint32_t     rom_size;
 	uint32_t     lock_on_size;
 	int          index;
@@ -448,8 +612,7 @@ void process_sram_def(char *key, map_iter_state *state)
 			fatal_error("SRAM size %s is invalid\n", size);
 		}
 		state->info->save_mask = nearest_pow2(state->info->save_size)-1;
-		state->info->save_buffer = malloc(state->info->save_size);
-		memset(state->info->save_buffer, 0, state->info->save_size);
+		state->info->save_buffer = alloc_save_buffer(state->info->save_size);
 		char *bus = tern_find_path(state->root, "SRAM\0bus\0", TVAL_PTR).ptrval;
 		if (!strcmp(bus, "odd")) {
 			state->info->save_type = RAM_FLAG_ODD;
@@ -481,7 +644,7 @@ void process_eeprom_def(char * key, map_iter_state *state)
 		} else {
 			fatal_error("EEPROM type %s is invalid\n", etype);
 		}
-		state->info->save_buffer = malloc(state->info->save_size);
+		state->info->save_buffer = alloc_save_buffer(state->info->save_size);
 		memset(state->info->save_buffer, 0xFF, state->info->save_size);
 		state->info->eeprom_map = malloc(sizeof(eeprom_map) * state->num_els);
 		memset(state->info->eeprom_map, 0, sizeof(eeprom_map) * state->num_els);
@@ -521,7 +684,7 @@ void process_nor_def(char *key, map_iter_state *state)
 			state->info->save_bus = RAM_FLAG_BOTH;
 		}
 		state->info->save_type = SAVE_NOR;
-		state->info->save_buffer = malloc(state->info->save_size);
+		state->info->save_buffer = alloc_save_buffer(state->info->save_size);
 		char *init = tern_find_path_default(state->root, "NOR\0init\0", (tern_val){.ptrval="FF"}, TVAL_PTR).ptrval;
 		if (!strcmp(init, "ROM")) {
 			uint32_t init_size = state->rom_size > state->info->save_size ? state->info->save_size : state->rom_size;
@@ -591,10 +754,10 @@ void map_iter_fun(char *key, tern_val val, uint8_t valtype, void *data)
 	} else if (!strcmp(dtype, "LOCK-ON")) {
 		rom_info lock_info;
 		if (state->lock_on) {
-			lock_info = configure_rom(state->rom_db, state->lock_on, state->lock_on_size, NULL, 0, NULL, 0);
+			lock_info = configure_rom(state->rom_db, state->lock_on, state->lock_on_size, NULL, NULL, 0, NULL, 0);
 		} else if (state->rom_size > start) {
 			//This is a bit of a hack to deal with pre-combined S3&K/S2&K ROMs and S&K ROM hacks
-			lock_info = configure_rom(state->rom_db, state->rom + start, state->rom_size - start, NULL, 0, NULL, 0);
+			lock_info = configure_rom(state->rom_db, state->rom + start, state->rom_size - start, NULL, NULL, 0, NULL, 0);
 		} else {
 			//skip this entry if there is no lock on cartridge attached
 			return;
@@ -786,7 +949,7 @@ void map_iter_fun(char *key, tern_val val, uint8_t valtype, void *data)
 		state->info->mapper_type = MAPPER_MULTI_GAME;
 		state->info->mapper_start_index = state->ptr_index++;
 		//make a mirror copy of the ROM so we can efficiently support arbitrary start offsets
-		state->rom = realloc(state->rom, state->rom_size * 2);
+		state->rom = rom_realloc(state->rom, state->rom_size * 2);
 		memcpy(state->rom + state->rom_size, state->rom, state->rom_size);
 		state->rom_size *= 2;
 		//make room for an extra map entry
@@ -825,30 +988,97 @@ void map_iter_fun(char *key, tern_val val, uint8_t valtype, void *data)
 	state->index++;
 }
 
-rom_info configure_rom(tern_node *rom_db, void *vrom, uint32_t rom_size, void *lock_on, uint32_t lock_on_size, memmap_chunk const *base_map, uint32_t base_chunks)
+static void get_product_id(uint8_t *rom, uint32_t rom_size, uint8_t *product_id)
 {
-	uint8_t product_id[GAME_ID_LEN+1];
-	uint8_t *rom = vrom;
 	product_id[GAME_ID_LEN] = 0;
 	for (int i = 0; i < GAME_ID_LEN; i++)
 	{
-		if (rom[GAME_ID_OFF + i] <= ' ') {
+		if (GAME_ID_OFF + i >= rom_size || rom[GAME_ID_OFF + i] <= ' ') {
 			product_id[i] = 0;
 			break;
 		}
 		product_id[i] = rom[GAME_ID_OFF + i];
 
 	}
+}
+
+static tern_node *find_rom_entry(rom_database *rom_db, uint8_t *product_id, uint8_t const *raw_hash)
+{
+	uint8_t hex_hash[41];
+	bin_to_hex(hex_hash, raw_hash, 20);
+	tern_node * entry = rom_db_find(rom_db, (char *)hex_hash);
+	if (!entry) {
+		entry = rom_db_find(rom_db, (char *)product_id);
+	}
+	return entry;
+}
+
+typedef struct {
+	uint8_t save_type;
+} save_iter_state;
+
+static void save_iter_fun(char *key, tern_val val, uint8_t valtype, void *data)
+{
+	if (valtype != TVAL_NODE) {
+		return;
+	}
+	save_iter_state *state = data;
+	char *dtype = tern_find_ptr_default(val.ptrval, "device", "ROM");
+	char *save_device = tern_find_path(val.ptrval, "save\0device\0", TVAL_PTR).ptrval;
+	if (!strcmp(dtype, "EEPROM") || (save_device && !strcmp(save_device, "EEPROM"))) {
+		state->save_type = SAVE_I2C;
+	} else if (!strcmp(dtype, "NOR")) {
+		state->save_type = SAVE_NOR;
+	} else if (!strcmp(dtype, "SRAM") && state->save_type == SAVE_NONE) {
+		state->save_type = RAM_FLAG_BOTH;
+	}
+}
+
+void describe_rom(rom_database *rom_db, uint8_t *rom, uint32_t rom_size, uint8_t const *sha1_hash, char **name, uint8_t *regions, uint8_t *save_type)
+{
+	uint8_t product_id[GAME_ID_LEN+1];
+	get_product_id(rom, rom_size, product_id);
+	tern_node *entry = find_rom_entry(rom_db, product_id, sha1_hash);
+	char *dbname = tern_find_ptr(entry, "name");
+	uint8_t has_header = rom_size >= ROM_END;
+	*name = dbname ? strdup(dbname) : has_header ? get_header_name(rom) : strdup("UNKNOWN");
+	*regions = 0;
+	for (char *dbreg = tern_find_ptr(entry, "regions"); dbreg && *dbreg; dbreg++)
+	{
+		*regions |= translate_region_char(*dbreg);
+	}
+	if (!*regions && rom_size > REGION_START + 3) {
+		*regions = get_header_regions(rom);
+	}
+	tern_node *map = tern_find_node(entry, "map");
+	if (map) {
+		save_iter_state state = {SAVE_NONE};
+		tern_foreach(map, save_iter_fun, &state);
+		*save_type = state.save_type;
+	} else if (has_ram_header(rom, rom_size)) {
+		*save_type = rom[RAM_FLAGS] & RAM_FLAG_MASK;
+	} else {
+		*save_type = SAVE_NONE;
+	}
+}
+
+rom_info configure_rom(rom_database *rom_db, void *vrom, uint32_t rom_size, uint8_t const *sha1_hash, void *lock_on, uint32_t lock_on_size, memmap_chunk const *base_map, uint32_t base_chunks)
+{
+	uint8_t product_id[GAME_ID_LEN+1];
+	uint8_t *rom = vrom;
+	get_product_id(rom, rom_size, product_id);
 	printf("Product ID: %s\n", product_id);
 	uint8_t raw_hash[20];
-	sha1(vrom, rom_size, raw_hash);
+	if (sha1_hash) {
+		//the ROM cache already hashed this file
+		memcpy(raw_hash, sha1_hash, sizeof(raw_hash));
+	} else {
+		sha1(vrom, rom_size, raw_hash);
+	}
 	uint8_t hex_hash[41];
 	bin_to_hex(hex_hash, raw_hash, 20);
 	printf("SHA1: %s\n", hex_hash);
-	tern_node * entry = tern_find_node(rom_db, hex_hash);
-	if (!entry) {
-		entry = tern_find_node(rom_db, product_id);
-	}
+	tern_node * entry = find_rom_entry(rom_db, product_id, raw_hash);
 	if (!entry) {
 		puts("Not found in ROM DB, examining header\n");
 		if (xband_detect(rom, rom_size)) {
@@ -16,6 +16,30 @@
 #include "tern.h"
 #include "serialize.h"
 
+//range of a battery save written since it was last flushed to disk, empty when start >= end
+typedef struct save_dirty {
+	uint32_t start;
+	uint32_t end;
+} save_dirty;
+
+static inline void mark_save_dirty(save_dirty *dirty, uint32_t offset, uint32_t size)
+{
+	if (!dirty) {
+		return;
+	}
+	if (dirty->start >= dirty->end) {
+		dirty->start = offset;
+		dirty->end = offset + size;
+	} else {
+		if (offset < dirty->start) {
+			dirty->start = offset;
+		}
+		if (offset + size > dirty->end) {
+			dirty->end = offset + size;
+		}
+	}
+}
+
 typedef struct {
 	uint32_t     start;
 	uint32_t     end;
@@ -27,6 +51,7 @@ typedef struct {
 typedef struct {
 	uint8_t     *buffer;
 	uint8_t     *page_buffer;
+	save_dirty  *dirty;
 	uint32_t    size;
 	uint32_t    page_size;
 	uint32_t    current_page;
@@ -80,8 +105,28 @@ struct rom_info {
 #define GAME_ID_OFF 0x183
 #define GAME_ID_LEN 8
 
-tern_node *load_rom_db();
-rom_info configure_rom(tern_node *rom_db, void *vrom, uint32_t rom_size, void *lock_on, uint32_t lock_on_size, memmap_chunk const *base_map, uint32_t base_chunks);
+//rom.bdb is a precompiled form of rom.db built by romdbc, all integers are little endian
+//header: ROMDB_MAGIC followed by a 32-bit key count
+//index: one record per SHA-1 or product ID key sorted with memcmp, each holding the key
+//NUL padded to ROMDB_KEY_LEN bytes and the 32-bit offset and size of the entry's config text
+#define ROMDB_MAGIC "BRDB"
+#define ROMDB_HEADER_SIZE 8
+#define ROMDB_KEY_LEN 40
+#define ROMDB_RECORD_SIZE (ROMDB_KEY_LEN + 8)
+
+typedef struct rom_database rom_database;
+
+rom_database *load_rom_db();
+//starts loading the ROM DB on a background thread so it's ready by the time the first ROM is configured
+void preload_rom_db(void);
+//waits for the DB started by preload_rom_db, loads it right away if no preload was started
+//the returned DB is shared and, like any rom_database, should only be used from one thread at a time
+rom_database *get_preloaded_rom_db(void);
+tern_node *rom_db_find(rom_database *db, char *key);
+//sha1_hash can be NULL, in which case the ROM is hashed here
+rom_info configure_rom(rom_database *rom_db, void *vrom, uint32_t rom_size, uint8_t const *sha1_hash, void *lock_on, uint32_t lock_on_size, memmap_chunk const *base_map, uint32_t base_chunks);
+//fills in the name, regions and save type configure_rom would find without building a memory map
+void describe_rom(rom_database *rom_db, uint8_t *rom, uint32_t rom_size, uint8_t const *sha1_hash, char **name, uint8_t *regions, uint8_t *save_type);
 rom_info configure_rom_heuristics(uint8_t *rom, uint32_t rom_size, memmap_chunk const *base_map, uint32_t base_chunks);
 uint8_t translate_region_char(uint8_t c);
 char const *save_type_name(uint8_t save_type);
@@ -0,0 +1,112 @@
+/*
+ Copyright 2013-2016 Michael Pavone
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+//Compiles rom.db into the indexed binary form loaded by load_rom_db, see romdb.h for the layout
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "romdb.h"
+#include "util.h"
+
+int headless = 1;
+tern_node *config;
+
+void render_errorbox(char *title, char *message)
+{
+}
+
+void render_infobox(char *title, char *message)
+{
+}
+
+typedef struct {
+	char     key[ROMDB_KEY_LEN];
+	char     *text;
+	uint32_t size;
+} db_entry;
+
+typedef struct {
+	db_entry *entries;
+	uint32_t count;
+	uint32_t storage;
+} collect_state;
+
+static void collect_entry(char *key, tern_val val, uint8_t valtype, void *data)
+{
+	collect_state *state = data;
+	if (valtype != TVAL_NODE) {
+		warning("Ignoring top level value %s\n", key);
+		return;
+	}
+	size_t len = strlen(key);
+	if (len > ROMDB_KEY_LEN) {
+		fatal_error("Key %s is longer than %d characters\n", key, ROMDB_KEY_LEN);
+	}
+	if (state->count == state->storage) {
+		state->storage = state->storage ? state->storage * 2 : 1024;
+		state->entries = realloc(state->entries, state->storage * sizeof(db_entry));
+	}
+	db_entry *entry = state->entries + state->count++;
+	memset(entry->key, 0, sizeof(entry->key));
+	memcpy(entry->key, key, len);
+	entry->text = serialize_config(val.ptrval, &entry->size);
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+	return memcmp(((const db_entry *)a)->key, ((const db_entry *)b)->key, ROMDB_KEY_LEN);
+}
+
+static void write_le32(uint8_t *dst, uint32_t value)
+{
+	dst[0] = value;
+	dst[1] = value >> 8;
+	dst[2] = value >> 16;
+	dst[3] = value >> 24;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		fatal_error("Usage: romdbc rom.db rom.bdb\n");
+	}
+	tern_node *db = parse_config_file(argv[1]);
+	if (!db) {
+		fatal_error("Failed to load %s\n", argv[1]);
+	}
+	collect_state state = {0};
+	tern_foreach(db, collect_entry, &state);
+	qsort(state.entries, state.count, sizeof(db_entry), compare_entries);
+
+	uint32_t header_size = ROMDB_HEADER_SIZE + state.count * ROMDB_RECORD_SIZE;
+	uint8_t *header = calloc(1, header_size);
+	memcpy(header, ROMDB_MAGIC, 4);
+	write_le32(header + 4, state.count);
+	uint32_t offset = header_size;
+	for (uint32_t i = 0; i < state.count; i++)
+	{
+		uint8_t *record = header + ROMDB_HEADER_SIZE + i * ROMDB_RECORD_SIZE;
+		memcpy(record, state.entries[i].key, ROMDB_KEY_LEN);
+		write_le32(record + ROMDB_KEY_LEN, offset);
+		write_le32(record + ROMDB_KEY_LEN + 4, state.entries[i].size);
+		offset += state.entries[i].size;
+	}
+
+	FILE *f = fopen(argv[2], "wb");
+	if (!f) {
+		fatal_error("Failed to open %s for writing\n", argv[2]);
+	}
+	uint8_t ok = fwrite(header, 1, header_size, f) == header_size;
+	for (uint32_t i = 0; ok && i < state.count; i++)
+	{
+		ok = fwrite(state.entries[i].text, 1, state.entries[i].size, f) == state.entries[i].size;
+	}
+	if (fclose(f) || !ok) {
+		remove(argv[2]);
+		fatal_error("Failed to write %s\n", argv[2]);
+	}
+	return 0;
+}
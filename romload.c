@@ -0,0 +1,318 @@
+/*
+ Copyright 2013-2016 Michael Pavone
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <SDL.h>
+#include "romload.h"
+#include "util.h"
+#include "zip.h"
+
+#define SMD_HEADER_SIZE 512
+#define SMD_MAGIC1 0x03
+#define SMD_MAGIC2 0xAA
+#define SMD_MAGIC3 0xBB
+#define SMD_BLOCK_SIZE 0x4000
+
+#ifdef DISABLE_ZLIB
+#define ROMFILE FILE*
+#define romopen fopen
+#define romread fread
+#define romseek fseek
+#define romgetc fgetc
+#define romclose fclose
+#else
+#include "zlib/zlib.h"
+#define ROMFILE gzFile
+#define romopen gzopen
+#define romread gzfread
+#define romseek gzseek
+#define romgetc gzgetc
+#define romclose gzclose
+#endif
+
+//smallest buffer handed out by the loaders, code that masks ROM addresses may read up to the next power of two
+#define MIN_ROM_BUFFER (512 * 1024)
+
+#ifndef _WIN32
+typedef struct {
+	void   *base;
+	size_t size;
+} mapped_rom;
+
+//ROMs are freed on whichever thread ran their system
+static SDL_SpinLock mapped_lock;
+static mapped_rom   *mapped;
+static uint32_t     num_mapped, mapped_storage;
+
+static size_t find_mapped(void *rom)
+{
+	size_t size = 0;
+	SDL_AtomicLock(&mapped_lock);
+		for (uint32_t i = 0; i < num_mapped; i++)
+		{
+			if (mapped[i].base == rom) {
+				size = mapped[i].size;
+				mapped[i] = mapped[--num_mapped];
+				break;
+			}
+		}
+	SDL_AtomicUnlock(&mapped_lock);
+	return size;
+}
+
+//Maps an uncompressed ROM privately so the file contents come straight from the page cache.
+//The mapping is padded with zero pages to the same power of two size the read path allocates.
+static uint32_t map_rom(const char *filename, void **dst)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+	struct stat st;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size || st.st_size > 0x7FFFFFFF) {
+		close(fd);
+		return 0;
+	}
+	size_t size = nearest_pow2(st.st_size);
+	if (size < MIN_ROM_BUFFER) {
+		size = MIN_ROM_BUFFER;
+	}
+	uint8_t *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		close(fd);
+		return 0;
+	}
+	if (mmap(base, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(base, size);
+		close(fd);
+		return 0;
+	}
+	close(fd);
+	SDL_AtomicLock(&mapped_lock);
+		if (num_mapped == mapped_storage) {
+			mapped_storage = mapped_storage ? mapped_storage * 2 : 4;
+			mapped = realloc(mapped, mapped_storage * sizeof(mapped_rom));
+		}
+		mapped[num_mapped++] = (mapped_rom){base, size};
+	SDL_AtomicUnlock(&mapped_lock);
+	*dst = base;
+	return st.st_size;
+}
+#endif
+
+void rom_free(void *rom)
+{
+#ifndef _WIN32
+	size_t size = find_mapped(rom);
+	if (size) {
+		munmap(rom, size);
+		return;
+	}
+#endif
+	free(rom);
+}
+
+void *rom_realloc(void *rom, size_t size)
+{
+#ifndef _WIN32
+	size_t old_size = find_mapped(rom);
+	if (old_size) {
+		void *ret = malloc(size);
+		memcpy(ret, rom, size < old_size ? size : old_size);
+		munmap(rom, old_size);
+		return ret;
+	}
+#endif
+	return realloc(rom, size);
+}
+
+static int load_smd_rom(ROMFILE f, void **buffer)
+{
+	uint8_t block[SMD_BLOCK_SIZE];
+	romseek(f, SMD_HEADER_SIZE, SEEK_SET);
+
+	size_t filesize = 512 * 1024;
+	size_t readsize = 0;
+	uint16_t *dst = malloc(filesize);
+	
+
+	size_t read;
+	do {
+		if ((readsize + SMD_BLOCK_SIZE > filesize)) {
+			filesize *= 2;
+			dst = realloc(dst, filesize);
+		}
+		read = romread(block, 1, SMD_BLOCK_SIZE, f);
+		if (read > 0) {
+			for (uint8_t *low = block, *high = (block+read/2), *end = block+read; high < end; high++, low++) {
+				*(dst++) = *low << 8 | *high;
+			}
+			readsize += read;
+		}
+	} while(read > 0);
+	romclose(f);
+	
+	*buffer = dst;
+	
+	return readsize;
+}
+
+//loads the named member, or the first one that looks like a ROM when member is NULL
+static uint32_t load_rom_zip(const char *filename, const char *member, void **dst)
+{
+	static const char *valid_exts[] = {"bin", "md", "gen", "sms", "rom"};
+	const uint32_t num_exts = sizeof(valid_exts)/sizeof(*valid_exts);
+	zip_file *z = zip_open(filename);
+	if (!z) {
+		return 0;
+	}
+	if (member) {
+		int32_t i = zip_find(z, member);
+		uint32_t ret = 0;
+		if (i >= 0) {
+			size_t out_size = nearest_pow2(z->entries[i].size);
+			*dst = zip_read(z, i, &out_size);
+			if (*dst) {
+				ret = out_size;
+			}
+		}
+		zip_close(z);
+		return ret;
+	}
+	
+	for (uint32_t i = 0; i < z->num_entries; i++)
+	{
+		char *ext = path_extension(z->entries[i].name);
+		if (!ext) {
+			continue;
+		}
+		for (uint32_t j = 0; j < num_exts; j++)
+		{
+			if (!strcasecmp(ext, valid_exts[j])) {
+				size_t out_size = nearest_pow2(z->entries[i].size);
+				*dst = zip_read(z, i, &out_size);
+				if (*dst) {
+					free(ext);
+					zip_close(z);
+					return out_size;
+				}
+			}
+		}
+		free(ext);
+	}
+	zip_close(z);
+	return 0;
+}
+
+//ROMs inside archives are addressed as ARCHIVE.zip/MEMBER, returns the archive path for those
+static char *split_member_path(const char *filename, const char **member)
+{
+	for (const char *cur = filename; *cur; cur++)
+	{
+		if (is_path_sep(*cur) && cur - filename >= 4 && !strncasecmp(cur - 4, ".zip", 4)) {
+			*member = cur + 1;
+			char *archive = malloc(cur - filename + 1);
+			memcpy(archive, filename, cur - filename);
+			archive[cur - filename] = 0;
+			return archive;
+		}
+	}
+	return NULL;
+}
+
+uint32_t load_rom(const char * filename, void **dst, system_type *stype)
+{
+	uint8_t header[10];
+	char *ext = path_extension(filename);
+	if (ext && !strcasecmp(ext, "zip")) {
+		free(ext);
+		return load_rom_zip(filename, NULL, dst);
+	}
+	free(ext);
+	ROMFILE f = romopen(filename, "rb");
+	if (!f) {
+		const char *member;
+		char *archive = split_member_path(filename, &member);
+		uint32_t size = archive ? load_rom_zip(archive, member, dst) : 0;
+		free(archive);
+		return size;
+	}
+	//the ROM browser's scanner feeds arbitrary files through here, so bad ones just fail to load
+	if (sizeof(header) != romread(header, 1, sizeof(header), f)) {
+		warning("Error reading from %s\n", filename);
+		romclose(f);
+		return 0;
+	}
+	
+	if (header[1] == SMD_MAGIC1 && header[8] == SMD_MAGIC2 && header[9] == SMD_MAGIC3) {
+		int i;
+		for (i = 3; i < 8; i++) {
+			if (header[i] != 0) {
+				break;
+			}
+		}
+		if (i == 8) {
+			if (header[2]) {
+				warning("%s is a split SMD ROM which is not currently supported\n", filename);
+				romclose(f);
+				return 0;
+			}
+			if (stype) {
+				*stype = SYSTEM_GENESIS;
+			}
+			return load_smd_rom(f, dst);
+		}
+	}
+	
+#ifndef _WIN32
+#ifndef DISABLE_ZLIB
+	if (gzdirect(f)) {
+#endif
+		uint32_t mapped_size = map_rom(filename, dst);
+		if (mapped_size) {
+			romclose(f);
+			return mapped_size;
+		}
+#ifndef DISABLE_ZLIB
+	}
+#endif
+#endif
+	size_t filesize = MIN_ROM_BUFFER;
+	size_t readsize = sizeof(header);
+		
+	char *buf = malloc(filesize);
+	memcpy(buf, header, readsize);
+	
+	size_t read;
+	do {
+		read = romread(buf + readsize, 1, filesize - readsize, f);
+		if (read > 0) {
+			readsize += read;
+			if (readsize == filesize) {
+				int one_more = romgetc(f);
+				if (one_more >= 0) {
+					filesize *= 2;
+					buf = realloc(buf, filesize);
+					buf[readsize++] = one_more;
+				} else {
+					read = 0;
+				}
+			}
+		}
+	} while (read > 0);
+	
+	*dst = buf;
+	
+	romclose(f);
+	return readsize;
+}
@@ -0,0 +1,13 @@
+#ifndef ROMLOAD_H_
+#define ROMLOAD_H_
+
+#include <stddef.h>
+#include "system.h"
+
+//loads a plain, gzipped, zipped or SMD format ROM image, returns the size or 0 on failure
+uint32_t load_rom(const char * filename, void **dst, system_type *stype);
+//ROM buffers may be memory mapped, so buffers from load_rom must be released and resized with these
+void rom_free(void *rom);
+void *rom_realloc(void *rom, size_t size);
+
+#endif //ROMLOAD_H_
@@ -1,11 +1,21 @@
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <SDL.h>
 #include "saves.h"
 #include "util.h"
+#ifndef DISABLE_ZLIB
+#include "zlib/zlib.h"
+#endif
 
 #ifdef _WIN32
 #define localtime_r(a,b) localtime(a)
 #include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 //0123456789012345678901234678
 //Slot N - December 31st, XXXX
@@ -37,6 +47,7 @@ save_slot_info *get_slot_info(system_header *system, uint32_t *num_out)
 	save_slot_info *dst = calloc(11, sizeof(save_slot_info));
 	time_t modtime;
 	struct tm ltime;
+	wait_state_writes();
 	for (uint32_t i = 0; i <= QUICK_SAVE_SLOT; i++)
 	{
 		char * cur = dst[i].desc = malloc(MAX_DESC_SIZE);
@@ -75,3 +86,336 @@ void free_slot_info(save_slot_info *slots)
 	}
 	free(slots);
 }
+
+//states that have been written keep their storage around for the next save
+#define MAX_SPARE_STATES 2
+
+typedef struct state_job state_job;
+struct state_job {
+	state_job *next;
+	char      *path; //NULL for a battery save flush, data then points at the mapped pages
+	uint8_t   *data;
+	size_t    size;
+	size_t    storage;
+};
+
+static SDL_SpinLock writer_spin;
+static SDL_Thread   *writer_thread;
+static SDL_mutex    *writer_lock;
+static SDL_cond     *writer_cond;
+static state_job    *pending_head;
+static state_job    *pending_tail;
+static state_job    *spare_jobs;
+static uint32_t     num_pending, num_spare;
+static uint8_t      writer_quit;
+
+//written to a temporary file and renamed over the destination so a crash
+//or full disk mid-write never clobbers the previous state in that slot
+static void write_state(state_job *job)
+{
+	char *tmp_path = alloc_concat(job->path, ".tmp");
+	uint8_t ok;
+#ifndef DISABLE_ZLIB
+	gzFile f = gzopen(tmp_path, "wb1");
+	ok = f != NULL;
+	if (ok) {
+		ok = gzwrite(f, SZ_IDENT, sizeof(SZ_IDENT) - 1) == sizeof(SZ_IDENT) - 1;
+		ok = ok && gzwrite(f, job->data, job->size) == job->size;
+		ok = gzclose(f) == Z_OK && ok;
+	}
+#else
+	FILE *f = fopen(tmp_path, "wb");
+	ok = f != NULL;
+	if (ok) {
+		ok = fwrite(SZ_IDENT, 1, sizeof(SZ_IDENT) - 1, f) == sizeof(SZ_IDENT) - 1;
+		ok = ok && fwrite(job->data, 1, job->size, f) == job->size;
+		ok = !fclose(f) && ok;
+	}
+#endif
+	if (ok) {
+#ifdef _WIN32
+		//rename won't replace an existing file on Windows
+		remove(job->path);
+#endif
+		ok = !rename(tmp_path, job->path);
+	}
+	if (!ok) {
+		remove(tmp_path);
+		warning("Failed to write save state to %s\n", job->path);
+	}
+	free(tmp_path);
+}
+
+static int writer_main(void *data)
+{
+	SDL_LockMutex(writer_lock);
+	for (;;)
+	{
+		while (!pending_head && !writer_quit)
+		{
+			SDL_CondWait(writer_cond, writer_lock);
+		}
+		state_job *job = pending_head;
+		if (!job) {
+			break;
+		}
+		pending_head = job->next;
+		if (!pending_head) {
+			pending_tail = NULL;
+		}
+		SDL_UnlockMutex(writer_lock);
+
+		if (job->path) {
+			write_state(job);
+			free(job->path);
+			job->path = NULL;
+		} else {
+			flush_save(job->data, job->size);
+			job->data = NULL;
+		}
+
+		SDL_LockMutex(writer_lock);
+		if (!job->data) {
+			free(job);
+		} else if (num_spare < MAX_SPARE_STATES) {
+			job->next = spare_jobs;
+			spare_jobs = job;
+			num_spare++;
+		} else {
+			free(job->data);
+			free(job);
+		}
+		num_pending--;
+		SDL_CondBroadcast(writer_cond);
+	}
+	SDL_UnlockMutex(writer_lock);
+	return 0;
+}
+
+static void state_writer_shutdown(void)
+{
+	SDL_LockMutex(writer_lock);
+		writer_quit = 1;
+		SDL_CondBroadcast(writer_cond);
+	SDL_UnlockMutex(writer_lock);
+	//the writer drains the queue before exiting so no states are lost
+	SDL_WaitThread(writer_thread, NULL);
+	writer_thread = NULL;
+}
+
+static uint8_t init_writer(void)
+{
+	uint8_t ret;
+	SDL_AtomicLock(&writer_spin);
+		if (!writer_lock) {
+			writer_lock = SDL_CreateMutex();
+			writer_cond = SDL_CreateCond();
+			writer_thread = SDL_CreateThread(writer_main, "state writer", NULL);
+			if (writer_thread) {
+				atexit(state_writer_shutdown);
+			} else {
+				warning("Failed to start save state writer thread: %s\n", SDL_GetError());
+			}
+		}
+		ret = writer_thread != NULL;
+	SDL_AtomicUnlock(&writer_spin);
+	return ret;
+}
+
+static void queue_job(state_job *job)
+{
+	SDL_LockMutex(writer_lock);
+		if (pending_tail) {
+			pending_tail->next = job;
+		} else {
+			pending_head = job;
+		}
+		pending_tail = job;
+		num_pending++;
+		SDL_CondBroadcast(writer_cond);
+	SDL_UnlockMutex(writer_lock);
+}
+
+void get_state_buffer(serialize_buffer *buf)
+{
+	state_job *job = NULL;
+	if (init_writer()) {
+		SDL_LockMutex(writer_lock);
+			job = spare_jobs;
+			if (job) {
+				spare_jobs = job->next;
+				num_spare--;
+			}
+		SDL_UnlockMutex(writer_lock);
+	}
+	if (job) {
+		buf->data = job->data;
+		buf->storage = job->storage;
+		buf->size = 0;
+		buf->current_section_start = 0;
+		free(job);
+	} else {
+		init_serialize(buf);
+	}
+}
+
+void save_state_async(serialize_buffer *buf, char *path)
+{
+	if (!init_writer()) {
+		save_to_file(buf, path);
+		free(buf->data);
+		buf->data = NULL;
+		return;
+	}
+	state_job *job = malloc(sizeof(state_job));
+	job->next = NULL;
+	job->path = strdup(path);
+	job->data = buf->data;
+	job->size = buf->size;
+	job->storage = buf->storage;
+	buf->data = NULL;
+	queue_job(job);
+}
+
+void wait_state_writes(void)
+{
+	if (!writer_thread) {
+		return;
+	}
+	SDL_LockMutex(writer_lock);
+		while (num_pending)
+		{
+			SDL_CondWait(writer_cond, writer_lock);
+		}
+	SDL_UnlockMutex(writer_lock);
+}
+
+uint8_t load_state_file(deserialize_buffer *buf, char *path)
+{
+	wait_state_writes();
+#ifdef DISABLE_ZLIB
+	return load_from_file(buf, path);
+#else
+	//gzread passes uncompressed files through untouched, so older states load too
+	gzFile f = gzopen(path, "rb");
+	if (!f) {
+		return 0;
+	}
+	char ident[sizeof(SZ_IDENT) - 1];
+	if (gzread(f, ident, sizeof(ident)) != sizeof(ident) || memcmp(ident, SZ_IDENT, sizeof(ident))) {
+		gzclose(f);
+		return 0;
+	}
+	size_t storage = 256*1024, size = 0;
+	uint8_t *data = malloc(storage);
+	int read;
+	while ((read = gzread(f, data + size, storage - size)) > 0)
+	{
+		size += read;
+		if (size == storage) {
+			storage *= 2;
+			data = realloc(data, storage);
+		}
+	}
+	gzclose(f);
+	if (read < 0) {
+		free(data);
+		return 0;
+	}
+	buf->size = size;
+	buf->cur_pos = 0;
+	buf->data = data;
+	buf->handlers = NULL;
+	buf->max_handler = 8;
+	return 1;
+#endif
+}
+
+uint8_t *alloc_save_buffer(uint32_t size)
+{
+#ifdef _WIN32
+	return malloc(size);
+#else
+	void *ret = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ret == MAP_FAILED) {
+		fatal_error("Failed to allocate %u bytes of save memory\n", size);
+	}
+	return ret;
+#endif
+}
+
+void free_save_buffer(uint8_t *buffer, uint32_t size)
+{
+	if (!buffer) {
+		return;
+	}
+#ifdef _WIN32
+	free(buffer);
+#else
+	//a queued flush may still reference these pages
+	wait_state_writes();
+	munmap(buffer, size);
+#endif
+}
+
+uint8_t map_save_file(uint8_t *buffer, uint32_t size, char *path, uint32_t *loaded)
+{
+#ifdef _WIN32
+	return 0;
+#else
+	if (!buffer) {
+		return 0;
+	}
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		return 0;
+	}
+	struct stat st;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return 0;
+	}
+	*loaded = st.st_size < size ? st.st_size : size;
+	if (st.st_size < size) {
+		//touching a mapped page past the end of the file faults so it needs to be full size
+		if (
+			pread(fd, buffer, *loaded, 0) != (ssize_t)*loaded
+			|| pwrite(fd, buffer, size, 0) != (ssize_t)size
+		) {
+			close(fd);
+			return 0;
+		}
+	}
+	void *mapped = mmap(buffer, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+	close(fd);
+	return mapped == buffer;
+#endif
+}
+
+void flush_save(uint8_t *buffer, uint32_t size)
+{
+#ifndef _WIN32
+	if (msync(buffer, size, MS_SYNC)) {
+		warning("Failed to flush save memory to disk\n");
+	}
+#endif
+}
+
+void flush_save_async(uint8_t *buffer, uint32_t start, uint32_t end)
+{
+#ifndef _WIN32
+	//buffer is page aligned, msync needs the start of the range to be too
+	start &= ~(uint32_t)(sysconf(_SC_PAGESIZE) - 1);
+	if (!init_writer()) {
+		flush_save(buffer + start, end - start);
+		return;
+	}
+	state_job *job = malloc(sizeof(state_job));
+	job->next = NULL;
+	job->path = NULL;
+	job->data = buffer + start;
+	job->size = end - start;
+	job->storage = 0;
+	queue_job(job);
+#endif
+}
@@ -4,6 +4,7 @@
 #include <time.h>
 #include <stdint.h>
 #include "system.h"
+#include "serialize.h"
 
 #define QUICK_SAVE_SLOT 10
 
@@ -15,5 +16,26 @@ typedef struct {
 char *get_slot_name(system_header *system, uint32_t slot_index, char *ext);
 save_slot_info *get_slot_info(system_header *system, uint32_t *num_out);
 void free_slot_info(save_slot_info *slots);
+//Native states are compressed and written on a background thread so saving doesn't stall emulation.
+//get_state_buffer hands out an empty buffer, reusing the storage of states that have been written.
+void get_state_buffer(serialize_buffer *buf);
+//queues buf for writing to path and takes ownership of its storage, path is copied
+void save_state_async(serialize_buffer *buf, char *path);
+//blocks until every queued state is on disk
+void wait_state_writes(void);
+//reads a native state written by save_state_async or an older uncompressed one
+uint8_t load_state_file(deserialize_buffer *buf, char *path);
+//Battery saves are allocated page aligned so map_save_file can put the save file at the same address,
+//code generated for the cartridge map keeps pointing at the right memory
+uint8_t *alloc_save_buffer(uint32_t size);
+void free_save_buffer(uint8_t *buffer, uint32_t size);
+//Backs buffer with a shared mapping of path so writes go straight to the page cache and survive a crash.
+//A missing or short file is filled out from the current contents of buffer first.
+//Returns 0 if the file can't be mapped, loaded is set to the number of bytes that came from the file.
+uint8_t map_save_file(uint8_t *buffer, uint32_t size, char *path, uint32_t *loaded);
+//queues an msync of the pages covering start to end on the state writer thread
+void flush_save_async(uint8_t *buffer, uint32_t start, uint32_t end);
+//writes all modified pages of a mapped save to disk before returning
+void flush_save(uint8_t *buffer, uint32_t size);
 
 #endif //SAVES_H_
@@ -50,12 +50,15 @@ m68k_context * write_sram_area_w(uint32_t address, m68k_context * context, uint1
 		case RAM_FLAG_BOTH:
 			gen->save_storage[address] = value >> 8;
 			gen->save_storage[address+1] = value;
+			mark_save_dirty(&gen->save_dirty, address, 2);
 			break;
 		case RAM_FLAG_EVEN:
 			gen->save_storage[address >> 1] = value >> 8;
+			mark_save_dirty(&gen->save_dirty, address >> 1, 1);
 			break;
 		case RAM_FLAG_ODD:
 			gen->save_storage[address >> 1] = value;
+			mark_save_dirty(&gen->save_dirty, address >> 1, 1);
 			break;
 		}
 	}
@@ -71,15 +74,18 @@ m68k_context * write_sram_area_b(uint32_t address, m68k_context * context, uint8
 		{
 		case RAM_FLAG_BOTH:
 			gen->save_storage[address] = value;
+			mark_save_dirty(&gen->save_dirty, address, 1);
 			break;
 		case RAM_FLAG_EVEN:
 			if (!(address & 1)) {
 				gen->save_storage[address >> 1] = value;
+				mark_save_dirty(&gen->save_dirty, address >> 1, 1);
 			}
 			break;
 		case RAM_FLAG_ODD:
 			if (address & 1) {
 				gen->save_storage[address >> 1] = value;
+				mark_save_dirty(&gen->save_dirty, address >> 1, 1);
 			}
 			break;
 		}
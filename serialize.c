@@ -17,12 +17,44 @@ void init_serialize(serialize_buffer *buf)
 	buf->data = malloc(SERIALIZE_DEFAULT_SIZE);
 }
 
-static void reserve(serialize_buffer *buf, size_t amount)
+static void grow(serialize_buffer *buf, size_t amount)
 {
-	if (amount > (buf->storage - buf->size)) {
+	while (amount > (buf->storage - buf->size))
+	{
 		buf->storage *= 2;
-		buf = realloc(buf, buf->storage + sizeof(*buf));
 	}
+	buf->data = realloc(buf->data, buf->storage);
+}
+
+//buffers reused through a snapshot settle at the right size after the first save, so growing stays out of line
+static inline void reserve(serialize_buffer *buf, size_t amount)
+{
+	if (amount > (buf->storage - buf->size)) {
+		grow(buf, amount);
+	}
+}
+
+//copies len big endian words between dst and src, swapping four at a time on little endian hosts
+static void copy_swap16(uint8_t *dst, uint8_t const *src, size_t len)
+{
+#ifdef BLASTEM_BIG_ENDIAN
+	memcpy(dst, src, len * sizeof(uint16_t));
+#else
+	size_t bytes = len * sizeof(uint16_t);
+	size_t i;
+	for (i = 0; i + sizeof(uint64_t) <= bytes; i += sizeof(uint64_t))
+	{
+		uint64_t words;
+		memcpy(&words, src + i, sizeof(words));
+		words = (words & 0x00FF00FF00FF00FFULL) << 8 | (words >> 8 & 0x00FF00FF00FF00FFULL);
+		memcpy(dst + i, &words, sizeof(words));
+	}
+	for (; i < bytes; i += sizeof(uint16_t))
+	{
+		dst[i] = src[i + 1];
+		dst[i + 1] = src[i];
+	}
+#endif
 }
 
 void save_int32(serialize_buffer *buf, uint32_t val)
@@ -63,10 +95,8 @@ void save_buffer8(serialize_buffer *buf, void *val, size_t len)
 void save_buffer16(serialize_buffer *buf, uint16_t *val, size_t len)
 {
 	reserve(buf, len * sizeof(*val));
-	for(; len != 0; len--, val++) {
-		buf->data[buf->size++] = *val >> 8;
-		buf->data[buf->size++] = *val;
-	}
+	copy_swap16(buf->data + buf->size, (uint8_t *)val, len);
+	buf->size += len * sizeof(*val);
 }
 
 void save_buffer32(serialize_buffer *buf, uint32_t *val, size_t len)
@@ -180,11 +210,8 @@ void load_buffer16(deserialize_buffer *buf, uint16_t *dst, size_t len)
 	if ((buf->size - buf->cur_pos) < len * sizeof(uint16_t)) {
 		fatal_error("Failed to load required buffer of size %d\n", len);
 	}
-	for(; len != 0; len--, dst++) {
-		uint16_t value = buf->data[buf->cur_pos++] << 8;
-		value |= buf->data[buf->cur_pos++];
-		*dst = value;
-	}
+	copy_swap16((uint8_t *)dst, buf->data + buf->cur_pos, len);
+	buf->cur_pos += len * sizeof(uint16_t);
 }
 void load_buffer32(deserialize_buffer *buf, uint32_t *dst, size_t len)
 {
@@ -221,7 +248,7 @@ void load_section(deserialize_buffer *buf)
 	buf->cur_pos += size;
 }
 
-static const char sz_ident[] = "BLSTSZ\x01\x07";
+static const char sz_ident[] = SZ_IDENT;
 
 uint8_t save_to_file(serialize_buffer *buf, char *path)
 {
@@ -275,3 +302,32 @@ uint8_t load_from_file(deserialize_buffer *buf, char *path)
 	fclose(f);
 	return 1;
 }
+
+void init_snapshot(snapshot *snap)
+{
+	init_serialize(&snap->buf);
+	init_deserialize(&snap->restore, NULL, 0);
+}
+
+serialize_buffer *begin_snapshot(snapshot *snap)
+{
+	snap->buf.size = 0;
+	snap->buf.current_section_start = 0;
+	return &snap->buf;
+}
+
+deserialize_buffer *begin_restore(snapshot *snap)
+{
+	snap->restore.data = snap->buf.data;
+	snap->restore.size = snap->buf.size;
+	snap->restore.cur_pos = 0;
+	return &snap->restore;
+}
+
+void free_snapshot(snapshot *snap)
+{
+	free(snap->buf.data);
+	free(snap->restore.handlers);
+	snap->buf.data = NULL;
+	snap->restore.handlers = NULL;
+}
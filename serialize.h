@@ -45,6 +45,9 @@ enum {
 	SECTION_CART_RAM
 };
 
+//identifies native format save states
+#define SZ_IDENT "BLSTSZ\x01\x07"
+
 void init_serialize(serialize_buffer *buf);
 void save_int32(serialize_buffer *buf, uint32_t val);
 void save_int16(serialize_buffer *buf, uint16_t val);
@@ -64,6 +67,20 @@ void load_buffer8(deserialize_buffer *buf, void *dst, size_t len);
 void load_buffer16(deserialize_buffer *buf, uint16_t *dst, size_t len);
 void load_buffer32(deserialize_buffer *buf, uint32_t *dst, size_t len);
 void load_section(deserialize_buffer *buf);
+//A snapshot keeps its storage and section handlers between uses, so after the first save
+//repeated save and restore cycles (rewind, run-ahead, rollback) don't allocate.
+//The system registers its handlers on the restore buffer the first time it sees them missing.
+typedef struct {
+	serialize_buffer   buf;
+	deserialize_buffer restore;
+} snapshot;
+
+void init_snapshot(snapshot *snap);
+//returns the snapshot's buffer emptied and ready to serialize into
+serialize_buffer *begin_snapshot(snapshot *snap);
+//returns a deserialize buffer over the last saved snapshot with any previously registered handlers
+deserialize_buffer *begin_restore(snapshot *snap);
+void free_snapshot(snapshot *snap);
 uint8_t save_to_file(serialize_buffer *buf, char *path);
 uint8_t load_from_file(deserialize_buffer *buf, char *path);
 #endif //SERIALIZE_H
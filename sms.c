@@ -193,8 +193,8 @@ static void set_speed_percent(system_header * system, uint32_t percent)
 	sms_context *context = (sms_context *)system;
 	uint32_t old_clock = context->master_clock;
 	context->master_clock = ((uint64_t)context->normal_clock * (uint64_t)percent) / 100;
-
-	psg_adjust_master_clock(context->psg, context->master_clock);
+	uint32_t audio_clock = render_set_speed(percent) ? context->normal_clock : context->master_clock;
+	psg_adjust_master_clock(context->psg, audio_clock);
 }
 
 void sms_serialize(sms_context *sms, serialize_buffer *buf)
@@ -296,19 +296,18 @@ static void save_state(sms_context *sms, uint8_t slot)
 {
 	char *save_path = get_slot_name(&sms->header, slot, "state");
 	serialize_buffer state;
-	init_serialize(&state);
+	get_state_buffer(&state);
 	sms_serialize(sms, &state);
-	save_to_file(&state, save_path);
+	save_state_async(&state, save_path);
 	printf("Saved state to %s\n", save_path);
 	free(save_path);
-	free(state.data);
 }
 
 static uint8_t load_state_path(sms_context *sms, char *path)
 {
 	deserialize_buffer state;
 	uint8_t ret;
-	if ((ret = load_from_file(&state, path))) {
+	if ((ret = load_state_file(&state, path))) {
 		sms_deserialize(&state, sms);
 		free(state.data);
 		printf("Loaded %s\n", path);
@@ -322,6 +321,7 @@ static uint8_t load_state(system_header *system, uint8_t slot)
 	char *statepath = get_slot_name(system, slot, "state");
 	uint8_t ret;
 	if (!sms->z80->native_pc) {
+		wait_state_writes();
 		ret = get_modification_time(statepath) != 0;
 		if (ret) {
 			system->delayed_load_slot = slot + 1;
@@ -580,6 +580,9 @@ sms_context *alloc_configure_sms(system_media *media, uint32_t opts, uint8_t for
 	
 	sms->psg = malloc(sizeof(psg_context));
 	psg_init(sms->psg, sms->master_clock, 15*16);
+	if (opts & OPT_PSG_WAVE_LOG) {
+		psg_start_wave_log(sms->psg, sms->master_clock);
+	}
 	
 	sms->vdp = malloc(sizeof(vdp_context));
 	init_vdp_context(sms->vdp, 0);
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "SDL.h"
+#include "startup.h"
+#include "pacing.h"
+
+#define MAX_PHASES 32
+
+typedef struct {
+	const char *name;
+	uint64_t   duration;
+	uint8_t    background;
+} startup_entry;
+
+static startup_entry phases[MAX_PHASES];
+static uint32_t      num_phases;
+static uint64_t      start, last;
+static SDL_SpinLock  phase_lock;
+static uint8_t       enabled, done;
+
+static void add_phase(const char *name, uint64_t duration, uint8_t background)
+{
+	SDL_AtomicLock(&phase_lock);
+		if (num_phases < MAX_PHASES) {
+			phases[num_phases].name = name;
+			phases[num_phases].duration = duration;
+			phases[num_phases++].background = background;
+		}
+	SDL_AtomicUnlock(&phase_lock);
+}
+
+void startup_trace_begin(void)
+{
+	start = last = pacing_now_ns();
+}
+
+void startup_trace_enable(void)
+{
+	enabled = 1;
+}
+
+void startup_phase(const char *name)
+{
+	if (done) {
+		return;
+	}
+	uint64_t now = pacing_now_ns();
+	add_phase(name, now - last, 0);
+	last = now;
+}
+
+void startup_background_phase(const char *name, uint64_t duration)
+{
+	add_phase(name, duration, 1);
+}
+
+void startup_trace_done(void)
+{
+	if (done) {
+		return;
+	}
+	startup_phase("first frame");
+	done = 1;
+	if (!enabled) {
+		return;
+	}
+	printf("Startup trace:\n");
+	SDL_AtomicLock(&phase_lock);
+		for (uint32_t i = 0; i < num_phases; i++)
+		{
+			printf("\t%-24s %8.2f ms%s\n", phases[i].name, phases[i].duration / 1000000.0, phases[i].background ? " (background)" : "");
+		}
+	SDL_AtomicUnlock(&phase_lock);
+	printf("\t%-24s %8.2f ms\n", "total", (last - start) / 1000000.0);
+	fflush(stdout);
+}
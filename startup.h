@@ -0,0 +1,18 @@
+#ifndef STARTUP_H_
+#define STARTUP_H_
+
+#include <stdint.h>
+
+//Startup phases are always recorded, they are cheap enough and there are only a handful.
+//With -T the time spent in each one is printed once the first frame has been produced.
+//called first thing in main, phases are timed from here
+void startup_trace_begin(void);
+void startup_trace_enable(void);
+//marks the end of a phase that started when the previous one ended
+void startup_phase(const char *name);
+//records a phase that ran on another thread, duration is in nanoseconds
+void startup_background_phase(const char *name, uint64_t duration);
+//marks the end of startup, only the first call does anything
+void startup_trace_done(void);
+
+#endif //STARTUP_H_
@@ -12,7 +12,7 @@
 #include "config.h"
 
 
-uint16_t read_dma_value(uint32_t address)
+uint16_t read_dma_value(system_header *system, uint32_t address)
 {
 	return 0;
 }
@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "stretch.h"
+
+//overlap between consecutive segments
+#define SEGMENT_MS 12
+//how far a segment may move from its nominal position to line up with the previous one
+#define SEARCH_MS 5
+//the coarse search only looks at every DECIMATE-th frame and lag
+#define DECIMATE 4
+
+struct time_stretch {
+	float    *input;
+	float    *window;
+	float    *pending;    //output from the last hop the caller hasn't taken yet
+	double   position;    //nominal start of the next segment
+	uint32_t input_len;
+	uint32_t input_storage;
+	uint32_t prev;        //actual start of the previous segment
+	uint32_t segment;
+	uint32_t search;
+	uint32_t pending_pos;
+	uint32_t pending_len;
+	uint8_t  primed;
+};
+
+time_stretch *stretch_new(uint32_t sample_rate)
+{
+	time_stretch *ts = calloc(1, sizeof(time_stretch));
+	ts->segment = sample_rate * SEGMENT_MS / 1000;
+	ts->search = sample_rate * SEARCH_MS / 1000;
+	ts->window = malloc(ts->segment * sizeof(float));
+	for (uint32_t i = 0; i < ts->segment; i++)
+	{
+		ts->window[i] = 0.5f - 0.5f * cosf(M_PI * (i + 0.5f) / ts->segment);
+	}
+	ts->pending = malloc(ts->segment * 2 * sizeof(float));
+	return ts;
+}
+
+void stretch_free(time_stretch *ts)
+{
+	free(ts->input);
+	free(ts->window);
+	free(ts->pending);
+	free(ts);
+}
+
+float *stretch_input(time_stretch *ts, uint32_t frames)
+{
+	if (ts->input_len + frames > ts->input_storage) {
+		ts->input_storage = (ts->input_len + frames) * 2;
+		ts->input = realloc(ts->input, ts->input_storage * 2 * sizeof(float));
+	}
+	float *dst = ts->input + ts->input_len * 2;
+	memset(dst, 0, frames * 2 * sizeof(float));
+	return dst;
+}
+
+void stretch_commit(time_stretch *ts, uint32_t frames)
+{
+	ts->input_len += frames;
+}
+
+uint32_t stretch_backlog(time_stretch *ts)
+{
+	return ts->position < ts->input_len ? ts->input_len - (uint32_t)ts->position : 0;
+}
+
+uint32_t stretch_segment(time_stretch *ts)
+{
+	return ts->segment;
+}
+
+static void discard(time_stretch *ts, uint32_t frames)
+{
+	if (frames > ts->input_len) {
+		frames = ts->input_len;
+	}
+	memmove(ts->input, ts->input + frames * 2, (ts->input_len - frames) * 2 * sizeof(float));
+	ts->input_len -= frames;
+	ts->prev = ts->prev > frames ? ts->prev - frames : 0;
+	ts->position = ts->position > frames ? ts->position - frames : 0.0;
+}
+
+void stretch_skip(time_stretch *ts, uint32_t frames)
+{
+	//jumping breaks continuity with the previous segment, so start over with a fresh one
+	ts->position += frames;
+	ts->primed = 0;
+	uint32_t nominal = ts->position;
+	discard(ts, nominal > ts->search ? nominal - ts->search : 0);
+}
+
+static float correlate(float *a, float *b, uint32_t frames, uint32_t step)
+{
+	float cross = 0.0f, energy = 1e-9f;
+	for (uint32_t i = 0; i < frames * 2; i += step * 2)
+	{
+		float mono_a = a[i] + a[i + 1];
+		float mono_b = b[i] + b[i + 1];
+		cross += mono_a * mono_b;
+		energy += mono_b * mono_b;
+	}
+	return cross / sqrtf(energy);
+}
+
+//Finds the segment start near the nominal position that best continues the previous segment
+static uint32_t best_offset(time_stretch *ts, uint32_t low, uint32_t high)
+{
+	float *template = ts->input + (ts->prev + ts->segment) * 2;
+	uint32_t best = low;
+	float best_score = -INFINITY;
+	for (uint32_t start = low; start <= high; start += DECIMATE)
+	{
+		float score = correlate(template, ts->input + start * 2, ts->segment, DECIMATE);
+		if (score > best_score) {
+			best_score = score;
+			best = start;
+		}
+	}
+	uint32_t coarse = best;
+	uint32_t fine_low = coarse > low + DECIMATE ? coarse - DECIMATE : low;
+	uint32_t fine_high = coarse + DECIMATE < high ? coarse + DECIMATE : high;
+	best_score = -INFINITY;
+	for (uint32_t start = fine_low; start <= fine_high; start++)
+	{
+		float score = correlate(template, ts->input + start * 2, ts->segment, 1);
+		if (score > best_score) {
+			best_score = score;
+			best = start;
+		}
+	}
+	return best;
+}
+
+//Produces one segment of output into pending, returns 0 if there isn't enough input
+static uint8_t hop(time_stretch *ts, double analysis_hop)
+{
+	uint32_t nominal = ts->position;
+	if (nominal + ts->search + 2 * ts->segment > ts->input_len) {
+		return 0;
+	}
+	float *out = ts->pending;
+	if (!ts->primed) {
+		memcpy(out, ts->input + nominal * 2, ts->segment * 2 * sizeof(float));
+		ts->prev = nominal;
+		ts->primed = 1;
+	} else {
+		uint32_t low = nominal > ts->search ? nominal - ts->search : 0;
+		uint32_t start = best_offset(ts, low, nominal + ts->search);
+		float *fade_out = ts->input + (ts->prev + ts->segment) * 2;
+		float *fade_in = ts->input + start * 2;
+		for (uint32_t i = 0; i < ts->segment; i++)
+		{
+			float w = ts->window[i];
+			out[i * 2] = fade_out[i * 2] * (1.0f - w) + fade_in[i * 2] * w;
+			out[i * 2 + 1] = fade_out[i * 2 + 1] * (1.0f - w) + fade_in[i * 2 + 1] * w;
+		}
+		ts->prev = start;
+	}
+	ts->pending_pos = 0;
+	ts->pending_len = ts->segment;
+	ts->position += analysis_hop;
+	//keep what the next template and the next search window still need
+	uint32_t keep = ts->prev;
+	uint32_t next = ts->position;
+	if (next > ts->search && next - ts->search < keep) {
+		keep = next - ts->search;
+	} else if (next <= ts->search) {
+		keep = 0;
+	}
+	if (keep > ts->segment * 4) {
+		discard(ts, keep);
+	}
+	return 1;
+}
+
+uint32_t stretch_output(time_stretch *ts, float *out, uint32_t frames, float speed)
+{
+	uint32_t written = 0;
+	while (written < frames)
+	{
+		if (ts->pending_pos == ts->pending_len && !hop(ts, speed * ts->segment)) {
+			break;
+		}
+		uint32_t chunk = ts->pending_len - ts->pending_pos;
+		if (chunk > frames - written) {
+			chunk = frames - written;
+		}
+		memcpy(out + written * 2, ts->pending + ts->pending_pos * 2, chunk * 2 * sizeof(float));
+		ts->pending_pos += chunk;
+		written += chunk;
+	}
+	return written;
+}
@@ -0,0 +1,24 @@
+#ifndef STRETCH_H_
+#define STRETCH_H_
+
+#include <stdint.h>
+
+//WSOLA time-stretching of interleaved stereo float samples, changes tempo without changing pitch
+typedef struct time_stretch time_stretch;
+
+time_stretch *stretch_new(uint32_t sample_rate);
+void stretch_free(time_stretch *ts);
+//Returns zeroed space for frames of input that sources can be mixed into, stretch_commit makes it visible
+float *stretch_input(time_stretch *ts, uint32_t frames);
+void stretch_commit(time_stretch *ts, uint32_t frames);
+//Input frames that have been committed but not consumed yet
+uint32_t stretch_backlog(time_stretch *ts);
+//Discards the oldest input frames, used to keep latency bounded
+void stretch_skip(time_stretch *ts, uint32_t frames);
+//Produces up to frames of output consuming speed input frames per output frame on average,
+//returns the number of frames written which is less than requested when input runs out
+uint32_t stretch_output(time_stretch *ts, float *out, uint32_t frames, float speed);
+//Overlap length, output is produced in units of this many frames
+uint32_t stretch_segment(time_stretch *ts);
+
+#endif //STRETCH_H_
@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "syscache.h"
+#include "arena.h"
+#include "blastem.h"
+#include "gen.h"
+#include "util.h"
+
+//rough size of a system context outside of its ROM and translated code
+#define CONTEXT_BASE_SIZE (2*1024*1024)
+
+typedef struct cached_system cached_system;
+struct cached_system {
+	cached_system *next; //most recently used first
+	system_header *system;
+	char          *path;
+	system_media  media;
+	uint64_t      size;
+	time_t        mtime;
+};
+
+static cached_system *cache_head;
+static uint64_t      cache_size;
+
+static uint64_t get_budget(void)
+{
+	char *budget = tern_find_path_default(config, "system\0context_cache_mb\0", (tern_val){.ptrval = "128"}, TVAL_PTR).ptrval;
+	return (uint64_t)strtoul(budget, NULL, 10) * 1024 * 1024;
+}
+
+static void free_entry(cached_system *entry)
+{
+	arena *a = entry->system->arena;
+	entry->system->free_context(entry->system);
+	//the translated code goes back to the pool the next game allocates from
+	merge_arena(a);
+	free(entry->media.dir);
+	free(entry->media.name);
+	free(entry->media.extension);
+	free(entry->path);
+	cache_size -= entry->size;
+	free(entry);
+}
+
+static void evict(uint64_t budget)
+{
+	while (cache_head && cache_size > budget)
+	{
+		cached_system **lru = &cache_head;
+		while ((*lru)->next)
+		{
+			lru = &(*lru)->next;
+		}
+		cached_system *entry = *lru;
+		*lru = NULL;
+		free_entry(entry);
+	}
+}
+
+uint8_t syscache_suspend(system_header *system, system_media *media, const char *path)
+{
+	uint64_t budget = get_budget();
+	uint64_t size = CONTEXT_BASE_SIZE + media->size + (uint64_t)arena_used_blocks(get_current_arena()) * CODE_ALLOC_SIZE;
+	if (size > budget) {
+		return 0;
+	}
+	if (system->vgm_logging) {
+		system->stop_vgm_log(system);
+	}
+	//blocks the game isn't using are better spent on whatever runs next
+	system->arena = start_new_arena();
+	take_free_blocks(system->arena);
+
+	cached_system *entry = calloc(1, sizeof(cached_system));
+	entry->system = system;
+	entry->path = strdup(path);
+	entry->media = *media;
+	entry->size = size;
+	entry->mtime = get_modification_time(entry->path);
+	media->buffer = NULL;
+	media->dir = media->name = media->extension = NULL;
+	media->size = 0;
+	media->has_sha1 = 0;
+	entry->next = cache_head;
+	cache_head = entry;
+	cache_size += size;
+	evict(budget);
+	return 1;
+}
+
+system_header *syscache_resume(const char *path, system_media *media)
+{
+	for (cached_system **cur = &cache_head; *cur; cur = &(*cur)->next)
+	{
+		cached_system *entry = *cur;
+		if (strcmp(entry->path, path)) {
+			continue;
+		}
+		*cur = entry->next;
+		if (get_modification_time(entry->path) != entry->mtime) {
+			//ROM has changed on disk since it was suspended
+			free_entry(entry);
+			return NULL;
+		}
+		system_header *system = entry->system;
+		*media = entry->media;
+		cache_size -= entry->size;
+		free(entry->path);
+		free(entry);
+		arena *spare = set_current_arena(system->arena);
+		merge_arena(spare);
+		return system;
+	}
+	return NULL;
+}
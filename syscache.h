@@ -0,0 +1,19 @@
+#ifndef SYSCACHE_H_
+#define SYSCACHE_H_
+
+#include <stdint.h>
+#include "system.h"
+
+//Games that get switched away from stay suspended in memory along with the code translated for them,
+//so coming back to a recent one resumes it instantly instead of starting over from a cold code cache.
+//The least recently used games are freed once the cache grows past system.context_cache_mb.
+
+//Must be called with the arena of system current. On success the cache owns system and the strings
+//in media, system->arena holds its arena and a fresh arena with any spare code blocks is current.
+//Returns 0 without taking anything if the game doesn't fit in the budget.
+uint8_t syscache_suspend(system_header *system, system_media *media, const char *path);
+//Removes and returns the suspended game loaded from path, media is filled in with the media it was
+//loaded from. The game's arena is made current and absorbs the blocks of the previous current arena.
+system_header *syscache_resume(const char *path, system_media *media);
+
+#endif //SYSCACHE_H_
@@ -59,7 +59,7 @@ system_header *alloc_config_system(system_type stype, system_media *media, uint3
 	switch (stype)
 	{
 	case SYSTEM_GENESIS:
-		return &(alloc_config_genesis(media->buffer, media->size, lock_on, lock_on_size, opts, force_region))->header;
+		return &(alloc_config_genesis(media->buffer, media->size, media->has_sha1 ? media->sha1 : NULL, lock_on, lock_on_size, opts, force_region))->header;
 #ifndef NO_Z80
 	case SYSTEM_SMS:
 		return &(alloc_configure_sms(media, opts, force_region))->header;
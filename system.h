@@ -30,6 +30,7 @@ typedef void (*system_mrel_fun)(system_header *, uint8_t, int32_t, int32_t);
 
 #include "arena.h"
 #include "romdb.h"
+#include "serialize.h"
 
 struct system_header {
 	system_header     *next_context;
@@ -54,15 +55,21 @@ struct system_header {
 	system_u8_fun     keyboard_down;
 	system_u8_fun     keyboard_up;
 	system_fun        config_updated;
+	system_str_fun    start_vgm_log;
+	system_fun        stop_vgm_log;
 	rom_info          info;
 	arena             *arena;
 	char              *next_rom;
 	char              *save_dir;
+	snapshot          *save_snapshot; //saved into at the next instruction boundary, then cleared
+	snapshot          *load_snapshot; //restored once the CPU has stopped, then cleared
+	uint32_t          exit_after; //frames to run before setting should_exit, 0 for no limit
 	uint8_t           enter_debugger;
 	uint8_t           should_exit;
 	uint8_t           save_state;
 	uint8_t           delayed_load_slot;
 	uint8_t           has_keyboard;
+	uint8_t           vgm_logging;
 	debugger_type     debugger_type;
 	system_type       type;
 };
@@ -74,9 +81,13 @@ struct system_media {
 	char         *extension;
 	system_media *chain;
 	uint32_t     size;
+	uint8_t      sha1[20]; //only valid when has_sha1 is set
+	uint8_t      has_sha1;
 };
 
 #define OPT_ADDRESS_LOG (1U << 31U)
+#define OPT_PSG_WAVE_LOG (1U << 30U)
+#define OPT_NO_Z80 (1U << 29U)
 
 system_type detect_system_type(system_media *media);
 system_header *alloc_config_system(system_type stype, system_media *media, uint32_t opts, uint8_t force_region);
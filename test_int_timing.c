@@ -13,7 +13,7 @@ uint32_t render_map_color(uint8_t r, uint8_t g, uint8_t b)
 	return 0;
 }
 
-uint16_t read_dma_value(uint32_t address)
+uint16_t read_dma_value(system_header *system, uint32_t address)
 {
 	return 0;
 }
@@ -0,0 +1,97 @@
+//Runs the same ROM in several libblastem instances at once and checks they all produce
+//exactly the requested number of frames with identical video and audio
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libblastem.h"
+
+#define MAX_INSTANCES 16
+#define FNV_PRIME 0x100000001B3ULL
+
+typedef struct {
+	uint64_t video_hash;
+	uint64_t audio_hash;
+	uint32_t frames;
+	uint32_t samples;
+} run_result;
+
+static const uint8_t pixel_bytes[NUM_PIXEL_FORMATS] = {4, 2, 1};
+
+static void hash_bytes(uint64_t *hash, uint8_t *data, uint32_t size)
+{
+	for (uint32_t i = 0; i < size; i++)
+	{
+		*hash = (*hash ^ data[i]) * FNV_PRIME;
+	}
+}
+
+static void on_frame(blastem_instance *inst, void *buffer, uint32_t pitch, uint32_t width, uint32_t height)
+{
+	run_result *res = blastem_data(inst);
+	uint32_t row_bytes = width * pixel_bytes[render_get_pixel_format()];
+	for (uint32_t y = 0; y < height; y++)
+	{
+		hash_bytes(&res->video_hash, (uint8_t *)buffer + y * pitch, row_bytes);
+	}
+	res->frames++;
+}
+
+static void on_sample(blastem_instance *inst, audio_source *src, int16_t left, int16_t right)
+{
+	run_result *res = blastem_data(inst);
+	int16_t pair[2] = {left, right};
+	hash_bytes(&res->audio_hash, (uint8_t *)pair, sizeof(pair));
+	res->samples++;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fputs("Usage: test_libblastem ROM [INSTANCES] [FRAMES]\n", stderr);
+		return 1;
+	}
+	uint32_t num_instances = argc > 2 ? atoi(argv[2]) : 4;
+	uint32_t frames = argc > 3 ? atoi(argv[3]) : 300;
+	if (!num_instances || num_instances > MAX_INSTANCES) {
+		num_instances = 4;
+	}
+	run_result results[MAX_INSTANCES];
+	blastem_instance *instances[MAX_INSTANCES];
+	memset(results, 0, sizeof(results));
+	for (uint32_t i = 0; i < num_instances; i++)
+	{
+		blastem_params params = {
+			.frame = on_frame,
+			.sample = on_sample,
+			.data = results + i,
+			.frames = frames
+		};
+		instances[i] = blastem_start(argv[1], &params);
+		if (!instances[i]) {
+			fprintf(stderr, "Failed to start instance %d\n", i);
+			return 1;
+		}
+	}
+	int ret = 0;
+	for (uint32_t i = 0; i < num_instances; i++)
+	{
+		if (!blastem_wait(instances[i])) {
+			fprintf(stderr, "Instance %d failed to run\n", i);
+			ret = 1;
+			continue;
+		}
+		run_result *res = results + i;
+		printf("%d: %d frames, %d samples, video %016llX, audio %016llX\n", i, res->frames, res->samples,
+			(unsigned long long)res->video_hash, (unsigned long long)res->audio_hash);
+		if (res->frames != frames) {
+			fprintf(stderr, "Instance %d delivered %d frames, expected %d\n", i, res->frames, frames);
+			ret = 1;
+		}
+		if (i && memcmp(res, results, sizeof(run_result))) {
+			fprintf(stderr, "Instance %d diverged from instance 0\n", i);
+			ret = 1;
+		}
+	}
+	puts(ret ? "FAILED" : "All instances match");
+	return ret;
+}
@@ -0,0 +1,118 @@
+//Checks that restoring a snapshot and running the same number of frames again
+//ends up with exactly the same serialized state as the first time through
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libblastem.h"
+
+enum {
+	PHASE_WARMUP,
+	PHASE_FIRST,
+	PHASE_REPLAY,
+	PHASE_CHECK
+};
+
+typedef struct {
+	snapshot start;
+	snapshot first;
+	snapshot replay;
+	uint32_t warmup;
+	uint32_t frames;
+	uint32_t count;
+	uint8_t  phase;
+	uint8_t  failed;
+} test_state;
+
+static void on_frame(blastem_instance *inst, void *buffer, uint32_t pitch, uint32_t width, uint32_t height)
+{
+	test_state *test = blastem_data(inst);
+	test->count++;
+	switch (test->phase)
+	{
+	case PHASE_WARMUP:
+		if (test->count == test->warmup) {
+			test->failed = !blastem_save_snapshot(inst, &test->start);
+			test->phase = PHASE_FIRST;
+			test->count = 0;
+		}
+		break;
+	case PHASE_FIRST:
+		if (test->count == test->frames) {
+			blastem_save_snapshot(inst, &test->first);
+			blastem_load_snapshot(inst, &test->start);
+			test->phase = PHASE_REPLAY;
+			test->count = 0;
+		}
+		break;
+	case PHASE_REPLAY:
+		if (test->count == test->frames) {
+			blastem_save_snapshot(inst, &test->replay);
+			test->phase = PHASE_CHECK;
+		}
+		break;
+	case PHASE_CHECK:
+		//the replay snapshot has been taken by the time the next frame ends
+		blastem_stop(inst);
+		break;
+	}
+	if (test->failed) {
+		blastem_stop(inst);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fputs("Usage: test_snapshot ROM [WARMUP_FRAMES] [FRAMES]\n", stderr);
+		return 1;
+	}
+	test_state test;
+	memset(&test, 0, sizeof(test));
+	test.warmup = argc > 2 ? atoi(argv[2]) : 60;
+	test.frames = argc > 3 ? atoi(argv[3]) : 120;
+	if (!test.warmup || !test.frames) {
+		fputs("Frame counts must be at least 1\n", stderr);
+		return 1;
+	}
+	init_snapshot(&test.start);
+	init_snapshot(&test.first);
+	init_snapshot(&test.replay);
+	blastem_params params = {
+		.frame = on_frame,
+		.data = &test
+	};
+	blastem_instance *inst = blastem_start(argv[1], &params);
+	if (!inst) {
+		fprintf(stderr, "Failed to start %s\n", argv[1]);
+		return 1;
+	}
+	int ret = 0;
+	if (!blastem_wait(inst)) {
+		fputs("Instance failed to run\n", stderr);
+		ret = 1;
+	} else if (test.failed) {
+		fputs("System does not support snapshots\n", stderr);
+		ret = 1;
+	} else if (test.phase != PHASE_CHECK) {
+		fputs("Instance stopped before the replay finished\n", stderr);
+		ret = 1;
+	} else if (!test.replay.buf.size) {
+		fputs("Replay snapshot was never taken\n", stderr);
+		ret = 1;
+	} else if (test.first.buf.size != test.replay.buf.size || memcmp(test.first.buf.data, test.replay.buf.data, test.first.buf.size)) {
+		size_t diff = 0;
+		while (diff < test.first.buf.size && diff < test.replay.buf.size && test.first.buf.data[diff] == test.replay.buf.data[diff])
+		{
+			diff++;
+		}
+		fprintf(stderr, "State after replaying %d frames differs at byte %d (%d vs %d bytes)\n",
+			test.frames, (int)diff, (int)test.first.buf.size, (int)test.replay.buf.size);
+		ret = 1;
+	} else {
+		printf("%d byte state matches after replaying %d frames\n", (int)test.first.buf.size, test.frames);
+	}
+	free_snapshot(&test.start);
+	free_snapshot(&test.first);
+	free_snapshot(&test.replay);
+	return ret;
+}
@@ -0,0 +1,184 @@
+//Checks that running YM2612 synthesis on the worker thread gives the same output as running it inline
+//Feeds the same random stream of writes, runs, resets and save state round trips to both
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ym2612.h"
+
+#define MCLKS_NTSC 53693175
+#define MCLKS_PER_YM 7
+
+int headless = 1;
+
+struct audio_source {
+	int16_t  *samples;
+	uint32_t num_samples;
+	uint32_t storage;
+};
+
+audio_source *render_audio_source(uint64_t master_clock, uint64_t sample_divider, uint8_t channels)
+{
+	return calloc(1, sizeof(audio_source));
+}
+
+void render_audio_adjust_clock(audio_source *src, uint64_t master_clock, uint64_t sample_divider)
+{
+}
+
+void render_free_source(audio_source *src)
+{
+	free(src->samples);
+	free(src);
+}
+
+void render_put_stereo_sample(audio_source *src, int16_t left, int16_t right)
+{
+	if (src->num_samples + 2 > src->storage) {
+		src->storage = src->storage ? src->storage * 2 : 4096;
+		src->samples = realloc(src->samples, src->storage * sizeof(int16_t));
+	}
+	src->samples[src->num_samples++] = left;
+	src->samples[src->num_samples++] = right;
+}
+
+void render_errorbox(char *title, char *message)
+{
+}
+
+void render_infobox(char *title, char *message)
+{
+}
+
+static const uint8_t test_regs[] = {
+	0x22, 0x24, 0x25, 0x26, 0x27, 0x28, 0x2A, 0x2B,
+	0x30, 0x40, 0x50, 0x60, 0x70, 0x80, 0x90,
+	0xA0, 0xA4, 0xA8, 0xAC, 0xB0, 0xB4
+};
+
+static void random_write(ym2612_context **contexts, int num_contexts)
+{
+	uint8_t reg = test_regs[rand() % sizeof(test_regs)];
+	if (reg >= 0xA0) {
+		reg += rand() % 4;
+	} else if (reg >= 0x30) {
+		reg += rand() % 16;
+	}
+	uint8_t part = reg >= 0x30 && (rand() & 1);
+	uint8_t value = rand();
+	if (reg == REG_KEY_ONOFF && (rand() & 1)) {
+		//favor key on so there is something to hear
+		value |= 0xF0;
+	} else if (reg == REG_DAC_ENABLE) {
+		//keep the DAC mostly off so channel 6 gets FM coverage too
+		value &= rand() % 4 ? 0x7F : 0xFF;
+	}
+	for (int i = 0; i < num_contexts; i++)
+	{
+		if (part) {
+			ym_address_write_part2(contexts[i], reg);
+		} else {
+			ym_address_write_part1(contexts[i], reg);
+		}
+		ym_data_write(contexts[i], value);
+	}
+}
+
+//serializing waits for the worker, so this also checks the synthesis copy matches
+static int compare_state(ym2612_context *inline_ym, ym2612_context *threaded)
+{
+	serialize_buffer a, b;
+	init_serialize(&a);
+	init_serialize(&b);
+	ym_serialize(inline_ym, &a);
+	ym_serialize(threaded, &b);
+	int same = a.size == b.size && !memcmp(a.data, b.data, a.size);
+	free(a.data);
+	free(b.data);
+	return same;
+}
+
+static void reload_state(ym2612_context *context)
+{
+	serialize_buffer state;
+	init_serialize(&state);
+	ym_serialize(context, &state);
+	deserialize_buffer buf;
+	init_deserialize(&buf, state.data, state.size);
+	ym_deserialize(&buf, context);
+	free(state.data);
+}
+
+static int run_differential(uint32_t seed, uint32_t iterations)
+{
+	ym2612_context *inline_ym = malloc(sizeof(ym2612_context));
+	ym2612_context *threaded = malloc(sizeof(ym2612_context));
+	ym_init(inline_ym, MCLKS_NTSC, MCLKS_PER_YM, 0);
+	ym_init(threaded, MCLKS_NTSC, MCLKS_PER_YM, YM_OPT_THREAD);
+	ym2612_context *both[] = {inline_ym, threaded};
+	srand(seed);
+	uint32_t cycle = 0;
+	int ret = 1;
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		int action = rand() % 1000;
+		if (action < 700) {
+			random_write(both, 2);
+		} else if (action < 995) {
+			//odd run lengths make sure partial samples at either end are covered
+			cycle += rand() % 20000;
+			ym_run(inline_ym, cycle);
+			ym_run(threaded, cycle);
+			if (cycle > 0x40000000) {
+				ym_adjust_cycles(inline_ym, 0x40000000);
+				ym_adjust_cycles(threaded, 0x40000000);
+				cycle -= 0x40000000;
+			}
+		} else if (action < 998) {
+			reload_state(inline_ym);
+			reload_state(threaded);
+		} else {
+			ym_reset(inline_ym);
+			ym_reset(threaded);
+		}
+		if (ym_read_status(inline_ym) != ym_read_status(threaded)) {
+			fprintf(stderr, "seed %d: status diverged after step %d\n", seed, i);
+			ret = 0;
+			break;
+		}
+		//a full comparison stalls the worker, so only do it now and then
+		if (!(i % 1000) && !compare_state(inline_ym, threaded)) {
+			fprintf(stderr, "seed %d: state diverged after step %d\n", seed, i);
+			ret = 0;
+			break;
+		}
+	}
+	ym_flush(threaded);
+	audio_source *a = inline_ym->audio, *b = threaded->audio;
+	if (ret && (a->num_samples != b->num_samples || memcmp(a->samples, b->samples, a->num_samples * sizeof(int16_t)))) {
+		fprintf(stderr, "seed %d: output differs\n", seed);
+		ret = 0;
+	}
+	if (ret) {
+		uint32_t nonzero = 0;
+		for (uint32_t i = 0; i < a->num_samples; i++)
+		{
+			nonzero += a->samples[i] != 0;
+		}
+		printf("seed %d: %d samples match (%d nonzero)\n", seed, a->num_samples / 2, nonzero);
+	}
+	ym_free(inline_ym);
+	ym_free(threaded);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t seeds = argc > 1 ? atoi(argv[1]) : 20;
+	for (uint32_t seed = 1; seed <= seeds; seed++)
+	{
+		if (!run_differential(seed, 50000)) {
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -16,6 +16,13 @@ typedef struct {
 #define PATH_SEP "/"
 #endif
 
+//for state that belongs to whichever system is running on the current thread
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 //Utility functions
 
 //Allocates a new string containing the concatenation of first and second
@@ -33,7 +40,7 @@ char * strip_ws(char * text);
 //Inserts a null after the first word, returns a pointer to the second word
 char * split_keyval(char * text);
 //Takes a binary byte buffer and produces a lowercase hex string
-void bin_to_hex(uint8_t *output, uint8_t *input, uint64_t size);
+void bin_to_hex(uint8_t *output, uint8_t const *input, uint64_t size);
 //Takes an (optionally) null-terminated UTF16-BE string and converts a maximum of max_size code-units to UTF-8
 char *utf16be_to_utf8(uint8_t *buf, uint32_t max_size);
 //Returns the next Unicode codepoint from a utf-8 string
@@ -72,6 +79,11 @@ void free_dir_list(dir_entry *list, size_t numentries);
 void sort_dir_list(dir_entry *list, size_t num_entries);
 //Gets the modification time of a file
 time_t get_modification_time(char *path);
+struct stat;
+//Gets the modification time from a stat result in nanoseconds, with only whole seconds on platforms that don't provide more
+uint64_t stat_mtime_ns(struct stat *st);
+//Returns a newly allocated absolute version of path with symlinks resolved where supported, NULL if it doesn't exist
+char *get_absolute_path(const char *path);
 //Recusrively creates a directory if it does not exist
 int ensure_dir_exists(const char *path);
 //Returns the contents of a symlink in a newly allocated string
@@ -74,6 +74,13 @@ static uint8_t debug_base[][3] = {
 	{127, 0, 127}    //Sprites
 };
 
+//colors that don't come from CRAM, PIXEL_PAL8 framebuffers keep them in the palette entries after the mode 4 ones
+#define FIXED_COLOR_BASE (CRAM_SIZE*3 + 32)
+#define FIXED_GREY 0
+#define FIXED_DEBUG 16
+#define NUM_FIXED_COLORS 32
+static uint32_t fixed_colors[NUM_FIXED_COLORS];
+
 static void update_video_params(vdp_context *context)
 {
 	if (context->regs[REG_MODE_2] & BIT_MODE_5) {
@@ -138,6 +145,73 @@ static void update_video_params(vdp_context *context)
 
 static uint8_t color_map_init_done;
 
+static void update_pixel_format(vdp_context *context);
+static void set_output_line(vdp_context *context, uint32_t output_line);
+
+static uint32_t debug_color(uint8_t color)
+{
+	uint8_t src = color & DBG_SRC_MASK;
+	if (src > DBG_SRC_S) {
+		return 0;
+	}
+	uint8_t r,g,b;
+	b = debug_base[src][0];
+	g = debug_base[src][1];
+	r = debug_base[src][2];
+	if (color & DBG_PRIORITY)
+	{
+		if (b) {
+			b += 48;
+		}
+		if (g) {
+			g += 48;
+		}
+		if (r) {
+			r += 48;
+		}
+	}
+	if (color & DBG_SHADOW) {
+		b /= 2;
+		g /= 2;
+		r /=2 ;
+	}
+	if (color & DBG_HILIGHT) {
+		if (b) {
+			b += 72;
+		}
+		if (g) {
+			g += 72;
+		}
+		if (r) {
+			r += 72;
+		}
+	}
+	return render_map_color(r, g, b);
+}
+
+//returns the fixed color at index in the current framebuffer format
+static uint32_t fixed_color(vdp_context *context, uint8_t index)
+{
+	return context->fb_format == PIXEL_PAL8 ? FIXED_COLOR_BASE + index : fixed_colors[index];
+}
+
+static void update_debug_colors(vdp_context *context)
+{
+	for (uint8_t color = 0; color < (1 << (3 + 1 + 1 + 1)); color++)
+	{
+		uint8_t src = color & DBG_SRC_MASK;
+		if (context->fb_format != PIXEL_PAL8) {
+			context->debugcolors[color] = debug_color(color);
+		} else if (src > DBG_SRC_S) {
+			context->debugcolors[color] = fixed_color(context, FIXED_GREY);
+		} else {
+			//only 16 fixed entries are left for these, the renderer never sets DBG_PRIORITY so it shares an entry
+			uint8_t variant = (color & DBG_SHADOW) ? 1 : (color & DBG_HILIGHT) ? 2 : 0;
+			context->debugcolors[color] = fixed_color(context, FIXED_DEBUG + src * 3 + variant);
+		}
+	}
+}
+
 void init_vdp_context(vdp_context * context, uint8_t region_pal)
 {
 	memset(context, 0, sizeof(*context));
@@ -145,12 +219,13 @@ void init_vdp_context(vdp_context * context, uint8_t region_pal)
 	memset(context->vdpmem, 0, VRAM_SIZE);
 	/*
 	*/
-	if (headless) {
-		context->output = malloc(LINEBUF_SIZE * sizeof(uint32_t));
+	context->conv_line = malloc(LINEBUF_SIZE * sizeof(uint32_t));
+	context->cur_buffer = FRAMEBUFFER_ODD;
+	context->fb = render_get_framebuffer(FRAMEBUFFER_ODD, &context->output_pitch);
+	if (!context->fb) {
+		//no framebuffer to render to when headless, so just reuse a single line buffer
+		context->output = context->conv_line;
 		context->output_pitch = 0;
-	} else {
-		context->cur_buffer = FRAMEBUFFER_ODD;
-		context->fb = render_get_framebuffer(FRAMEBUFFER_ODD, &context->output_pitch);
 	}
 	context->linebuf = malloc(LINEBUF_SIZE + SCROLL_BUFFER_SIZE*2);
 	memset(context->linebuf, 0, LINEBUF_SIZE + SCROLL_BUFFER_SIZE*2);
@@ -183,6 +258,16 @@ void init_vdp_context(vdp_context * context, uint8_t region_pal)
 			}
 			color_map[color] = render_map_color(r, g, b);
 		}
+		for (uint8_t level = 0; level < 16; level++)
+		{
+			fixed_colors[FIXED_GREY + level] = render_map_color(level * 17, level * 17, level * 17);
+		}
+		for (uint8_t src = 0; src <= DBG_SRC_S; src++)
+		{
+			fixed_colors[FIXED_DEBUG + src * 3] = debug_color(src);
+			fixed_colors[FIXED_DEBUG + src * 3 + 1] = debug_color(src | DBG_SHADOW);
+			fixed_colors[FIXED_DEBUG + src * 3 + 2] = debug_color(src | DBG_HILIGHT);
+		}
 		for (uint16_t mode4_addr = 0; mode4_addr < 0x4000; mode4_addr++)
 		{
 			uint16_t mode5_addr = mode4_addr & 0x3DFD;
@@ -202,53 +287,14 @@ void init_vdp_context(vdp_context * context, uint8_t region_pal)
 		}
 		color_map_init_done = 1;
 	}
-	for (uint8_t color = 0; color < (1 << (3 + 1 + 1 + 1)); color++)
-	{
-		uint8_t src = color & DBG_SRC_MASK;
-		if (src > DBG_SRC_S) {
-			context->debugcolors[color] = 0;
-		} else {
-			uint8_t r,g,b;
-			b = debug_base[src][0];
-			g = debug_base[src][1];
-			r = debug_base[src][2];
-			if (color & DBG_PRIORITY)
-			{
-				if (b) {
-					b += 48;
-				}
-				if (g) {
-					g += 48;
-				}
-				if (r) {
-					r += 48;
-				}
-			}
-			if (color & DBG_SHADOW) {
-				b /= 2;
-				g /= 2;
-				r /=2 ;
-			}
-			if (color & DBG_HILIGHT) {
-				if (b) {
-					b += 72;
-				}
-				if (g) {
-					g += 72;
-				}
-				if (r) {
-					r += 72;
-				}
-			}
-			context->debugcolors[color] = render_map_color(r, g, b);
-		}
-	}
+	update_debug_colors(context);
 	if (region_pal) {
 		context->flags2 |= FLAG2_REGION_PAL;
 	}
 	update_video_params(context);
-	if (!headless) {
-		context->output = (uint32_t *)(((char *)context->fb) + context->output_pitch * context->border_top);
+	if (context->fb) {
+		update_pixel_format(context);
+		set_output_line(context, context->border_top);
 	}
 }
 
@@ -256,6 +302,7 @@ void vdp_free(vdp_context *context)
 {
 	free(context->vdpmem);
 	free(context->linebuf);
+	free(context->conv_line);
 	free(context);
 }
 
@@ -777,12 +824,89 @@ static void read_sprite_x_mode4(vdp_context * context)
 
 static void update_color_map(vdp_context *context, uint16_t index, uint16_t value)
 {
+	if (context->fb_format == PIXEL_PAL8) {
+		//colors holds palette indices in this mode, CRAM is captured per line instead
+		return;
+	}
 	context->colors[index] = color_map[value & CRAM_BITS];
 	context->colors[index + CRAM_SIZE] = color_map[(value & CRAM_BITS) | FBUF_SHADOW];
 	context->colors[index + CRAM_SIZE*2] = color_map[(value & CRAM_BITS) | FBUF_HILIGHT];
 	context->colors[index + CRAM_SIZE*3] = color_map[(value & CRAM_BITS) | FBUF_MODE4];
 }
 
+static void update_pixel_format(vdp_context *context)
+{
+	uint8_t format = render_get_pixel_format();
+	if (format != context->fb_format) {
+		context->fb_format = format;
+		if (format == PIXEL_PAL8) {
+			for (int i = 0; i < CRAM_SIZE*4; i++)
+			{
+				context->colors[i] = i;
+			}
+		} else {
+			for (int i = 0; i < CRAM_SIZE; i++)
+			{
+				update_color_map(context, i, context->cram[i]);
+			}
+		}
+		update_debug_colors(context);
+	}
+	context->line_cram = format == PIXEL_PAL8 ? render_get_line_cram(context->cur_buffer) : NULL;
+	context->fb_line = NULL;
+}
+
+static void set_output_line(vdp_context *context, uint32_t output_line)
+{
+	if (context->fb_format == PIXEL_ARGB8888) {
+		context->output = (uint32_t *)(((char *)context->fb) + context->output_pitch * output_line);
+	} else {
+		context->fb_line = ((uint8_t *)context->fb) + context->output_pitch * output_line;
+		context->fb_line_cram = context->line_cram ? context->line_cram + output_line * CRAM_SIZE : NULL;
+		context->output = context->conv_line;
+	}
+}
+
+static void flush_output_line(vdp_context *context)
+{
+	if (!context->fb_line) {
+		return;
+	}
+	uint32_t *src = context->conv_line;
+	if (context->fb_format == PIXEL_RGB565) {
+		uint16_t *dst = (uint16_t *)context->fb_line;
+		for (int i = 0; i < LINEBUF_SIZE; i++)
+		{
+			uint32_t pixel = src[i];
+			dst[i] = (pixel >> 8 & 0xF800) | (pixel >> 5 & 0x7E0) | (pixel >> 3 & 0x1F);
+		}
+	} else {
+		uint8_t *dst = context->fb_line;
+		for (int i = 0; i < LINEBUF_SIZE; i++)
+		{
+			dst[i] = src[i];
+		}
+		if (context->fb_line_cram) {
+			memcpy(context->fb_line_cram, context->cram, sizeof(context->cram));
+		}
+	}
+}
+
+void vdp_expand_palette(uint16_t *cram, uint32_t *palette)
+{
+	for (int i = 0; i < CRAM_SIZE; i++)
+	{
+		palette[i] = color_map[cram[i] & CRAM_BITS];
+		palette[i + CRAM_SIZE] = color_map[(cram[i] & CRAM_BITS) | FBUF_SHADOW];
+		palette[i + CRAM_SIZE*2] = color_map[(cram[i] & CRAM_BITS) | FBUF_HILIGHT];
+		palette[i + CRAM_SIZE*3] = color_map[(cram[i] & CRAM_BITS) | FBUF_MODE4];
+	}
+	for (int i = 0; i < NUM_FIXED_COLORS; i++)
+	{
+		palette[FIXED_COLOR_BASE + i] = fixed_colors[i];
+	}
+}
+
 void write_cram_internal(vdp_context * context, uint16_t addr, uint16_t value)
 {
 	context->cram[addr] = value;
@@ -1029,7 +1153,7 @@ static void run_dma_src(vdp_context * context, int32_t slot)
 			cur = context->fifo + context->fifo_write;
 			cur->cycle = context->cycles + ((context->regs[REG_MODE_4] & BIT_H40) ? 16 : 20)*FIFO_LATENCY;
 			cur->address = context->address;
-			cur->value = read_dma_value((context->regs[REG_DMASRC_H] << 16) | (context->regs[REG_DMASRC_M] << 8) | context->regs[REG_DMASRC_L]);
+			cur->value = read_dma_value(context->system, (context->regs[REG_DMASRC_H] << 16) | (context->regs[REG_DMASRC_M] << 8) | context->regs[REG_DMASRC_L]);
 			cur->cd = context->cd;
 			cur->partial = 0;
 			if (context->fifo_read < 0) {
@@ -1649,11 +1773,11 @@ static void render_map_mode4(uint32_t line, int32_t col, vdp_context * context)
 		} else {
 			for (int i = 28; i >= 0; i -= 4)
 			{
-				uint8_t value = (pixel >> i & 0xF) * 17;
+				uint8_t level = pixel >> i & 0xF;
 				if (context->debug_pal == 3) {
-					value = 255 - value;
+					level = 15 - level;
 				}
-				*(dst++) = render_map_color(value, value, value);
+				*(dst++) = fixed_color(context, FIXED_GREY + level);
 			}
 		}
 	}
@@ -1719,7 +1843,7 @@ static void vdp_advance_line(vdp_context *context)
 
 static void advance_output_line(vdp_context *context)
 {
-	if (headless) {
+	if (!context->fb) {
 		if (context->vcounter == context->inactive_start) {
 			context->frame++;
 		}
@@ -1729,10 +1853,12 @@ static void advance_output_line(vdp_context *context)
 			? 240 + BORDER_TOP_V30_PAL + BORDER_BOT_V30_PAL 
 			: 224 + BORDER_TOP_V28 + BORDER_BOT_V28;
 
+		flush_output_line(context);
 		if (context->output_lines == lines_max) {
 			render_framebuffer_updated(context->cur_buffer, context->h40_lines > (context->inactive_start + context->border_top) / 2 ? LINEBUF_SIZE : (256+HORIZ_BORDER));
 			context->cur_buffer = context->flags2 & FLAG2_EVEN_FIELD ? FRAMEBUFFER_EVEN : FRAMEBUFFER_ODD;
 			context->fb = render_get_framebuffer(context->cur_buffer, &context->output_pitch);
+			update_pixel_format(context);
 			context->h40_lines = 0;
 			context->frame++;
 			context->output_lines = 0;
@@ -1754,7 +1880,7 @@ static void advance_output_line(vdp_context *context)
 		} else {
 			output_line = INVALID_LINE;
 		}
-		context->output = (uint32_t *)(((char *)context->fb) + context->output_pitch * output_line);
+		set_output_line(context, output_line);
 		context->done_output = context->output;
 #ifdef DEBUG_FB_FILL
 		for (int i = 0; i < LINEBUF_SIZE; i++)
@@ -1770,20 +1896,30 @@ static void advance_output_line(vdp_context *context)
 
 void vdp_release_framebuffer(vdp_context *context)
 {
+	if (!context->fb) {
+		return;
+	}
+	flush_output_line(context);
 	render_framebuffer_updated(context->cur_buffer, context->h40_lines > (context->inactive_start + context->border_top) / 2 ? LINEBUF_SIZE : (256+HORIZ_BORDER));
 	context->output = context->fb = NULL;
+	context->fb_line = NULL;
 }
 
 void vdp_reacquire_framebuffer(vdp_context *context)
 {
 	context->fb = render_get_framebuffer(context->cur_buffer, &context->output_pitch);
+	if (!context->fb) {
+		context->output = context->conv_line;
+		return;
+	}
+	update_pixel_format(context);
 	uint16_t lines_max = (context->flags2 & FLAG2_REGION_PAL) 
 			? 240 + BORDER_TOP_V30_PAL + BORDER_BOT_V30_PAL
 			: 224 + BORDER_TOP_V28 + BORDER_BOT_V28;
 	if (context->output_lines <= lines_max && context->output_lines > 0) {
-		context->output = (uint32_t *)(((char *)context->fb) + context->output_pitch * (context->output_lines - 1));
+		set_output_line(context, context->output_lines - 1);
 	} else {
-		context->output = (uint32_t *)(((char *)context->fb) + context->output_pitch * INVALID_LINE);
+		set_output_line(context, INVALID_LINE);
 	}
 }
 
@@ -2753,7 +2889,7 @@ static void vdp_inactive(vdp_context *context, uint32_t target_cycles, uint8_t i
 		vint_line = context->inactive_start + 1;
 		vint_slot = VINT_SLOT_MODE4;
 		line_change = LINE_CHANGE_MODE4;
-		bg_color = render_map_color(0, 0, 0);
+		bg_color = fixed_color(context, FIXED_GREY);
 		jump_start = 147;
 		jump_dest = 233;
 		if (context->regs[REG_MODE_1] & BIT_MODE_4) {
@@ -167,6 +167,12 @@ typedef struct {
 	uint32_t    *output;
 	uint32_t    *done_output;
 	uint32_t    *fb;
+	//lines are rendered to conv_line and converted into fb_line when fb_format is not PIXEL_ARGB8888
+	uint32_t    *conv_line;
+	uint8_t     *fb_line;
+	//per-line CRAM snapshots for PIXEL_PAL8 output
+	uint16_t    *line_cram;
+	uint16_t    *fb_line_cram;
 	system_header  *system;
 	uint16_t    cram[CRAM_SIZE];
 	uint32_t    colors[CRAM_SIZE*4];
@@ -210,6 +216,7 @@ typedef struct {
 	uint8_t     pending_byte;
 	uint8_t     state;
 	uint8_t     cur_buffer;
+	uint8_t     fb_format;
 	uint8_t     *tmp_buf_a;
 	uint8_t     *tmp_buf_b;
 } vdp_context;
@@ -250,6 +257,8 @@ void vdp_check_update_sat_byte(vdp_context *context, uint32_t address, uint8_t v
 void vdp_pbc_pause(vdp_context *context);
 void vdp_release_framebuffer(vdp_context *context);
 void vdp_reacquire_framebuffer(vdp_context *context);
+//expands a CRAM snapshot into the 256 entry palette used by PIXEL_PAL8 framebuffers
+void vdp_expand_palette(uint16_t *cram, uint32_t *palette);
 void vdp_serialize(vdp_context *context, serialize_buffer *buf);
 void vdp_deserialize(deserialize_buffer *buf, void *vcontext);
 
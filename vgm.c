@@ -0,0 +1,820 @@
+/*
+ Copyright 2013 Michael Pavone
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vgm.h"
+#include "util.h"
+#ifndef DISABLE_ZLIB
+#include "zlib/zlib.h"
+#endif
+
+#define MAX_SOUND_CYCLES 100000
+#define VGM_SAMPLE_RATE 44100
+#define LOAD_CHUNK_SIZE (64 * 1024)
+
+uint8_t *vgm_load(char *path, uint32_t *size_out)
+{
+	uint8_t *buffer = NULL;
+	uint32_t size = 0, storage = 0;
+#ifndef DISABLE_ZLIB
+	//gzread passes uncompressed files through unchanged so this handles .vgm and .vgz alike
+	gzFile f = gzopen(path, "rb");
+	if (!f) {
+		warning("Failed to open %s for reading\n", path);
+		return NULL;
+	}
+	int read;
+	do {
+		if (size + LOAD_CHUNK_SIZE > storage) {
+			storage = storage ? storage * 2 : LOAD_CHUNK_SIZE * 4;
+			buffer = realloc(buffer, storage);
+		}
+		read = gzread(f, buffer + size, LOAD_CHUNK_SIZE);
+		if (read > 0) {
+			size += read;
+		}
+	} while (read > 0);
+	if (read < 0) {
+		int errnum;
+		warning("Failed to decompress %s: %s\n", path, gzerror(f, &errnum));
+		gzclose(f);
+		free(buffer);
+		return NULL;
+	}
+	gzclose(f);
+#else
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		warning("Failed to open %s for reading\n", path);
+		return NULL;
+	}
+	storage = file_size(f);
+	buffer = malloc(storage);
+	size = fread(buffer, 1, storage, f);
+	fclose(f);
+#endif
+	*size_out = size;
+	return buffer;
+}
+
+uint8_t vgm_player_init(vgm_player *player, uint8_t *file, uint32_t file_size, uint32_t master_clock, ym2612_context *ym, psg_context *psg, uint32_t loops)
+{
+	memset(player, 0, sizeof(vgm_player));
+	player->file = file;
+	player->file_size = file_size;
+	if (file_size < sizeof(vgm_header)) {
+		//old files can have a shorter header, pad it out with zeros
+		if (file_size < 0x40) {
+			return 0;
+		}
+		memcpy(&player->header, file, file_size);
+	} else {
+		memcpy(&player->header, file, sizeof(vgm_header));
+	}
+	if (memcmp(player->header.ident, "Vgm ", 4)) {
+		return 0;
+	}
+	if (player->header.version < 0x150 || !player->header.data_offset) {
+		player->header.data_offset = 0xC;
+	}
+	uint32_t data_start = player->header.data_offset + 0x34;
+	uint32_t data_end = player->header.eof_offset + 4;
+	if (data_end > file_size || data_end < data_start) {
+		data_end = file_size;
+	}
+	if (data_start >= data_end) {
+		return 0;
+	}
+	player->data = player->cur = file + data_start;
+	player->end = file + data_end;
+	player->ym = ym;
+	player->psg = psg;
+	player->mclks_sample = master_clock / VGM_SAMPLE_RATE;
+	player->cycle_limit = master_clock / 60;
+	player->loops = loops;
+	return 1;
+}
+
+void vgm_player_free(vgm_player *player)
+{
+	for (int i = 0; i < DATA_STREAM_LIMIT; i++)
+	{
+		free(player->banks[i].data);
+		free(player->banks[i].block_offsets);
+	}
+	free(player->file);
+	player->file = NULL;
+}
+
+static void write_chip(vgm_player *player, uint8_t chip, uint8_t port, uint8_t reg, uint8_t value)
+{
+	if (chip == STREAM_CHIP_YM2612) {
+		if (port) {
+			ym_address_write_part2(player->ym, reg);
+		} else {
+			ym_address_write_part1(player->ym, reg);
+		}
+		ym_data_write(player->ym, value);
+	} else if (chip == STREAM_CHIP_PSG) {
+		psg_write(player->psg, value);
+	}
+}
+
+static vgm_stream *find_stream(vgm_player *player, uint8_t id, uint8_t create)
+{
+	for (uint32_t i = 0; i < player->num_streams; i++)
+	{
+		if (player->streams[i].id == id) {
+			return player->streams + i;
+		}
+	}
+	if (!create) {
+		return NULL;
+	}
+	if (player->num_streams == VGM_MAX_STREAMS) {
+		warning("Too many DAC streams, ignoring stream %X\n", id);
+		return NULL;
+	}
+	vgm_stream *stream = player->streams + player->num_streams++;
+	memset(stream, 0, sizeof(vgm_stream));
+	stream->id = id;
+	stream->step_size = 1;
+	return stream;
+}
+
+static void stream_set_frequency(vgm_player *player, vgm_stream *stream, uint32_t frequency)
+{
+	stream->frequency = frequency;
+	if (frequency) {
+		//stream timing uses the same sample clock as VGM waits so the two stay in step
+		uint64_t period = (uint64_t)player->mclks_sample * VGM_SAMPLE_RATE;
+		stream->interval = period / frequency;
+		stream->interval_rem = period % frequency;
+	}
+	stream->interval_frac = 0;
+}
+
+static void stream_start(vgm_player *player, vgm_stream *stream, uint32_t start, uint8_t mode, uint32_t length)
+{
+	if (start != 0xFFFFFFFF) {
+		stream->start = start + stream->step_base;
+		stream->pos = stream->start;
+	}
+	if ((mode & STREAM_LENGTH_MASK) == STREAM_LENGTH_IGNORE) {
+		return;
+	}
+	vgm_bank *bank = player->banks + stream->bank;
+	switch (mode & STREAM_LENGTH_MASK)
+	{
+	case STREAM_LENGTH_COMMANDS:
+		stream->length = length;
+		break;
+	case STREAM_LENGTH_MSEC:
+		stream->length = (uint64_t)length * stream->frequency / 1000;
+		break;
+	case STREAM_LENGTH_END:
+		if (mode & STREAM_REVERSE) {
+			stream->length = stream->pos / stream->step_size + 1;
+		} else {
+			stream->length = stream->pos < bank->size ? (bank->size - stream->pos + stream->step_size - 1) / stream->step_size : 0;
+		}
+		break;
+	}
+	stream->flags = mode;
+	stream->remaining = stream->length;
+	stream->next_cycle = player->current_cycle;
+	stream->interval_frac = 0;
+	stream->active = stream->remaining && stream->frequency && stream->configured;
+}
+
+static void stream_step(vgm_player *player, vgm_stream *stream)
+{
+	vgm_bank *bank = player->banks + stream->bank;
+	if (stream->pos < bank->size) {
+		write_chip(player, stream->chip, stream->port, stream->reg, bank->data[stream->pos]);
+	}
+	if (stream->flags & STREAM_REVERSE) {
+		stream->pos -= stream->step_size;
+	} else {
+		stream->pos += stream->step_size;
+	}
+	stream->next_cycle += stream->interval;
+	stream->interval_frac += stream->interval_rem;
+	if (stream->interval_frac >= stream->frequency) {
+		stream->interval_frac -= stream->frequency;
+		stream->next_cycle++;
+	}
+	if (!--stream->remaining) {
+		if (stream->flags & STREAM_LOOP) {
+			stream->pos = stream->start;
+			stream->remaining = stream->length;
+		} else {
+			stream->active = 0;
+		}
+	}
+}
+
+static void run_chips(vgm_player *player, uint32_t cycle)
+{
+	psg_run(player->psg, cycle);
+	ym_run(player->ym, cycle);
+}
+
+static void vgm_wait(vgm_player *player, uint32_t samples)
+{
+	player->samples += samples;
+	uint32_t cycles = samples * player->mclks_sample;
+	while (cycles)
+	{
+		uint32_t step = cycles > MAX_SOUND_CYCLES ? MAX_SOUND_CYCLES : cycles;
+		uint32_t target = player->current_cycle + step;
+		//stream writes are interleaved with the chips at the cycle they are scheduled for
+		for (;;)
+		{
+			vgm_stream *next = NULL;
+			for (uint32_t i = 0; i < player->num_streams; i++)
+			{
+				vgm_stream *stream = player->streams + i;
+				if (stream->active && stream->next_cycle < target && (!next || stream->next_cycle < next->next_cycle)) {
+					next = stream;
+				}
+			}
+			if (!next) {
+				break;
+			}
+			run_chips(player, next->next_cycle);
+			stream_step(player, next);
+		}
+		player->current_cycle = target;
+		run_chips(player, target);
+		cycles -= step;
+
+		if (player->current_cycle > player->cycle_limit) {
+			player->current_cycle -= player->cycle_limit;
+			player->psg->cycles -= player->cycle_limit;
+			ym_adjust_cycles(player->ym, player->cycle_limit);
+			for (uint32_t i = 0; i < player->num_streams; i++)
+			{
+				vgm_stream *stream = player->streams + i;
+				stream->next_cycle = stream->next_cycle > player->cycle_limit ? stream->next_cycle - player->cycle_limit : 0;
+			}
+			if (player->frame_done) {
+				player->frame_done(player->frame_data);
+			}
+		}
+	}
+}
+
+static uint32_t read_le(uint8_t *src, uint8_t bytes)
+{
+	uint32_t value = 0;
+	for (uint8_t i = 0; i < bytes; i++)
+	{
+		value |= src[i] << (8 * i);
+	}
+	return value;
+}
+
+static void add_data_block(vgm_player *player, uint8_t type, uint8_t *data, uint32_t size)
+{
+	if (type >= DATA_STREAM_LIMIT) {
+		return;
+	}
+	//blocks of the same type are concatenated into a single bank that streams and seeks address
+	vgm_bank *bank = player->banks + type;
+	if (bank->num_blocks == bank->block_storage) {
+		bank->block_storage = bank->block_storage ? bank->block_storage * 2 : 16;
+		bank->block_offsets = realloc(bank->block_offsets, bank->block_storage * sizeof(uint32_t));
+	}
+	bank->block_offsets[bank->num_blocks++] = bank->size;
+	if (bank->size + size > bank->storage) {
+		bank->storage = (bank->size + size) * 2;
+		bank->data = realloc(bank->data, bank->storage);
+	}
+	memcpy(bank->data + bank->size, data, size);
+	bank->size += size;
+}
+
+//number of operand bytes for commands of chips that are not emulated, these are skipped
+static uint8_t skip_size(uint8_t cmd)
+{
+	if (cmd >= 0x30 && cmd <= 0x3F) {
+		return 1;
+	}
+	if ((cmd >= 0x40 && cmd <= 0x4E) || (cmd >= 0x51 && cmd <= 0x5F) || (cmd >= 0xA0 && cmd <= 0xBF)) {
+		return 2;
+	}
+	if (cmd >= 0xC0 && cmd <= 0xDF) {
+		return 3;
+	}
+	if (cmd >= 0xE1) {
+		return 4;
+	}
+	return 0xFF;
+}
+
+uint8_t vgm_play(vgm_player *player)
+{
+#define NEED(bytes) if (player->end - player->cur < (bytes)) { warning("VGM data is truncated\n"); return 0; }
+	uint32_t loops = player->loops;
+	while (player->cur < player->end)
+	{
+		uint8_t cmd = *(player->cur++);
+		uint8_t *cur = player->cur;
+		switch(cmd)
+		{
+		case CMD_PSG_STEREO:
+			//ignore for now
+			NEED(1);
+			player->cur++;
+			break;
+		case CMD_PSG:
+			NEED(1);
+			psg_write(player->psg, cur[0]);
+			player->cur++;
+			break;
+		case CMD_YM2612_0:
+		case CMD_YM2612_1:
+			NEED(2);
+			write_chip(player, STREAM_CHIP_YM2612, cmd == CMD_YM2612_1, cur[0], cur[1]);
+			player->cur += 2;
+			break;
+		case CMD_WAIT:
+			NEED(2);
+			vgm_wait(player, read_le(cur, 2));
+			player->cur += 2;
+			break;
+		case CMD_WAIT_60:
+			vgm_wait(player, 735);
+			break;
+		case CMD_WAIT_50:
+			vgm_wait(player, 882);
+			break;
+		case CMD_END:
+			if (player->header.loop_offset && --loops) {
+				uint32_t loop_start = player->header.loop_offset + 0x1C;
+				if (loop_start < player->data - player->file || loop_start >= player->end - player->file) {
+					warning("Invalid loop offset %X\n", player->header.loop_offset);
+					return 0;
+				}
+				player->cur = player->file + loop_start;
+			} else {
+				//TODO: fade out
+				return 1;
+			}
+			break;
+		case CMD_DATA: {
+			NEED(6);
+			uint8_t data_type = cur[1];
+			//the top bit of the size flags a 32-bit ROM size for some block types
+			uint32_t data_size = read_le(cur + 2, 4) & 0x7FFFFFFF;
+			player->cur += 6;
+			NEED(data_size);
+			add_data_block(player, data_type, player->cur, data_size);
+			player->cur += data_size;
+			break;
+		}
+		case CMD_PCM_WRITE:
+			NEED(11);
+			player->cur += 11;
+			break;
+		case CMD_DATA_SEEK:
+			NEED(4);
+			player->seek_offset = read_le(cur, 4);
+			player->cur += 4;
+			break;
+		case CMD_DAC_STREAM_SETUP: {
+			NEED(4);
+			vgm_stream *stream = find_stream(player, cur[0], 1);
+			if (stream) {
+				stream->chip = cur[1] & 0x7F;
+				stream->port = cur[2];
+				stream->reg = cur[3];
+				stream->configured = stream->chip == STREAM_CHIP_YM2612 || stream->chip == STREAM_CHIP_PSG;
+				if (!stream->configured) {
+					warning("DAC stream %X targets unsupported chip type %X\n", cur[0], stream->chip);
+				}
+			}
+			player->cur += 4;
+			break;
+		}
+		case CMD_DAC_STREAM_DATA: {
+			NEED(4);
+			vgm_stream *stream = find_stream(player, cur[0], 1);
+			if (stream) {
+				stream->bank = cur[1] < DATA_STREAM_LIMIT ? cur[1] : 0;
+				stream->step_size = cur[2] ? cur[2] : 1;
+				stream->step_base = cur[3];
+			}
+			player->cur += 4;
+			break;
+		}
+		case CMD_DAC_STREAM_FREQ: {
+			NEED(5);
+			vgm_stream *stream = find_stream(player, cur[0], 1);
+			if (stream) {
+				stream_set_frequency(player, stream, read_le(cur + 1, 4));
+				if (!stream->frequency) {
+					stream->active = 0;
+				}
+			}
+			player->cur += 5;
+			break;
+		}
+		case CMD_DAC_STREAM_START: {
+			NEED(10);
+			vgm_stream *stream = find_stream(player, cur[0], 0);
+			if (stream) {
+				stream_start(player, stream, read_le(cur + 1, 4), cur[5], read_le(cur + 6, 4));
+			}
+			player->cur += 10;
+			break;
+		}
+		case CMD_DAC_STREAM_STOP:
+			NEED(1);
+			for (uint32_t i = 0; i < player->num_streams; i++)
+			{
+				if (cur[0] == 0xFF || player->streams[i].id == cur[0]) {
+					player->streams[i].active = 0;
+				}
+			}
+			player->cur++;
+			break;
+		case CMD_DAC_STREAM_STARTFAST: {
+			NEED(4);
+			vgm_stream *stream = find_stream(player, cur[0], 0);
+			uint16_t block = read_le(cur + 1, 2);
+			if (stream) {
+				vgm_bank *bank = player->banks + stream->bank;
+				if (block < bank->num_blocks) {
+					uint32_t start = bank->block_offsets[block];
+					uint32_t end = block + 1 < bank->num_blocks ? bank->block_offsets[block + 1] : bank->size;
+					uint8_t mode = STREAM_LENGTH_COMMANDS;
+					if (cur[3] & STREAM_FAST_LOOP) {
+						mode |= STREAM_LOOP;
+					}
+					if (cur[3] & STREAM_FAST_REVERSE) {
+						mode |= STREAM_REVERSE;
+					}
+					//step base is added back by stream_start
+					stream_start(player, stream, start - stream->step_base, mode, (end - start) / stream->step_size);
+				} else {
+					warning("DAC stream %X references missing data block %d\n", cur[0], block);
+				}
+			}
+			player->cur += 4;
+			break;
+		}
+		default:
+			if (cmd >= CMD_WAIT_SHORT && cmd < (CMD_WAIT_SHORT + 0x10)) {
+				vgm_wait(player, (cmd & 0xF) + 1);
+			} else if (cmd >= CMD_YM2612_DAC && cmd < CMD_DAC_STREAM_SETUP) {
+				vgm_bank *bank = player->banks + DATA_YM2612_PCM;
+				if (player->seek_offset < bank->size) {
+					write_chip(player, STREAM_CHIP_YM2612, 0, REG_DAC, bank->data[player->seek_offset++]);
+				} else {
+					warning("Encountered DAC write command but data seek pointer is invalid!\n");
+				}
+				if (cmd & 0xF) {
+					vgm_wait(player, cmd & 0xF);
+				}
+			} else {
+				uint8_t size = skip_size(cmd);
+				if (size == 0xFF) {
+					warning("unimplemented command: %X at offset %X\n", cmd, (unsigned int)(player->cur - player->file - 1));
+					return 0;
+				}
+				NEED(size);
+				player->cur += size;
+			}
+		}
+	}
+#undef NEED
+	return 1;
+}
+
+//DAC writes further apart than this end the current run of samples
+#define DAC_BURST_GAP (VGM_SAMPLE_RATE / 30)
+#define MAX_DAC_BURST (64 * 1024)
+#define NO_DAC_CMD 0xFFFFFFFF
+#define PENDING_FLUSH_SIZE 4096
+
+typedef struct {
+	uint32_t hash;
+	uint32_t offset;
+	uint32_t size;
+} dac_burst;
+
+struct vgm_writer {
+	FILE      *f;
+	uint8_t   *pending;
+	uint8_t   *burst;
+	uint8_t   *bank;
+	dac_burst *bursts;
+	uint64_t  cycle_base;
+	uint64_t  last_sample;
+	uint64_t  last_dac_sample;
+	uint32_t  pending_size;
+	uint32_t  pending_storage;
+	uint32_t  burst_size;
+	uint32_t  bank_size;
+	uint32_t  bank_storage;
+	uint32_t  num_bursts;
+	uint32_t  burst_storage;
+	uint32_t  seek_patch;
+	uint32_t  last_dac_cmd;
+	uint32_t  mclks_sample;
+	uint32_t  dac_writes;
+	uint8_t   burst_open;
+};
+
+static void pending_append(vgm_writer *vgm, uint8_t *data, uint32_t size)
+{
+	if (vgm->pending_size + size > vgm->pending_storage) {
+		vgm->pending_storage = (vgm->pending_size + size) * 2;
+		vgm->pending = realloc(vgm->pending, vgm->pending_storage);
+	}
+	memcpy(vgm->pending + vgm->pending_size, data, size);
+	vgm->pending_size += size;
+}
+
+static void flush_pending(vgm_writer *vgm)
+{
+	fwrite(vgm->pending, 1, vgm->pending_size, vgm->f);
+	vgm->pending_size = 0;
+	vgm->last_dac_cmd = NO_DAC_CMD;
+}
+
+static void emit_cmd(vgm_writer *vgm, uint8_t cmd, uint8_t *operands, uint32_t size)
+{
+	pending_append(vgm, &cmd, 1);
+	pending_append(vgm, operands, size);
+	vgm->last_dac_cmd = NO_DAC_CMD;
+}
+
+static uint64_t cycle_to_sample(vgm_writer *vgm, uint32_t cycle)
+{
+	return (vgm->cycle_base + cycle) / vgm->mclks_sample;
+}
+
+static void emit_wait(vgm_writer *vgm, uint64_t sample)
+{
+	if (sample <= vgm->last_sample) {
+		return;
+	}
+	uint64_t wait = sample - vgm->last_sample;
+	vgm->last_sample = sample;
+	if (vgm->last_dac_cmd != NO_DAC_CMD) {
+		//a DAC write command can carry up to 15 samples of wait for free
+		uint8_t folded = wait > 0xF ? 0xF : wait;
+		vgm->pending[vgm->last_dac_cmd] |= folded;
+		wait -= folded;
+		vgm->last_dac_cmd = NO_DAC_CMD;
+	}
+	while (wait)
+	{
+		uint8_t operands[2];
+		if (wait == 735) {
+			emit_cmd(vgm, CMD_WAIT_60, NULL, 0);
+			wait = 0;
+		} else if (wait == 882) {
+			emit_cmd(vgm, CMD_WAIT_50, NULL, 0);
+			wait = 0;
+		} else if (wait <= 16) {
+			emit_cmd(vgm, CMD_WAIT_SHORT + wait - 1, NULL, 0);
+			wait = 0;
+		} else {
+			uint16_t amount = wait > 0xFFFF ? 0xFFFF : wait;
+			operands[0] = amount;
+			operands[1] = amount >> 8;
+			emit_cmd(vgm, CMD_WAIT, operands, 2);
+			wait -= amount;
+		}
+	}
+}
+
+static uint32_t hash_burst(uint8_t *data, uint32_t size)
+{
+	//FNV-1a
+	uint32_t hash = 2166136261U;
+	for (uint32_t i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+//Finishes the current run of DAC writes. Runs identical to an earlier one reuse its data,
+//otherwise the samples are written as a new data block ahead of the commands that play them
+static void end_burst(vgm_writer *vgm)
+{
+	if (!vgm->burst_open) {
+		return;
+	}
+	vgm->burst_open = 0;
+	uint32_t hash = hash_burst(vgm->burst, vgm->burst_size);
+	uint32_t offset = vgm->bank_size;
+	for (uint32_t i = 0; i < vgm->num_bursts; i++)
+	{
+		dac_burst *prev = vgm->bursts + i;
+		if (prev->hash == hash && prev->size == vgm->burst_size && !memcmp(vgm->bank + prev->offset, vgm->burst, vgm->burst_size)) {
+			offset = prev->offset;
+			break;
+		}
+	}
+	if (offset == vgm->bank_size) {
+		uint8_t header[7] = {CMD_DATA, CMD_END, DATA_YM2612_PCM};
+		for (int i = 0; i < 4; i++)
+		{
+			header[3 + i] = vgm->burst_size >> (8 * i);
+		}
+		fwrite(header, 1, sizeof(header), vgm->f);
+		fwrite(vgm->burst, 1, vgm->burst_size, vgm->f);
+		if (vgm->bank_size + vgm->burst_size > vgm->bank_storage) {
+			vgm->bank_storage = (vgm->bank_size + vgm->burst_size) * 2;
+			vgm->bank = realloc(vgm->bank, vgm->bank_storage);
+		}
+		memcpy(vgm->bank + vgm->bank_size, vgm->burst, vgm->burst_size);
+		vgm->bank_size += vgm->burst_size;
+		if (vgm->num_bursts == vgm->burst_storage) {
+			vgm->burst_storage = vgm->burst_storage ? vgm->burst_storage * 2 : 64;
+			vgm->bursts = realloc(vgm->bursts, vgm->burst_storage * sizeof(dac_burst));
+		}
+		vgm->bursts[vgm->num_bursts++] = (dac_burst){
+			.hash = hash,
+			.offset = offset,
+			.size = vgm->burst_size
+		};
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		vgm->pending[vgm->seek_patch + i] = offset >> (8 * i);
+	}
+	vgm->burst_size = 0;
+	//keep a trailing DAC command open so the next wait can still be folded into it
+	uint32_t last_dac_cmd = vgm->last_dac_cmd;
+	if (last_dac_cmd == vgm->pending_size - 1) {
+		fwrite(vgm->pending, 1, last_dac_cmd, vgm->f);
+		vgm->pending[0] = vgm->pending[last_dac_cmd];
+		vgm->pending_size = 1;
+		vgm->last_dac_cmd = 0;
+	} else {
+		flush_pending(vgm);
+	}
+}
+
+vgm_writer *vgm_write_open(char *path, uint32_t master_clock, uint8_t pal)
+{
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		warning("Failed to open %s for writing\n", path);
+		return NULL;
+	}
+	vgm_writer *vgm = calloc(1, sizeof(vgm_writer));
+	vgm->f = f;
+	vgm->mclks_sample = master_clock / VGM_SAMPLE_RATE;
+	vgm->last_dac_cmd = NO_DAC_CMD;
+	vgm_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.ident, "Vgm ", 4);
+	header.version = 0x150;
+	header.sn76489_clk = master_clock / 15;
+	header.rate = pal ? 50 : 60;
+	//Sega PSG noise feedback pattern and shift register width
+	header.sn76489_fb = 0x9;
+	header.sn76489_shift = 16;
+	header.ym2612_clk = master_clock / 7;
+	header.data_offset = sizeof(vgm_header) - 0x34;
+	//eof offset and sample count are filled in when the log is closed
+	fwrite(&header, 1, sizeof(header), f);
+	return vgm;
+}
+
+void vgm_ym2612_write(vgm_writer *vgm, uint32_t cycle, uint8_t part, uint8_t reg, uint8_t value)
+{
+	uint64_t sample = cycle_to_sample(vgm, cycle);
+	if (part || reg != REG_DAC) {
+		emit_wait(vgm, sample);
+		uint8_t operands[] = {reg, value};
+		emit_cmd(vgm, part ? CMD_YM2612_1 : CMD_YM2612_0, operands, sizeof(operands));
+		if (!vgm->burst_open && vgm->pending_size >= PENDING_FLUSH_SIZE) {
+			flush_pending(vgm);
+		}
+		return;
+	}
+	vgm->dac_writes++;
+	if (vgm->burst_open && (sample > vgm->last_dac_sample + DAC_BURST_GAP || vgm->burst_size == MAX_DAC_BURST)) {
+		end_burst(vgm);
+	}
+	emit_wait(vgm, sample);
+	if (!vgm->burst_open) {
+		//the seek target is patched in once the burst is complete and its data location is known
+		uint8_t operands[4] = {0};
+		emit_cmd(vgm, CMD_DATA_SEEK, operands, sizeof(operands));
+		vgm->seek_patch = vgm->pending_size - sizeof(operands);
+		vgm->burst_open = 1;
+		if (!vgm->burst) {
+			vgm->burst = malloc(MAX_DAC_BURST);
+		}
+	}
+	vgm->burst[vgm->burst_size++] = value;
+	vgm->last_dac_sample = sample;
+	emit_cmd(vgm, CMD_YM2612_DAC, NULL, 0);
+	vgm->last_dac_cmd = vgm->pending_size - 1;
+}
+
+void vgm_psg_write(vgm_writer *vgm, uint32_t cycle, uint8_t value)
+{
+	emit_wait(vgm, cycle_to_sample(vgm, cycle));
+	emit_cmd(vgm, CMD_PSG, &value, 1);
+	if (!vgm->burst_open && vgm->pending_size >= PENDING_FLUSH_SIZE) {
+		flush_pending(vgm);
+	}
+}
+
+void vgm_ym2612_state(vgm_writer *vgm, uint32_t cycle, ym2612_context *ym)
+{
+	for (int part = 0; part < 2; part++)
+	{
+		uint8_t *regs = part ? ym->part2_regs : ym->part1_regs;
+		uint8_t start = part ? YM_PART2_START : YM_PART1_START;
+		for (int reg = start; reg < YM_REG_END; reg++)
+		{
+			if (reg == REG_KEY_ONOFF || reg == REG_DAC || (reg & 0xFC) == REG_BLOCK_FNUM_H || (reg & 0xFC) == REG_BLOCK_FN_CH3) {
+				continue;
+			}
+			if ((reg & 3) == 3 && reg >= REG_FNUM_LOW) {
+				//unused slots in the frequency and channel registers
+				continue;
+			}
+			if ((reg & 0xFC) == REG_FNUM_LOW || (reg & 0xFC) == REG_FNUM_LOW_CH3) {
+				//the high frequency bits are latched until the low bits are written
+				vgm_ym2612_write(vgm, cycle, part, reg + 4, regs[reg + 4 - start]);
+			}
+			vgm_ym2612_write(vgm, cycle, part, reg, regs[reg - start]);
+		}
+	}
+	vgm_ym2612_write(vgm, cycle, 0, REG_DAC, ym->part1_regs[REG_DAC - YM_PART1_START]);
+	for (int i = 0; i < NUM_CHANNELS; i++)
+	{
+		vgm_ym2612_write(vgm, cycle, 0, REG_KEY_ONOFF, ym->channels[i].keyon | (i < 3 ? i : i + 1));
+	}
+}
+
+void vgm_psg_state(vgm_writer *vgm, uint32_t cycle, psg_context *psg)
+{
+	for (int channel = 0; channel < 3; channel++)
+	{
+		vgm_psg_write(vgm, cycle, 0x80 | channel << 5 | (psg->counter_load[channel] & 0xF));
+		vgm_psg_write(vgm, cycle, psg->counter_load[channel] >> 4 & 0x3F);
+	}
+	uint8_t noise = 3;
+	if (!psg->noise_use_tone) {
+		for (noise = 0; noise < 3 && (0x10 << noise) != psg->counter_load[3]; noise++)
+		{
+		}
+	}
+	vgm_psg_write(vgm, cycle, 0xE0 | psg->noise_type | noise);
+	for (int channel = 0; channel < 4; channel++)
+	{
+		vgm_psg_write(vgm, cycle, 0x90 | channel << 5 | psg->volume[channel]);
+	}
+}
+
+void vgm_adjust_cycles(vgm_writer *vgm, uint32_t deduction)
+{
+	vgm->cycle_base += deduction;
+	//a long enough pause in DAC writes can be detected here rather than waiting for the next one
+	if (vgm->burst_open && vgm->cycle_base / vgm->mclks_sample > vgm->last_dac_sample + DAC_BURST_GAP) {
+		end_burst(vgm);
+	}
+}
+
+void vgm_write_close(vgm_writer *vgm, uint32_t cycle)
+{
+	end_burst(vgm);
+	emit_wait(vgm, cycle_to_sample(vgm, cycle));
+	emit_cmd(vgm, CMD_END, NULL, 0);
+	flush_pending(vgm);
+	uint32_t size = ftell(vgm->f);
+	uint32_t eof_offset = size - offsetof(vgm_header, eof_offset);
+	uint32_t num_samples = vgm->last_sample;
+	fseek(vgm->f, offsetof(vgm_header, eof_offset), SEEK_SET);
+	fwrite(&eof_offset, sizeof(eof_offset), 1, vgm->f);
+	fseek(vgm->f, offsetof(vgm_header, num_samples), SEEK_SET);
+	fwrite(&num_samples, sizeof(num_samples), 1, vgm->f);
+	fclose(vgm->f);
+	info_message("VGM log finished: %d bytes, %d DAC writes stored as %d bytes of sample data\n", size, vgm->dac_writes, vgm->bank_size);
+	free(vgm->pending);
+	free(vgm->burst);
+	free(vgm->bank);
+	free(vgm->bursts);
+	free(vgm);
+}
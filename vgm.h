@@ -59,9 +59,26 @@ enum {
 };
 
 enum {
-	DATA_YM2612_PCM = 0
+	DATA_YM2612_PCM = 0,
+	//types at or above this are compressed or ROM/RAM images rather than streamable data
+	DATA_STREAM_LIMIT = 0x40
 };
 
+enum {
+	STREAM_CHIP_PSG = 0,
+	STREAM_CHIP_YM2612 = 2
+};
+
+#define STREAM_LENGTH_MASK    0x3
+#define STREAM_LENGTH_IGNORE  0
+#define STREAM_LENGTH_COMMANDS 1
+#define STREAM_LENGTH_MSEC    2
+#define STREAM_LENGTH_END     3
+#define STREAM_REVERSE        0x10
+#define STREAM_LOOP           0x80
+#define STREAM_FAST_LOOP      0x01
+#define STREAM_FAST_REVERSE   0x10
+
 #pragma pack(pop)
 
 typedef struct {
@@ -71,4 +88,85 @@ typedef struct {
 	uint8_t           type;
 } data_block;
 
+#include "ym2612.h"
+#include "psg.h"
+
+#define VGM_MAX_STREAMS 8
+
+typedef struct {
+	uint8_t  *data;
+	uint32_t size;
+	uint32_t storage;
+	uint32_t *block_offsets;
+	uint32_t num_blocks;
+	uint32_t block_storage;
+} vgm_bank;
+
+typedef struct {
+	uint32_t next_cycle;
+	uint32_t interval;
+	uint32_t interval_rem;
+	uint32_t interval_frac;
+	uint32_t frequency;
+	uint32_t pos;
+	uint32_t start;
+	uint32_t length;
+	uint32_t remaining;
+	uint8_t  id;
+	uint8_t  chip;
+	uint8_t  port;
+	uint8_t  reg;
+	uint8_t  bank;
+	uint8_t  step_size;
+	uint8_t  step_base;
+	uint8_t  flags;
+	uint8_t  configured;
+	uint8_t  active;
+} vgm_stream;
+
+typedef void (*vgm_frame_handler)(void *data);
+
+typedef struct {
+	vgm_header        header;
+	uint8_t           *file;
+	uint8_t           *data;
+	uint8_t           *cur;
+	uint8_t           *end;
+	ym2612_context    *ym;
+	psg_context       *psg;
+	vgm_frame_handler frame_done;
+	void              *frame_data;
+	uint64_t          samples;
+	uint32_t          file_size;
+	uint32_t          mclks_sample;
+	uint32_t          cycle_limit;
+	uint32_t          current_cycle;
+	uint32_t          seek_offset;
+	uint32_t          loops;
+	uint32_t          num_streams;
+	vgm_bank          banks[DATA_STREAM_LIMIT];
+	vgm_stream        streams[VGM_MAX_STREAMS];
+} vgm_player;
+
+//Reads a VGM file into memory, gzip compressed VGZ files are decompressed transparently
+uint8_t *vgm_load(char *path, uint32_t *size_out);
+//Takes ownership of file, returns 0 if it is not a valid VGM file
+uint8_t vgm_player_init(vgm_player *player, uint8_t *file, uint32_t file_size, uint32_t master_clock, ym2612_context *ym, psg_context *psg, uint32_t loops);
+//Plays to the end of the file, frame_done is called about every 60th of a second of emulated time
+//returns 0 if playback stopped early because of a malformed or unsupported command
+uint8_t vgm_play(vgm_player *player);
+void vgm_player_free(vgm_player *player);
+
+typedef struct vgm_writer vgm_writer;
+
+//Opens a VGM file for logging chip writes, cycles are in master clocks
+vgm_writer *vgm_write_open(char *path, uint32_t master_clock, uint8_t pal);
+//Writes the full register state of a chip so playback starts from the same point as the emulator
+void vgm_ym2612_state(vgm_writer *vgm, uint32_t cycle, ym2612_context *ym);
+void vgm_psg_state(vgm_writer *vgm, uint32_t cycle, psg_context *psg);
+void vgm_ym2612_write(vgm_writer *vgm, uint32_t cycle, uint8_t part, uint8_t reg, uint8_t value);
+void vgm_psg_write(vgm_writer *vgm, uint32_t cycle, uint8_t value);
+void vgm_adjust_cycles(vgm_writer *vgm, uint32_t deduction);
+void vgm_write_close(vgm_writer *vgm, uint32_t cycle);
+
 #endif //VGM_H_
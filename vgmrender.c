@@ -0,0 +1,429 @@
+/*
+ Copyright 2013 Michael Pavone
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+//Renders VGM/VGZ files straight to WAV without an audio device, several files at a time
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "render.h"
+#include "ym2612.h"
+#include "psg.h"
+#include "util.h"
+#include "wave.h"
+#include "vgm.h"
+
+#define MCLKS_NTSC 53693175
+#define MCLKS_PER_68K 7
+#define MCLKS_PER_YM  MCLKS_PER_68K
+#define MCLKS_PER_Z80 15
+#define MCLKS_PER_PSG (MCLKS_PER_Z80*16)
+
+#define BUFFER_INC_RES 0x40000000UL
+#define DEFAULT_SAMPLE_RATE 44100
+#define DEFAULT_LOWPASS_CUTOFF 3390
+#define DEFAULT_LOOPS 2
+
+int headless = 1;
+
+//set before any workers start and read-only afterwards
+static uint32_t sample_rate = DEFAULT_SAMPLE_RATE;
+static uint32_t lowpass_cutoff = DEFAULT_LOWPASS_CUTOFF;
+
+//Offline replacement for the SDL audio sources: output is resampled the same way,
+//but collected in a growable buffer that the owning worker drains after each frame
+struct audio_source {
+	int16_t  *samples;
+	uint64_t buffer_fraction;
+	uint64_t buffer_inc;
+	uint32_t lowpass_alpha;
+	uint32_t num_frames;
+	uint32_t storage;
+	int16_t  last_left;
+	int16_t  last_right;
+	uint8_t  num_channels;
+};
+
+void render_audio_adjust_clock(audio_source *src, uint64_t master_clock, uint64_t sample_divider)
+{
+	src->buffer_inc = ((BUFFER_INC_RES * (uint64_t)sample_rate) / master_clock) * sample_divider;
+}
+
+audio_source *render_audio_source(uint64_t master_clock, uint64_t sample_divider, uint8_t channels)
+{
+	audio_source *src = calloc(1, sizeof(audio_source));
+	src->num_channels = channels;
+	render_audio_adjust_clock(src, master_clock, sample_divider);
+	double rc = (1.0 / lowpass_cutoff) / (2.0 * M_PI);
+	double dt = 1.0 / ((double)master_clock / (double)(sample_divider));
+	double alpha = dt / (dt + rc);
+	src->lowpass_alpha = (int32_t)(((double)0x10000) * alpha);
+	return src;
+}
+
+void render_free_source(audio_source *src)
+{
+	free(src->samples);
+	free(src);
+}
+
+static int16_t lowpass_sample(audio_source *src, int16_t last, int16_t current)
+{
+	int32_t tmp = current * src->lowpass_alpha + last * (0x10000 - src->lowpass_alpha);
+	return tmp >> 16;
+}
+
+static int16_t interp_sample(audio_source *src, int16_t last, int16_t current)
+{
+	int64_t tmp = last * ((src->buffer_fraction << 16) / src->buffer_inc);
+	tmp += current * (0x10000 - ((src->buffer_fraction << 16) / src->buffer_inc));
+	return tmp >> 16;
+}
+
+static int16_t *alloc_frame(audio_source *src)
+{
+	if (src->num_frames == src->storage) {
+		src->storage = src->storage ? src->storage * 2 : 4096;
+		src->samples = realloc(src->samples, src->storage * src->num_channels * sizeof(int16_t));
+	}
+	return src->samples + src->num_frames++ * src->num_channels;
+}
+
+void render_put_mono_sample(audio_source *src, int16_t value)
+{
+	value = lowpass_sample(src, src->last_left, value);
+	src->buffer_fraction += src->buffer_inc;
+	while (src->buffer_fraction > BUFFER_INC_RES)
+	{
+		src->buffer_fraction -= BUFFER_INC_RES;
+		*alloc_frame(src) = interp_sample(src, src->last_left, value);
+	}
+	src->last_left = value;
+}
+
+void render_put_mono_samples(audio_source *src, int16_t value, uint32_t count)
+{
+	//same shortcut as the SDL version, once the filter settles only the number of outputs matters
+	for (; count && lowpass_sample(src, src->last_left, value) != src->last_left; count--)
+	{
+		render_put_mono_sample(src, value);
+	}
+	if (!count) {
+		return;
+	}
+	uint64_t total = src->buffer_fraction + count * src->buffer_inc;
+	uint64_t outputs = total > BUFFER_INC_RES ? (total - 1) / BUFFER_INC_RES : 0;
+	src->buffer_fraction = total - outputs * BUFFER_INC_RES;
+	for (; outputs; outputs--)
+	{
+		*alloc_frame(src) = src->last_left;
+	}
+}
+
+void render_put_stereo_sample(audio_source *src, int16_t left, int16_t right)
+{
+	left = lowpass_sample(src, src->last_left, left);
+	right = lowpass_sample(src, src->last_right, right);
+	src->buffer_fraction += src->buffer_inc;
+	while (src->buffer_fraction > BUFFER_INC_RES)
+	{
+		src->buffer_fraction -= BUFFER_INC_RES;
+		int16_t *frame = alloc_frame(src);
+		frame[0] = interp_sample(src, src->last_left, left);
+		frame[1] = interp_sample(src, src->last_right, right);
+	}
+	src->last_left = left;
+	src->last_right = right;
+}
+
+void render_errorbox(char *title, char *message)
+{
+}
+
+void render_infobox(char *title, char *message)
+{
+}
+
+typedef struct {
+	char     *in_path;
+	char     *out_path;
+	uint64_t frames;
+	uint64_t elapsed;
+	uint8_t  ok;
+} render_job;
+
+typedef struct {
+	ym2612_context *ym;
+	psg_context    *psg;
+	FILE           *out;
+	int16_t        *mix;
+	uint32_t       mix_storage;
+	uint64_t       frames;
+} render_state;
+
+static render_job *jobs;
+static uint32_t   num_jobs;
+static SDL_atomic_t next_job;
+static uint32_t   loops = DEFAULT_LOOPS;
+
+static void drop_frames(audio_source *src, uint32_t frames)
+{
+	src->num_frames -= frames;
+	memmove(src->samples, src->samples + frames * src->num_channels, src->num_frames * src->num_channels * sizeof(int16_t));
+}
+
+//mixes as many frames as both chips have produced, flush pads whichever chip is behind with silence
+static void mix_output(render_state *state, uint8_t flush)
+{
+	audio_source *ym = state->ym->audio, *psg = state->psg->audio;
+	uint32_t frames = ym->num_frames < psg->num_frames ? ym->num_frames : psg->num_frames;
+	if (flush) {
+		frames = ym->num_frames > psg->num_frames ? ym->num_frames : psg->num_frames;
+	}
+	if (!frames) {
+		return;
+	}
+	if (frames * 2 > state->mix_storage) {
+		state->mix_storage = frames * 4;
+		state->mix = realloc(state->mix, state->mix_storage * sizeof(int16_t));
+	}
+	for (uint32_t i = 0; i < frames; i++)
+	{
+		int32_t psg_value = i < psg->num_frames ? psg->samples[i] : 0;
+		int32_t left = psg_value, right = psg_value;
+		if (i < ym->num_frames) {
+			left += ym->samples[i * 2];
+			right += ym->samples[i * 2 + 1];
+		}
+		state->mix[i * 2] = left > 0x7FFF ? 0x7FFF : left < -0x8000 ? -0x8000 : left;
+		state->mix[i * 2 + 1] = right > 0x7FFF ? 0x7FFF : right < -0x8000 ? -0x8000 : right;
+	}
+	fwrite(state->mix, sizeof(int16_t), frames * 2, state->out);
+	state->frames += frames;
+	drop_frames(ym, frames < ym->num_frames ? frames : ym->num_frames);
+	drop_frames(psg, frames < psg->num_frames ? frames : psg->num_frames);
+}
+
+static void frame_done(void *data)
+{
+	mix_output(data, 0);
+}
+
+static void render_file(render_job *job, render_state *state)
+{
+	uint64_t start = SDL_GetPerformanceCounter();
+	uint32_t size;
+	uint8_t *file = vgm_load(job->in_path, &size);
+	if (!file) {
+		return;
+	}
+	state->ym = malloc(sizeof(ym2612_context));
+	state->psg = malloc(sizeof(psg_context));
+	ym_init(state->ym, MCLKS_NTSC, MCLKS_PER_YM, 0);
+	psg_init(state->psg, MCLKS_NTSC, MCLKS_PER_PSG);
+	vgm_player player;
+	if (!vgm_player_init(&player, file, size, MCLKS_NTSC, state->ym, state->psg, loops)) {
+		warning("%s is not a valid VGM file\n", job->in_path);
+		goto cleanup;
+	}
+	state->out = fopen(job->out_path, "wb");
+	if (!state->out) {
+		warning("Failed to open %s for writing\n", job->out_path);
+		goto cleanup;
+	}
+	wave_init(state->out, sample_rate, 16, 2);
+	state->frames = 0;
+	player.frame_done = frame_done;
+	player.frame_data = state;
+	job->ok = vgm_play(&player);
+	mix_output(state, 1);
+	wave_finalize(state->out);
+	job->frames = state->frames;
+	job->elapsed = SDL_GetPerformanceCounter() - start;
+cleanup:
+	//vgm_player_free also releases file, even when init fails
+	vgm_player_free(&player);
+	ym_free(state->ym);
+	psg_free(state->psg);
+}
+
+static int render_worker(void *data)
+{
+	render_state state;
+	memset(&state, 0, sizeof(state));
+	for (;;)
+	{
+		uint32_t index = SDL_AtomicAdd(&next_job, 1);
+		if (index >= num_jobs) {
+			break;
+		}
+		render_file(jobs + index, &state);
+	}
+	free(state.mix);
+	return 0;
+}
+
+static char *output_path(char *in_path, char *out_dir)
+{
+	char *base = basename_no_extension(in_path);
+	char *dir = out_dir ? strdup(out_dir) : path_dirname(in_path);
+	char *path;
+	if (dir) {
+		char const *parts[] = {dir, PATH_SEP, base, ".wav"};
+		path = alloc_concat_m(4, parts);
+	} else {
+		path = alloc_concat(base, ".wav");
+	}
+	free(dir);
+	free(base);
+	return path;
+}
+
+static void add_job(char *in_path, char *out_dir, uint32_t *storage)
+{
+	if (num_jobs == *storage) {
+		*storage = *storage ? *storage * 2 : 64;
+		jobs = realloc(jobs, *storage * sizeof(render_job));
+	}
+	render_job *job = jobs + num_jobs++;
+	memset(job, 0, sizeof(render_job));
+	job->in_path = in_path;
+	job->out_path = output_path(in_path, out_dir);
+}
+
+static void usage(void)
+{
+	fputs(
+		"Usage: vgmrender [OPTIONS] FILE...\n"
+		"Renders each VGM or VGZ file to a WAV file of the same name\n"
+		"\t-o DIR      Write output files to DIR instead of next to the input\n"
+		"\t-l LIST     Also render every file listed in LIST, one path per line\n"
+		"\t-j THREADS  Number of files to render in parallel (default: number of CPUs)\n"
+		"\t-r RATE     Output sample rate (default: 44100)\n"
+		"\t-c CUTOFF   Lowpass filter cutoff in Hz (default: 3390)\n"
+		"\t-n LOOPS    Number of times to play looped files (default: 2)\n"
+		"\t-q          Only print the summary\n", stderr);
+}
+
+int main(int argc, char **argv)
+{
+	set_exe_str(argv[0]);
+	char *out_dir = NULL;
+	uint32_t num_threads = SDL_GetCPUCount();
+	uint32_t job_storage = 0;
+	uint8_t quiet = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (argv[i][0] == '-' && argv[i][1] && !argv[i][2]) {
+			char opt = argv[i][1];
+			if (opt == 'q') {
+				quiet = 1;
+				continue;
+			}
+			if (i + 1 >= argc) {
+				usage();
+				return 1;
+			}
+			char *arg = argv[++i];
+			switch (opt)
+			{
+			case 'o':
+				out_dir = arg;
+				break;
+			case 'l': {
+				FILE *list = fopen(arg, "r");
+				if (!list) {
+					fatal_error("Failed to open %s for reading\n", arg);
+				}
+				char line[4096];
+				while (fgets(line, sizeof(line), list))
+				{
+					char *path = strip_ws(line);
+					if (*path) {
+						add_job(strdup(path), out_dir, &job_storage);
+					}
+				}
+				fclose(list);
+				break;
+			}
+			case 'j':
+				num_threads = atoi(arg);
+				break;
+			case 'r':
+				sample_rate = atoi(arg);
+				break;
+			case 'c':
+				lowpass_cutoff = atoi(arg);
+				break;
+			case 'n':
+				loops = atoi(arg);
+				break;
+			default:
+				usage();
+				return 1;
+			}
+		} else {
+			add_job(argv[i], out_dir, &job_storage);
+		}
+	}
+	if (!num_jobs || !sample_rate || !lowpass_cutoff || !loops) {
+		usage();
+		return 1;
+	}
+	if (num_threads < 1) {
+		num_threads = 1;
+	}
+	if (num_threads > num_jobs) {
+		num_threads = num_jobs;
+	}
+
+	uint64_t start = SDL_GetPerformanceCounter();
+	SDL_AtomicSet(&next_job, 0);
+	SDL_Thread **threads = malloc(num_threads * sizeof(SDL_Thread *));
+	//the main thread is one of the workers
+	for (uint32_t i = 1; i < num_threads; i++)
+	{
+		threads[i] = SDL_CreateThread(render_worker, "vgm render", NULL);
+		if (!threads[i]) {
+			warning("Failed to start render thread: %s\n", SDL_GetError());
+		}
+	}
+	render_worker(NULL);
+	for (uint32_t i = 1; i < num_threads; i++)
+	{
+		if (threads[i]) {
+			SDL_WaitThread(threads[i], NULL);
+		}
+	}
+	double elapsed = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+	double audio_seconds = 0, cpu_seconds = 0;
+	uint32_t failed = 0;
+	for (uint32_t i = 0; i < num_jobs; i++)
+	{
+		render_job *job = jobs + i;
+		double job_audio = (double)job->frames / sample_rate;
+		double job_time = (double)job->elapsed / SDL_GetPerformanceFrequency();
+		audio_seconds += job_audio;
+		cpu_seconds += job_time;
+		if (!job->ok) {
+			failed++;
+		}
+		if (quiet) {
+			continue;
+		}
+		if (!job->elapsed) {
+			printf("%s: failed\n", job->in_path);
+		} else {
+			printf("%s: %.1fs of audio in %.3fs (%.1fx realtime)%s\n", job->out_path, job_audio, job_time,
+				job_time > 0 ? job_audio / job_time : 0, job->ok ? "" : ", incomplete");
+		}
+	}
+	printf("Rendered %d files (%d failed or incomplete) with %d threads\n", num_jobs, failed, num_threads);
+	printf("%.1fs of audio in %.3fs: %.1fx realtime overall, %.1fx per thread\n", audio_seconds, elapsed,
+		elapsed > 0 ? audio_seconds / elapsed : 0, cpu_seconds > 0 ? audio_seconds / cpu_seconds : 0);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,214 @@
+/*
+ Copyright 2013 Michael Pavone
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SDL.h"
+#include "wavelog.h"
+#include "wave.h"
+#include "util.h"
+
+//a little over 150ms of a YM-2612 channel, keeps lock traffic negligible
+#define BLOCK_SAMPLES 8192
+
+typedef struct wave_block wave_block;
+struct wave_block {
+	wave_block *next;
+	wave_log   *log;
+	uint32_t   count;
+	uint8_t    last;
+	int16_t    samples[BLOCK_SAMPLES];
+};
+
+struct wave_log {
+	FILE       *file;
+	wave_block *block;
+	uint8_t    closed;
+};
+
+//shared by every open log, protected by log_lock
+static SDL_mutex  *log_lock;
+static SDL_cond   *block_ready;
+static SDL_cond   *log_closed;
+static wave_block *free_blocks;
+static wave_block *pending_head;
+static wave_block *pending_tail;
+//the writer is started with the first log and then left running for the life of the process
+static SDL_Thread *writer;
+
+static void write_block(wave_block *block)
+{
+	wave_log *log = block->log;
+	if (block->count) {
+		fwrite(block->samples, sizeof(int16_t), block->count, log->file);
+	}
+	if (block->last) {
+		wave_finalize(log->file);
+	}
+}
+
+static void release_block(wave_block *block)
+{
+	wave_log *log = block->log;
+	SDL_LockMutex(log_lock);
+		if (block->last) {
+			log->closed = 1;
+			SDL_CondBroadcast(log_closed);
+		}
+		block->next = free_blocks;
+		free_blocks = block;
+	SDL_UnlockMutex(log_lock);
+}
+
+static int writer_main(void *data)
+{
+	for (;;)
+	{
+		SDL_LockMutex(log_lock);
+			while (!pending_head)
+			{
+				SDL_CondWait(block_ready, log_lock);
+			}
+			wave_block *block = pending_head;
+			pending_head = block->next;
+			if (!pending_head) {
+				pending_tail = NULL;
+			}
+		SDL_UnlockMutex(log_lock);
+		write_block(block);
+		release_block(block);
+	}
+	return 0;
+}
+
+static wave_block *alloc_block(wave_log *log)
+{
+	SDL_LockMutex(log_lock);
+		wave_block *block = free_blocks;
+		if (block) {
+			free_blocks = block->next;
+		}
+	SDL_UnlockMutex(log_lock);
+	if (!block) {
+		//the writer fell behind, grow the pool rather than stall the producer
+		block = malloc(sizeof(wave_block));
+	}
+	block->next = NULL;
+	block->log = log;
+	block->count = 0;
+	block->last = 0;
+	return block;
+}
+
+static void submit_block(wave_block *block)
+{
+	if (!writer) {
+		write_block(block);
+		release_block(block);
+		return;
+	}
+	SDL_LockMutex(log_lock);
+		if (pending_tail) {
+			pending_tail->next = block;
+		} else {
+			pending_head = block;
+		}
+		pending_tail = block;
+		SDL_CondSignal(block_ready);
+	SDL_UnlockMutex(log_lock);
+}
+
+static void next_block(wave_log *log)
+{
+	submit_block(log->block);
+	log->block = alloc_block(log);
+}
+
+wave_log *wave_log_open(char *path, uint32_t sample_rate, uint16_t num_channels)
+{
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		warning("Failed to open WAVE log file %s for writing\n", path);
+		return NULL;
+	}
+	if (!wave_init(f, sample_rate, 16, num_channels)) {
+		warning("Failed to write WAVE header to %s\n", path);
+		fclose(f);
+		return NULL;
+	}
+	if (!log_lock) {
+		log_lock = SDL_CreateMutex();
+		block_ready = SDL_CreateCond();
+		log_closed = SDL_CreateCond();
+		writer = SDL_CreateThread(writer_main, "WAVE log", NULL);
+		if (!writer) {
+			warning("Failed to start WAVE log thread: %s, logs will be written synchronously\n", SDL_GetError());
+		}
+	}
+	wave_log *log = calloc(1, sizeof(wave_log));
+	log->file = f;
+	log->block = alloc_block(log);
+	return log;
+}
+
+void wave_log_sample(wave_log *log, int16_t value)
+{
+	wave_block *block = log->block;
+	block->samples[block->count++] = value;
+	if (block->count == BLOCK_SAMPLES) {
+		next_block(log);
+	}
+}
+
+void wave_log_run(wave_log *log, int16_t value, uint32_t count)
+{
+	while (count)
+	{
+		wave_block *block = log->block;
+		uint32_t space = BLOCK_SAMPLES - block->count;
+		uint32_t chunk = count < space ? count : space;
+		for (uint32_t i = 0; i < chunk; i++)
+		{
+			block->samples[block->count + i] = value;
+		}
+		block->count += chunk;
+		count -= chunk;
+		if (block->count == BLOCK_SAMPLES) {
+			next_block(log);
+		}
+	}
+}
+
+void wave_log_samples(wave_log *log, int16_t *samples, uint32_t count)
+{
+	while (count)
+	{
+		wave_block *block = log->block;
+		uint32_t space = BLOCK_SAMPLES - block->count;
+		uint32_t chunk = count < space ? count : space;
+		memcpy(block->samples + block->count, samples, chunk * sizeof(int16_t));
+		block->count += chunk;
+		samples += chunk;
+		count -= chunk;
+		if (block->count == BLOCK_SAMPLES) {
+			next_block(log);
+		}
+	}
+}
+
+void wave_log_close(wave_log *log)
+{
+	//blocks are written in submission order, so once the last one is done the file is complete
+	log->block->last = 1;
+	submit_block(log->block);
+	SDL_LockMutex(log_lock);
+		while (!log->closed)
+		{
+			SDL_CondWait(log_closed, log_lock);
+		}
+	SDL_UnlockMutex(log_lock);
+	free(log);
+}
@@ -0,0 +1,21 @@
+/*
+ Copyright 2013 Michael Pavone
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#ifndef WAVELOG_H_
+#define WAVELOG_H_
+
+#include <stdint.h>
+
+//16-bit WAVE files fed from the emulation or audio threads
+//samples are collected into blocks that a shared writer thread puts on disk
+typedef struct wave_log wave_log;
+
+wave_log *wave_log_open(char *path, uint32_t sample_rate, uint16_t num_channels);
+void wave_log_sample(wave_log *log, int16_t value);
+void wave_log_run(wave_log *log, int16_t value, uint32_t count);
+void wave_log_samples(wave_log *log, int16_t *samples, uint32_t count);
+void wave_log_close(wave_log *log);
+
+#endif //WAVELOG_H_
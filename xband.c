@@ -6,6 +6,7 @@
 #include "tern.h"
 #include "xband.h"
 #include "util.h"
+#include "saves.h"
 
 #define BIT_ROM_HI 4
 
@@ -156,6 +157,7 @@ static void *xband_write_b(uint32_t address, void *context, uint8_t value)
 		dprintf("Write to \"soft\" control register %X\n", value);
 	} else if ((x->control & BIT_ROM_HI && address < 0x200000) || (address >= 0x200000 && !(x->control & BIT_ROM_HI))) {
 		gen->save_storage[(address & 0xFFFF) ^ 1] = value;
+		mark_save_dirty(&gen->save_dirty, (address & 0xFFFF) ^ 1, 1);
 		m68k_handle_code_write(address, m68k);
 		//TODO: handle code at mirror addresses
 	} else {
@@ -179,6 +181,7 @@ static void *xband_write_w(uint32_t address, void *context, uint16_t value)
 	} else if ((x->control & BIT_ROM_HI && address < 0x200000) || (address >= 0x200000 && !(x->control & BIT_ROM_HI))) {
 		gen->save_storage[address & 0xFFFE] = value;
 		gen->save_storage[(address & 0xFFFE) | 1] = value >> 8;
+		mark_save_dirty(&gen->save_dirty, address & 0xFFFE, 2);
 		m68k_handle_code_write(address, m68k);
 		//TODO: handle code at mirror addresses
 		return context;
@@ -323,11 +326,11 @@ void xband_deserialize(deserialize_buffer *buf, genesis_context *gen)
 	}
 }
 
-rom_info xband_configure_rom(tern_node *rom_db, void *rom, uint32_t rom_size, void *lock_on, uint32_t lock_on_size, memmap_chunk const *base_map, uint32_t base_chunks)
+rom_info xband_configure_rom(rom_database *rom_db, void *rom, uint32_t rom_size, void *lock_on, uint32_t lock_on_size, memmap_chunk const *base_map, uint32_t base_chunks)
 {
 	rom_info info;
 	if (lock_on && lock_on_size) {
-		rom_info lock_on_info = configure_rom(rom_db, lock_on, lock_on_size, NULL, 0, base_map, base_chunks);
+		rom_info lock_on_info = configure_rom(rom_db, lock_on, lock_on_size, NULL, NULL, 0, base_map, base_chunks);
 		info.name = alloc_concat("XBAND - ", lock_on_info.name);
 		info.regions = lock_on_info.regions;
 		free_rom_info(&lock_on_info);
@@ -336,7 +339,7 @@ rom_info xband_configure_rom(tern_node *rom_db, void *rom, uint32_t rom_size, vo
 		info.regions = REGION_J|REGION_U|REGION_E;
 	}
 	info.save_size = 64*1024;
-	info.save_buffer = malloc(info.save_size);
+	info.save_buffer = alloc_save_buffer(info.save_size);
 	info.save_mask = info.save_size-1;
 	info.save_type = RAM_FLAG_BOTH;
 	info.port1_override = info.ext_override = info.mouse_mode = NULL;
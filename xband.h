@@ -13,7 +13,7 @@ typedef struct {
 } xband;
 
 uint8_t xband_detect(uint8_t *rom, uint32_t rom_size);
-rom_info xband_configure_rom(tern_node *rom_db, void *rom, uint32_t rom_size, void *lock_on, uint32_t lock_on_size, memmap_chunk const *base_map, uint32_t base_chunks);
+rom_info xband_configure_rom(rom_database *rom_db, void *rom, uint32_t rom_size, void *lock_on, uint32_t lock_on_size, memmap_chunk const *base_map, uint32_t base_chunks);
 void xband_serialize(genesis_context *gen, serialize_buffer *buf);
 void xband_deserialize(deserialize_buffer *buf, genesis_context *gen);
 
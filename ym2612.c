@@ -9,8 +9,8 @@
 #include <stdlib.h>
 #include "ym2612.h"
 #include "render.h"
-#include "wave.h"
 #include "blastem.h"
+#include "util.h"
 
 //#define DO_DEBUG_PRINT
 #ifdef DO_DEBUG_PRINT
@@ -40,6 +40,19 @@
 #define BIT_STATUS_TIMERB 0x2
 
 static uint32_t ym_calc_phase_inc(ym2612_context * context, ym_operator * operator, uint32_t op);
+enum {
+	YM_CMD_RUN,
+	YM_CMD_ADDRESS1,
+	YM_CMD_ADDRESS2,
+	YM_CMD_DATA,
+	YM_CMD_RESET,
+	YM_CMD_ADJUST_CYCLES,
+	YM_CMD_MASTER_CLOCK
+};
+
+static void ym_queue(ym2612_context *context, uint8_t type, uint32_t value);
+static void ym_start_worker(ym2612_context *context);
+static void ym_stop_worker(ym2612_context *context);
 
 enum {
 	PHASE_ATTACK,
@@ -48,7 +61,8 @@ enum {
 	PHASE_RELEASE
 };
 
-uint8_t did_tbl_init = 0;
+static SDL_atomic_t did_tbl_init;
+static SDL_SpinLock tbl_lock;
 //According to Nemesis, real hardware only uses a 256 entry quarter sine table; however,
 //memory is cheap so using a half sine table will probably save some cycles
 //a full sine table would be nice, but negative numbers don't get along with log2
@@ -109,9 +123,14 @@ static void ym_finalize_log()
 	if (!log_context) {
 		return;
 	}
+	if (log_context->worker) {
+		//the worker's copy of the context is the one producing samples
+		ym_stop_worker(log_context);
+	}
 	for (int i = 0; i < NUM_CHANNELS; i++) {
-		if (log_context->channels[i].logfile) {
-			wave_finalize(log_context->channels[i].logfile);
+		if (log_context->channel_logs[i]) {
+			wave_log_close(log_context->channel_logs[i]);
+			log_context->channel_logs[i] = NULL;
 		}
 	}
 	log_context = NULL;
@@ -119,7 +138,12 @@ static void ym_finalize_log()
 
 void ym_adjust_master_clock(ym2612_context * context, uint32_t master_clock)
 {
-	render_audio_adjust_clock(context->audio, master_clock, context->clock_inc * NUM_OPERATORS);
+	if (context->worker) {
+		//the audio source belongs to the worker, so the change has to happen in order with the samples it produces
+		ym_queue(context, YM_CMD_MASTER_CLOCK, master_clock);
+	} else {
+		render_audio_adjust_clock(context->audio, master_clock, context->clock_inc * NUM_OPERATORS);
+	}
 }
 
 #ifdef __ANDROID__
@@ -159,6 +183,81 @@ void ym_reset(ym2612_context *context)
 		context->operators[i].envelope = MAX_ENVELOPE;
 		context->operators[i].env_phase = PHASE_RELEASE;
 	}
+	if (context->worker) {
+		ym_queue(context, YM_CMD_RESET, 0);
+	}
+}
+
+static void init_tables(void)
+{
+	//populate sine table
+	for (int32_t i = 0; i < 512; i++) {
+		double sine = sin( ((double)(i*2+1) / SINE_TABLE_SIZE) * M_PI_2 );
+
+		//table stores 4.8 fixed pointed representation of the base 2 log
+		sine_table[i] = round_fixed_point(-log2(sine), 8);
+	}
+	//populate power table
+	for (int32_t i = 0; i < POW_TABLE_SIZE; i++) {
+		double linear = pow(2, -((double)((i & 0xFF)+1) / 256.0));
+		int32_t tmp = round_fixed_point(linear, 11);
+		int32_t shift = (i >> 8) - 2;
+		if (shift < 0) {
+			tmp <<= 0-shift;
+		} else {
+			tmp >>= shift;
+		}
+		pow_table[i] =  tmp;
+	}
+	//populate envelope generator rate table, from small base table
+	for (int rate = 0; rate < 64; rate++) {
+		for (int cycle = 0; cycle < 8; cycle++) {
+			uint16_t value;
+			if (rate < 2) {
+				value = 0;
+			} else if (rate >= 60) {
+				value = 8;
+			} else if (rate < 8) {
+				value = rate_table_base[((rate & 6) == 6 ? 16 : 0) + cycle];
+			} else if (rate < 48) {
+				value = rate_table_base[(rate & 0x3) * 8 + cycle];
+			} else {
+				value = rate_table_base[32 + (rate & 0x3) * 8 + cycle] << ((rate - 48) >> 2);
+			}
+			rate_table[rate * 8 + cycle] = value;
+		}
+	}
+	//populate LFO PM table from small base table
+	//seems like there must be a better way to derive this
+	for (int freq = 0; freq < 128; freq++) {
+		for (int pms = 0; pms < 8; pms++) {
+			for (int step = 0; step < 32; step++) {
+				int16_t value = 0;
+				for (int bit = 0x40, shift = 0; bit > 0; bit >>= 1, shift++) {
+					if (freq & bit) {
+						value += lfo_pm_base[pms][(step & 0x8) ? 7-step & 7 : step & 7] >> shift;
+					}
+				}
+				if (step & 0x10) {
+					value = -value;
+				}
+				lfo_pm_table[freq * 256 + pms * 32 + step] = value;
+			}
+		}
+	}
+}
+
+void ym_init_tables(void)
+{
+	if (!SDL_AtomicGet(&did_tbl_init)) {
+		//other instances may already be running, so the tables are built once and only published when complete
+		SDL_AtomicLock(&tbl_lock);
+		if (!SDL_AtomicGet(&did_tbl_init)) {
+			init_tables();
+			SDL_AtomicSet(&did_tbl_init, 1);
+		}
+		SDL_AtomicUnlock(&tbl_lock);
+	}
 }
 
 void ym_init(ym2612_context * context, uint32_t master_clock, uint32_t clock_div, uint32_t options)
@@ -169,20 +268,11 @@ void ym_init(ym2612_context * context, uint32_t master_clock, uint32_t clock_div
 	context->clock_inc = clock_div * 6;
 	context->audio = render_audio_source(master_clock, context->clock_inc * NUM_OPERATORS, 2);
 	
-	//some games seem to expect that the LR flags start out as 1
-	for (int i = 0; i < NUM_CHANNELS; i++) {
-		if (options & YM_OPT_WAVE_LOG) {
+	if (options & YM_OPT_WAVE_LOG) {
+		for (int i = 0; i < NUM_CHANNELS; i++) {
 			char fname[64];
 			sprintf(fname, "ym_channel_%d.wav", i);
-			FILE * f = context->channels[i].logfile = fopen(fname, "wb");
-			if (!f) {
-				fprintf(stderr, "Failed to open WAVE log file %s for writing\n", fname);
-				continue;
-			}
-			if (!wave_init(f, master_clock / (context->clock_inc * NUM_OPERATORS), 16, 1)) {
-				fclose(f);
-				context->channels[i].logfile = NULL;
-			}
+			context->channel_logs[i] = wave_log_open(fname, master_clock / (context->clock_inc * NUM_OPERATORS), 1);
 		}
 	}
 	if (options & YM_OPT_WAVE_LOG) {
@@ -192,68 +282,18 @@ void ym_init(ym2612_context * context, uint32_t master_clock, uint32_t clock_div
 			registered_finalize = 1;
 		}
 	}
-	if (!did_tbl_init) {
-		//populate sine table
-		for (int32_t i = 0; i < 512; i++) {
-			double sine = sin( ((double)(i*2+1) / SINE_TABLE_SIZE) * M_PI_2 );
-
-			//table stores 4.8 fixed pointed representation of the base 2 log
-			sine_table[i] = round_fixed_point(-log2(sine), 8);
-		}
-		//populate power table
-		for (int32_t i = 0; i < POW_TABLE_SIZE; i++) {
-			double linear = pow(2, -((double)((i & 0xFF)+1) / 256.0));
-			int32_t tmp = round_fixed_point(linear, 11);
-			int32_t shift = (i >> 8) - 2;
-			if (shift < 0) {
-				tmp <<= 0-shift;
-			} else {
-				tmp >>= shift;
-			}
-			pow_table[i] =  tmp;
-		}
-		//populate envelope generator rate table, from small base table
-		for (int rate = 0; rate < 64; rate++) {
-			for (int cycle = 0; cycle < 8; cycle++) {
-				uint16_t value;
-				if (rate < 2) {
-					value = 0;
-				} else if (rate >= 60) {
-					value = 8;
-				} else if (rate < 8) {
-					value = rate_table_base[((rate & 6) == 6 ? 16 : 0) + cycle];
-				} else if (rate < 48) {
-					value = rate_table_base[(rate & 0x3) * 8 + cycle];
-				} else {
-					value = rate_table_base[32 + (rate & 0x3) * 8 + cycle] << ((rate - 48) >> 2);
-				}
-				rate_table[rate * 8 + cycle] = value;
-			}
-		}
-		//populate LFO PM table from small base table
-		//seems like there must be a better way to derive this
-		for (int freq = 0; freq < 128; freq++) {
-			for (int pms = 0; pms < 8; pms++) {
-				for (int step = 0; step < 32; step++) {
-					int16_t value = 0;
-					for (int bit = 0x40, shift = 0; bit > 0; bit >>= 1, shift++) {
-						if (freq & bit) {
-							value += lfo_pm_base[pms][(step & 0x8) ? 7-step & 7 : step & 7] >> shift;
-						}
-					}
-					if (step & 0x10) {
-						value = -value;
-					}
-					lfo_pm_table[freq * 256 + pms * 32 + step] = value;
-				}
-			}
-		}
-	}
+	ym_init_tables();
 	ym_reset(context);
+	if (options & YM_OPT_THREAD) {
+		ym_start_worker(context);
+	}
 }
 
 void ym_free(ym2612_context *context)
 {
+	if (context->worker) {
+		ym_stop_worker(context);
+	}
 	render_free_source(context->audio);
 	if (context == log_context) {
 		ym_finalize_log();
@@ -321,65 +361,78 @@ static void csm_keyoff(ym2612_context *context)
 	}
 }
 
-void ym_run(ym2612_context * context, uint32_t to_cycle)
+//Updates timers and LFO at the beginning of each 144 cycle period
+static void ym_update_timers(ym2612_context *context)
 {
-	//printf("Running YM2612 from cycle %d to cycle %d\n", context->current_cycle, to_cycle);
-	//TODO: Fix channel update order OR remap channels in register write
-	for (; context->current_cycle < to_cycle; context->current_cycle += context->clock_inc) {
-		//Update timers at beginning of 144 cycle period
-		if (!context->current_op) {
-			if (context->timer_control & BIT_TIMERA_ENABLE) {
-				if (context->timer_a != TIMER_A_MAX) {
-					context->timer_a++;
-					if (context->csm_keyon) {
-						csm_keyoff(context);
-					}
-				} else {
-					if (context->timer_control & BIT_TIMERA_LOAD) {
-						context->timer_control &= ~BIT_TIMERA_LOAD;
-					} else if (context->timer_control & BIT_TIMERA_OVEREN) {
-						context->status |= BIT_STATUS_TIMERA;
-					}
-					context->timer_a = context->timer_a_load;
-					if (!context->csm_keyon && context->ch3_mode == CSM_MODE) {
-						context->csm_keyon = 0xF0;
-						uint8_t changes = 0xF0 ^ context->channels[2].keyon;;
-						for (uint8_t op = 2*4, bit = 0; op < 3*4; op++, bit++)
-						{
-							if (changes & keyon_bits[bit]) {
-								keyon(context->operators + op, context->channels + 2);
-							}
-						}
-					}
-				}
+	if (context->timer_control & BIT_TIMERA_ENABLE) {
+		if (context->timer_a != TIMER_A_MAX) {
+			context->timer_a++;
+			if (context->csm_keyon) {
+				csm_keyoff(context);
 			}
-			if (!context->sub_timer_b) {
-				if (context->timer_control & BIT_TIMERB_ENABLE) {
-					if (context->timer_b != TIMER_B_MAX) {
-						context->timer_b++;
-					} else {
-						if (context->timer_control & BIT_TIMERB_LOAD) {
-							context->timer_control &= ~BIT_TIMERB_LOAD;
-						} else if (context->timer_control & BIT_TIMERB_OVEREN) {
-							context->status |= BIT_STATUS_TIMERB;
-						}
-						context->timer_b = context->timer_b_load;
+		} else {
+			if (context->timer_control & BIT_TIMERA_LOAD) {
+				context->timer_control &= ~BIT_TIMERA_LOAD;
+			} else if (context->timer_control & BIT_TIMERA_OVEREN) {
+				context->status |= BIT_STATUS_TIMERA;
+			}
+			context->timer_a = context->timer_a_load;
+			if (!context->csm_keyon && context->ch3_mode == CSM_MODE) {
+				context->csm_keyon = 0xF0;
+				uint8_t changes = 0xF0 ^ context->channels[2].keyon;;
+				for (uint8_t op = 2*4, bit = 0; op < 3*4; op++, bit++)
+				{
+					if (changes & keyon_bits[bit]) {
+						keyon(context->operators + op, context->channels + 2);
 					}
 				}
 			}
-			context->sub_timer_b += 0x10;
-			//Update LFO
-			if (context->lfo_enable) {
-				if (context->lfo_counter) {
-					context->lfo_counter--;
-				} else {
-					context->lfo_counter = lfo_timer_values[context->lfo_freq];
-					context->lfo_am_step += 2;
-					context->lfo_am_step &= 0xFE;
-					context->lfo_pm_step = context->lfo_am_step / 8;
+		}
+	}
+	if (!context->sub_timer_b) {
+		if (context->timer_control & BIT_TIMERB_ENABLE) {
+			if (context->timer_b != TIMER_B_MAX) {
+				context->timer_b++;
+			} else {
+				if (context->timer_control & BIT_TIMERB_LOAD) {
+					context->timer_control &= ~BIT_TIMERB_LOAD;
+				} else if (context->timer_control & BIT_TIMERB_OVEREN) {
+					context->status |= BIT_STATUS_TIMERB;
 				}
+				context->timer_b = context->timer_b_load;
 			}
 		}
+	}
+	context->sub_timer_b += 0x10;
+	//Update LFO
+	if (context->lfo_enable) {
+		if (context->lfo_counter) {
+			context->lfo_counter--;
+		} else {
+			context->lfo_counter = lfo_timer_values[context->lfo_freq];
+			context->lfo_am_step += 2;
+			context->lfo_am_step &= 0xFE;
+			context->lfo_pm_step = context->lfo_am_step / 8;
+		}
+	}
+}
+
+static void ym_clear_busy(ym2612_context *context)
+{
+	if (context->current_cycle >= context->write_cycle + (context->busy_cycles * context->clock_inc / 6)) {
+		context->status &= 0x7F;
+		context->write_cycle = CYCLE_NEVER;
+	}
+}
+
+static void ym_synthesize(ym2612_context * context, uint32_t to_cycle)
+{
+	//printf("Running YM2612 from cycle %d to cycle %d\n", context->current_cycle, to_cycle);
+	//TODO: Fix channel update order OR remap channels in register write
+	for (; context->current_cycle < to_cycle; context->current_cycle += context->clock_inc) {
+		if (!context->current_op) {
+			ym_update_timers(context);
+		}
 		//Update Envelope Generator
 		if (!(context->current_op % 3)) {
 			uint32_t env_cyc = context->env_counter;
@@ -605,8 +658,8 @@ void ym_run(ym2612_context * context, uint32_t to_cycle)
 						value |= 0xC000;
 					}
 				}
-				if (context->channels[i].logfile) {
-					fwrite(&value, sizeof(value), 1, context->channels[i].logfile);
+				if (context->channel_logs[i]) {
+					wave_log_sample(context->channel_logs[i], value);
 				}
 				if (context->channels[i].lr & 0x80) {
 					left += (value * YM_VOLUME_MULTIPLIER) / YM_VOLUME_DIVIDER;
@@ -619,13 +672,198 @@ void ym_run(ym2612_context * context, uint32_t to_cycle)
 		}
 		
 	}
-	if (context->current_cycle >= context->write_cycle + (context->busy_cycles * context->clock_inc / 6)) {
-		context->status &= 0x7F;
-		context->write_cycle = CYCLE_NEVER;
-	}
+	ym_clear_busy(context);
 	//printf("Done running YM2612 at cycle %d\n", context->current_cycle, to_cycle);
 }
 
+//Only advances the state visible to the 68K and Z80, used when synthesis happens on the worker thread
+static void ym_run_timers(ym2612_context * context, uint32_t to_cycle)
+{
+	while (context->current_cycle < to_cycle)
+	{
+		if (!context->current_op) {
+			ym_update_timers(context);
+		}
+		//nothing else observable happens until the next timer update, so skip ahead
+		uint32_t steps = (to_cycle - context->current_cycle + context->clock_inc - 1) / context->clock_inc;
+		if (steps > NUM_OPERATORS - context->current_op) {
+			steps = NUM_OPERATORS - context->current_op;
+		}
+		context->current_op += steps;
+		if (context->current_op == NUM_OPERATORS) {
+			context->current_op = 0;
+		}
+		context->current_cycle += steps * context->clock_inc;
+	}
+	ym_clear_busy(context);
+}
+
+#define YM_QUEUE_SIZE 4096
+
+typedef struct {
+	uint32_t value;
+	uint8_t  type;
+} ym_command;
+
+//The worker replays every call made on the emulation side against its own copy of the chip,
+//so its output is identical to running synthesis inline
+struct ym_worker {
+	ym2612_context synth;
+	ym_command     queue[YM_QUEUE_SIZE];
+	SDL_atomic_t   head; //only written by the emulation thread
+	SDL_atomic_t   tail; //only written by the worker thread
+	SDL_sem        *work;
+	SDL_mutex      *lock;
+	SDL_cond       *drained;
+	SDL_Thread     *thread;
+	uint8_t        quit;
+};
+
+static void ym_queue(ym2612_context *context, uint8_t type, uint32_t value)
+{
+	ym_worker *worker = context->worker;
+	uint32_t head = SDL_AtomicGet(&worker->head);
+	if (head - (uint32_t)SDL_AtomicGet(&worker->tail) == YM_QUEUE_SIZE) {
+		//synthesis has fallen a full queue behind, wait for it to catch up
+		SDL_SemPost(worker->work);
+		SDL_LockMutex(worker->lock);
+			while (head - (uint32_t)SDL_AtomicGet(&worker->tail) == YM_QUEUE_SIZE)
+			{
+				SDL_CondWait(worker->drained, worker->lock);
+			}
+		SDL_UnlockMutex(worker->lock);
+	}
+	ym_command *cmd = worker->queue + (head & (YM_QUEUE_SIZE - 1));
+	cmd->type = type;
+	cmd->value = value;
+	SDL_AtomicSet(&worker->head, head + 1);
+	if (type == YM_CMD_RUN) {
+		SDL_SemPost(worker->work);
+	}
+}
+
+static void ym_process_command(ym2612_context *synth, ym_command *cmd)
+{
+	switch (cmd->type)
+	{
+	case YM_CMD_RUN:
+		ym_synthesize(synth, cmd->value);
+		break;
+	case YM_CMD_ADDRESS1:
+		ym_address_write_part1(synth, cmd->value);
+		break;
+	case YM_CMD_ADDRESS2:
+		ym_address_write_part2(synth, cmd->value);
+		break;
+	case YM_CMD_DATA:
+		ym_data_write(synth, cmd->value);
+		break;
+	case YM_CMD_RESET:
+		ym_reset(synth);
+		break;
+	case YM_CMD_ADJUST_CYCLES:
+		ym_adjust_cycles(synth, cmd->value);
+		break;
+	case YM_CMD_MASTER_CLOCK:
+		ym_adjust_master_clock(synth, cmd->value);
+		break;
+	}
+}
+
+static int ym_worker_main(void *data)
+{
+	ym_worker *worker = data;
+	uint8_t quit;
+	do {
+		SDL_SemWait(worker->work);
+		uint32_t tail = SDL_AtomicGet(&worker->tail);
+		uint32_t head;
+		while ((head = SDL_AtomicGet(&worker->head)) != tail)
+		{
+			for (; tail != head; tail++)
+			{
+				ym_process_command(&worker->synth, worker->queue + (tail & (YM_QUEUE_SIZE - 1)));
+			}
+			SDL_AtomicSet(&worker->tail, tail);
+		}
+		SDL_LockMutex(worker->lock);
+			SDL_CondSignal(worker->drained);
+			quit = worker->quit;
+		SDL_UnlockMutex(worker->lock);
+	} while (!quit);
+	return 0;
+}
+
+static void ym_start_worker(ym2612_context *context)
+{
+	ym_worker *worker = calloc(1, sizeof(ym_worker));
+	worker->synth = *context;
+	worker->work = SDL_CreateSemaphore(0);
+	worker->lock = SDL_CreateMutex();
+	worker->drained = SDL_CreateCond();
+	worker->thread = SDL_CreateThread(ym_worker_main, "YM2612", worker);
+	if (!worker->thread) {
+		warning("Failed to start YM2612 thread: %s, synthesis will run on the emulation thread\n", SDL_GetError());
+		SDL_DestroySemaphore(worker->work);
+		SDL_DestroyMutex(worker->lock);
+		SDL_DestroyCond(worker->drained);
+		free(worker);
+		return;
+	}
+	context->worker = worker;
+}
+
+static void ym_stop_worker(ym2612_context *context)
+{
+	ym_worker *worker = context->worker;
+	SDL_LockMutex(worker->lock);
+		worker->quit = 1;
+	SDL_UnlockMutex(worker->lock);
+	SDL_SemPost(worker->work);
+	SDL_WaitThread(worker->thread, NULL);
+	SDL_DestroySemaphore(worker->work);
+	SDL_DestroyMutex(worker->lock);
+	SDL_DestroyCond(worker->drained);
+	free(worker);
+	context->worker = NULL;
+}
+
+void ym_flush(ym2612_context *context)
+{
+	ym_worker *worker = context->worker;
+	if (!worker) {
+		return;
+	}
+	SDL_SemPost(worker->work);
+	SDL_LockMutex(worker->lock);
+		while (SDL_AtomicGet(&worker->tail) != SDL_AtomicGet(&worker->head))
+		{
+			SDL_CondWait(worker->drained, worker->lock);
+		}
+	SDL_UnlockMutex(worker->lock);
+}
+
+void ym_run(ym2612_context * context, uint32_t to_cycle)
+{
+	if (context->worker) {
+		ym_run_timers(context, to_cycle);
+		ym_queue(context, YM_CMD_RUN, to_cycle);
+	} else {
+		ym_synthesize(context, to_cycle);
+	}
+}
+
+void ym_adjust_cycles(ym2612_context *context, uint32_t deduction)
+{
+	context->current_cycle -= deduction;
+	if (context->write_cycle != CYCLE_NEVER) {
+		context->write_cycle = context->write_cycle >= deduction ? context->write_cycle - deduction : 0;
+	}
+	if (context->worker) {
+		ym_queue(context, YM_CMD_ADJUST_CYCLES, deduction);
+	}
+}
+
 void ym_address_write_part1(ym2612_context * context, uint8_t address)
 {
 	//printf("address_write_part1: %X\n", address);
@@ -634,6 +872,9 @@ void ym_address_write_part1(ym2612_context * context, uint8_t address)
 	context->write_cycle = context->current_cycle;
 	context->busy_cycles = BUSY_CYCLES_ADDRESS;
 	context->status |= 0x80;
+	if (context->worker) {
+		ym_queue(context, YM_CMD_ADDRESS1, address);
+	}
 }
 
 void ym_address_write_part2(ym2612_context * context, uint8_t address)
@@ -644,6 +885,9 @@ void ym_address_write_part2(ym2612_context * context, uint8_t address)
 	context->write_cycle = context->current_cycle;
 	context->busy_cycles = BUSY_CYCLES_ADDRESS;
 	context->status |= 0x80;
+	if (context->worker) {
+		ym_queue(context, YM_CMD_ADDRESS2, address);
+	}
 }
 
 static uint8_t fnum_to_keycode[] = {
@@ -753,6 +997,9 @@ void ym_data_write(ym2612_context * context, uint8_t value)
 	if (context->selected_reg >= YM_REG_END) {
 		return;
 	}
+	if (context->worker) {
+		ym_queue(context, YM_CMD_DATA, value);
+	}
 	if (context->selected_part) {
 		if (context->selected_reg < YM_PART2_START) {
 			return;
@@ -955,6 +1202,10 @@ uint8_t ym_read_status(ym2612_context * context)
 
 void ym_print_channel_info(ym2612_context *context, int channel)
 {
+	if (context->worker) {
+		ym_flush(context);
+		context = &context->worker->synth;
+	}
 	ym_channel *chan = context->channels + channel;
 	printf("\n***Channel %d***\n"
 	       "Algorithm: %d\n"
@@ -1021,6 +1272,10 @@ void ym_print_timer_info(ym2612_context *context)
 
 void ym_serialize(ym2612_context *context, serialize_buffer *buf)
 {
+	if (context->worker) {
+		ym_flush(context);
+		context = &context->worker->synth;
+	}
 	save_buffer8(buf, context->part1_regs, YM_PART1_REGS);
 	save_buffer8(buf, context->part2_regs, YM_PART2_REGS);
 	for (int i = 0; i < NUM_OPERATORS; i++)
@@ -1068,6 +1323,10 @@ void ym_serialize(ym2612_context *context, serialize_buffer *buf)
 void ym_deserialize(deserialize_buffer *buf, void *vcontext)
 {
 	ym2612_context *context = vcontext;
+	//load into the emulation side copy only, the synthesis copy is replaced wholesale afterwards
+	ym_worker *worker = context->worker;
+	ym_flush(context);
+	context->worker = NULL;
 	uint8_t temp_regs[YM_PART1_REGS];
 	load_buffer8(buf, temp_regs, YM_PART1_REGS);
 	context->selected_part = 0;
@@ -1138,4 +1397,8 @@ void ym_deserialize(deserialize_buffer *buf, void *vcontext)
 	context->current_cycle = load_int32(buf);
 	context->write_cycle = load_int32(buf);
 	context->busy_cycles = load_int32(buf);
+	if (worker) {
+		worker->synth = *context;
+		context->worker = worker;
+	}
 }
@@ -10,12 +10,16 @@
 #include <stdio.h>
 #include "serialize.h"
 #include "render.h"
+#include "wavelog.h"
 
 #define NUM_PART_REGS (0xB7-0x30)
 #define NUM_CHANNELS 6
 #define NUM_OPERATORS (4*NUM_CHANNELS)
 
+//log each channel to ym_channel_N.wav
 #define YM_OPT_WAVE_LOG 1
+//run FM synthesis on a separate thread, only timers and status are kept on the emulation thread
+#define YM_OPT_THREAD 2
 
 typedef struct {
 	uint32_t phase_counter;
@@ -34,7 +38,6 @@ typedef struct {
 } ym_operator;
 
 typedef struct {
-	FILE *   logfile;
 	uint16_t fnum;
 	int16_t  output;
 	int16_t  op1_old;
@@ -62,8 +65,12 @@ typedef struct {
 #define YM_PART1_REGS (YM_REG_END-YM_PART1_START)
 #define YM_PART2_REGS (YM_REG_END-YM_PART2_START)
 
+typedef struct ym_worker ym_worker;
+
 typedef struct {
 	audio_source *audio;
+	ym_worker   *worker;
+	wave_log    *channel_logs[NUM_CHANNELS];
     uint32_t    clock_inc;
 	uint32_t    current_cycle;
 	//TODO: Condense the next two fields into one
@@ -124,11 +131,16 @@ enum {
 	REG_LR_AMS_PMS   = 0xB4
 };
 
+//Builds the lookup tables shared by all contexts, ym_init calls this but it can be done ahead of time from any thread
+void ym_init_tables(void);
 void ym_init(ym2612_context * context, uint32_t master_clock, uint32_t clock_div, uint32_t options);
 void ym_reset(ym2612_context *context);
 void ym_free(ym2612_context *context);
 void ym_adjust_master_clock(ym2612_context * context, uint32_t master_clock);
 void ym_run(ym2612_context * context, uint32_t to_cycle);
+void ym_adjust_cycles(ym2612_context *context, uint32_t deduction);
+//Waits for the synthesis thread, if any, to catch up with all calls made so far
+void ym_flush(ym2612_context *context);
 void ym_address_write_part1(ym2612_context * context, uint8_t address);
 void ym_address_write_part2(ym2612_context * context, uint8_t address);
 void ym_data_write(ym2612_context * context, uint8_t value);
@@ -2,7 +2,10 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <time.h>
+#include <sys/stat.h>
 #include "util.h"
+#include "hash.h"
 #include "zip.h"
 #ifndef DISABLE_ZLIB
 #include "zlib/zlib.h"
@@ -13,65 +16,19 @@ static const char eocd_magic[4] = {'P', 'K', 5, 6};
 #define MIN_EOCD_SIZE 22
 #define MIN_CDFD_SIZE 46
 #define ZIP_MAX_EOCD_OFFSET (64*1024+MIN_EOCD_SIZE)
+#define ZIP_READ_CHUNK (16*1024)
 
 enum {
 	ZIP_STORE = 0,
 	ZIP_DEFLATE = 8
 };
 
-zip_file *zip_open(const char *filename)
+static zip_entry *parse_central_directory(uint8_t *buf, uint32_t cd_size, uint16_t cd_count, uint32_t *num_entries)
 {
-	FILE *f = fopen(filename, "rb");
-	if (!f) {
-		return NULL;
-	}
-	long fsize = file_size(f);
-	if (fsize < MIN_EOCD_SIZE) {
-		//too small to be a zip file
-		goto fail;
-	}
-	
-	long max_offset = fsize > ZIP_MAX_EOCD_OFFSET ? ZIP_MAX_EOCD_OFFSET : fsize;
-	fseek(f, -max_offset, SEEK_END);
-	uint8_t *buf = malloc(max_offset);
-	if (max_offset != fread(buf, 1, max_offset, f)) {
-		goto fail;
-	}
-	
-	long current_offset;
-	uint32_t cd_start, cd_size;
-	uint16_t cd_count;
-	for (current_offset = max_offset - MIN_EOCD_SIZE; current_offset >= 0; current_offset--)
-	{
-		if (memcmp(eocd_magic, buf + current_offset, sizeof(eocd_magic))) {
-			continue;
-		}
-		uint16_t comment_size = buf[current_offset + 20] | buf[current_offset + 21] << 8;
-		if (comment_size != (max_offset - current_offset - MIN_EOCD_SIZE)) {
-			continue;
-		}
-		cd_start = buf[current_offset + 16] | buf[current_offset + 17] << 8
-			| buf[current_offset + 18] << 16 | buf[current_offset + 19] << 24;
-		if (cd_start > (fsize - (max_offset - current_offset))) {
-			continue;
-		}
-		cd_size = buf[current_offset + 12] | buf[current_offset + 13] << 8
-			| buf[current_offset + 14] << 16 | buf[current_offset + 15] << 24;
-		if ((cd_start + cd_size) > (fsize - (max_offset - current_offset))) {
-			continue;
-		}
-		cd_count = buf[current_offset + 10] | buf[current_offset + 11] << 8;
-		break;
-	}
-	free(buf);
-	if (current_offset < 0) {
-		//failed to find EOCD
-		goto fail;
-	}
-	buf = malloc(cd_size);
-	fseek(f, cd_start, SEEK_SET);
-	if (cd_size != fread(buf, 1, cd_size, f)) {
-		goto fail_free;
+	if (cd_size < MIN_CDFD_SIZE) {
+		//only an empty archive can have a directory this small
+		*num_entries = 0;
+		return cd_count ? NULL : calloc(1, sizeof(zip_entry));
 	}
 	zip_entry *entries = calloc(cd_count, sizeof(zip_entry));
 	uint32_t cd_max_last = cd_size - MIN_CDFD_SIZE;
@@ -83,7 +40,10 @@ zip_file *zip_open(const char *filename)
 		}
 		uint32_t name_length = buf[off + 28] | buf[off + 29] << 8;
 		uint32_t extra_length = buf[off + 30] | buf[off + 31] << 8;
-		//TODO: verify name length doesn't go past end of CD
+		uint32_t comment_length = buf[off + 32] | buf[off + 33] << 8;
+		if (name_length > cd_size - off - MIN_CDFD_SIZE) {
+			goto fail_entries;
+		}
 		
 		cur_entry->name = malloc(name_length + 1);
 		memcpy(cur_entry->name, buf + off + MIN_CDFD_SIZE, name_length);
@@ -99,14 +59,10 @@ zip_file *zip_open(const char *filename)
 			
 		cur_entry->compression_method = buf[off + 10] | buf[off + 11] << 8;
 		
-		off += name_length + extra_length + MIN_CDFD_SIZE;
+		off += name_length + extra_length + comment_length + MIN_CDFD_SIZE;
 	}
-	
-	zip_file *z = malloc(sizeof(zip_file));
-	z->entries = entries;
-	z->file = f;
-	z->num_entries = cur_entry - entries;
-	return z;
+	*num_entries = cur_entry - entries;
+	return entries;
 	
 fail_entries:
 	for (cur_entry--; cur_entry >= entries; cur_entry--)
@@ -114,16 +70,253 @@ fail_entries:
 		free(cur_entry->name);
 	}
 	free(entries);
-fail_free:
+	return NULL;
+}
+
+//Reads the central directory of an archive, returns NULL if f is not a zip file
+static uint8_t *read_central_directory(FILE *f, long fsize, uint32_t *cd_size_out, uint16_t *cd_count_out)
+{
+	if (fsize < MIN_EOCD_SIZE) {
+		//too small to be a zip file
+		return NULL;
+	}
+	//most archives have no comment, so try the one spot the EOCD record can be before scanning for it
+	long max_offset = MIN_EOCD_SIZE;
+	uint8_t *buf = malloc(ZIP_MAX_EOCD_OFFSET);
+	long current_offset;
+	uint32_t cd_start, cd_size;
+	uint16_t cd_count;
+	for (;;)
+	{
+		fseek(f, -max_offset, SEEK_END);
+		if (max_offset != fread(buf, 1, max_offset, f)) {
+			free(buf);
+			return NULL;
+		}
+		for (current_offset = max_offset - MIN_EOCD_SIZE; current_offset >= 0; current_offset--)
+		{
+			if (memcmp(eocd_magic, buf + current_offset, sizeof(eocd_magic))) {
+				continue;
+			}
+			uint16_t comment_size = buf[current_offset + 20] | buf[current_offset + 21] << 8;
+			if (comment_size != (max_offset - current_offset - MIN_EOCD_SIZE)) {
+				continue;
+			}
+			cd_start = buf[current_offset + 16] | buf[current_offset + 17] << 8
+				| buf[current_offset + 18] << 16 | buf[current_offset + 19] << 24;
+			if (cd_start > (fsize - (max_offset - current_offset))) {
+				continue;
+			}
+			cd_size = buf[current_offset + 12] | buf[current_offset + 13] << 8
+				| buf[current_offset + 14] << 16 | buf[current_offset + 15] << 24;
+			if ((cd_start + cd_size) > (fsize - (max_offset - current_offset))) {
+				continue;
+			}
+			cd_count = buf[current_offset + 10] | buf[current_offset + 11] << 8;
+			break;
+		}
+		if (current_offset >= 0 || max_offset == (fsize > ZIP_MAX_EOCD_OFFSET ? ZIP_MAX_EOCD_OFFSET : fsize)) {
+			break;
+		}
+		max_offset = fsize > ZIP_MAX_EOCD_OFFSET ? ZIP_MAX_EOCD_OFFSET : fsize;
+	}
 	free(buf);
-fail:
+	if (current_offset < 0) {
+		//failed to find EOCD
+		return NULL;
+	}
+	buf = malloc(cd_size ? cd_size : 1);
+	fseek(f, cd_start, SEEK_SET);
+	if (cd_size != fread(buf, 1, cd_size, f)) {
+		free(buf);
+		return NULL;
+	}
+	*cd_size_out = cd_size;
+	*cd_count_out = cd_count;
+	return buf;
+}
+
+static const char index_magic[4] = {'B', 'Z', 'I', '1'};
+#define INDEX_HEADER_SIZE 26
+
+static void write_le(uint8_t *dst, uint64_t value, uint8_t bytes)
+{
+	for (uint8_t i = 0; i < bytes; i++)
+	{
+		dst[i] = value >> (8 * i);
+	}
+}
+
+static uint64_t read_le(uint8_t *src, uint8_t bytes)
+{
+	uint64_t value = 0;
+	for (uint8_t i = 0; i < bytes; i++)
+	{
+		value |= (uint64_t)src[i] << (8 * i);
+	}
+	return value;
+}
+
+//Central directories are cached in the user data directory, keyed by the archive's path and
+//validated against its size and modification time, so reopening an archive only needs a stat
+static char *index_path(const char *filename)
+{
+	char const *userdata = get_userdata_dir();
+	if (!userdata) {
+		return NULL;
+	}
+	//the same archive can be reached by many relative paths and a relative one means nothing after a chdir
+	char *absolute = get_absolute_path(filename);
+	if (!absolute) {
+		return NULL;
+	}
+	uint8_t hash[20];
+	sha1((uint8_t *)absolute, strlen(absolute), hash);
+	free(absolute);
+	char name[sizeof(hash) * 2 + 1];
+	for (int i = 0; i < sizeof(hash); i++)
+	{
+		sprintf(name + i * 2, "%02x", hash[i]);
+	}
+	char const *parts[] = {userdata, PATH_SEP, "blastem", PATH_SEP, "zipindex", PATH_SEP, name};
+	return alloc_concat_m(sizeof(parts)/sizeof(*parts), parts);
+}
+
+static uint8_t *load_index(char *path, uint64_t fsize, uint64_t mtime, uint32_t *cd_size, uint16_t *cd_count)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		return NULL;
+	}
+	uint8_t header[INDEX_HEADER_SIZE];
+	uint8_t *buf = NULL;
+	if (sizeof(header) == fread(header, 1, sizeof(header), f) && !memcmp(header, index_magic, sizeof(index_magic))
+		&& read_le(header + 4, 8) == fsize && read_le(header + 12, 8) == mtime
+	) {
+		*cd_count = read_le(header + 20, 2);
+		*cd_size = read_le(header + 22, 4);
+		buf = malloc(*cd_size ? *cd_size : 1);
+		if (*cd_size != fread(buf, 1, *cd_size, f)) {
+			free(buf);
+			buf = NULL;
+		}
+	}
 	fclose(f);
+	return buf;
+}
+
+static void save_index(char *path, uint64_t fsize, uint64_t mtime, uint8_t *cd, uint32_t cd_size, uint16_t cd_count)
+{
+	char *dir = path_dirname(path);
+	uint8_t dir_ok = ensure_dir_exists(dir);
+	free(dir);
+	if (!dir_ok) {
+		return;
+	}
+	//written to a temporary file and renamed over the old index so a crash never leaves a truncated one
+	char *tmp_path = alloc_concat(path, ".tmp");
+	FILE *f = fopen(tmp_path, "wb");
+	if (!f) {
+		free(tmp_path);
+		return;
+	}
+	uint8_t header[INDEX_HEADER_SIZE];
+	memcpy(header, index_magic, sizeof(index_magic));
+	write_le(header + 4, fsize, 8);
+	write_le(header + 12, mtime, 8);
+	write_le(header + 20, cd_count, 2);
+	write_le(header + 22, cd_size, 4);
+	uint8_t ok = fwrite(header, 1, sizeof(header), f) == sizeof(header);
+	ok = ok && fwrite(cd, 1, cd_size, f) == cd_size;
+	ok = !fclose(f) && ok;
+	if (ok) {
+#ifdef _WIN32
+		//rename won't replace an existing file on Windows
+		remove(path);
+#endif
+		ok = !rename(tmp_path, path);
+	}
+	if (!ok) {
+		remove(tmp_path);
+	}
+	free(tmp_path);
+}
+
+zip_file *zip_open(const char *filename)
+{
+	struct stat st;
+	if (stat(filename, &st)) {
+		return NULL;
+	}
+	char *cache_path = index_path(filename);
+	FILE *f = NULL;
+	uint32_t cd_size;
+	uint16_t cd_count;
+	uint64_t mtime = stat_mtime_ns(&st);
+	uint8_t *buf = cache_path ? load_index(cache_path, st.st_size, mtime, &cd_size, &cd_count) : NULL;
+	if (!buf) {
+		f = fopen(filename, "rb");
+		if (!f) {
+			free(cache_path);
+			return NULL;
+		}
+		buf = read_central_directory(f, st.st_size, &cd_size, &cd_count);
+		if (!buf) {
+			goto fail;
+		}
+		//an archive rewritten within the same timestamp tick would still match, so recent ones aren't cached yet
+		if (cache_path && mtime < (uint64_t)(time(NULL) - 2) * 1000000000ULL) {
+			save_index(cache_path, st.st_size, mtime, buf, cd_size, cd_count);
+		}
+	}
+	uint32_t num_entries;
+	zip_entry *entries = parse_central_directory(buf, cd_size, cd_count, &num_entries);
+	free(buf);
+	if (!entries) {
+		goto fail;
+	}
+	free(cache_path);
+	
+	zip_file *z = malloc(sizeof(zip_file));
+	z->entries = entries;
+	//with a cached directory the archive itself isn't touched until a member is read
+	z->file = f;
+	z->path = strdup(filename);
+	z->num_entries = num_entries;
+	return z;
+	
+fail:
+	free(cache_path);
+	if (f) {
+		fclose(f);
+	}
 	return NULL;
 }
 
+int32_t zip_find(zip_file *f, const char *name)
+{
+	for (uint32_t i = 0; i < f->num_entries; i++)
+	{
+		const char *a = f->entries[i].name, *b = name;
+		//member paths may have been built with the native separator
+		for (; *a && (*a == *b || (is_path_sep(*a) && is_path_sep(*b))); a++, b++)
+		{
+		}
+		if (!*a && !*b) {
+			return i;
+		}
+	}
+	return -1;
+}
+
 uint8_t *zip_read(zip_file *f, uint32_t index, size_t *out_size)
 {
-	
+	if (!f->file) {
+		f->file = fopen(f->path, "rb");
+		if (!f->file) {
+			return NULL;
+		}
+	}
 	fseek(f->file, f->entries[index].local_header_off + 26, SEEK_SET);
 	uint8_t tmp[4];
 	if (sizeof(tmp) != fread(tmp, 1, sizeof(tmp), f->file)) {
@@ -152,28 +345,46 @@ uint8_t *zip_read(zip_file *f, uint32_t index, size_t *out_size)
 		break;
 #ifndef DISABLE_ZLIB
 	case ZIP_DEFLATE: {
-		//note in unzip.c in zlib/contrib suggests a dummy byte is needed, so we allocate an extra byte here
-		uint8_t *src_buf = malloc(f->entries[index].compressed_size + 1);
-		if (f->entries[index].compressed_size != fread(src_buf, 1, f->entries[index].compressed_size, f->file)) {
-			free(src_buf);
-			return NULL;
-		}
-		uLongf destLen = *out_size;
+		//inflate straight into the destination so only a small window of compressed data is ever in memory
+		//note in unzip.c in zlib/contrib suggests a dummy byte is needed, so we leave room for an extra byte here
+		uint8_t src_buf[ZIP_READ_CHUNK + 1];
+		uint64_t remaining = f->entries[index].compressed_size;
 		z_stream stream;
 		memset(&stream, 0, sizeof(stream));
-		stream.avail_in = f->entries[index].compressed_size + 1;
-		stream.next_in = src_buf;
 		stream.next_out = buf;
 		stream.avail_out = *out_size;
-		if (Z_OK == inflateInit2(&stream, -15)) {
-			int result = inflate(&stream, Z_FINISH);
-			*out_size = stream.total_out;
-			free(src_buf);
-			inflateEnd(&stream);
-			if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
-				free(buf);
-				return NULL;
+		if (Z_OK != inflateInit2(&stream, -15)) {
+			free(buf);
+			return NULL;
+		}
+		int result = Z_OK;
+		uint8_t dummy_sent = 0;
+		while (result == Z_OK && stream.avail_out)
+		{
+			if (!stream.avail_in) {
+				if (dummy_sent) {
+					break;
+				}
+				uint32_t chunk = remaining > ZIP_READ_CHUNK ? ZIP_READ_CHUNK : remaining;
+				if (chunk != fread(src_buf, 1, chunk, f->file)) {
+					result = Z_DATA_ERROR;
+					break;
+				}
+				remaining -= chunk;
+				if (!remaining) {
+					src_buf[chunk++] = 0;
+					dummy_sent = 1;
+				}
+				stream.next_in = src_buf;
+				stream.avail_in = chunk;
 			}
+			result = inflate(&stream, Z_NO_FLUSH);
+		}
+		*out_size = stream.total_out;
+		inflateEnd(&stream);
+		if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+			free(buf);
+			return NULL;
 		}
 		break;
 	}
@@ -188,7 +399,10 @@ uint8_t *zip_read(zip_file *f, uint32_t index, size_t *out_size)
 
 void zip_close(zip_file *f)
 {
-	fclose(f->file);
+	if (f->file) {
+		fclose(f->file);
+	}
+	free(f->path);
 	for (uint32_t i = 0; i < f->num_entries; i++)
 	{
 		free(f->entries[i].name);
@@ -15,10 +15,13 @@ typedef struct {
 typedef struct {
 	zip_entry *entries;
 	FILE      *file;
+	char      *path;
 	uint32_t  num_entries;
 } zip_file;
 
 zip_file *zip_open(const char *filename);
+//returns the index of the member with the given name or -1 if there is none
+int32_t zip_find(zip_file *f, const char *name);
 uint8_t *zip_read(zip_file *f, uint32_t index, size_t *out_size);
 void zip_close(zip_file *f);
 